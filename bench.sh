@@ -0,0 +1,68 @@
+#!/bin/bash
+
+#
+# Benchmark Script for MyOS
+#
+# Boots the OS in QEMU without a display, types `bench` and `poweroff`
+# into the shell, and saves the console output and the CSV results.
+#
+# Environment:
+#   BENCH_SUITE    - Run only this suite (mem, string, fs, disk, uart,
+#                    sched, sync)
+#   BENCH_OUTPUT   - Console log (default bench_output.txt)
+#   BENCH_RESULTS  - CSV results (default bench_results.csv)
+#   BENCH_TIMEOUT  - Seconds before giving up (default 300)
+#   DISK           - Disk image to attach for the disk suite (default
+#                    disk.img, if it exists)
+#   CPU            - CPU model to emulate (default cortex-a57)
+#
+
+KERNEL="kernel.elf"
+OUTPUT="${BENCH_OUTPUT:-bench_output.txt}"
+RESULTS="${BENCH_RESULTS:-bench_results.csv}"
+TIMEOUT="${BENCH_TIMEOUT:-300}"
+DISK="${DISK:-disk.img}"
+CPU="${CPU:-cortex-a57}"
+
+# Check if kernel exists
+if [ ! -f "$KERNEL" ]; then
+    echo "Error: Kernel not found. Please run 'make' first."
+    exit 1
+fi
+
+DISK_ARGS=()
+if [ -f "$DISK" ]; then
+    DISK_ARGS=(-drive "file=$DISK,if=none,format=raw,id=hd0"
+               -device virtio-blk-device,drive=hd0)
+fi
+
+echo "Running benchmarks in QEMU (log: $OUTPUT)..."
+
+# The shell buffers input, so the commands can be sent while it boots.
+# poweroff makes QEMU exit once the suite is done.
+{
+    sleep 1
+    printf 'bench %s\n' "$BENCH_SUITE"
+    printf 'poweroff\n'
+} | timeout "$TIMEOUT" qemu-system-aarch64 \
+    -M virt \
+    -cpu "$CPU" \
+    -smp 4 \
+    -kernel "$KERNEL" \
+    "${DISK_ARGS[@]}" \
+    -nographic > "$OUTPUT" 2>&1
+status=$?
+
+tr -d '\r' < "$OUTPUT" | grep '^bench,' > "$RESULTS"
+
+if [ $status -eq 124 ]; then
+    echo "Error: QEMU timed out after $TIMEOUT seconds"
+    exit 1
+fi
+
+if ! grep -q '^# bench: done' "$OUTPUT"; then
+    echo "Error: benchmark suite did not finish, see $OUTPUT"
+    exit 1
+fi
+
+echo "Results: $RESULTS ($(($(wc -l < "$RESULTS") - 1)) benchmarks)"
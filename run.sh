@@ -6,8 +6,15 @@
 # This script launches the OS in QEMU with appropriate settings
 # for the ARM64 virt machine.
 #
+# Environment:
+#   DISK - Disk image to attach (default disk.img, if it exists)
+#   CPU  - CPU model to emulate (default cortex-a57; a kernel built with
+#          LSE=1 needs one with LSE atomics, such as max)
+#
 
 KERNEL="kernel.elf"
+DISK="${DISK:-disk.img}"
+CPU="${CPU:-cortex-a57}"
 
 # Check if kernel exists
 if [ ! -f "$KERNEL" ]; then
@@ -15,18 +22,30 @@ if [ ! -f "$KERNEL" ]; then
     exit 1
 fi
 
+# Attach the disk image as a virtio-blk device if there is one
+# (create it with 'make disk')
+DISK_ARGS=()
+if [ -f "$DISK" ]; then
+    DISK_ARGS=(-drive "file=$DISK,if=none,format=raw,id=hd0"
+               -device virtio-blk-device,drive=hd0)
+fi
+
 echo "Starting MyOS in QEMU..."
 echo "To exit QEMU: Press Ctrl-A then X"
 echo ""
 
 # Launch QEMU with ARM64 virt machine
 # -M virt: Use the virtual ARM platform
-# -cpu cortex-a57: Emulate Cortex-A57 processor
+# -cpu $CPU: Emulate a Cortex-A57 processor unless told otherwise
+# -smp 4: Four CPU cores (secondaries are started by smp_init)
 # -kernel: The kernel image to load
 # -nographic: No graphical window, serial I/O via terminal
+# -drive/-device (if $DISK exists): the disk, on a virtio-mmio slot
 
 qemu-system-aarch64 \
     -M virt \
-    -cpu cortex-a57 \
+    -cpu "$CPU" \
+    -smp 4 \
     -kernel "$KERNEL" \
+    "${DISK_ARGS[@]}" \
     -nographic
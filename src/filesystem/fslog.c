@@ -0,0 +1,702 @@
+/*
+ * File System Log Implementation
+ *
+ * Disk layout (4KB blocks, through the block cache):
+ *
+ *   Block 0, 1   Headers, written alternately. Each names a log ID and
+ *                where its checkpoint starts; mount uses the valid one
+ *                with the higher generation. A new checkpoint is only
+ *                pointed to once all of it is on disk, so a crash while
+ *                writing one leaves the previous header in charge.
+ *   Block 2...   The log, a circular run of records addressed by a
+ *                64-bit position that only grows (block = 2 +
+ *                position / 4KB modulo the log size)
+ *
+ * A record is a record_t, the path (no terminator) and len data bytes,
+ * packed back to back and free to cross block boundaries. Records carry
+ * the log ID, a sequence number one higher than the record before, and
+ * a checksum that covers the record and the previous record's checksum.
+ * Replay stops at the first record that doesn't fit that chain, which
+ * catches torn writes, blocks that never made it to the disk and
+ * records left from an earlier trip around the log.
+ *
+ * Records are staged in the tail block until it fills up and is handed
+ * to the cache; nothing is written until a commit, which pads the tail
+ * to a block boundary and syncs the cache. Padding means a commit never
+ * rewrites a block holding records that were already committed. Replay
+ * skips it: after an invalid record in the middle of a block, it tries
+ * once more at the start of the next one.
+ *
+ * A checkpoint is a CHECKPOINT record, the records that recreate every
+ * file and directory, and a CHECKPOINT_END record, written at the end
+ * of the log like any other. Mount replays the one its header points
+ * to. Any other checkpoint it meets in the log (one that was written
+ * but whose header never made it) is skipped, since replaying the log
+ * before it already produced the same state.
+ */
+
+#include "fslog.h"
+#include "memfs.h"
+#include "../kernel/bcache.h"
+#include "../kernel/string.h"
+
+#define TRACE_MODULE FS
+#include "../kernel/trace.h"
+
+#define LOG_BLOCK_SIZE BCACHE_BLOCK_SIZE
+#define HEADER_BLOCKS  2
+#define MIN_LOG_BLOCKS 16
+
+#define HEADER_MAGIC 0x4C53464Du   // "MFSL"
+#define RECORD_MAGIC 0x4345524Du   // "MREC"
+
+/*
+ * Longest data in one record; longer writes are split
+ */
+#define MAX_RECORD_DATA (64 * 1024)
+
+/*
+ * Record types
+ */
+enum {
+    REC_CHECKPOINT = 1,            // Start of a checkpoint
+    REC_CHECKPOINT_END,
+    REC_MOUNT,                     // First record after a mount (arg: seed)
+    REC_CREATE,
+    REC_MKDIR,
+    REC_WRITE,                     // arg: offset
+    REC_TRUNCATE,                  // arg: size
+    REC_DELETE,
+    REC_RMDIR
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t checksum;             // FNV-1a of prev, the record (with
+                                   // this field 0), path and data
+    uint64_t log_id;
+    uint64_t seq;
+    uint64_t arg;
+    uint32_t prev;                 // Checksum of the record before
+    uint32_t len;                  // Data bytes after the path
+    uint16_t path_len;
+    uint8_t type;
+    uint8_t reserved;
+    uint32_t reserved2;
+} record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t checksum;             // FNV-1a of the header with this 0
+    uint64_t log_id;
+    uint64_t generation;
+    uint64_t log_blocks;
+    uint64_t ckpt_pos;             // Position of the CHECKPOINT record
+    uint64_t ckpt_end;             // ... and just past its END record
+    uint64_t ckpt_seq;             // Its sequence number
+    uint32_t ckpt_prev;            // Checksum of the record before it
+    uint32_t reserved;
+} header_t;
+
+_Static_assert(sizeof(header_t) <= 512, "header must fit in one sector");
+
+static struct {
+    int mounted;
+    int replaying;
+    int paused;                    // fslog_pause depth
+    int in_checkpoint;
+    int checkpoint_failed;         // Something in this checkpoint failed
+    header_t header;               // Newest header on disk
+    uint64_t head;                 // Position of the next record
+    uint64_t committed;            // Everything before this is on disk
+    uint64_t seq;                  // Next sequence number
+    uint32_t prev;                 // Checksum of the last record
+    fslog_stats_t stats;
+} journal;
+
+/*
+ * The block holding head; bytes past head are zero
+ */
+static char tail[LOG_BLOCK_SIZE];
+
+/*
+ * Replay buffers
+ */
+static char replay_path[FS_PATH_MAX];
+static char replay_data[MAX_RECORD_DATA];
+
+static uint32_t checksum(uint32_t hash, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t record_checksum(record_t *rec, const char *path, const void *data) {
+    uint32_t saved = rec->checksum;
+
+    rec->checksum = 0;
+    uint32_t hash = checksum(2166136261u, rec, sizeof(*rec));
+    hash = checksum(hash, path, rec->path_len);
+    hash = checksum(hash, data, rec->len);
+    rec->checksum = saved;
+    return hash;
+}
+
+static uint32_t header_checksum(header_t *h) {
+    uint32_t saved = h->checksum;
+
+    h->checksum = 0;
+    uint32_t hash = checksum(2166136261u, h, sizeof(*h));
+    h->checksum = saved;
+    return hash;
+}
+
+static inline uint64_t round_up_block(uint64_t pos) {
+    return (pos + LOG_BLOCK_SIZE - 1) / LOG_BLOCK_SIZE * LOG_BLOCK_SIZE;
+}
+
+static inline uint64_t region_bytes(void) {
+    return journal.header.log_blocks * LOG_BLOCK_SIZE;
+}
+
+/*
+ * Disk block holding a log position
+ */
+static inline uint64_t pos_block(uint64_t pos) {
+    return HEADER_BLOCKS + (pos / LOG_BLOCK_SIZE) % journal.header.log_blocks;
+}
+
+/*
+ * Stop logging after a disk error or when the log is full
+ */
+static void log_failed(const char *why, uint64_t arg) {
+    TRACE(ERROR, why, arg, journal.head);
+    (void)why;
+    (void)arg;
+    journal.stats.failed = 1;
+}
+
+/*
+ * Read len bytes of the log at pos
+ */
+static int log_read(uint64_t pos, void *buf, size_t len) {
+    char *dst = buf;
+
+    while (len > 0) {
+        size_t offset = pos % LOG_BLOCK_SIZE;
+        size_t chunk = LOG_BLOCK_SIZE - offset;
+        if (chunk > len) {
+            chunk = len;
+        }
+        if (bcache_read(pos_block(pos), offset, dst, chunk) != 0) {
+            return -1;
+        }
+        pos += chunk;
+        dst += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/*
+ * Add bytes at the head, handing the tail block to the cache each time
+ * it fills
+ */
+static int log_put(const void *buf, size_t len) {
+    const char *src = buf;
+
+    while (len > 0) {
+        size_t offset = journal.head % LOG_BLOCK_SIZE;
+        size_t chunk = LOG_BLOCK_SIZE - offset;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(tail + offset, src, chunk);
+        journal.head += chunk;
+        src += chunk;
+        len -= chunk;
+
+        if (journal.head % LOG_BLOCK_SIZE == 0) {
+            if (bcache_write(pos_block(journal.head - 1), 0, tail, LOG_BLOCK_SIZE) != 0) {
+                return -1;
+            }
+            memset(tail, 0, sizeof(tail));
+        }
+    }
+    return 0;
+}
+
+/*
+ * Write everything since the last commit to the disk
+ */
+static int commit(void) {
+    if (journal.stats.failed) {
+        return -1;
+    }
+    if (journal.head == journal.committed) {
+        return 0;
+    }
+
+    if (journal.head % LOG_BLOCK_SIZE != 0) {
+        if (bcache_write(pos_block(journal.head), 0, tail, LOG_BLOCK_SIZE) != 0) {
+            log_failed("commit: write failed", 0);
+            return -1;
+        }
+        memset(tail, 0, sizeof(tail));
+        journal.head = round_up_block(journal.head);
+    }
+    if (bcache_sync() != 0) {
+        log_failed("commit: sync failed", 0);
+        return -1;
+    }
+
+    TRACE(DEBUG, "commit", journal.committed, journal.head);
+    journal.committed = journal.head;
+    journal.stats.commits++;
+    return 0;
+}
+
+/*
+ * Check that bytes more (plus padding for a commit) fit in front of the
+ * newest checkpoint, which has to stay intact
+ */
+static int has_room(uint64_t bytes) {
+    return journal.head + bytes + LOG_BLOCK_SIZE <= journal.header.ckpt_pos + region_bytes();
+}
+
+/*
+ * Check whether the log is filling up: a checkpoint is due once the
+ * records after the newest one take half the space it leaves free, so
+ * another checkpoint of about the same size still fits
+ */
+static int needs_checkpoint(uint64_t bytes) {
+    uint64_t ckpt = journal.header.ckpt_end - journal.header.ckpt_pos;
+
+    return journal.head + bytes - journal.header.ckpt_end > (region_bytes() - ckpt) / 2;
+}
+
+static int write_checkpoint(void);
+
+/*
+ * Append a record
+ * If the log is filling up this writes a checkpoint first. memfs may already
+ * hold the change (or not yet, for a remove), so the checkpoint may or
+ * may not include it; every record is safe to replay on top of a state
+ * that already has its change.
+ * Returns 0 on success, -1 on error
+ */
+static int append(int type, const char *path, uint64_t arg, const void *data, size_t len) {
+    if (journal.stats.failed) {
+        return -1;
+    }
+
+    size_t path_len = strlen(path);
+    uint64_t bytes = sizeof(record_t) + path_len + len;
+
+    /*
+     * A checkpoint frees everything before it
+     */
+    if (!journal.in_checkpoint && needs_checkpoint(bytes) && write_checkpoint() != 0) {
+        log_failed("checkpoint failed", bytes);
+        return -1;
+    }
+    if (!has_room(bytes)) {
+        log_failed("log full", bytes);
+        return -1;
+    }
+
+    record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = RECORD_MAGIC;
+    rec.log_id = journal.header.log_id;
+    rec.seq = journal.seq;
+    rec.arg = arg;
+    rec.prev = journal.prev;
+    rec.len = (uint32_t)len;
+    rec.path_len = (uint16_t)path_len;
+    rec.type = (uint8_t)type;
+    rec.checksum = record_checksum(&rec, path, data);
+
+    if (log_put(&rec, sizeof(rec)) != 0 || log_put(path, path_len) != 0 ||
+        log_put(data, len) != 0) {
+        log_failed("append: write failed", type);
+        return -1;
+    }
+    journal.seq++;
+    journal.prev = rec.checksum;
+    journal.stats.records++;
+
+    if (journal.head - journal.committed >= FSLOG_BATCH_BYTES) {
+        return commit();
+    }
+    return 0;
+}
+
+/*
+ * Write a header to its block and make sure it's on disk
+ */
+static int write_header(header_t *h) {
+    static char block[LOG_BLOCK_SIZE];
+
+    h->checksum = header_checksum(h);
+    memset(block, 0, sizeof(block));
+    memcpy(block, h, sizeof(*h));
+    if (bcache_write(h->generation % HEADER_BLOCKS, 0, block, sizeof(block)) != 0 ||
+        bcache_sync() != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int all_zero(const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * fs_walk callback: the records that recreate one entry
+ * Files are written a block at a time, leaving out blocks of zeros
+ * (holes, mostly); the final truncate sets the size.
+ */
+static void checkpoint_entry(const char *path, size_t size, int is_dir, void *arg) {
+    (void)arg;
+
+    if (is_dir) {
+        if (append(REC_MKDIR, path, 0, NULL, 0) != 0) {
+            journal.checkpoint_failed = 1;
+        }
+        return;
+    }
+
+    fs_view_t view;
+    if (append(REC_CREATE, path, 0, NULL, 0) != 0 || fs_view_open(path, &view) != 0) {
+        journal.checkpoint_failed = 1;
+        return;
+    }
+
+    const char *data;
+    size_t offset = 0;
+    size_t n;
+    while ((n = fs_view_chunk(&view, offset, &data)) > 0) {
+        if (!all_zero(data, n) && append(REC_WRITE, path, offset, data, n) != 0) {
+            journal.checkpoint_failed = 1;
+        }
+        offset += n;
+    }
+    fs_view_close(&view);
+
+    if (size > 0 && append(REC_TRUNCATE, path, size, NULL, 0) != 0) {
+        journal.checkpoint_failed = 1;
+    }
+}
+
+/*
+ * Write the whole file table to the log and point a new header at it
+ */
+static int write_checkpoint(void) {
+    if (commit() != 0) {
+        return -1;
+    }
+
+    header_t h = journal.header;
+    h.generation++;
+    h.ckpt_pos = journal.head;
+    h.ckpt_seq = journal.seq;
+    h.ckpt_prev = journal.prev;
+
+    journal.in_checkpoint = 1;
+    journal.checkpoint_failed = 0;
+    if (append(REC_CHECKPOINT, "", 0, NULL, 0) != 0) {
+        journal.checkpoint_failed = 1;
+    } else {
+        fs_walk(checkpoint_entry, NULL);
+    }
+
+    /*
+     * Always close the checkpoint, so replay knows where a failed one
+     * ends
+     */
+    if (append(REC_CHECKPOINT_END, "", 0, NULL, 0) != 0) {
+        journal.checkpoint_failed = 1;
+    }
+    h.ckpt_end = journal.head;
+    journal.in_checkpoint = 0;
+
+    if (commit() != 0 || journal.checkpoint_failed) {
+        TRACE(ERROR, "checkpoint failed", h.generation, 0);
+        return -1;
+    }
+    if (write_header(&h) != 0) {
+        log_failed("checkpoint: header write failed", h.generation);
+        return -1;
+    }
+
+    journal.header = h;
+    journal.stats.checkpoints++;
+    TRACE(INFO, "checkpoint", h.ckpt_pos, h.ckpt_end - h.ckpt_pos);
+    return 0;
+}
+
+/*
+ * Read the record at pos if it is the next one in the chain
+ * Returns its total size in bytes, or 0 if it isn't
+ */
+static uint64_t read_record(uint64_t pos, uint64_t seq, uint32_t prev, record_t *rec) {
+    if (log_read(pos, rec, sizeof(*rec)) != 0 ||
+        rec->magic != RECORD_MAGIC || rec->log_id != journal.header.log_id ||
+        rec->seq != seq || rec->prev != prev ||
+        rec->path_len >= FS_PATH_MAX || rec->len > MAX_RECORD_DATA) {
+        return 0;
+    }
+
+    uint64_t bytes = sizeof(*rec) + rec->path_len + rec->len;
+    if (pos + bytes > journal.header.ckpt_pos + region_bytes() ||
+        log_read(pos + sizeof(*rec), replay_path, rec->path_len) != 0 ||
+        log_read(pos + sizeof(*rec) + rec->path_len, replay_data, rec->len) != 0 ||
+        record_checksum(rec, replay_path, replay_data) != rec->checksum) {
+        return 0;
+    }
+    replay_path[rec->path_len] = '\0';
+    return bytes;
+}
+
+/*
+ * Apply a replayed record to memfs
+ * Failures are ignored: the log only holds changes that worked, so one
+ * can only fail here if memory is shorter than it was.
+ */
+static void apply_record(const record_t *rec) {
+    int fd;
+
+    switch (rec->type) {
+    case REC_CREATE:
+        fd = fs_open(replay_path, FS_O_CREATE);
+        if (fd >= 0) {
+            fs_close(fd);
+        }
+        break;
+    case REC_MKDIR:
+        fs_mkdir(replay_path);
+        break;
+    case REC_WRITE:
+        fs_write_at(replay_path, rec->arg, replay_data, rec->len);
+        break;
+    case REC_TRUNCATE:
+        fs_truncate(replay_path, rec->arg);
+        break;
+    case REC_DELETE:
+        fs_delete_file(replay_path);
+        break;
+    case REC_RMDIR:
+        fs_rmdir(replay_path);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Replay from the header's checkpoint to the end of the log
+ */
+static void replay(void) {
+    uint64_t pos = journal.header.ckpt_pos;
+    uint64_t seq = journal.header.ckpt_seq;
+    uint32_t prev = journal.header.ckpt_prev;
+    int skipping = 0;
+    record_t rec;
+
+    journal.replaying = 1;
+    for (;;) {
+        uint64_t bytes = read_record(pos, seq, prev, &rec);
+        if (bytes == 0) {
+            if (pos % LOG_BLOCK_SIZE == 0) {
+                break;  // The end of the log
+            }
+            pos = round_up_block(pos);  // Commit padding
+            continue;
+        }
+
+        if (rec.type == REC_CHECKPOINT && pos != journal.header.ckpt_pos) {
+            skipping = 1;  // Another checkpoint: same state as here
+        } else if (rec.type == REC_CHECKPOINT_END) {
+            skipping = 0;
+        } else if (!skipping) {
+            apply_record(&rec);
+        }
+
+        journal.stats.replayed++;
+        if (pos >= journal.header.ckpt_end) {
+            journal.stats.replayed_tail++;
+        }
+        pos += bytes;
+        seq++;
+        prev = rec.checksum;
+    }
+    journal.replaying = 0;
+
+    journal.head = round_up_block(pos);
+    journal.committed = journal.head;
+    journal.seq = seq;
+    journal.prev = prev;
+}
+
+/*
+ * Read a header block
+ * Returns 1 if it holds a valid header for this disk
+ */
+static int read_header(uint64_t block, header_t *h) {
+    return bcache_read(block, 0, h, sizeof(*h)) == 0 &&
+           h->magic == HEADER_MAGIC && h->checksum == header_checksum(h) &&
+           h->log_blocks == bcache_blocks() - HEADER_BLOCKS &&
+           h->ckpt_end >= h->ckpt_pos;
+}
+
+/*
+ * Check that a header's checkpoint starts where it says
+ */
+static int checkpoint_present(const header_t *h) {
+    record_t rec;
+
+    journal.header = *h;
+    return read_record(h->ckpt_pos, h->ckpt_seq, h->ckpt_prev, &rec) != 0 &&
+           rec.type == REC_CHECKPOINT;
+}
+
+int fslog_mount(uint64_t seed) {
+    header_t headers[HEADER_BLOCKS];
+    int valid[HEADER_BLOCKS];
+
+    memset(&journal, 0, sizeof(journal));
+    memset(tail, 0, sizeof(tail));
+    if (bcache_blocks() < HEADER_BLOCKS + MIN_LOG_BLOCKS) {
+        return -1;
+    }
+
+    for (int i = 0; i < HEADER_BLOCKS; i++) {
+        valid[i] = read_header((uint64_t)i, &headers[i]);
+    }
+
+    /*
+     * Newest header first; fall back to the other if its checkpoint is
+     * unreadable
+     */
+    int newest = (valid[1] && (!valid[0] || headers[1].generation > headers[0].generation)) ? 1 : 0;
+    for (int n = 0; n < HEADER_BLOCKS; n++) {
+        int i = n == 0 ? newest : 1 - newest;
+        if (!valid[i] || !checkpoint_present(&headers[i])) {
+            continue;
+        }
+
+        replay();
+        journal.mounted = 1;
+        TRACE(INFO, "mount", journal.stats.replayed, journal.stats.replayed_tail);
+
+        /*
+         * Start this boot's records with one nobody wrote before, so a
+         * record left past the end by a crash can't continue the chain
+         */
+        append(REC_MOUNT, "", seed, NULL, 0);
+        return 0;
+    }
+
+    /*
+     * No file system: format, with a checkpoint of whatever memfs holds
+     */
+    memset(&journal.header, 0, sizeof(journal.header));
+    journal.header.magic = HEADER_MAGIC;
+    journal.header.log_id = seed | 1;
+    journal.header.log_blocks = bcache_blocks() - HEADER_BLOCKS;
+    journal.seq = 1;
+    journal.mounted = 1;
+    if (write_checkpoint() != 0) {
+        journal.mounted = 0;
+        return -1;
+    }
+    TRACE(INFO, "format", journal.header.log_blocks, journal.header.log_id);
+    return 1;
+}
+
+void fslog_unmount(void) {
+    journal.mounted = 0;
+}
+
+int fslog_active(void) {
+    return journal.mounted && !journal.replaying && !journal.paused && !journal.stats.failed;
+}
+
+int fslog_mounted(void) {
+    return journal.mounted;
+}
+
+void fslog_pause(void) {
+    journal.paused++;
+}
+
+void fslog_resume(void) {
+    journal.paused--;
+}
+
+void fslog_create(const char *path, int is_dir) {
+    append(is_dir ? REC_MKDIR : REC_CREATE, path, 0, NULL, 0);
+}
+
+void fslog_write(const char *path, size_t offset, const void *buf, size_t len) {
+    const char *src = buf;
+
+    while (len > 0) {
+        size_t chunk = len < MAX_RECORD_DATA ? len : MAX_RECORD_DATA;
+        if (append(REC_WRITE, path, offset, src, chunk) != 0) {
+            return;
+        }
+        src += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+}
+
+void fslog_truncate(const char *path, size_t size) {
+    append(REC_TRUNCATE, path, size, NULL, 0);
+}
+
+void fslog_remove(const char *path, int is_dir) {
+    append(is_dir ? REC_RMDIR : REC_DELETE, path, 0, NULL, 0);
+}
+
+int fslog_pending(void) {
+    return journal.mounted && journal.head != journal.committed;
+}
+
+int fslog_commit(void) {
+    if (!journal.mounted) {
+        return -1;
+    }
+    if (commit() != 0) {
+        return -1;
+    }
+    if (journal.head - journal.header.ckpt_end >= FSLOG_CHECKPOINT_BYTES) {
+        return write_checkpoint();
+    }
+    return 0;
+}
+
+int fslog_checkpoint(void) {
+    if (!journal.mounted || journal.stats.failed) {
+        return -1;
+    }
+    return write_checkpoint();
+}
+
+void fslog_get_stats(fslog_stats_t *stats) {
+    *stats = journal.stats;
+    stats->log_blocks = journal.header.log_blocks;
+    stats->live_bytes = journal.head - journal.header.ckpt_pos;
+    stats->pending_bytes = journal.head - journal.committed;
+}
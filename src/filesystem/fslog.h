@@ -0,0 +1,136 @@
+/*
+ * File System Log Header
+ *
+ * Makes memfs persistent on the disk (through the block cache) without
+ * turning each change into a random write. memfs stays the copy that
+ * is read; every change to it is appended to a log on disk as a record
+ * (create, write, truncate, remove), and at boot the log is replayed
+ * into an empty memfs.
+ *
+ * - Records collect in the log's tail and go to the disk together on
+ *   fslog_commit (group commit): one run of sequential blocks, sent as
+ *   concurrent requests. The shell's flusher thread commits once
+ *   nothing has been logged for FSLOG_COMMIT_MS; a commit also happens
+ *   once FSLOG_BATCH_BYTES have piled up
+ * - Once FSLOG_CHECKPOINT_BYTES have been logged since the last
+ *   checkpoint, the whole file table is written out again as a compact
+ *   run of records, and a header block is switched to point at it.
+ *   Mount replays from the newest checkpoint, so boot time depends on
+ *   the size of the files, not on how many writes came before
+ * - The log wraps around the disk; space before the newest checkpoint
+ *   is free
+ *
+ * A crash loses at most the changes since the last commit. Every record
+ * carries a sequence number and a checksum, and replay stops at the
+ * first record that is missing, torn or left over from an earlier
+ * trip around the disk.
+ */
+
+#ifndef FSLOG_H
+#define FSLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * How long the flusher waits after the last change before committing
+ */
+#define FSLOG_COMMIT_MS 500
+
+/*
+ * Commit once this much is waiting
+ */
+#define FSLOG_BATCH_BYTES (64 * 1024)
+
+/*
+ * Write a checkpoint once this much has been logged since the last one
+ */
+#define FSLOG_CHECKPOINT_BYTES (1024 * 1024)
+
+/*
+ * Log statistics
+ */
+typedef struct {
+    uint64_t log_blocks;          // Size of the log area
+    uint64_t live_bytes;          // From the newest checkpoint to the end
+    uint64_t pending_bytes;       // Logged but not committed yet
+    uint64_t records;             // Records logged since mount
+    uint64_t commits;
+    uint64_t checkpoints;
+    uint64_t replayed;            // Records replayed at mount
+    uint64_t replayed_tail;       // ... of which after the checkpoint
+    int failed;                   // A write to the log failed; nothing
+                                  // is logged from then on
+} fslog_stats_t;
+
+/*
+ * Mount the file system on the disk (after bcache_init and fs_init)
+ * Replays the log into memfs, or formats the disk if it holds no log.
+ * seed tells this format apart from earlier ones on the same disk
+ * (any value that changes from boot to boot, e.g. the timer).
+ * Returns 1 if the disk was formatted, 0 if an existing file system
+ * was mounted, -1 if the disk is too small or can't be read
+ */
+int fslog_mount(uint64_t seed);
+
+/*
+ * Stop logging, dropping anything not committed (for tests, to
+ * simulate a crash)
+ */
+void fslog_unmount(void);
+
+/*
+ * Check whether changes are being logged (mounted, not replaying)
+ */
+int fslog_active(void);
+
+/*
+ * Check whether the disk holds the mounted log (even one that has
+ * failed or is paused), so nothing else may write to it
+ */
+int fslog_mounted(void);
+
+/*
+ * Stop logging changes for a while, and start again (calls nest)
+ * For scratch files that should never reach the disk, like the file
+ * benchmarks' (see bench_scratch_enter). Whatever changes in between
+ * must be undone before fslog_resume, or memfs and the disk no longer
+ * agree; nothing else may change memfs meanwhile (the shell's files
+ * lock is held).
+ */
+void fslog_pause(void);
+void fslog_resume(void);
+
+/*
+ * Record changes to memfs (called by memfs, after the change worked)
+ * Paths are absolute.
+ */
+void fslog_create(const char *path, int is_dir);
+void fslog_write(const char *path, size_t offset, const void *buf, size_t len);
+void fslog_truncate(const char *path, size_t size);
+void fslog_remove(const char *path, int is_dir);
+
+/*
+ * Check whether there are changes waiting to be committed
+ */
+int fslog_pending(void);
+
+/*
+ * Write every waiting change to the disk, then a checkpoint if one is
+ * due
+ * Returns 0 on success, -1 if the disk write failed
+ */
+int fslog_commit(void);
+
+/*
+ * Commit, then write a checkpoint now
+ * Returns 0 on success, -1 on error
+ */
+int fslog_checkpoint(void);
+
+/*
+ * Get log statistics
+ */
+void fslog_get_stats(fslog_stats_t *stats);
+
+#endif // FSLOG_H
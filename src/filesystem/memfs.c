@@ -2,222 +2,1515 @@
  * In-Memory File System Implementation
  *
  * This file system keeps all files in RAM using a simple array.
- * It's not persistent - files are lost when the OS restarts.
+ * On its own it's not persistent - files are lost when the OS restarts.
+ * When fslog has a disk mounted, every change that succeeds is also
+ * handed to it as it happens (create, write, truncate, remove) and
+ * memfs is rebuilt from the log at boot.
+ *
+ * Directories are slots too: every entry records the slot of the
+ * directory it's in, and the root directory has a reserved slot
+ * (FS_ROOT) of its own.
+ *
+ * Entries are found through a hash index that works as a dentry cache:
+ * it is keyed by (parent directory, name hash), so looking up one path
+ * component is a single hash lookup however many entries there are,
+ * and resolving a path costs one lookup per component. Each name's
+ * hash is computed once when the entry is created and stored in the
+ * slot, and slots in the same bucket are chained together; a lookup
+ * walks one short chain and only compares names when the parent and
+ * stored hash match. Free slots are found with a count-trailing-zeros
+ * on the in-use bitmap, so creating a file doesn't scan the array
+ * either.
+ *
+ * File content is kept in FS_BLOCK_SIZE blocks, each one page from the
+ * page allocator, found through a per-file block map. Growing a file
+ * adds blocks (and at worst doubles the map, an array of pointers)
+ * without moving the data already written, and a read or write at an
+ * offset only touches the blocks it covers. Blocks that were never
+ * written are holes: they read as zeros and take no memory.
+ *
+ * Blocks are reference counted so views (fs_view_open) can pin a
+ * file's content without copying it. A view takes a reference on every
+ * block; a write to a block someone else also holds first copies it
+ * (copy-on-write), so the view keeps seeing the content as it was.
+ *
+ * Readers don't lock (see "Readers" below): every change to what they
+ * read is made inside a write section of a seqlock, and a read that
+ * overlapped one is done again. Blocks and block maps a change drops
+ * are only freed once no reader can still be looking at them.
  */
 
 #include "memfs.h"
+#include "fslog.h"
 #include "../kernel/memory.h"
+#include "../kernel/page_alloc.h"
+#include "../kernel/sched.h"
+#include "../kernel/seqlock.h"
+#include "../kernel/smp.h"
 #include "../kernel/string.h"
-#include "../kernel/uart.h"  // For debug output
+
+#define TRACE_MODULE FS
+#include "../kernel/trace.h"
+
+_Static_assert(FS_BLOCK_SIZE == PAGE_SIZE, "memfs blocks are single pages");
+
+/*
+ * File table
+ *
+ * Split by how often each field is read. Lookups, listings and
+ * free-slot searches only touch the hot arrays: a bit per slot for
+ * "in use" and "is a directory", and each slot's name hash, parent,
+ * chain link and size packed next to the other slots' copies, so a
+ * chain walk or a scan reads a few bytes per slot instead of a whole
+ * file_t. The cold file_t records (full name, block map) are only read
+ * once the hot fields match. The extra slot at the end is the root
+ * directory.
+ */
+#define FS_SLOTS     (MAX_FILES + 1)
+#define FS_ROOT      MAX_FILES
+#define FS_MAP_WORDS ((FS_SLOTS + 31) / 32)
+
+_Static_assert(FS_SLOTS < INT16_MAX, "slot numbers must fit in int16_t");
+
+static struct {
+    uint32_t used[FS_MAP_WORDS];   // Bit per slot: in use
+    uint32_t dir[FS_MAP_WORDS];    // Bit per slot: is a directory
+    uint32_t hash[FS_SLOTS];       // Hash of name (see fs_hash_name)
+    int16_t parent[FS_SLOTS];      // Slot of the directory it's in
+    int16_t next[FS_SLOTS];        // Next slot in the same hash chain,
+                                   // -1 at the end
+    size_t size[FS_SLOTS];         // Content size in bytes
+} hot;
+
+static file_t files[FS_SLOTS];
+
+/*
+ * Current directory, which paths not starting with '/' start from
+ */
+static int cwd = FS_ROOT;
+
+/*
+ * Hash index: first slot of each bucket's chain, -1 if empty
+ */
+static int hash_buckets[FS_HASH_BUCKETS];
+
+/*
+ * Number of files and directories in use, kept as they come and go
+ */
+static int file_count = 0;
+
+/*
+ * Open file handles: a slot and the generation it had when opened
+ */
+typedef struct {
+    int in_use;
+    int slot;
+    uint32_t gen;
+} handle_t;
+
+static handle_t handles[FS_MAX_OPEN];
+
+/*
+ * Path of the entry being logged (see log_path)
+ */
+static char log_path_buf[FS_PATH_MAX];
 
 /*
- * Array of files
- * This is our entire file system - just an array in memory
+ * Readers
+ *
+ * The read functions (see memfs.h) run without a lock, alongside each
+ * other and a change. A change makes its edits to the file table, the
+ * hash index, the current directory and file content between
+ * seq_write_lock and seq_write_unlock on fs_seq; a reader that
+ * overlapped such a section throws away what it read and reads again
+ * (see seqlock.h). The sections are short and never include the fslog
+ * calls, which may wait for the disk.
+ *
+ * What a reader has read may be half-changed until it checks, so it
+ * must not trust the pointers it followed to stay allocated: a change
+ * can drop a block the reader is copying from, or a block map it is
+ * indexing. Those are retired instead of freed, stamped with the
+ * current epoch, and freed once every core that was reading has
+ * finished. Each core publishes the epoch its read started in (0 when
+ * it isn't reading); something retired in epoch e is safe to free once
+ * no core shows an epoch <= e.
  */
-static file_t files[MAX_FILES];
+#define FS_RETIRE_MAX 64
+
+static seqlock_t fs_seq = SEQLOCK_INIT;
+static volatile uint64_t fs_epoch = 1;
+
+static struct {
+    volatile uint64_t epoch;       // Epoch its read started in, or 0
+} __attribute__((aligned(64))) readers[MAX_CPUS];
+
+static struct {
+    void *ptr;
+    uint64_t epoch;                // fs_epoch when it was dropped
+    int is_block;                  // A block (page) rather than a map
+} retired[FS_RETIRE_MAX];
+
+static int retired_count;
+
+/*
+ * Slot bitmap helpers
+ */
+static inline int bit_test(const uint32_t *map, int slot) {
+    return (map[slot / 32] >> (slot % 32)) & 1;
+}
+
+static inline void bit_set(uint32_t *map, int slot) {
+    map[slot / 32] |= 1u << (slot % 32);
+}
+
+static inline void bit_clear(uint32_t *map, int slot) {
+    map[slot / 32] &= ~(1u << (slot % 32));
+}
+
+static inline int is_dir(int slot) {
+    return bit_test(hot.dir, slot);
+}
+
+/*
+ * Hash len bytes of a name (FNV-1a)
+ */
+static uint32_t hash_name(const char *name, size_t len) {
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint32_t fs_hash_name(const char *name) {
+    return hash_name(name, strlen(name));
+}
+
+/*
+ * Bucket for a name in a directory
+ * The parent's slot is mixed in so the same name in different
+ * directories lands in different buckets.
+ */
+static inline int *bucket_for(int parent, uint32_t hash) {
+    hash ^= (uint32_t)(parent + 1) * 0x9E3779B1u;
+    return &hash_buckets[hash & (FS_HASH_BUCKETS - 1)];
+}
+
+/*
+ * Start a read: keep the thread on its core and publish the epoch
+ * The fence makes the epoch visible before any pointer is loaded (it
+ * pairs with the one in reclaim).
+ * Returns the sequence count for read_retry
+ */
+static uint32_t read_begin(void) {
+    uint32_t seq = seq_read_begin(&fs_seq);
+
+    preempt_disable();
+    __atomic_store_n(&readers[smp_cpu_id()].epoch,
+                     __atomic_load_n(&fs_epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return seq;
+}
+
+/*
+ * Finish a read
+ * Returns 1 if a change overlapped it (read again), 0 if what was read
+ * is consistent
+ */
+static int read_retry(uint32_t seq) {
+    int retry = seq_read_retry(&fs_seq, seq);
+
+    __atomic_store_n(&readers[smp_cpu_id()].epoch, 0, __ATOMIC_RELEASE);
+    preempt_enable();
+    return retry;
+}
+
+/*
+ * Free whatever no reader can still be using
+ * Starts a new epoch first, so reads that begin from now on can't have
+ * seen anything retired so far.
+ */
+static void reclaim(void) {
+    if (retired_count == 0) {
+        return;
+    }
+
+    __atomic_store_n(&fs_epoch, fs_epoch + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    uint64_t oldest = UINT64_MAX;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        uint64_t epoch = __atomic_load_n(&readers[cpu].epoch, __ATOMIC_ACQUIRE);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < retired_count; i++) {
+        if (retired[i].epoch >= oldest) {
+            retired[kept++] = retired[i];
+        } else if (retired[i].is_block) {
+            page_free(retired[i].ptr);
+        } else {
+            free(retired[i].ptr);
+        }
+    }
+    TRACE(DEBUG, "reclaim", retired_count - kept, kept);
+    retired_count = kept;
+}
+
+/*
+ * Free a block or block map once no reader can be using it
+ */
+static void retire(void *ptr, int is_block) {
+    while (retired_count == FS_RETIRE_MAX) {
+        // Full: wait for the reads in progress to finish
+        reclaim();
+#ifdef HOST_BUILD
+        sched_yield();
+#endif
+    }
+
+    retired[retired_count].ptr = ptr;
+    retired[retired_count].epoch = fs_epoch;
+    retired[retired_count].is_block = is_block;
+    retired_count++;
+}
+
+/*
+ * Start and finish a change to what readers see
+ * Finishing frees what the change retired if nobody is reading.
+ */
+static void change_begin(void) {
+    seq_write_lock(&fs_seq);
+}
+
+static void change_end(void) {
+    seq_write_unlock(&fs_seq);
+    reclaim();
+}
+
+/*
+ * Length of a slot's name
+ * Bounded, as a reader may see the name while a change rewrites it.
+ */
+static size_t slot_name_len(const file_t *file) {
+    size_t len = 0;
+
+    while (len < MAX_FILENAME_LEN - 1 && file->name[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+/*
+ * Write the absolute path of a slot into buf
+ * Built backwards from the end of buf, one parent at a time.
+ * Returns 0 on success, -1 if it doesn't fit
+ */
+static int slot_path(int slot, char *buf, size_t size) {
+    size_t pos = size;
+
+    if (size == 0) {
+        return -1;
+    }
+    buf[--pos] = '\0';
+
+    for (int dir = slot; dir != FS_ROOT; dir = hot.parent[dir]) {
+        size_t len = slot_name_len(&files[dir]);
+        if (pos < len + 1) {
+            return -1;
+        }
+        pos -= len;
+        memcpy(buf + pos, files[dir].name, len);
+        buf[--pos] = '/';
+    }
+
+    if (pos == size - 1) {
+        if (pos == 0) {
+            return -1;
+        }
+        buf[--pos] = '/';  // The root
+    }
+
+    // Slide the path to the start of buf (forwards, so overlap is fine)
+    for (size_t i = 0; pos + i < size; i++) {
+        buf[i] = buf[pos + i];
+    }
+    return 0;
+}
+
+/*
+ * Path of a slot for the log (valid until the next call)
+ * FS_PATH_MAX always fits.
+ */
+static const char *log_path(int slot) {
+    slot_path(slot, log_path_buf, sizeof(log_path_buf));
+    return log_path_buf;
+}
 
 /*
  * Initialize the file system
  */
 void fs_init(void) {
+    for (int i = 0; i < FS_HASH_BUCKETS; i++) {
+        hash_buckets[i] = -1;
+    }
+
     /*
-     * Mark all file slots as unused
+     * Mark all file slots as unused. Bits past the last slot are marked
+     * used so the free-slot search never returns them.
      */
-    for (int i = 0; i < MAX_FILES; i++) {
-        files[i].in_use = 0;
-        files[i].content = NULL;
-        files[i].size = 0;
+    for (int w = 0; w < FS_MAP_WORDS; w++) {
+        hot.used[w] = 0;
+        hot.dir[w] = 0;
+    }
+    for (int i = FS_SLOTS; i < FS_MAP_WORDS * 32; i++) {
+        bit_set(hot.used, i);
+    }
+
+    for (int i = 0; i < FS_SLOTS; i++) {
+        hot.hash[i] = 0;
+        hot.parent[i] = FS_ROOT;
+        hot.next[i] = -1;
+        hot.size[i] = 0;
+        files[i].map = NULL;
         files[i].name[0] = '\0';
+        files[i].gen = 0;
+        files[i].children = 0;
+    }
+    file_count = 0;
+
+    /*
+     * The root directory is its own parent and is never freed
+     */
+    bit_set(hot.used, FS_ROOT);
+    bit_set(hot.dir, FS_ROOT);
+    cwd = FS_ROOT;
+
+    for (int i = 0; i < FS_MAX_OPEN; i++) {
+        handles[i].in_use = 0;
     }
+
+    // Anything still retired belonged to the allocators' previous life
+    retired_count = 0;
 }
 
 /*
- * Find a file by name
- * Returns pointer to file, or NULL if not found
+ * Look up one path component (len bytes of name) in a directory
+ * "." and ".." are the directory itself and its parent.
+ * A reader racing a change may walk a chain while it is relinked, so
+ * the walk stops after FS_SLOTS steps (the read is done again anyway).
+ * Returns the entry's slot, or -1 if there's no such name
  */
-static file_t *find_file(const char *filename) {
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (files[i].in_use && strcmp(files[i].name, filename) == 0) {
-            return &files[i];
+static int lookup(int dir, const char *name, size_t len) {
+    if (len == 1 && name[0] == '.') {
+        return dir;
+    }
+    if (len == 2 && name[0] == '.' && name[1] == '.') {
+        return hot.parent[dir];
+    }
+    if (len >= MAX_FILENAME_LEN) {
+        return -1;  // Longer than any name can be
+    }
+
+    uint32_t hash = hash_name(name, len);
+    int steps = 0;
+
+    for (int i = *bucket_for(dir, hash); i != -1 && steps < FS_SLOTS; i = hot.next[i]) {
+        steps++;
+        if (hot.hash[i] == hash && hot.parent[i] == dir &&
+            strncmp(files[i].name, name, len) == 0 && files[i].name[len] == '\0') {
+            return i;
         }
     }
-    return NULL;
+    return -1;
 }
 
 /*
- * Find a free file slot
- * Returns pointer to file slot, or NULL if file system is full
+ * Resolve every component of a path but the last
+ * Absolute paths start at the root, others at the current directory.
+ * Sets *leaf and *leaf_len to the last component (empty for "/" or "").
+ * Returns the slot of the directory the last component is in, or -1 if
+ * a directory on the way doesn't exist
  */
-static file_t *find_free_slot(void) {
-    uart_puts("[FS_DEBUG] find_free_slot: entering loop\n");
-    for (int i = 0; i < MAX_FILES; i++) {
-        uart_puts("[FS_DEBUG] find_free_slot: checking slot ");
-        uart_putc('0' + (i / 10));
-        uart_putc('0' + (i % 10));
-        uart_putc('\n');
+static int walk_path(const char *path, const char **leaf, size_t *leaf_len) {
+    if (path == NULL) {
+        return -1;
+    }
+
+    int dir = (*path == '/') ? FS_ROOT : cwd;
+
+    for (;;) {
+        while (*path == '/') {
+            path++;
+        }
+
+        size_t len = 0;
+        while (path[len] != '\0' && path[len] != '/') {
+            len++;
+        }
+
+        const char *next = path + len;
+        while (*next == '/') {
+            next++;
+        }
+        if (*next == '\0') {
+            *leaf = path;
+            *leaf_len = len;
+            return dir;
+        }
 
-        if (!files[i].in_use) {
-            uart_puts("[FS_DEBUG] find_free_slot: found free slot\n");
-            return &files[i];
+        dir = lookup(dir, path, len);
+        if (dir == -1 || !is_dir(dir)) {
+            return -1;
         }
+        path = next;
     }
-    uart_puts("[FS_DEBUG] find_free_slot: no free slots\n");
-    return NULL;
 }
 
 /*
- * Create or update a file
+ * Find a file or directory by path
+ * Returns the entry's slot, or -1 if not found
  */
-int fs_write_file(const char *filename, const char *content) {
-    uart_puts("[FS_DEBUG] fs_write_file called\n");
+static int find_entry(const char *path) {
+    const char *leaf;
+    size_t len;
+    int dir = walk_path(path, &leaf, &len);
+
+    if (dir == -1 || len == 0) {
+        return dir;  // Not found, or the path names a directory ("/")
+    }
+    return lookup(dir, leaf, len);
+}
+
+/*
+ * Find a regular file by path
+ * Returns the file's slot, or -1 if not found or a directory
+ */
+static int find_file(const char *path) {
+    int slot = find_entry(path);
+
+    return (slot != -1 && !is_dir(slot)) ? slot : -1;
+}
+
+/*
+ * Number of blocks needed to hold size bytes
+ */
+static inline size_t blocks_for(size_t size) {
+    return (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+}
+
+/*
+ * Number of entries in a file's block map
+ */
+static inline size_t map_cap(const file_t *file) {
+    return file->map != NULL ? file->map->cap : 0;
+}
+
+/*
+ * Get a block of a file, or NULL for a hole
+ * The map is loaded once, so the bound and the entry come from the
+ * same one even if a change swaps it. The entry is loaded with acquire:
+ * block_for_write swaps in a copy outside any change, and its contents
+ * must be visible before the pointer is.
+ */
+static inline char *block_at(const file_t *file, size_t index) {
+    const block_map_t *map = __atomic_load_n(&file->map, __ATOMIC_ACQUIRE);
+
+    return (map != NULL && index < map->cap)
+        ? __atomic_load_n(&map->blocks[index], __ATOMIC_ACQUIRE) : NULL;
+}
+
+/*
+ * Make the block map hold at least count entries
+ * Only the pointers are copied into a new map; the blocks stay where
+ * they are. The old map is retired, as a reader may be indexing it.
+ */
+static int grow_map(file_t *file, size_t count) {
+    size_t old_cap = map_cap(file);
+
+    if (count <= old_cap) {
+        return 0;
+    }
+
+    size_t cap = old_cap * 2;
+    if (cap < count) {
+        cap = count;
+    }
+
+    block_map_t *map = malloc(sizeof(block_map_t) + cap * sizeof(char *));
+    if (map == NULL) {
+        return -1;
+    }
+    map->cap = cap;
+    if (old_cap > 0) {
+        memcpy(map->blocks, file->map->blocks, old_cap * sizeof(char *));
+        retire(file->map, 0);
+    }
+    memset(map->blocks + old_cap, 0, (cap - old_cap) * sizeof(char *));
+
+    // Publish the map only once it is filled in
+    __atomic_store_n(&file->map, map, __ATOMIC_RELEASE);
+    TRACE(DEBUG, "grow_map", cap, count);
+    return 0;
+}
+
+/*
+ * Number of holders (the file and any views) of a block
+ * Kept in the block's page_t, whose in_use field is ours while we own
+ * the page.
+ */
+static inline uint16_t *block_refs(const char *block) {
+    return &page_of(block)->in_use;
+}
+
+/*
+ * Drop a reference to a block, retiring it with the last one
+ */
+static void block_put(char *block) {
+    if (--*block_refs(block) == 0) {
+        retire(block, 1);
+    }
+}
+
+/*
+ * Get a block of a file that only the file holds, so it can be written
+ * A hole gets a new zeroed block; a block shared with a view is copied.
+ * Returns NULL if out of memory.
+ */
+static char *block_for_write(file_t *file, size_t index) {
+    char *block = file->map->blocks[index];
+
+    if (block != NULL && *block_refs(block) == 1) {
+        return block;
+    }
+
+    char *copy = page_alloc(0);
+    if (copy == NULL) {
+        return NULL;
+    }
+    *block_refs(copy) = 1;
+
+    if (block != NULL) {
+        memcpy(copy, block, FS_BLOCK_SIZE);
+        block_put(block);
+        TRACE(DEBUG, "cow", index, *block_refs(block));
+    } else {
+        memset(copy, 0, FS_BLOCK_SIZE);
+    }
+
+    // Readers may see this block's bytes below the size, so publish the
+    // copy only once it is filled in (pairs with block_at)
+    __atomic_store_n(&file->map->blocks[index], copy, __ATOMIC_RELEASE);
+    return copy;
+}
+
+/*
+ * Drop every block from index first on
+ */
+static void free_blocks(file_t *file, size_t first) {
+    for (size_t i = first; i < map_cap(file); i++) {
+        if (file->map->blocks[i] != NULL) {
+            block_put(file->map->blocks[i]);
+            file->map->blocks[i] = NULL;
+        }
+    }
+}
+
+/*
+ * Drop everything past size bytes: free the blocks after it and zero
+ * the rest of the last block, so growing the file again reads zeros
+ * Returns -1 if the last block is shared and can't be copied; its tail
+ * is then left as it was.
+ */
+static int trim_blocks(file_t *file, size_t size) {
+    free_blocks(file, blocks_for(size));
+
+    if (block_at(file, size / FS_BLOCK_SIZE) == NULL) {
+        return 0;
+    }
+
+    char *last = block_for_write(file, size / FS_BLOCK_SIZE);
+    if (last == NULL) {
+        return -1;
+    }
+    size_t used = size % FS_BLOCK_SIZE;
+    memset(last + used, 0, FS_BLOCK_SIZE - used);
+    return 0;
+}
+
+/*
+ * Shrink or grow a file to size bytes
+ * Growing needs no memory: the new range is a hole. Shrinking can fail
+ * only when the new last block is shared with a view and can't be
+ * copied. Only the size change holds readers off; the blocks past it
+ * are trimmed afterwards, when readers no longer look there.
+ */
+static int set_size(int slot, size_t size) {
+    file_t *file = &files[slot];
+    size_t old_size = hot.size[slot];
+    size_t last = size / FS_BLOCK_SIZE;
+
+    // Make the new last block ours first, so trimming it can't fail
+    if (size < old_size && size % FS_BLOCK_SIZE != 0 && block_at(file, last) != NULL &&
+        block_for_write(file, last) == NULL) {
+        return -1;
+    }
+
+    change_begin();
+    hot.size[slot] = size;
+    change_end();
+
+    if (size < old_size) {
+        (void)trim_blocks(file, size);
+        reclaim();
+    }
+
+    if (fslog_active()) {
+        fslog_truncate(log_path(slot), size);
+    }
+    return 0;
+}
+
+/*
+ * Copy len bytes into a file at offset, allocating blocks for holes and
+ * copying blocks shared with views
+ * This writes in place, so it is only for bytes at or past the file's
+ * size, which readers don't look at (see update_file).
+ * Returns 0 on success, -1 if out of memory
+ */
+static int write_blocks(file_t *file, size_t offset, const char *src, size_t len) {
+    if (grow_map(file, blocks_for(offset + len)) != 0) {
+        return -1;
+    }
+
+    while (len > 0) {
+        size_t index = offset / FS_BLOCK_SIZE;
+        size_t start = offset % FS_BLOCK_SIZE;
+        size_t chunk = FS_BLOCK_SIZE - start;
+        if (chunk > len) {
+            chunk = len;
+        }
+
+        char *block = block_for_write(file, index);
+        if (block == NULL) {
+            return -1;
+        }
+
+        memcpy(block + start, src, chunk);
+        src += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/*
+ * A write to bytes readers can see, prepared outside any change
+ * Every block it touches gets a new copy: the old bytes around the
+ * write (zeros past the new size), and the new bytes in it.
+ * publish_write then swaps the copies in, so the change only holds
+ * readers off for the swap, not for allocating and copying.
+ */
+typedef struct {
+    size_t first;               // Index of the first block touched
+    size_t count;               // Number of blocks touched
+    char **blocks;              // The copies; after publish_write, the
+                                // blocks they replaced
+} staged_write_t;
+
+/*
+ * Build the copies for writing len bytes at offset in a file that will
+ * be size bytes long
+ * Returns 0 on success, -1 if out of memory (nothing is changed then,
+ * apart from a larger block map)
+ */
+static int stage_write(file_t *file, size_t offset, const char *src, size_t len,
+                       size_t size, staged_write_t *w) {
+    w->first = offset / FS_BLOCK_SIZE;
+    w->count = blocks_for(offset + len) - w->first;
+    w->blocks = NULL;
+
+    if (w->count == 0) {
+        return 0;
+    }
+    if (grow_map(file, w->first + w->count) != 0) {
+        return -1;
+    }
+    w->blocks = malloc(w->count * sizeof(char *));
+    if (w->blocks == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < w->count; i++) {
+        char *copy = page_alloc(0);
+        if (copy == NULL) {
+            while (i > 0) {
+                page_free(w->blocks[--i]);
+            }
+            free(w->blocks);
+            return -1;
+        }
+        *block_refs(copy) = 1;
+
+        const char *old = block_at(file, w->first + i);
+        size_t base = (w->first + i) * FS_BLOCK_SIZE;
+        size_t start = (offset > base) ? offset - base : 0;
+        size_t end = offset + len - base;
+        if (end > FS_BLOCK_SIZE) {
+            end = FS_BLOCK_SIZE;
+        }
+
+        if (old != NULL) {
+            memcpy(copy, old, start);
+        } else {
+            memset(copy, 0, start);
+        }
+        memcpy(copy + start, src + (base + start - offset), end - start);
+        if (old != NULL && base + end < size) {
+            memcpy(copy + end, old + end, FS_BLOCK_SIZE - end);
+        } else {
+            memset(copy + end, 0, FS_BLOCK_SIZE - end);
+        }
+        w->blocks[i] = copy;
+    }
+    return 0;
+}
+
+/*
+ * Swap the copies into the file's map (inside a change)
+ */
+static void publish_write(file_t *file, staged_write_t *w) {
+    for (size_t i = 0; i < w->count; i++) {
+        char *old = file->map->blocks[w->first + i];
+        file->map->blocks[w->first + i] = w->blocks[i];
+        w->blocks[i] = old;
+    }
+}
+
+/*
+ * Drop the blocks a published write replaced (after the change)
+ */
+static void drop_staged(staged_write_t *w) {
+    for (size_t i = 0; i < w->count; i++) {
+        if (w->blocks[i] != NULL) {
+            block_put(w->blocks[i]);
+        }
+    }
+    if (w->blocks != NULL) {
+        free(w->blocks);
+    }
+}
+
+/*
+ * Write len bytes to a file at offset and make it size bytes long
+ * Readers see the old content or the new, never a mix, and are held off
+ * only while the size and block pointers change:
+ *
+ * - A write that starts at or past the end goes in place, since
+ *   readers don't look there; then the size is set
+ * - Any other write is staged in new blocks and swapped in
+ *
+ * Either way the blocks past a smaller size are dropped afterwards.
+ * Returns 0 on success, -1 if out of memory (the file is unchanged)
+ */
+static int update_file(int slot, size_t offset, const char *src, size_t len, size_t size) {
+    file_t *file = &files[slot];
+    size_t old_size = hot.size[slot];
+
+    if (offset >= old_size) {
+        if (write_blocks(file, offset, src, len) != 0) {
+            // Give back what this write added. This can't fail where it
+            // matters: a block still shared with a view wasn't written,
+            // so its tail is already zero.
+            (void)trim_blocks(file, old_size);
+            reclaim();
+            return -1;
+        }
+        change_begin();
+        hot.size[slot] = size;
+        change_end();
+        return 0;
+    }
+
+    staged_write_t w;
+    if (stage_write(file, offset, src, len, size, &w) != 0) {
+        return -1;
+    }
+
+    change_begin();
+    publish_write(file, &w);
+    hot.size[slot] = size;
+    change_end();
+
+    if (size < old_size) {
+        free_blocks(file, blocks_for(size));
+    }
+    drop_staged(&w);
+    reclaim();
+    return 0;
+}
+
+/*
+ * Find a free slot: the lowest clear bit of the in-use bitmap
+ * Returns the slot, or -1 if file system is full
+ */
+static int alloc_slot(void) {
+    for (int w = 0; w < FS_MAP_WORDS; w++) {
+        uint32_t free_bits = ~hot.used[w];
+        if (free_bits != 0) {
+            int slot = w * 32 + __builtin_ctz(free_bits);
+            TRACE(DEBUG, "alloc_slot", slot, file_count);
+            return slot;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Name a slot, put it in a directory and add it to the hash index
+ */
+static void index_insert(int slot, int dir, const char *name, size_t len) {
+    memcpy(files[slot].name, name, len);
+    files[slot].name[len] = '\0';
+    hot.hash[slot] = hash_name(name, len);
+    hot.parent[slot] = (int16_t)dir;
+    bit_set(hot.used, slot);
+    files[dir].children++;
+
+    int *bucket = bucket_for(dir, hot.hash[slot]);
+    hot.next[slot] = (int16_t)*bucket;
+    *bucket = slot;
+    file_count++;
+}
+
+/*
+ * Remove a file from the hash index and free its slot
+ */
+static void release_file(int slot) {
+    file_t *file = &files[slot];
+    int *bucket = bucket_for(hot.parent[slot], hot.hash[slot]);
+    int prev = -1;
+
+    if (fslog_active()) {
+        fslog_remove(log_path(slot), is_dir(slot));
+    }
+
+    change_begin();
+    for (int i = *bucket; i != slot; i = hot.next[i]) {
+        prev = i;
+    }
+    if (prev == -1) {
+        *bucket = hot.next[slot];
+    } else {
+        hot.next[prev] = hot.next[slot];
+    }
+    files[hot.parent[slot]].children--;
+
+    file->name[0] = '\0';
+    file->gen++;
+    hot.size[slot] = 0;
+    bit_clear(hot.dir, slot);
+    bit_clear(hot.used, slot);
+    file_count--;
+    change_end();
 
     /*
-     * Validate filename
+     * No reader can find the slot any more, and it isn't reused until
+     * the next change, so its blocks are dropped outside the change
      */
-    if (filename == NULL || filename[0] == '\0') {
-        uart_puts("[FS_DEBUG] Invalid filename\n");
-        return -1;  // Invalid filename
+    free_blocks(file, 0);
+    if (file->map != NULL) {
+        retire(file->map, 0);
+        file->map = NULL;
     }
+    reclaim();
+}
 
-    uart_puts("[FS_DEBUG] About to call strlen on filename\n");
-    if (strlen(filename) >= MAX_FILENAME_LEN) {
-        uart_puts("[FS_DEBUG] Filename too long\n");
+/*
+ * Find a file or directory, creating it if it doesn't exist
+ * If created isn't NULL, it is set to whether this call created it.
+ * Returns the slot, or -1 if the path is invalid, a directory on the
+ * way is missing, the entry exists but isn't of the type asked for, or
+ * the file system is full
+ */
+static int open_or_create(const char *path, int want_dir, int *created) {
+    const char *name;
+    size_t name_len;
+
+    int dir = walk_path(path, &name, &name_len);
+    if (dir == -1) {
+        TRACE(ERROR, "write: no such directory", 0, 0);
+        return -1;
+    }
+
+    /*
+     * Try to find existing entry
+     */
+    int slot = (name_len > 0) ? lookup(dir, name, name_len) : dir;
+    if (created != NULL) {
+        *created = (slot == -1);
+    }
+    if (slot != -1) {
+        return (is_dir(slot) == want_dir) ? slot : -1;
+    }
+
+    /*
+     * Validate the new name
+     */
+    if (name_len >= MAX_FILENAME_LEN) {
+        TRACE(ERROR, "write: name too long", name_len, 0);
         return -1;  // Filename too long
     }
 
-    uart_puts("[FS_DEBUG] About to call strlen on content\n");
+    /*
+     * If it doesn't exist, create it
+     */
+    slot = alloc_slot();
+    if (slot == -1) {
+        TRACE(ERROR, "write: no free slots", file_count, 0);
+        return -1;  // File system full
+    }
+
+    change_begin();
+    index_insert(slot, dir, name, name_len);
+    if (want_dir) {
+        bit_set(hot.dir, slot);
+    }
+    hot.size[slot] = 0;
+    files[slot].children = 0;
+    files[slot].map = NULL;
+    change_end();
+    TRACE(INFO, "create", slot, hot.hash[slot]);
+
+    if (fslog_active()) {
+        fslog_create(log_path(slot), want_dir);
+    }
+    return slot;
+}
+
+/*
+ * Create a file or replace its content
+ */
+int fs_write_file(const char *filename, const char *content) {
     /*
      * Validate content size
      */
     size_t content_len = (content != NULL) ? strlen(content) : 0;
-    uart_puts("[FS_DEBUG] strlen completed\n");
     if (content_len > MAX_FILE_SIZE) {
-        uart_puts("[FS_DEBUG] Content too large\n");
+        TRACE(ERROR, "write: too large", content_len, 0);
         return -1;  // Content too large
     }
 
-    /*
-     * Try to find existing file
-     */
-    uart_puts("[FS_DEBUG] About to call find_file\n");
-    file_t *file = find_file(filename);
-    uart_puts("[FS_DEBUG] find_file returned\n");
+    int created;
+    int slot = open_or_create(filename, 0, &created);
+    if (slot == -1) {
+        return -1;
+    }
+    TRACE(DEBUG, "write", content_len, hot.size[slot]);
 
     /*
-     * If file doesn't exist, create it
+     * The new content replaces the old in one step, and whatever is
+     * left of the old content past it is cut off
      */
-    if (file == NULL) {
-        uart_puts("[FS_DEBUG] File not found, creating new\n");
-        file = find_free_slot();
-        if (file == NULL) {
-            uart_puts("[FS_DEBUG] No free slots!\n");
-            return -1;  // File system full
-        }
-
-        uart_puts("[FS_DEBUG] Got free slot, calling strncpy\n");
-        // Initialize new file
-        strncpy(file->name, filename, MAX_FILENAME_LEN - 1);
-        uart_puts("[FS_DEBUG] strncpy done\n");
-        file->name[MAX_FILENAME_LEN - 1] = '\0';
-        file->in_use = 1;
-    } else {
-        // File exists - free old content
-        if (file->content != NULL) {
-            free(file->content);
+    int ret = update_file(slot, 0, content, content_len, content_len);
+    if (ret != 0) {
+        // Out of memory: the old content is still there. A file this
+        // call created is dropped again.
+        TRACE(ERROR, "write: out of memory", content_len, 0);
+        if (created) {
+            release_file(slot);
         }
+        return -1;
+    }
+    if (fslog_active()) {
+        fslog_write(log_path(slot), 0, content, content_len);
+        fslog_truncate(log_path(slot), content_len);
     }
 
-    /*
-     * Allocate and copy content
-     */
-    uart_puts("[FS_DEBUG] About to allocate content\n");
-    if (content_len > 0) {
-        file->content = (char *)malloc(content_len + 1);
-        uart_puts("[FS_DEBUG] malloc returned\n");
-        if (file->content == NULL) {
-            // Out of memory - mark slot as unused
-            uart_puts("[FS_DEBUG] malloc failed!\n");
-            file->in_use = 0;
-            return -1;
+    return 0;  // Success
+}
+
+/*
+ * Write len bytes to a file at offset
+ * Returns 0 on success, -1 if the file would be too large or we ran out
+ * of memory (the size is then unchanged)
+ */
+static int file_write(int slot, size_t offset, const void *buf, size_t len) {
+    if (offset > MAX_FILE_SIZE || len > MAX_FILE_SIZE - offset) {
+        TRACE(ERROR, "write: too large", offset, len);
+        return -1;
+    }
+    TRACE(DEBUG, "write_at", offset, len);
+
+    if (len == 0) {
+        return 0;
+    }
+
+    size_t size = (offset + len > hot.size[slot]) ? offset + len : hot.size[slot];
+    int ret = update_file(slot, offset, buf, len, size);
+    if (ret != 0) {
+        TRACE(ERROR, "write: out of memory", offset, len);
+        return -1;
+    }
+
+    if (fslog_active()) {
+        fslog_write(log_path(slot), offset, buf, len);
+    }
+    return 0;
+}
+
+/*
+ * Read up to len bytes from a file at offset
+ * Returns the number of bytes read
+ */
+static size_t file_read(int slot, size_t offset, void *buf, size_t len) {
+    const file_t *file = &files[slot];
+    size_t size = hot.size[slot];
+
+    if (offset >= size) {
+        return 0;
+    }
+    if (len > size - offset) {
+        len = size - offset;
+    }
+
+    char *dst = buf;
+    size_t done = 0;
+
+    while (done < len) {
+        size_t index = offset / FS_BLOCK_SIZE;
+        size_t start = offset % FS_BLOCK_SIZE;
+        size_t chunk = FS_BLOCK_SIZE - start;
+        if (chunk > len - done) {
+            chunk = len - done;
         }
-        uart_puts("[FS_DEBUG] About to strcpy content\n");
-        strcpy(file->content, content);
-        uart_puts("[FS_DEBUG] strcpy done\n");
-    } else {
-        file->content = NULL;
+
+        const char *block = block_at(file, index);
+        if (block != NULL) {
+            memcpy(dst + done, block + start, chunk);
+        } else {
+            memset(dst + done, 0, chunk);  // Hole
+        }
+        offset += chunk;
+        done += chunk;
     }
 
-    file->size = content_len;
+    return len;
+}
 
-    uart_puts("[FS_DEBUG] fs_write_file complete\n");
-    return 0;  // Success
+/*
+ * Write at an offset
+ */
+int fs_write_at(const char *filename, size_t offset, const void *buf, size_t len) {
+    int slot = open_or_create(filename, 0, NULL);
+
+    if (slot == -1) {
+        return -1;
+    }
+    return file_write(slot, offset, buf, len);
+}
+
+/*
+ * Read at an offset
+ */
+long fs_read_at(const char *filename, size_t offset, void *buf, size_t len) {
+    long ret;
+    uint32_t seq;
+
+    do {
+        seq = read_begin();
+        int slot = find_file(filename);
+        ret = (slot != -1) ? (long)file_read(slot, offset, buf, len) : -1;
+    } while (read_retry(seq));
+
+    return ret;
+}
+
+/*
+ * Set a file's size
+ */
+int fs_truncate(const char *filename, size_t size) {
+    int slot = find_file(filename);
+
+    if (slot == -1 || size > MAX_FILE_SIZE) {
+        return -1;
+    }
+    return set_size(slot, size);
+}
+
+/*
+ * Get a file's size
+ */
+long fs_file_size(const char *filename) {
+    long ret;
+    uint32_t seq;
+
+    do {
+        seq = read_begin();
+        int slot = find_file(filename);
+        ret = (slot != -1) ? (long)hot.size[slot] : -1;
+    } while (read_retry(seq));
+
+    return ret;
+}
+
+/*
+ * Get the file behind a handle
+ * Returns its slot, or -1 if the handle isn't open or its file was
+ * deleted
+ */
+static int handle_file(int fd) {
+    if (fd < 0 || fd >= FS_MAX_OPEN || !handles[fd].in_use) {
+        return -1;
+    }
+
+    int slot = handles[fd].slot;
+    if (!bit_test(hot.used, slot) || files[slot].gen != handles[fd].gen) {
+        return -1;
+    }
+    return slot;
 }
 
 /*
- * Read a file's content
+ * Open a file
  */
-const char *fs_read_file(const char *filename) {
-    file_t *file = find_file(filename);
+int fs_open(const char *filename, int flags) {
+    int fd = 0;
+
+    while (fd < FS_MAX_OPEN && handles[fd].in_use) {
+        fd++;
+    }
+    if (fd == FS_MAX_OPEN) {
+        TRACE(ERROR, "open: no free handles", 0, 0);
+        return -1;
+    }
+
+    int slot = (flags & FS_O_CREATE) ? open_or_create(filename, 0, NULL) : find_file(filename);
+    if (slot == -1) {
+        return -1;
+    }
 
-    if (file == NULL) {
-        return NULL;  // File not found
+    if (flags & FS_O_TRUNC) {
+        set_size(slot, 0);  // Frees every block, so can't fail
     }
 
-    return file->content;
+    handles[fd].in_use = 1;
+    handles[fd].slot = slot;
+    handles[fd].gen = files[slot].gen;
+    TRACE(DEBUG, "open", fd, slot);
+    return fd;
+}
+
+long fs_pread(int fd, void *buf, size_t len, size_t offset) {
+    long ret;
+    uint32_t seq;
+
+    do {
+        seq = read_begin();
+        int slot = handle_file(fd);
+        ret = (slot != -1) ? (long)file_read(slot, offset, buf, len) : -1;
+    } while (read_retry(seq));
+
+    return ret;
+}
+
+long fs_pwrite(int fd, const void *buf, size_t len, size_t offset) {
+    int slot = handle_file(fd);
+
+    if (slot == -1 || file_write(slot, offset, buf, len) != 0) {
+        return -1;
+    }
+    return (long)len;
+}
+
+long fs_append(int fd, const void *buf, size_t len) {
+    int slot = handle_file(fd);
+
+    if (slot == -1 || file_write(slot, hot.size[slot], buf, len) != 0) {
+        return -1;
+    }
+    return (long)len;
+}
+
+long fs_fsize(int fd) {
+    long ret;
+    uint32_t seq;
+
+    do {
+        seq = read_begin();
+        int slot = handle_file(fd);
+        ret = (slot != -1) ? (long)hot.size[slot] : -1;
+    } while (read_retry(seq));
+
+    return ret;
+}
+
+/*
+ * Close a handle
+ */
+int fs_close(int fd) {
+    if (fd < 0 || fd >= FS_MAX_OPEN || !handles[fd].in_use) {
+        return -1;
+    }
+
+    handles[fd].in_use = 0;
+    return 0;
+}
+
+/*
+ * Zeros for views to point at in holes
+ */
+static const char zero_block[FS_BLOCK_SIZE];
+
+/*
+ * Open a view of a file's current content
+ */
+int fs_view_open(const char *filename, fs_view_t *view) {
+    int slot = find_file(filename);
+
+    if (slot == -1) {
+        return -1;
+    }
+
+    size_t count = blocks_for(hot.size[slot]);
+    view->blocks = NULL;
+    view->size = hot.size[slot];
+    if (count == 0) {
+        return 0;
+    }
+
+    view->blocks = malloc(count * sizeof(char *));
+    if (view->blocks == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        char *block = block_at(&files[slot], i);
+        if (block != NULL && *block_refs(block) == UINT16_MAX) {
+            // Too many views of this block - undo and fail
+            view->size = i * FS_BLOCK_SIZE;
+            fs_view_close(view);
+            return -1;
+        }
+        if (block != NULL) {
+            (*block_refs(block))++;
+        }
+        view->blocks[i] = block;
+    }
+    TRACE(DEBUG, "view_open", slot, count);
+    return 0;
+}
+
+/*
+ * Get the bytes of a view at offset
+ */
+size_t fs_view_chunk(const fs_view_t *view, size_t offset, const char **data) {
+    if (offset >= view->size) {
+        *data = NULL;
+        return 0;
+    }
+
+    size_t start = offset % FS_BLOCK_SIZE;
+    size_t chunk = FS_BLOCK_SIZE - start;
+    if (chunk > view->size - offset) {
+        chunk = view->size - offset;
+    }
+
+    const char *block = view->blocks[offset / FS_BLOCK_SIZE];
+    *data = (block != NULL ? block : zero_block) + start;
+    return chunk;
+}
+
+/*
+ * Close a view
+ */
+void fs_view_close(fs_view_t *view) {
+    size_t count = blocks_for(view->size);
+
+    for (size_t i = 0; i < count; i++) {
+        if (view->blocks[i] != NULL) {
+            block_put(view->blocks[i]);
+        }
+    }
+    free(view->blocks);
+    view->blocks = NULL;
+    view->size = 0;
+    reclaim();
 }
 
 /*
  * Delete a file
  */
 int fs_delete_file(const char *filename) {
-    file_t *file = find_file(filename);
+    int slot = find_file(filename);
 
-    if (file == NULL) {
+    if (slot == -1) {
         return -1;  // File not found
     }
 
     /*
-     * Free the content and mark slot as unused
+     * Free the content and return the slot
      */
-    if (file->content != NULL) {
-        free(file->content);
-        file->content = NULL;
+    TRACE(INFO, "delete", slot, hot.size[slot]);
+    release_file(slot);
+
+    return 0;  // Success
+}
+
+/*
+ * List the current directory
+ * Walks the set bits of the in-use bitmap, checking each slot's parent.
+ * The entries are copied out first and only handed to the callback
+ * once the read is known to be consistent, so it sees each one once.
+ */
+void fs_list_files(void (*callback)(const char *name, size_t size, int is_dir)) {
+    struct {
+        char name[MAX_FILENAME_LEN];
+        size_t size;
+        int is_dir;
+    } entries[MAX_FILES];
+    int count;
+    uint32_t seq;
+
+    do {
+        seq = read_begin();
+        count = 0;
+
+        int dir = cwd;
+        for (int w = 0; w < FS_MAP_WORDS; w++) {
+            uint32_t bits = hot.used[w];
+
+            while (bits != 0) {
+                int slot = w * 32 + __builtin_ctz(bits);
+                bits &= bits - 1;
+
+                if (slot < MAX_FILES && hot.parent[slot] == dir) {
+                    size_t len = slot_name_len(&files[slot]);
+                    memcpy(entries[count].name, files[slot].name, len);
+                    entries[count].name[len] = '\0';
+                    entries[count].size = hot.size[slot];
+                    entries[count].is_dir = is_dir(slot);
+                    count++;
+                }
+            }
+        }
+    } while (read_retry(seq));
+
+    for (int i = 0; i < count; i++) {
+        callback(entries[i].name, entries[i].size, entries[i].is_dir);
     }
+}
 
-    file->in_use = 0;
-    file->size = 0;
-    file->name[0] = '\0';
+/*
+ * Create a directory
+ */
+int fs_mkdir(const char *path) {
+    if (find_entry(path) != -1) {
+        return -1;  // Already exists
+    }
+    return (open_or_create(path, 1, NULL) != -1) ? 0 : -1;
+}
 
-    return 0;  // Success
+/*
+ * Delete an empty directory
+ */
+int fs_rmdir(const char *path) {
+    int slot = find_entry(path);
+
+    if (slot == -1 || !is_dir(slot) || slot == FS_ROOT ||
+        files[slot].children > 0 || slot == cwd) {
+        return -1;
+    }
+
+    TRACE(INFO, "rmdir", slot, 0);
+    release_file(slot);
+    return 0;
 }
 
 /*
- * List all files
+ * Change the current directory
  */
-void fs_list_files(void (*callback)(const char *name, size_t size)) {
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (files[i].in_use) {
-            callback(files[i].name, files[i].size);
+int fs_chdir(const char *path) {
+    int slot = find_entry(path);
+
+    if (slot == -1 || !is_dir(slot)) {
+        return -1;
+    }
+    change_begin();
+    cwd = slot;
+    change_end();
+    return 0;
+}
+
+/*
+ * Get the path of the current directory
+ */
+int fs_getcwd(char *buf, size_t size) {
+    int ret;
+    uint32_t seq;
+
+    do {
+        seq = read_begin();
+        ret = slot_path(cwd, buf, size);
+    } while (read_retry(seq));
+
+    return ret;
+}
+
+/*
+ * Visit the entries in a directory, and recursively what's in each
+ * subdirectory
+ * Depth is bounded by MAX_FILES.
+ */
+static void walk_dir(int dir,
+                     void (*callback)(const char *path, size_t size, int is_dir, void *arg),
+                     void *arg) {
+    static char path[FS_PATH_MAX];
+
+    for (int slot = 0; slot < MAX_FILES; slot++) {
+        if (!bit_test(hot.used, slot) || hot.parent[slot] != dir) {
+            continue;
+        }
+
+        slot_path(slot, path, sizeof(path));
+        callback(path, hot.size[slot], is_dir(slot), arg);
+        if (is_dir(slot)) {
+            walk_dir(slot, callback, arg);
         }
     }
 }
 
+/*
+ * Visit every file and directory
+ */
+void fs_walk(void (*callback)(const char *path, size_t size, int is_dir, void *arg),
+             void *arg) {
+    walk_dir(FS_ROOT, callback, arg);
+}
+
 /*
  * Check if a file exists
  */
 int fs_file_exists(const char *filename) {
-    return (find_file(filename) != NULL) ? 1 : 0;
+    int found;
+    uint32_t seq;
+
+    do {
+        seq = read_begin();
+        found = (find_file(filename) != -1);
+    } while (read_retry(seq));
+
+    return found;
 }
 
 /*
- * Get number of files
+ * Get number of files and directories
  */
 int fs_get_file_count(void) {
-    int count = 0;
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (files[i].in_use) {
-            count++;
-        }
-    }
-    return count;
+    return file_count;
 }
@@ -2,55 +2,208 @@
  * In-Memory File System Header
  *
  * A simple file system that stores files in RAM.
- * Files are lost when the OS is restarted.
+ * Files are lost when the OS is restarted, unless a disk is attached:
+ * then every change is also logged to it (see fslog.h) and replayed at
+ * the next boot.
+ *
+ * Every filename below is a path: "/a/b" starts at the root, "b" and
+ * "../b" at the current directory (see fs_chdir).
+ *
+ * Concurrency: fs_read_at, fs_file_size, fs_file_exists,
+ * fs_list_files, fs_getcwd, fs_pread and fs_fsize only read. They take
+ * no lock and can run on any number of cores at once, and alongside a
+ * change. Everything else changes the file system (views too, which
+ * pin blocks), and the caller must make sure only one of those runs at
+ * a time - the shell holds its file lock around them.
  */
 
 #ifndef MEMFS_H
 #define MEMFS_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 /*
- * Maximum number of files in the file system
+ * Maximum number of files and directories in the file system (not
+ * counting the root directory)
  */
 #define MAX_FILES 32
 
 /*
- * Maximum filename length (including null terminator)
+ * Maximum length of a file or directory name, one path component
+ * (including null terminator)
  */
 #define MAX_FILENAME_LEN 64
 
 /*
- * Maximum file content size
+ * Longest possible path: every slot nested in the one before,
+ * including the null terminator
+ */
+#define FS_PATH_MAX (MAX_FILES * MAX_FILENAME_LEN + 2)
+
+/*
+ * Maximum file content size (16MB)
+ */
+#define MAX_FILE_SIZE (16 * 1024 * 1024)
+
+/*
+ * File content is stored in blocks of this size (one page each)
+ */
+#define FS_BLOCK_SIZE 4096
+
+/*
+ * Maximum number of open file handles
  */
-#define MAX_FILE_SIZE 4096
+#define FS_MAX_OPEN 16
+
+/*
+ * fs_open flags
+ */
+#define FS_O_CREATE 0x1   // Create the file if it doesn't exist
+#define FS_O_TRUNC  0x2   // Empty the file
+
+/*
+ * Number of buckets in the filename hash index (power of two)
+ * Twice MAX_FILES keeps the chains short
+ */
+#define FS_HASH_BUCKETS 64
+
+/*
+ * Block map: a file's block pointers and how many there is room for
+ * The count is kept with the pointers, so a reader racing a change
+ * can't pair one map with another map's size.
+ */
+typedef struct {
+    size_t cap;                    // Entries in blocks
+    char *blocks[];
+} block_map_t;
 
 /*
- * File structure
+ * File structure (the rarely read part of a slot)
+ *
+ * Content lives in a block map: map->blocks[i] holds bytes
+ * [i * FS_BLOCK_SIZE, (i + 1) * FS_BLOCK_SIZE). A NULL entry is a hole
+ * that reads as zeros. Bytes past the size in the last block are zero.
+ * Directories use the same structure with no content.
+ *
+ * The fields every lookup and scan reads (in use, name hash, parent,
+ * size) live in separate per-field arrays in memfs.c.
  */
 typedef struct {
     char name[MAX_FILENAME_LEN];  // Filename
-    char *content;                 // File content (dynamically allocated)
-    size_t size;                   // Content size in bytes
-    int in_use;                    // 1 if file exists, 0 if slot is free
+    block_map_t *map;              // Block map (NULL if never written)
+    uint32_t gen;                  // Bumped when the slot is freed, so
+                                   // handles to a deleted file fail
+    int children;                  // Entries in a directory
 } file_t;
 
+/*
+ * Read-only view of a file's content
+ *
+ * A snapshot of the file's blocks at fs_view_open, pinned so that later
+ * writes, truncates and even deleting the file don't change or free what
+ * the view sees (writes copy a pinned block first). Read it a block at a
+ * time with fs_view_chunk, without copying, and release it with
+ * fs_view_close.
+ */
+typedef struct {
+    char **blocks;                 // Pinned blocks (NULL for holes)
+    size_t size;                   // Content size when opened
+} fs_view_t;
+
 /*
  * Initialize the file system
  */
 void fs_init(void);
 
 /*
- * Create or update a file
+ * Create a file or replace its content with a string
  * Returns 0 on success, -1 on error
  */
 int fs_write_file(const char *filename, const char *content);
 
 /*
- * Read a file's content
- * Returns pointer to content, or NULL if file not found
+ * Write len bytes at offset, creating the file if needed
+ * Writing past the end grows the file; any gap reads as zeros.
+ * Returns 0 on success, -1 on error (the file size is then unchanged)
  */
-const char *fs_read_file(const char *filename);
+int fs_write_at(const char *filename, size_t offset, const void *buf, size_t len);
+
+/*
+ * Read up to len bytes from offset
+ * Returns the number of bytes read (0 at or past the end of the file),
+ * or -1 if the file doesn't exist
+ */
+long fs_read_at(const char *filename, size_t offset, void *buf, size_t len);
+
+/*
+ * Set a file's size, freeing blocks past the end or adding zeros
+ * Returns 0 on success, -1 on error
+ */
+int fs_truncate(const char *filename, size_t size);
+
+/*
+ * Get a file's size in bytes
+ * Returns -1 if the file doesn't exist
+ */
+long fs_file_size(const char *filename);
+
+/*
+ * Open a file by name (flags: FS_O_*)
+ * Returns a handle (>= 0), or -1 if the file doesn't exist (without
+ * FS_O_CREATE), can't be created, or all handles are in use.
+ * A handle to a file that is then deleted fails with -1 until closed.
+ */
+int fs_open(const char *filename, int flags);
+
+/*
+ * Read up to len bytes at offset through a handle
+ * Returns the number of bytes read (0 at or past the end), or -1
+ */
+long fs_pread(int fd, void *buf, size_t len, size_t offset);
+
+/*
+ * Write len bytes at offset through a handle
+ * Returns len on success, or -1 (the file size is then unchanged)
+ */
+long fs_pwrite(int fd, const void *buf, size_t len, size_t offset);
+
+/*
+ * Write len bytes at the end of the file
+ * Only the blocks at the end are touched, so this costs O(len) however
+ * large the file is. Returns len on success, or -1.
+ */
+long fs_append(int fd, const void *buf, size_t len);
+
+/*
+ * Get the size of an open file, or -1
+ */
+long fs_fsize(int fd);
+
+/*
+ * Close a handle
+ * Returns 0 on success, -1 if it isn't open
+ */
+int fs_close(int fd);
+
+/*
+ * Open a view of a file's current content
+ * Returns 0 on success, -1 if the file doesn't exist or out of memory
+ */
+int fs_view_open(const char *filename, fs_view_t *view);
+
+/*
+ * Get the bytes of a view at offset
+ * Sets *data to point at them and returns how many there are in a row
+ * (up to the end of the block or the view), or 0 at or past the end.
+ * The pointer stays valid until the view is closed.
+ */
+size_t fs_view_chunk(const fs_view_t *view, size_t offset, const char **data);
+
+/*
+ * Release a view
+ */
+void fs_view_close(fs_view_t *view);
 
 /*
  * Delete a file
@@ -59,10 +212,45 @@ const char *fs_read_file(const char *filename);
 int fs_delete_file(const char *filename);
 
 /*
- * List all files
- * Calls callback for each file with filename and size
+ * List the current directory
+ * Calls callback for each entry with its name, size and whether it's a
+ * directory
+ */
+void fs_list_files(void (*callback)(const char *name, size_t size, int is_dir));
+
+/*
+ * Create a directory
+ * Returns 0 on success, -1 if it exists, its parent doesn't, the name
+ * is invalid or the file system is full
+ */
+int fs_mkdir(const char *path);
+
+/*
+ * Delete an empty directory
+ * Returns 0 on success, -1 if it isn't an empty directory, or is the
+ * root or current directory
+ */
+int fs_rmdir(const char *path);
+
+/*
+ * Change the current directory
+ * Returns 0 on success, -1 if the path isn't a directory
+ */
+int fs_chdir(const char *path);
+
+/*
+ * Write the absolute path of the current directory into buf
+ * Returns 0 on success, -1 if it doesn't fit
+ */
+int fs_getcwd(char *buf, size_t size);
+
+/*
+ * Call callback for every file and directory, with its absolute path,
+ * each directory before the entries in it
+ * The callback must not change the file system.
  */
-void fs_list_files(void (*callback)(const char *name, size_t size));
+void fs_walk(void (*callback)(const char *path, size_t size, int is_dir, void *arg),
+             void *arg);
 
 /*
  * Check if a file exists
@@ -71,8 +259,13 @@ void fs_list_files(void (*callback)(const char *name, size_t size));
 int fs_file_exists(const char *filename);
 
 /*
- * Get number of files
+ * Get number of files and directories
  */
 int fs_get_file_count(void);
 
+/*
+ * Hash a filename (FNV-1a, 32-bit)
+ */
+uint32_t fs_hash_name(const char *name);
+
 #endif // MEMFS_H
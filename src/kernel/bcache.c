@@ -0,0 +1,406 @@
+/*
+ * Block Buffer Cache
+ *
+ * BCACHE_BUFFERS page-sized buffers, each either free, holding a block,
+ * or receiving one from a read-ahead still in flight.
+ *
+ * Every buffer with a block is in the hash table (by block number).
+ * Buffers nobody holds are also on the LRU list, most recently used at
+ * the front; reuse takes the back. A held buffer is never reused, so
+ * its data stays put until bcache_put.
+ *
+ * Read-ahead requests are left in flight with the request ID in the
+ * buffer; whoever needs the buffer next (a bcache_get of that block,
+ * or reusing it) collects the result first.
+ */
+
+#include "bcache.h"
+#include "page_alloc.h"
+#include "string.h"
+#include "virtio_blk.h"
+
+#define TRACE_MODULE BLK
+#include "trace.h"
+
+#define BLOCK_SECTORS (BCACHE_BLOCK_SIZE / VIRTIO_BLK_SECTOR_SIZE)
+#define HASH_SIZE     128   // Power of two
+
+_Static_assert(BCACHE_BLOCK_SIZE == PAGE_SIZE, "buffers are single pages");
+_Static_assert((BCACHE_BUFFERS & (BCACHE_BUFFERS - 1)) == 0, "buffer pool is one page_alloc order");
+
+/*
+ * Buffer flags
+ */
+#define BUF_VALID     0x1   // data holds the block
+#define BUF_DIRTY     0x2   // ... and it differs from the disk
+#define BUF_HASHED    0x4   // block is set and the buffer is in the hash table
+#define BUF_READAHEAD 0x8   // Read ahead and not asked for yet
+
+static bcache_buf_t bufs[BCACHE_BUFFERS];
+static bcache_buf_t *hash[HASH_SIZE];
+static bcache_buf_t lru;            // List head: lru.lru_next is the most recent
+static uint64_t blocks = 0;
+static uint64_t last_block = UINT64_MAX;
+static bcache_stats_t stats;
+
+static inline bcache_buf_t **hash_bucket(uint64_t block) {
+    return &hash[block & (HASH_SIZE - 1)];
+}
+
+static bcache_buf_t *hash_find(uint64_t block) {
+    for (bcache_buf_t *b = *hash_bucket(block); b != NULL; b = b->hash_next) {
+        if (b->block == block) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+static void hash_insert(bcache_buf_t *b, uint64_t block) {
+    bcache_buf_t **bucket = hash_bucket(block);
+
+    b->block = block;
+    b->flags = BUF_HASHED;
+    b->hash_next = *bucket;
+    *bucket = b;
+}
+
+static void hash_remove(bcache_buf_t *b) {
+    bcache_buf_t **link = hash_bucket(b->block);
+
+    while (*link != b) {
+        link = &(*link)->hash_next;
+    }
+    *link = b->hash_next;
+    b->flags = 0;
+}
+
+static void lru_remove(bcache_buf_t *b) {
+    b->lru_prev->lru_next = b->lru_next;
+    b->lru_next->lru_prev = b->lru_prev;
+}
+
+/*
+ * Put a buffer at the front (most recent) or back (next to be reused)
+ */
+static void lru_insert(bcache_buf_t *b, int front) {
+    bcache_buf_t *prev = front ? &lru : lru.lru_prev;
+
+    b->lru_prev = prev;
+    b->lru_next = prev->lru_next;
+    prev->lru_next->lru_prev = b;
+    prev->lru_next = b;
+}
+
+/*
+ * Collect a buffer's read-ahead, if it has one in flight
+ */
+static void finish_io(bcache_buf_t *b) {
+    if (b->io < 0) {
+        return;
+    }
+    if (virtio_blk_wait(b->io) == 0) {
+        b->flags |= BUF_VALID;
+    }
+    b->io = -1;
+}
+
+/*
+ * Collect any one read-ahead, freeing a request slot
+ * Returns 1 if there was one, 0 if nothing is in flight
+ */
+static int finish_any_io(void) {
+    for (int i = 0; i < BCACHE_BUFFERS; i++) {
+        if (bufs[i].io >= 0) {
+            finish_io(&bufs[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Queue a read or write of a buffer's block, waiting for a request slot
+ * if read-aheads have them all
+ * Returns the request ID, or -1 on error
+ */
+static int submit(bcache_buf_t *b, int write) {
+    int id;
+
+    while ((id = virtio_blk_submit(b->block * BLOCK_SECTORS, b->data, BLOCK_SECTORS, write)) < 0) {
+        if (!finish_any_io()) {
+            return -1;
+        }
+    }
+    return id;
+}
+
+static int write_back(bcache_buf_t *b) {
+    int id = submit(b, 1);
+
+    if (id < 0 || virtio_blk_wait(id) != 0) {
+        TRACE(ERROR, "write-back failed", b->block, 0);
+        return -1;
+    }
+    b->flags &= ~BUF_DIRTY;
+    stats.writebacks++;
+    return 0;
+}
+
+/*
+ * Take the least recently used buffer off the LRU list for reuse,
+ * writing it back first if it is dirty
+ * Returns NULL if every buffer is held (or every dirty one fails to
+ * write)
+ */
+static bcache_buf_t *take_buffer(void) {
+    for (bcache_buf_t *b = lru.lru_prev; b != &lru; b = b->lru_prev) {
+        finish_io(b);
+        if ((b->flags & BUF_DIRTY) && write_back(b) != 0) {
+            continue;
+        }
+
+        lru_remove(b);
+        if (b->flags & BUF_HASHED) {
+            hash_remove(b);
+        }
+        return b;
+    }
+    return NULL;
+}
+
+/*
+ * Return a buffer whose block couldn't be read to the free end of the
+ * LRU list
+ */
+static void discard(bcache_buf_t *b) {
+    hash_remove(b);
+    b->refs = 0;
+    lru_insert(b, 0);
+}
+
+/*
+ * Start reads of up to count blocks from start that aren't cached yet
+ * Stops early when the request slots run out; read-ahead is only a
+ * hint.
+ */
+static void read_ahead(uint64_t start, int count) {
+    for (uint64_t block = start; block < start + (uint64_t)count && block < blocks; block++) {
+        if (hash_find(block) != NULL) {
+            continue;
+        }
+
+        bcache_buf_t *b = take_buffer();
+        if (b == NULL) {
+            return;
+        }
+        hash_insert(b, block);
+
+        int id = virtio_blk_submit(block * BLOCK_SECTORS, b->data, BLOCK_SECTORS, 0);
+        if (id < 0) {
+            discard(b);
+            return;
+        }
+        b->io = id;
+        b->flags |= BUF_READAHEAD;
+        lru_insert(b, 1);
+        stats.readaheads++;
+    }
+}
+
+int bcache_init(void) {
+    if (!virtio_blk_ready()) {
+        return -1;
+    }
+
+    char *data = page_alloc(__builtin_ctz(BCACHE_BUFFERS));
+    if (data == NULL) {
+        return -1;
+    }
+
+    memset(bufs, 0, sizeof(bufs));
+    memset(hash, 0, sizeof(hash));
+    memset(&stats, 0, sizeof(stats));
+    lru.lru_next = lru.lru_prev = &lru;
+    for (int i = 0; i < BCACHE_BUFFERS; i++) {
+        bufs[i].data = data + i * BCACHE_BLOCK_SIZE;
+        bufs[i].io = -1;
+        lru_insert(&bufs[i], 0);
+    }
+
+    blocks = virtio_blk_capacity() / BLOCK_SECTORS;
+    last_block = UINT64_MAX;
+    return 0;
+}
+
+uint64_t bcache_blocks(void) {
+    return blocks;
+}
+
+bcache_buf_t *bcache_get(uint64_t block) {
+    if (block >= blocks) {
+        return NULL;
+    }
+
+    int sequential = block == last_block + 1;
+    last_block = block;
+
+    bcache_buf_t *b = hash_find(block);
+    if (b != NULL) {
+        if (b->refs++ == 0) {
+            lru_remove(b);
+        }
+        finish_io(b);
+
+        if (b->flags & BUF_READAHEAD) {
+            // Keep the read-ahead window BCACHE_READAHEAD blocks ahead
+            b->flags &= ~BUF_READAHEAD;
+            stats.readahead_hits++;
+            read_ahead(block + BCACHE_READAHEAD, 1);
+        }
+
+        if (!(b->flags & BUF_VALID)) {
+            // Its read-ahead failed; try once more
+            int id = submit(b, 0);
+            if (id < 0 || virtio_blk_wait(id) != 0) {
+                discard(b);
+                return NULL;
+            }
+            b->flags |= BUF_VALID;
+        }
+        stats.hits++;
+        return b;
+    }
+
+    stats.misses++;
+    b = take_buffer();
+    if (b == NULL) {
+        return NULL;
+    }
+    hash_insert(b, block);
+    b->refs = 1;
+
+    /*
+     * Queue the read-ahead behind this block's read so the disk works
+     * on both while we wait for the first
+     */
+    int id = submit(b, 0);
+    if (id >= 0 && sequential) {
+        read_ahead(block + 1, BCACHE_READAHEAD);
+    }
+    if (id < 0 || virtio_blk_wait(id) != 0) {
+        TRACE(ERROR, "read failed", block, 0);
+        discard(b);
+        return NULL;
+    }
+    b->flags |= BUF_VALID;
+    return b;
+}
+
+void bcache_put(bcache_buf_t *buf) {
+    if (--buf->refs == 0) {
+        lru_insert(buf, 1);
+    }
+}
+
+void bcache_mark_dirty(bcache_buf_t *buf) {
+    buf->flags |= BUF_DIRTY;
+}
+
+int bcache_read(uint64_t block, size_t offset, void *buf, size_t len) {
+    if (offset > BCACHE_BLOCK_SIZE || len > BCACHE_BLOCK_SIZE - offset) {
+        return -1;
+    }
+
+    bcache_buf_t *b = bcache_get(block);
+    if (b == NULL) {
+        return -1;
+    }
+    memcpy(buf, b->data + offset, len);
+    bcache_put(b);
+    return 0;
+}
+
+int bcache_write(uint64_t block, size_t offset, const void *buf, size_t len) {
+    if (offset > BCACHE_BLOCK_SIZE || len > BCACHE_BLOCK_SIZE - offset) {
+        return -1;
+    }
+
+    /*
+     * A whole-block write doesn't need the old contents
+     */
+    bcache_buf_t *b = hash_find(block);
+    if (len == BCACHE_BLOCK_SIZE && block < blocks && (b == NULL || b->refs == 0)) {
+        if (b == NULL) {
+            b = take_buffer();
+            if (b == NULL) {
+                return -1;
+            }
+            hash_insert(b, block);
+        } else {
+            lru_remove(b);
+            finish_io(b);
+            b->flags &= ~BUF_READAHEAD;
+        }
+        b->refs = 1;
+        b->flags |= BUF_VALID;
+    } else if ((b = bcache_get(block)) == NULL) {
+        return -1;
+    }
+
+    memcpy(b->data + offset, buf, len);
+    bcache_mark_dirty(b);
+    bcache_put(b);
+    return 0;
+}
+
+int bcache_sync(void) {
+    bcache_buf_t *batch[VIRTIO_BLK_MAX_INFLIGHT];
+    int ids[VIRTIO_BLK_MAX_INFLIGHT];
+    int ret = 0;
+    int i = 0;
+
+    // Read-aheads would hold request slots the writes can use
+    while (finish_any_io()) {
+    }
+
+    while (i < BCACHE_BUFFERS) {
+        /*
+         * Queue a batch of writes, then wait for all of them
+         */
+        int n = 0;
+        for (; i < BCACHE_BUFFERS && n < VIRTIO_BLK_MAX_INFLIGHT; i++) {
+            bcache_buf_t *b = &bufs[i];
+            if (!(b->flags & BUF_DIRTY)) {
+                continue;
+            }
+            ids[n] = virtio_blk_submit(b->block * BLOCK_SECTORS, b->data, BLOCK_SECTORS, 1);
+            if (ids[n] < 0) {
+                ret = -1;
+                continue;
+            }
+            batch[n++] = b;
+        }
+
+        for (int j = 0; j < n; j++) {
+            if (virtio_blk_wait(ids[j]) != 0) {
+                TRACE(ERROR, "write-back failed", batch[j]->block, 0);
+                ret = -1;
+                continue;
+            }
+            batch[j]->flags &= ~BUF_DIRTY;
+            stats.writebacks++;
+        }
+    }
+    return ret;
+}
+
+void bcache_get_stats(bcache_stats_t *out) {
+    *out = stats;
+    out->dirty = 0;
+    for (int i = 0; i < BCACHE_BUFFERS; i++) {
+        if (bufs[i].flags & BUF_DIRTY) {
+            out->dirty++;
+        }
+    }
+}
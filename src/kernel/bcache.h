@@ -0,0 +1,107 @@
+/*
+ * Block Buffer Cache Header
+ *
+ * Keeps recently used disk blocks in memory on top of the virtio-blk
+ * driver. Blocks are 4KB (eight sectors, one page), numbered from the
+ * start of the disk.
+ *
+ * - Lookups go through a hash table; buffers not in use sit on an LRU
+ *   list, and a miss reuses the least recently used one
+ * - Writes only dirty the buffer (write-back); dirty blocks reach the
+ *   disk when their buffer is reused or on bcache_sync, which sends up
+ *   to VIRTIO_BLK_MAX_INFLIGHT writes at once
+ * - A miss that follows a miss on the previous block also starts reads
+ *   of the next BCACHE_READAHEAD blocks, in flight while the caller
+ *   works on the first one
+ *
+ * Like memfs, the cache expects to be used from one core at a time
+ * (the shell on core 0).
+ */
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BCACHE_BLOCK_SIZE 4096
+#define BCACHE_BUFFERS    64
+#define BCACHE_READAHEAD  4
+
+/*
+ * A cached block
+ * data holds the block while the buffer is held (bcache_get to
+ * bcache_put); everything else belongs to the cache.
+ */
+typedef struct bcache_buf {
+    uint64_t block;
+    char *data;
+    uint32_t flags;
+    int refs;                         // Holders (bcache_get without bcache_put)
+    int io;                           // Read-ahead request in flight, or -1
+    struct bcache_buf *hash_next;
+    struct bcache_buf *lru_prev;      // Only while refs == 0
+    struct bcache_buf *lru_next;
+} bcache_buf_t;
+
+/*
+ * Cache statistics
+ */
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t readaheads;              // Blocks read ahead of a request
+    uint64_t readahead_hits;          // ... that were then asked for
+    uint64_t writebacks;              // Dirty blocks written to disk
+    int dirty;                        // Dirty buffers right now
+} bcache_stats_t;
+
+/*
+ * Allocate the buffers (needs the disk, see virtio_blk_init)
+ * Returns 0 on success, -1 if there is no disk or no memory
+ */
+int bcache_init(void);
+
+/*
+ * Disk size in blocks (0 before bcache_init)
+ */
+uint64_t bcache_blocks(void);
+
+/*
+ * Get a block, reading it from the disk if it isn't cached
+ * The buffer stays in the cache until the matching bcache_put.
+ * Returns NULL if the block is out of range, on a disk error, or if
+ * every buffer is held
+ */
+bcache_buf_t *bcache_get(uint64_t block);
+
+/*
+ * Release a buffer from bcache_get
+ */
+void bcache_put(bcache_buf_t *buf);
+
+/*
+ * Note that a held buffer's data has changed and must be written back
+ */
+void bcache_mark_dirty(bcache_buf_t *buf);
+
+/*
+ * Copy len bytes at offset within a block out of / into the cache
+ * (offset + len must not pass the end of the block)
+ * Returns 0 on success, -1 on error
+ */
+int bcache_read(uint64_t block, size_t offset, void *buf, size_t len);
+int bcache_write(uint64_t block, size_t offset, const void *buf, size_t len);
+
+/*
+ * Write every dirty block to the disk
+ * Returns 0 on success, -1 if any write failed (those stay dirty)
+ */
+int bcache_sync(void);
+
+/*
+ * Get cache statistics
+ */
+void bcache_get_stats(bcache_stats_t *stats);
+
+#endif // BCACHE_H
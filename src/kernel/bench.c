@@ -0,0 +1,819 @@
+/*
+ * Benchmark Suite Implementation
+ */
+
+#include "bench.h"
+#include "shell.h"
+#include "uart.h"
+#include "string.h"
+#include "memory.h"
+#include "mpmc.h"
+#include "sched.h"
+#include "seqlock.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "bcache.h"
+#include "virtio_blk.h"
+#include "../filesystem/memfs.h"
+#include "../filesystem/fslog.h"
+
+/*
+ * Largest ops per sample tried while calibrating
+ */
+#define BENCH_MAX_OPS (1UL << 24)
+
+/*
+ * Fewer samples for the UART, where every operation takes real time
+ */
+#define BENCH_UART_SAMPLES 21
+
+/*
+ * ... and for the disk
+ */
+#define BENCH_DISK_SAMPLES 21
+
+/*
+ * Sample buffer (the shell runs one benchmark at a time)
+ */
+static uint64_t samples[BENCH_SAMPLES];
+
+/*
+ * Sink for results so the compiler can't drop the calls
+ */
+static volatile uint64_t bench_sink;
+
+/*
+ * Compiler barrier: makes the compiler assume memory was read and
+ * changed, so repeated identical calls aren't merged
+ */
+static inline void bench_clobber(void) {
+    __asm__ volatile("" ::: "memory");
+}
+
+static uint64_t time_ops(bench_fn fn, void *arg, uint64_t ops) {
+    uint64_t start = timer_ticks();
+    fn(arg, ops);
+    return timer_ticks() - start;
+}
+
+static void sort_samples(uint64_t *values, int count) {
+    for (int i = 1; i < count; i++) {
+        uint64_t v = values[i];
+        int j = i - 1;
+        while (j >= 0 && values[j] > v) {
+            values[j + 1] = values[j];
+            j--;
+        }
+        values[j + 1] = v;
+    }
+}
+
+/*
+ * Time a benchmark
+ */
+void bench_measure(bench_fn fn, void *arg, int count, bench_result_t *result) {
+    uint64_t min_ticks = timer_freq() * BENCH_SAMPLE_US / 1000000;
+    uint64_t ops = 1;
+
+    if (count < 1 || count > BENCH_SAMPLES) {
+        count = BENCH_SAMPLES;
+    }
+
+    /*
+     * Double ops until one sample is long enough; this also warms up
+     * the caches and allocator before the real samples
+     */
+    while (ops < BENCH_MAX_OPS && time_ops(fn, arg, ops) < min_ticks) {
+        ops *= 2;
+    }
+
+    for (int i = 0; i < count; i++) {
+        samples[i] = time_ops(fn, arg, ops);
+    }
+    sort_samples(samples, count);
+
+    result->ops = ops;
+    result->min = timer_ticks_to_ns(samples[0] * 100) / ops;
+    result->median = timer_ticks_to_ns(samples[count / 2] * 100) / ops;
+    result->p99 = timer_ticks_to_ns(samples[(count * 99) / 100] * 100) / ops;
+}
+
+/*
+ * Print hundredths as a decimal with two places
+ */
+static void put_hundredths(uint64_t value) {
+    uart_put_dec(value / 100);
+    uart_putc('.');
+    uart_putc((char)('0' + (value / 10) % 10));
+    uart_putc((char)('0' + value % 10));
+}
+
+/*
+ * Print a result
+ */
+void bench_report(const char *suite, const char *name, uint64_t param,
+                  const bench_result_t *result) {
+    uart_puts("bench,");
+    uart_puts(suite);
+    uart_putc(',');
+    uart_puts(name);
+    uart_putc(',');
+    uart_put_dec(param);
+    uart_putc(',');
+    uart_put_dec(result->ops);
+    uart_putc(',');
+    put_hundredths(result->min);
+    uart_putc(',');
+    put_hundredths(result->median);
+    uart_putc(',');
+    put_hundredths(result->p99);
+    uart_putc('\n');
+}
+
+static void run_one(const char *suite, const char *name, uint64_t param,
+                    bench_fn fn, void *arg, int count) {
+    bench_result_t result;
+
+    bench_measure(fn, arg, count, &result);
+    bench_report(suite, name, param, &result);
+}
+
+/*
+ * Suite: mem
+ * malloc/free pairs across the slab size classes and the large path
+ */
+static const size_t mem_sizes[] = {
+    16, 64, 256, 1024, 2048, 8192
+};
+
+static void op_malloc_free(void *arg, uint64_t ops) {
+    size_t size = *(const size_t *)arg;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        void *p = malloc(size);
+        bench_clobber();
+        free(p);
+    }
+}
+
+static void suite_mem(void) {
+    for (size_t i = 0; i < sizeof(mem_sizes) / sizeof(mem_sizes[0]); i++) {
+        size_t size = mem_sizes[i];
+        run_one("mem", "malloc_free", size, op_malloc_free, &size, BENCH_SAMPLES);
+    }
+}
+
+/*
+ * Suite: string
+ * memcpy and strlen at the sizes strbench uses
+ */
+#define STRING_MAX_SIZE (64 * 1024)
+
+static const size_t string_sizes[] = {
+    16, 64, 256, 1024, 4096, 16384, 65536
+};
+
+typedef struct {
+    char *src;
+    char *dst;
+    size_t size;
+} string_args_t;
+
+static void op_memcpy(void *arg, uint64_t ops) {
+    string_args_t *a = arg;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        memcpy(a->dst, a->src, a->size);
+        bench_clobber();
+    }
+}
+
+static void op_strlen(void *arg, uint64_t ops) {
+    string_args_t *a = arg;
+    uint64_t total = 0;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        total += strlen(a->src);
+        bench_clobber();
+    }
+    bench_sink = total;
+}
+
+static void suite_string(void) {
+    string_args_t a;
+
+    a.src = malloc(STRING_MAX_SIZE + 1);
+    a.dst = malloc(STRING_MAX_SIZE + 1);
+    if (a.src == NULL || a.dst == NULL) {
+        uart_puts("# bench: out of memory for string buffers\n");
+        free(a.src);
+        free(a.dst);
+        return;
+    }
+    memset(a.src, 'a', STRING_MAX_SIZE + 1);
+
+    for (size_t i = 0; i < sizeof(string_sizes) / sizeof(string_sizes[0]); i++) {
+        a.size = string_sizes[i];
+        run_one("string", "memcpy", a.size, op_memcpy, &a, BENCH_SAMPLES);
+    }
+
+    for (size_t i = 0; i < sizeof(string_sizes) / sizeof(string_sizes[0]); i++) {
+        a.size = string_sizes[i];
+        a.src[a.size] = '\0';
+        run_one("string", "strlen", a.size, op_strlen, &a, BENCH_SAMPLES);
+        a.src[a.size] = 'a';
+    }
+
+    free(a.src);
+    free(a.dst);
+}
+
+/*
+ * Suite: fs
+ * Write, read, failed lookups and listing the directory as bench.<n>
+ * files fill up the file system; param is the total number of files. Then 4KB writes and
+ * reads at offsets in a large file; param is its size. Then 64-byte
+ * appends through a handle to a log that starts empty and one that
+ * starts at the large size; param is the starting size, and the two
+ * should cost the same. Last, looking up a file at the end of a path
+ * of nested directories; param is the number of directories. It all
+ * happens in a scratch directory (see bench_scratch_enter).
+ */
+#define FS_NAME_LEN  16
+#define FS_FILE_SIZE 64
+#define FS_LARGE_SIZE (1024 * 1024)
+#define FS_LARGE_NAME "bench.large"
+#define FS_LOG_SLACK (64 * 1024)
+#define FS_DEPTH_MAX 8
+
+static const int fs_fills[] = { 1, 8, 16, MAX_FILES };
+static const int fs_depths[] = { 1, 2, 4, FS_DEPTH_MAX };
+
+typedef struct {
+    char names[MAX_FILES][FS_NAME_LEN];
+    char content[FS_FILE_SIZE + 1];
+    int count;
+} fs_args_t;
+
+static fs_args_t fs_args;
+static char fs_chunk[FS_BLOCK_SIZE];
+
+/*
+ * Name of the nth benchmark file
+ */
+void bench_file_name(char *buf, int n) {
+    char digits[12];
+    int len = 0;
+
+    strcpy(buf, "bench.");
+    buf += 6;
+    do {
+        digits[len++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n > 0);
+    while (len > 0) {
+        *buf++ = digits[--len];
+    }
+    *buf = '\0';
+}
+
+/*
+ * Scratch directory: /bench.tmp, or /bench.tmp<n> if that name is taken
+ */
+#define SCRATCH_TRIES 100
+
+static char scratch_dir[16];
+static char scratch_cwd[FS_PATH_MAX];
+
+int bench_scratch_enter(void) {
+    if (fs_getcwd(scratch_cwd, sizeof(scratch_cwd)) != 0) {
+        return -1;
+    }
+
+    fslog_pause();
+    for (int n = 0; n < SCRATCH_TRIES; n++) {
+        char *p = scratch_dir + 10;
+        strcpy(scratch_dir, "/bench.tmp");
+        if (n >= 10) {
+            *p++ = (char)('0' + n / 10);
+        }
+        if (n > 0) {
+            *p++ = (char)('0' + n % 10);
+        }
+        *p = '\0';
+
+        if (fs_mkdir(scratch_dir) == 0) {
+            if (fs_chdir(scratch_dir) == 0) {
+                return 0;
+            }
+            fs_rmdir(scratch_dir);
+            break;
+        }
+    }
+    fslog_resume();
+    return -1;
+}
+
+void bench_scratch_leave(void) {
+    fs_chdir(scratch_cwd);
+    fs_rmdir(scratch_dir);
+    fslog_resume();
+}
+
+static void op_fs_write(void *arg, uint64_t ops) {
+    fs_args_t *a = arg;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        fs_write_file(a->names[i % (uint64_t)a->count], a->content);
+    }
+}
+
+static void op_fs_read(void *arg, uint64_t ops) {
+    fs_args_t *a = arg;
+    char buf[FS_FILE_SIZE];
+    uint64_t total = 0;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        total += (uint64_t)fs_read_at(a->names[i % (uint64_t)a->count], 0, buf, sizeof(buf));
+    }
+    bench_sink = total;
+}
+
+static void op_fs_lookup_miss(void *arg, uint64_t ops) {
+    (void)arg;
+    uint64_t found = 0;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        found += (uint64_t)fs_file_exists("bench.missing");
+    }
+    bench_sink = found;
+}
+
+static uint64_t fs_listed;
+
+static void count_listed(const char *name, size_t size, int is_dir) {
+    (void)name;
+    (void)size;
+    (void)is_dir;
+    fs_listed++;
+}
+
+static void op_fs_list(void *arg, uint64_t ops) {
+    (void)arg;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        fs_list_files(count_listed);
+    }
+    bench_sink = fs_listed;
+}
+
+static void op_fs_write_at(void *arg, uint64_t ops) {
+    (void)arg;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        size_t offset = (i % (FS_LARGE_SIZE / FS_BLOCK_SIZE)) * FS_BLOCK_SIZE;
+        fs_write_at(FS_LARGE_NAME, offset, fs_chunk, sizeof(fs_chunk));
+    }
+}
+
+static void op_fs_read_at(void *arg, uint64_t ops) {
+    (void)arg;
+    uint64_t total = 0;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        size_t offset = (i % (FS_LARGE_SIZE / FS_BLOCK_SIZE)) * FS_BLOCK_SIZE;
+        total += (uint64_t)fs_read_at(FS_LARGE_NAME, offset, fs_chunk, sizeof(fs_chunk));
+    }
+    bench_sink = total;
+}
+
+typedef struct {
+    int fd;
+    size_t base;
+} fs_log_t;
+
+static void op_fs_append(void *arg, uint64_t ops) {
+    fs_log_t *log = arg;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        fs_append(log->fd, fs_args.content, FS_FILE_SIZE);
+        if ((size_t)fs_fsize(log->fd) >= log->base + FS_LOG_SLACK) {
+            fs_truncate(FS_LARGE_NAME, log->base);   // Keep memory bounded
+        }
+    }
+}
+
+static void op_fs_lookup_path(void *arg, uint64_t ops) {
+    const char *path = arg;
+    uint64_t found = 0;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        found += (uint64_t)fs_file_exists(path);
+    }
+    bench_sink = found;
+}
+
+/*
+ * Nested directories bench.d/d/d/..., with a file f at some depths
+ */
+static void fs_bench_paths(void) {
+    static char path[FS_DEPTH_MAX * 2 + 16];
+    size_t len = 0;
+    int depth = 0;
+    int made = 0;
+
+    for (depth = 1; depth <= FS_DEPTH_MAX; depth++) {
+        strcpy(path + len, depth == 1 ? "bench.d" : "/d");
+        len += (depth == 1) ? 7 : 2;
+        if (fs_mkdir(path) != 0) {
+            break;
+        }
+        made = depth;
+
+        for (size_t i = 0; i < sizeof(fs_depths) / sizeof(fs_depths[0]); i++) {
+            if (fs_depths[i] != depth) {
+                continue;
+            }
+            strcpy(path + len, "/f");
+            if (fs_write_file(path, "x") == 0) {
+                run_one("fs", "lookup_path", (uint64_t)depth, op_fs_lookup_path, path,
+                        BENCH_SAMPLES);
+                fs_delete_file(path);
+            }
+            path[len] = '\0';
+        }
+    }
+
+    /*
+     * Remove the directories, deepest first
+     */
+    for (; made > 0; made--) {
+        len = 7 + (size_t)(made - 1) * 2;
+        path[len] = '\0';
+        fs_rmdir(path);
+    }
+}
+
+static void fs_bench_run(void) {
+    fs_args_t *a = &fs_args;
+    int room = MAX_FILES - fs_get_file_count();
+    int last = 0;
+
+    memset(a->content, 'x', FS_FILE_SIZE);
+    a->content[FS_FILE_SIZE] = '\0';
+
+    for (size_t i = 0; i < sizeof(fs_fills) / sizeof(fs_fills[0]); i++) {
+        int fill = fs_fills[i] < room ? fs_fills[i] : room;
+        if (fill <= last) {
+            continue;  // Already measured at this fill level
+        }
+
+        /*
+         * Top up to this many files
+         */
+        for (a->count = last; a->count < fill; a->count++) {
+            bench_file_name(a->names[a->count], a->count);
+            if (fs_write_file(a->names[a->count], a->content) != 0) {
+                break;
+            }
+        }
+        last = a->count;
+        if (a->count == 0) {
+            break;
+        }
+
+        uint64_t files = (uint64_t)fs_get_file_count();
+        run_one("fs", "write", files, op_fs_write, a, BENCH_SAMPLES);
+        run_one("fs", "read", files, op_fs_read, a, BENCH_SAMPLES);
+        run_one("fs", "lookup_miss", files, op_fs_lookup_miss, a, BENCH_SAMPLES);
+        run_one("fs", "list", files, op_fs_list, NULL, BENCH_SAMPLES);
+    }
+
+    for (int i = 0; i < last; i++) {
+        fs_delete_file(a->names[i]);
+    }
+
+    memset(fs_chunk, 'x', sizeof(fs_chunk));
+    for (size_t offset = 0; offset < FS_LARGE_SIZE; offset += FS_BLOCK_SIZE) {
+        if (fs_write_at(FS_LARGE_NAME, offset, fs_chunk, sizeof(fs_chunk)) != 0) {
+            fs_delete_file(FS_LARGE_NAME);
+            return;  // Out of memory or no free slot
+        }
+    }
+    run_one("fs", "write_at_4k", FS_LARGE_SIZE, op_fs_write_at, NULL, BENCH_SAMPLES);
+    run_one("fs", "read_at_4k", FS_LARGE_SIZE, op_fs_read_at, NULL, BENCH_SAMPLES);
+
+    fs_log_t log;
+    log.fd = fs_open(FS_LARGE_NAME, 0);
+    if (log.fd >= 0) {
+        log.base = FS_LARGE_SIZE;
+        run_one("fs", "append_64", log.base, op_fs_append, &log, BENCH_SAMPLES);
+        fs_truncate(FS_LARGE_NAME, 0);
+        log.base = 0;
+        run_one("fs", "append_64", log.base, op_fs_append, &log, BENCH_SAMPLES);
+        fs_close(log.fd);
+    }
+    fs_delete_file(FS_LARGE_NAME);
+
+    fs_bench_paths();
+}
+
+static void suite_fs(void) {
+    if (bench_scratch_enter() != 0) {
+        return;  // No room for the directory
+    }
+    fs_bench_run();
+    bench_scratch_leave();
+}
+
+/*
+ * Suite: disk
+ * Buffer cache reads that hit, sequential reads that miss (so read-ahead
+ * is working), scattered reads that miss (so it isn't), and writing
+ * back a batch of dirty blocks. Only runs with a disk attached. The
+ * write-back rewrites blocks with what they already hold, so the disk
+ * contents survive.
+ */
+#define DISK_SPAN  (4 * BCACHE_BUFFERS)   // Blocks read, more than fit
+#define DISK_BATCH 16                     // Blocks per write-back
+
+static uint64_t disk_next;
+static char disk_buf[64];
+
+static void op_disk_read_hit(void *arg, uint64_t ops) {
+    (void)arg;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        bcache_read(0, 0, disk_buf, sizeof(disk_buf));
+    }
+}
+
+/*
+ * Reads walk the span with this stride: 1 is sequential, a large
+ * prime jumps around
+ */
+static void op_disk_read_stride(void *arg, uint64_t ops) {
+    uint64_t stride = *(const uint64_t *)arg;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        disk_next = (disk_next + stride) % DISK_SPAN;
+        bcache_read(disk_next, 0, disk_buf, sizeof(disk_buf));
+    }
+}
+
+static void op_disk_sync(void *arg, uint64_t ops) {
+    (void)arg;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        for (uint64_t block = 0; block < DISK_BATCH; block++) {
+            bcache_buf_t *b = bcache_get(block);
+            if (b != NULL) {
+                bcache_mark_dirty(b);
+                bcache_put(b);
+            }
+        }
+        bcache_sync();
+    }
+}
+
+static void suite_disk(void) {
+    if (!virtio_blk_ready() || bcache_blocks() < DISK_SPAN) {
+        return;
+    }
+
+    uint64_t sequential = 1;
+    uint64_t scattered = 97;
+
+    run_one("disk", "read_hit", 1, op_disk_read_hit, NULL, BENCH_DISK_SAMPLES);
+    run_one("disk", "read_seq", BCACHE_READAHEAD, op_disk_read_stride, &sequential,
+            BENCH_DISK_SAMPLES);
+    run_one("disk", "read_scattered", 0, op_disk_read_stride, &scattered,
+            BENCH_DISK_SAMPLES);
+    run_one("disk", "sync", DISK_BATCH, op_disk_sync, NULL, BENCH_DISK_SAMPLES);
+}
+
+/*
+ * Suite: uart
+ * uart_puts of a 64-byte line, including draining it to the UART, so
+ * this is the real console throughput. The lines it prints never start
+ * with "bench," so they don't mix with the results.
+ */
+static const char uart_line[] =
+    "uart 0123456789abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTU\n";
+
+static void op_uart_puts(void *arg, uint64_t ops) {
+    (void)arg;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        uart_puts(uart_line);
+    }
+    uart_flush();
+}
+
+static void suite_uart(void) {
+    uart_flush();
+    run_one("uart", "puts", sizeof(uart_line) - 1, op_uart_puts, NULL,
+            BENCH_UART_SAMPLES);
+}
+
+/*
+ * Suite: sched
+ * Switching between two threads on one core (one thread_yield each
+ * way is one operation), and a thread's whole life: created on this
+ * core, switched to, exits, freed
+ */
+static volatile int sched_partner_stop;
+static volatile uint64_t sched_exited;
+
+static void sched_partner(void *arg) {
+    (void)arg;
+
+    while (!sched_partner_stop) {
+        thread_yield();
+    }
+    sched_exited++;
+}
+
+static void sched_empty(void *arg) {
+    (void)arg;
+    sched_exited++;
+}
+
+static void op_yield(void *arg, uint64_t ops) {
+    (void)arg;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        thread_yield();
+    }
+}
+
+static void op_create_exit(void *arg, uint64_t ops) {
+    (void)arg;
+    int cpu = smp_cpu_id();
+
+    for (uint64_t i = 0; i < ops; i++) {
+        uint64_t target = sched_exited + 1;
+        if (thread_create("bench", sched_empty, NULL, cpu) < 0) {
+            return;
+        }
+        while (sched_exited != target) {
+            thread_yield();
+        }
+    }
+}
+
+static void suite_sched(void) {
+    thread_t *self = thread_current();
+
+    if (self == NULL || self->pinned == THREAD_ANY_CPU) {
+        return;  // Both need to stay on one core
+    }
+
+    sched_partner_stop = 0;
+    uint64_t target = sched_exited + 1;
+    if (thread_create("bench", sched_partner, NULL, self->pinned) >= 0) {
+        run_one("sched", "yield", 2, op_yield, NULL, BENCH_SAMPLES);
+
+        sched_partner_stop = 1;
+        while (sched_exited != target) {
+            thread_yield();
+        }
+    }
+
+    run_one("sched", "create_exit", 1, op_create_exit, NULL, BENCH_SAMPLES);
+}
+
+/*
+ * Suite: sync
+ * The uncontended cost of the synchronization primitives: a ticket
+ * lock taken and released, a seqlock read of two words, and a push and
+ * pop through the lock-free ring (lockstress measures them contended)
+ */
+static spinlock_t sync_lock = SPINLOCK_INIT;
+static seqlock_t sync_seq = SEQLOCK_INIT;
+static mpmc_slot_t sync_slots[16];
+static mpmc_ring_t sync_ring;
+static uint64_t sync_data[2];
+
+static void op_spin_lock(void *arg, uint64_t ops) {
+    (void)arg;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        spin_lock(&sync_lock);
+        bench_clobber();
+        spin_unlock(&sync_lock);
+    }
+}
+
+static void op_seq_read(void *arg, uint64_t ops) {
+    (void)arg;
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        uint32_t seq;
+        do {
+            seq = seq_read_begin(&sync_seq);
+            sum += sync_data[0] + sync_data[1];
+        } while (seq_read_retry(&sync_seq, seq));
+    }
+    bench_sink = sum;
+}
+
+static void op_ring(void *arg, uint64_t ops) {
+    void *item;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        mpmc_push(&sync_ring, arg);
+        mpmc_pop(&sync_ring, &item);
+    }
+    bench_sink = (uint64_t)(uintptr_t)item;
+}
+
+static void suite_sync(void) {
+    mpmc_init(&sync_ring, sync_slots, sizeof(sync_slots) / sizeof(sync_slots[0]));
+
+    run_one("sync", "spin_lock", 1, op_spin_lock, NULL, BENCH_SAMPLES);
+    run_one("sync", "seq_read", 1, op_seq_read, NULL, BENCH_SAMPLES);
+    run_one("sync", "ring_push_pop", 1, op_ring, sync_data, BENCH_SAMPLES);
+}
+
+/*
+ * Suite table
+ */
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} bench_suite_t;
+
+static const bench_suite_t suites[] = {
+    { "mem",    suite_mem },
+    { "string", suite_string },
+    { "fs",     suite_fs },
+    { "disk",   suite_disk },
+    { "uart",   suite_uart },
+    { "sched",  suite_sched },
+    { "sync",   suite_sync },
+};
+
+#define NUM_SUITES (sizeof(suites) / sizeof(suites[0]))
+
+/*
+ * Run one or every suite
+ */
+int bench_run(const char *suite) {
+    const bench_suite_t *only = NULL;
+
+    if (suite != NULL) {
+        for (size_t i = 0; i < NUM_SUITES; i++) {
+            if (strcmp(suites[i].name, suite) == 0) {
+                only = &suites[i];
+            }
+        }
+        if (only == NULL) {
+            return -1;
+        }
+    }
+
+    uart_puts("# bench: ");
+    uart_put_dec((uint64_t)smp_num_cpus());
+    uart_puts(" cpus, counter ");
+    uart_put_dec(timer_freq());
+    uart_puts(" Hz, ");
+    uart_put_dec(BENCH_SAMPLES);
+    uart_puts(" samples\n");
+    uart_puts("bench,suite,name,param,ops,min_ns,median_ns,p99_ns\n");
+
+    for (size_t i = 0; i < NUM_SUITES; i++) {
+        if (only == NULL || only == &suites[i]) {
+            suites[i].run();
+        }
+    }
+
+    uart_puts("# bench: done\n");
+    return 0;
+}
+
+void bench_list(void) {
+    for (size_t i = 0; i < NUM_SUITES; i++) {
+        uart_puts(i == 0 ? "" : " ");
+        uart_puts(suites[i].name);
+    }
+    uart_putc('\n');
+}
+
+/*
+ * Command: bench
+ * Run the benchmark suite, or one suite of it
+ */
+static void cmd_bench(int argc, char **argv) {
+    const char *suite = argc >= 2 ? argv[1] : NULL;
+
+    if (bench_run(suite) != 0) {
+        uart_puts("Unknown suite: ");
+        uart_puts(suite);
+        uart_puts("\nSuites: ");
+        bench_list();
+    }
+}
+SHELL_COMMAND(bench, cmd_bench, "[suite]", "Run the benchmark suite (CSV output)", SHELL_CMD_FILES);
@@ -0,0 +1,98 @@
+/*
+ * Benchmark Suite Header
+ *
+ * Repeatable microbenchmarks for the allocator, the file system, the
+ * string functions, the UART, the scheduler and the locks, run with
+ * the `bench` shell command.
+ *
+ * Each benchmark is timed as a number of samples. A sample runs the
+ * operation enough times to take at least BENCH_SAMPLE_US, so timer
+ * resolution doesn't matter, and records the time per operation. The
+ * samples are sorted and reported as min, median and 99th percentile,
+ * one CSV line per benchmark:
+ *
+ *   bench,<suite>,<name>,<param>,<ops>,<min_ns>,<median_ns>,<p99_ns>
+ *
+ * where param is the size or fill level being measured and ops is the
+ * number of operations per sample. `make bench` collects these lines.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+/*
+ * Samples per benchmark (101 makes the median and p99 exact entries)
+ */
+#define BENCH_SAMPLES 101
+
+/*
+ * Minimum length of one sample, in microseconds
+ */
+#define BENCH_SAMPLE_US 200
+
+/*
+ * Operation being measured: run it ops times
+ */
+typedef void (*bench_fn)(void *arg, uint64_t ops);
+
+/*
+ * Result of one benchmark
+ * Times are per operation, in hundredths of a nanosecond
+ */
+typedef struct {
+    uint64_t ops;               // Operations per sample
+    uint64_t min;
+    uint64_t median;
+    uint64_t p99;
+} bench_result_t;
+
+/*
+ * Time fn(arg, ops) over the given number of samples
+ * (at most BENCH_SAMPLES), picking ops so a sample is long enough
+ */
+void bench_measure(bench_fn fn, void *arg, int samples, bench_result_t *result);
+
+/*
+ * Print a result as a CSV line
+ */
+void bench_report(const char *suite, const char *name, uint64_t param,
+                  const bench_result_t *result);
+
+/*
+ * Run one suite by name, or every suite if suite is NULL
+ * Returns 0 on success, -1 if there is no such suite
+ */
+int bench_run(const char *suite);
+
+/*
+ * Print the names of the suites
+ */
+void bench_list(void);
+
+/*
+ * Name of the nth benchmark file ("bench.<n>"), shared with fsbench
+ * buf must hold 16 bytes (n below 10^9)
+ */
+void bench_file_name(char *buf, int n);
+
+/*
+ * Scratch directory for the file benchmarks (bench fs, fsbench and
+ * fsscale)
+ * They create and delete files by fixed names, so they run in a
+ * directory made fresh for them and never overwrite or delete a user's
+ * file of the same name. Callers hold the shell's files lock, so there
+ * is only ever one. Logging is paused meanwhile (see fslog_pause): the
+ * scratch files never reach the disk, and the timings are of memfs
+ * alone whether or not a disk is attached.
+ *
+ * bench_scratch_enter makes it and changes into it; returns 0 on
+ * success, -1 if it couldn't (nothing is changed then).
+ * bench_scratch_leave changes back and removes it, once the benchmark
+ * has deleted its files.
+ */
+int bench_scratch_enter(void);
+void bench_scratch_leave(void);
+
+#endif // BENCH_H
@@ -0,0 +1,141 @@
+/*
+ * Flattened Device Tree (FDT) Implementation
+ *
+ * A device tree blob has a header, a "structure block" of tokens that
+ * describe nodes and their properties, and a "strings block" holding
+ * property names. All numbers are big-endian.
+ *
+ * This may run before the MMU is on, when unaligned loads fault, so
+ * every value is read one byte at a time.
+ */
+
+#include "fdt.h"
+#include "string.h"
+
+/*
+ * Header magic number
+ */
+#define FDT_MAGIC 0xD00DFEED
+
+/*
+ * Header field offsets
+ */
+#define FDT_OFF_MAGIC       0
+#define FDT_OFF_TOTALSIZE   4
+#define FDT_OFF_DT_STRUCT   8
+#define FDT_OFF_DT_STRINGS  12
+
+/*
+ * Structure block tokens
+ */
+#define FDT_BEGIN_NODE  1
+#define FDT_END_NODE    2
+#define FDT_PROP        3
+#define FDT_NOP         4
+#define FDT_END         9
+
+/*
+ * Read a big-endian 32-bit value
+ */
+static uint32_t read_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+/*
+ * Read a big-endian value made of 1 or 2 32-bit cells
+ */
+static uint64_t read_cells(const uint8_t *p, uint32_t cells) {
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < cells; i++) {
+        value = (value << 32) | read_be32(p + i * 4);
+    }
+    return value;
+}
+
+/*
+ * Round an offset up to the next 4-byte boundary
+ */
+static uint32_t align4(uint32_t offset) {
+    return (offset + 3) & ~3U;
+}
+
+/*
+ * Check for a valid blob
+ */
+int fdt_valid(const void *fdt) {
+    if (fdt == NULL || ((uintptr_t)fdt & 3) != 0) {
+        return 0;
+    }
+    return read_be32((const uint8_t *)fdt + FDT_OFF_MAGIC) == FDT_MAGIC;
+}
+
+/*
+ * Get the blob size
+ */
+size_t fdt_size(const void *fdt) {
+    return read_be32((const uint8_t *)fdt + FDT_OFF_TOTALSIZE);
+}
+
+/*
+ * Find the first RAM range
+ *
+ * Walks the structure block looking for a top-level node whose name
+ * is "memory" or starts with "memory@", and decodes its "reg" property
+ * using the root node's #address-cells and #size-cells.
+ */
+int fdt_get_memory(const void *fdt, uint64_t *base, uint64_t *size) {
+    if (!fdt_valid(fdt)) {
+        return -1;
+    }
+
+    const uint8_t *blob = (const uint8_t *)fdt;
+    const uint8_t *structs = blob + read_be32(blob + FDT_OFF_DT_STRUCT);
+    const char *strings = (const char *)blob + read_be32(blob + FDT_OFF_DT_STRINGS);
+    uint32_t total = read_be32(blob + FDT_OFF_TOTALSIZE);
+
+    uint32_t address_cells = 2;  // Defaults from the device tree spec
+    uint32_t size_cells = 1;
+    int depth = 0;
+    int in_memory = 0;
+    uint32_t offset = 0;
+
+    while ((size_t)(structs - blob) + offset < total) {
+        uint32_t token = read_be32(structs + offset);
+        offset += 4;
+
+        if (token == FDT_BEGIN_NODE) {
+            const char *name = (const char *)structs + offset;
+            depth++;
+            in_memory = (depth == 2) &&
+                        (strcmp(name, "memory") == 0 || strncmp(name, "memory@", 7) == 0);
+            offset = align4(offset + (uint32_t)strlen(name) + 1);
+        } else if (token == FDT_END_NODE) {
+            depth--;
+            in_memory = 0;
+        } else if (token == FDT_PROP) {
+            uint32_t len = read_be32(structs + offset);
+            const char *prop = strings + read_be32(structs + offset + 4);
+            const uint8_t *value = structs + offset + 8;
+
+            if (depth == 1 && strcmp(prop, "#address-cells") == 0) {
+                address_cells = read_be32(value);
+            } else if (depth == 1 && strcmp(prop, "#size-cells") == 0) {
+                size_cells = read_be32(value);
+            } else if (in_memory && strcmp(prop, "reg") == 0 &&
+                       len >= (address_cells + size_cells) * 4) {
+                *base = read_cells(value, address_cells);
+                *size = read_cells(value + address_cells * 4, size_cells);
+                return 0;
+            }
+
+            offset = align4(offset + 8 + len);
+        } else if (token == FDT_NOP) {
+            continue;
+        } else {
+            break;  // FDT_END or garbage
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,32 @@
+/*
+ * Flattened Device Tree (FDT) Header
+ *
+ * QEMU describes the machine (RAM size, devices, ...) in a device tree
+ * blob and passes its address to the kernel in register x0. We only
+ * read a few facts out of it, so this is a minimal read-only parser.
+ */
+
+#ifndef FDT_H
+#define FDT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Check whether ptr points to a valid device tree blob
+ * Returns 1 if valid, 0 otherwise
+ */
+int fdt_valid(const void *fdt);
+
+/*
+ * Get the total size of the blob in bytes
+ */
+size_t fdt_size(const void *fdt);
+
+/*
+ * Find the first RAM range from the /memory node
+ * Returns 0 on success, -1 if not found
+ */
+int fdt_get_memory(const void *fdt, uint64_t *base, uint64_t *size);
+
+#endif // FDT_H
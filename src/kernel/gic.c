@@ -0,0 +1,135 @@
+/*
+ * Generic Interrupt Controller (GICv2) Implementation
+ *
+ * Every interrupt gets the same priority and SPIs all go to core 0, so
+ * there is no nesting and no balancing; this is the simplest setup that
+ * lets devices and other cores interrupt us.
+ */
+
+#include "gic.h"
+
+/*
+ * Distributor registers
+ */
+#define GICD_CTLR       (*(volatile uint32_t *)(GIC_DIST_BASE + 0x000))
+#define GICD_TYPER      (*(volatile uint32_t *)(GIC_DIST_BASE + 0x004))
+#define GICD_ISENABLER  ((volatile uint32_t *)(GIC_DIST_BASE + 0x100))
+#define GICD_ICENABLER  ((volatile uint32_t *)(GIC_DIST_BASE + 0x180))
+#define GICD_ICPENDR    ((volatile uint32_t *)(GIC_DIST_BASE + 0x280))
+#define GICD_IPRIORITYR ((volatile uint8_t *)(GIC_DIST_BASE + 0x400))
+#define GICD_ITARGETSR  ((volatile uint8_t *)(GIC_DIST_BASE + 0x800))
+#define GICD_SGIR       (*(volatile uint32_t *)(GIC_DIST_BASE + 0xF00))
+#define GICD_PIDR2      (*(volatile uint32_t *)(GIC_DIST_BASE + 0xFE8))
+
+/*
+ * CPU interface registers
+ */
+#define GICC_CTLR       (*(volatile uint32_t *)(GIC_CPU_BASE + 0x000))
+#define GICC_PMR        (*(volatile uint32_t *)(GIC_CPU_BASE + 0x004))
+#define GICC_IAR        (*(volatile uint32_t *)(GIC_CPU_BASE + 0x00C))
+#define GICC_EOIR       (*(volatile uint32_t *)(GIC_CPU_BASE + 0x010))
+
+/*
+ * Priority given to every interrupt, and the mask that lets them through
+ * (lower value = higher priority; an interrupt is signalled if its
+ * priority is below the mask)
+ */
+#define GIC_PRIORITY     0xA0
+#define GIC_PRIORITY_MASK 0xF0
+
+static int gic_initialized = 0;
+static unsigned int gic_num_irqs = 0;
+
+/*
+ * Initialize the calling core's CPU interface and its banked
+ * SGI/PPI registers
+ */
+void gic_cpu_init(void) {
+    for (int irq = 0; irq < GIC_SPI_BASE; irq++) {
+        GICD_IPRIORITYR[irq] = GIC_PRIORITY;
+    }
+    GICD_ISENABLER[0] = 0xFFFF;          // SGIs; PPIs are enabled on demand
+
+    GICC_PMR = GIC_PRIORITY_MASK;
+    GICC_CTLR = 1;                        // Signal interrupts to this core
+}
+
+/*
+ * Initialize the distributor
+ */
+int gic_init(void) {
+    /*
+     * ArchRev 1 or 2 is a GICv2; a GICv3 distributor is programmed
+     * differently and has no memory-mapped CPU interface
+     */
+    uint32_t arch = (GICD_PIDR2 >> 4) & 0xF;
+    if (arch != 1 && arch != 2) {
+        return -1;
+    }
+
+    GICD_CTLR = 0;
+
+    gic_num_irqs = ((GICD_TYPER & 0x1F) + 1) * 32;
+    if (gic_num_irqs > GIC_MAX_IRQ) {
+        gic_num_irqs = GIC_MAX_IRQ;
+    }
+
+    /*
+     * Start with every shared interrupt disabled, not pending,
+     * routed to core 0
+     */
+    for (unsigned int irq = GIC_SPI_BASE; irq < gic_num_irqs; irq += 32) {
+        GICD_ICENABLER[irq / 32] = 0xFFFFFFFF;
+        GICD_ICPENDR[irq / 32] = 0xFFFFFFFF;
+    }
+    for (unsigned int irq = GIC_SPI_BASE; irq < gic_num_irqs; irq++) {
+        GICD_IPRIORITYR[irq] = GIC_PRIORITY;
+        GICD_ITARGETSR[irq] = 1 << 0;
+    }
+
+    GICD_CTLR = 1;
+
+    gic_cpu_init();
+    gic_initialized = 1;
+    return 0;
+}
+
+int gic_ready(void) {
+    return gic_initialized;
+}
+
+/*
+ * Enable or disable an interrupt
+ */
+void gic_enable_irq(unsigned int irq) {
+    if (irq < GIC_MAX_IRQ) {
+        GICD_ISENABLER[irq / 32] = 1U << (irq % 32);
+    }
+}
+
+void gic_disable_irq(unsigned int irq) {
+    if (irq < GIC_MAX_IRQ) {
+        GICD_ICENABLER[irq / 32] = 1U << (irq % 32);
+    }
+}
+
+/*
+ * Acknowledge and complete interrupts
+ */
+uint32_t gic_ack(void) {
+    return GICC_IAR;
+}
+
+void gic_eoi(uint32_t iar) {
+    GICC_EOIR = iar;
+}
+
+/*
+ * Send an SGI to one core
+ * The barrier makes our earlier memory writes visible to the target
+ * before it takes the interrupt.
+ */
+void gic_send_sgi(int cpu, unsigned int sgi) {
+    __asm__ volatile("dsb ish" ::: "memory");
+    GICD_SGIR = (1U << (16 + cpu)) | (sgi & 0xF);
+}
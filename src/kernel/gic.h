@@ -0,0 +1,84 @@
+/*
+ * Generic Interrupt Controller (GIC) Header
+ *
+ * The GIC collects interrupts from devices and other cores and signals
+ * them to the CPU cores. QEMU's virt machine provides a GICv2 by default:
+ *
+ *   Distributor (GICD) at 0x08000000 - shared; enables, prioritizes and
+ *                                      routes each interrupt
+ *   CPU interface (GICC) at 0x08010000 - banked per core; the core reads
+ *                                        it to acknowledge an interrupt
+ *
+ * Interrupt IDs:
+ *   0-15   SGIs (software generated, sent between cores)
+ *   16-31  PPIs (private to one core, e.g. its timer)
+ *   32+    SPIs (shared peripherals, e.g. the UART)
+ */
+
+#ifndef GIC_H
+#define GIC_H
+
+#include <stdint.h>
+
+/*
+ * Register windows on QEMU's virt machine
+ */
+#define GIC_DIST_BASE 0x08000000UL
+#define GIC_CPU_BASE  0x08010000UL
+
+/*
+ * Number of interrupt IDs we handle
+ */
+#define GIC_MAX_IRQ 256
+
+/*
+ * Interrupt IDs of the first PPI and SPI
+ */
+#define GIC_PPI_BASE 16
+#define GIC_SPI_BASE 32
+
+/*
+ * Returned by gic_ack when no interrupt is pending
+ */
+#define GIC_SPURIOUS 1023
+
+/*
+ * Initialize the distributor and the boot core's CPU interface
+ * Returns 0 on success, -1 if there is no GICv2 (e.g. -M virt,gic-version=3)
+ */
+int gic_init(void);
+
+/*
+ * Initialize the calling core's CPU interface (secondary cores)
+ */
+void gic_cpu_init(void);
+
+/*
+ * Check whether gic_init succeeded
+ */
+int gic_ready(void);
+
+/*
+ * Enable or disable an interrupt
+ * SPIs are routed to core 0
+ */
+void gic_enable_irq(unsigned int irq);
+void gic_disable_irq(unsigned int irq);
+
+/*
+ * Acknowledge the highest priority pending interrupt
+ * Returns the raw IAR value; the interrupt ID is its low 10 bits
+ */
+uint32_t gic_ack(void);
+
+/*
+ * Signal the end of handling for a value returned by gic_ack
+ */
+void gic_eoi(uint32_t iar);
+
+/*
+ * Send software generated interrupt sgi (0-15) to a core
+ */
+void gic_send_sgi(int cpu, unsigned int sgi);
+
+#endif // GIC_H
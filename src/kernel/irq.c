@@ -0,0 +1,137 @@
+/*
+ * Interrupt and Exception Handling Implementation
+ */
+
+#include "irq.h"
+#include "gic.h"
+#include "sched.h"
+#include "smp.h"
+#include "uart.h"
+
+/*
+ * vectors.S hard-codes the frame layout
+ */
+_Static_assert(sizeof(trap_frame_t) == TRAP_FRAME_SIZE, "trap frame size");
+_Static_assert(offsetof(trap_frame_t, q) == TRAP_FRAME_FP, "trap frame FP offset");
+
+/*
+ * Exception vector table (in vectors.S)
+ */
+extern char exception_vectors[];
+
+/*
+ * Registered handlers, indexed by interrupt ID
+ */
+static struct {
+    irq_handler_t handler;
+    void *arg;
+} irq_table[GIC_MAX_IRQ];
+
+/*
+ * Interrupts handled by each core
+ */
+static uint64_t irq_counts[MAX_CPUS];
+
+/*
+ * Names of the 16 vector table entries, for crash reports
+ */
+static const char *const exception_names[16] = {
+    "Sync (EL1t)", "IRQ (EL1t)", "FIQ (EL1t)", "SError (EL1t)",
+    "Sync (EL1h)", "IRQ (EL1h)", "FIQ (EL1h)", "SError (EL1h)",
+    "Sync (EL0 64-bit)", "IRQ (EL0 64-bit)", "FIQ (EL0 64-bit)", "SError (EL0 64-bit)",
+    "Sync (EL0 32-bit)", "IRQ (EL0 32-bit)", "FIQ (EL0 32-bit)", "SError (EL0 32-bit)"
+};
+
+/*
+ * Install the exception vectors on the calling core
+ */
+void irq_init(void) {
+    __asm__ volatile("msr vbar_el1, %0\n\tisb" :: "r"(exception_vectors) : "memory");
+}
+
+/*
+ * Attach a handler to an interrupt
+ */
+int irq_register(unsigned int irq, irq_handler_t handler, void *arg) {
+    if (irq >= GIC_MAX_IRQ || handler == NULL || irq_table[irq].handler != NULL) {
+        return -1;
+    }
+
+    irq_table[irq].arg = arg;
+    __atomic_store_n(&irq_table[irq].handler, handler, __ATOMIC_RELEASE);
+    gic_enable_irq(irq);
+    return 0;
+}
+
+uint64_t irq_count(int cpu) {
+    return irq_counts[cpu];
+}
+
+/*
+ * irq_handle - Called from vectors.S for every IRQ
+ *
+ * Runs with interrupts masked. Handles every pending interrupt before
+ * returning, so one exception entry can serve several devices, then
+ * switches threads if the tick said so: the interrupted thread's
+ * registers stay in the trap frame on its stack until it runs again.
+ */
+void irq_handle(trap_frame_t *frame) {
+    (void)frame;
+
+    while (1) {
+        uint32_t iar = gic_ack();
+        uint32_t irq = iar & 0x3FF;
+
+        if (irq >= GIC_SPURIOUS - 3) {
+            break;  // 1020-1023: nothing (more) pending
+        }
+
+        irq_handler_t handler = NULL;
+        if (irq < GIC_MAX_IRQ) {
+            handler = __atomic_load_n(&irq_table[irq].handler, __ATOMIC_ACQUIRE);
+        }
+        if (handler != NULL) {
+            handler(irq_table[irq].arg);
+        }
+
+        irq_counts[smp_cpu_id()]++;
+        gic_eoi(iar);
+    }
+
+    sched_preempt();
+}
+
+/*
+ * exception_handle - Called from vectors.S for anything but an IRQ
+ *
+ * We don't expect any of these: print what happened and stop this core.
+ */
+void exception_handle(trap_frame_t *frame, uint64_t type) {
+    uint64_t esr, far;
+    __asm__ volatile("mrs %0, esr_el1" : "=r"(esr));
+    __asm__ volatile("mrs %0, far_el1" : "=r"(far));
+
+    uart_panic_mode();
+
+    uart_puts("\n[PANIC] Unhandled exception on CPU ");
+    uart_put_dec((uint64_t)smp_cpu_id());
+    uart_puts(": ");
+    uart_puts(exception_names[type & 0xF]);
+    uart_puts("\n  ESR: ");
+    uart_put_hex(esr);
+    uart_puts("  (class ");
+    uart_put_hex(esr >> 26);
+    uart_puts(")\n  ELR: ");
+    uart_put_hex(frame->elr);
+    uart_puts("\n  FAR: ");
+    uart_put_hex(far);
+    uart_puts("\n  SP:  ");
+    uart_put_hex((uint64_t)frame + TRAP_FRAME_SIZE);
+    uart_puts("\n  LR:  ");
+    uart_put_hex(frame->x[30]);
+    uart_puts("\n");
+
+    while (1) {
+        __asm__ volatile("wfe");
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * Interrupt and Exception Handling Header
+ *
+ * The exception vector table (src/boot/vectors.S) saves the interrupted
+ * state into a trap_frame_t on the current stack and calls into C:
+ * irq_handle() for interrupts, exception_handle() for everything else.
+ * Drivers attach to an interrupt ID with irq_register().
+ *
+ * This header is also included from vectors.S, so everything that is
+ * not a plain #define must stay inside the __ASSEMBLER__ guard.
+ */
+
+#ifndef IRQ_H
+#define IRQ_H
+
+/*
+ * Size of a trap_frame_t, and the offset of its FP/SIMD area
+ */
+#define TRAP_FRAME_SIZE 800
+#define TRAP_FRAME_FP   288
+
+/*
+ * SGI used to wake a core sleeping in WFI (see smp.c)
+ */
+#define IRQ_SGI_WAKEUP 0
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Registers saved on exception entry
+ *
+ * The FP/SIMD registers are saved too: the compiler may use them in any
+ * C code, including interrupt handlers.
+ */
+typedef struct {
+    uint64_t x[31];                // x0-x30
+    uint64_t elr;                  // Address to return to
+    uint64_t spsr;                 // Saved processor state
+    uint64_t fpsr;                 // FP status and control
+    uint64_t fpcr;
+    uint64_t pad;
+    __uint128_t q[32];             // q0-q31
+} trap_frame_t;
+
+/*
+ * Interrupt handler type
+ */
+typedef void (*irq_handler_t)(void *arg);
+
+/*
+ * Install the exception vectors on the calling core
+ * Every core must call this before unmasking interrupts
+ */
+void irq_init(void);
+
+/*
+ * Attach a handler to an interrupt ID and enable it in the GIC
+ * Returns 0 on success, -1 if the ID is out of range or taken
+ */
+int irq_register(unsigned int irq, irq_handler_t handler, void *arg);
+
+/*
+ * Number of interrupts the calling core has handled
+ */
+uint64_t irq_count(int cpu);
+
+/*
+ * Unmask / mask interrupts on the calling core
+ */
+static inline void irq_enable(void) {
+    __asm__ volatile("msr daifclr, #2" ::: "memory");
+}
+
+static inline void irq_disable(void) {
+    __asm__ volatile("msr daifset, #2" ::: "memory");
+}
+
+/*
+ * Mask interrupts, returning the previous state for irq_restore
+ */
+static inline uint64_t irq_save(void) {
+    uint64_t flags;
+    __asm__ volatile("mrs %0, daif\n\tmsr daifset, #2" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+    __asm__ volatile("msr daif, %0" :: "r"(flags) : "memory");
+}
+
+#endif // __ASSEMBLER__
+
+#endif // IRQ_H
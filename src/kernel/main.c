@@ -12,70 +12,213 @@
 #include "memory.h"
 #include "string.h"
 #include "shell.h"
+#include "smp.h"
+#include "mmu.h"
+#include "fdt.h"
+#include "page_alloc.h"
+#include "sched.h"
+#include "gic.h"
+#include "irq.h"
+#include "timer.h"
+#include "virtio_blk.h"
+#include "bcache.h"
 #include "../filesystem/memfs.h"
+#include "../filesystem/fslog.h"
+
+/*
+ * RAM layout to assume when there is no device tree
+ * (QEMU virt defaults: 128MB at 0x40000000)
+ */
+#define DEFAULT_RAM_BASE 0x40000000UL
+#define DEFAULT_RAM_SIZE (128UL * 1024 * 1024)
+
+/*
+ * Buffers for the boot-time memcpy benchmark
+ */
+#define BENCH_BUF_SIZE   (32 * 1024)
+#define BENCH_ITERATIONS 16
+
+static char bench_src[BENCH_BUF_SIZE] __attribute__((aligned(16)));
+static char bench_dst[BENCH_BUF_SIZE] __attribute__((aligned(16)));
+
+/*
+ * Measure memcpy throughput in KB/s using the generic timer counter
+ */
+static uint64_t memcpy_throughput(void) {
+    uint64_t start = timer_ticks();
+
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        memcpy(bench_dst, bench_src, BENCH_BUF_SIZE);
+    }
+
+    uint64_t end = timer_ticks();
+    if (end == start) {
+        end = start + 1;
+    }
+
+    uint64_t bytes = (uint64_t)BENCH_BUF_SIZE * BENCH_ITERATIONS;
+    return bytes * timer_freq() / (end - start) / 1024;
+}
 
 /*
  * kernel_main - Main kernel entry point
  *
- * Called from boot.S after basic hardware initialization.
+ * Called from boot.S after basic hardware initialization, with the
+ * device tree address QEMU passed in x0 (may be 0 or invalid).
  * This function never returns.
  */
-void kernel_main(void) {
+void kernel_main(void *dtb) {
     /*
-     * Step 1: Initialize UART for console I/O
+     * Step 1: Initialize UART for console I/O, and the timer
      * We need this first so we can print status messages
      */
     uart_init();
+    timer_init();
 
     /*
      * Print welcome banner
      */
-    uart_puts("\n");
-    uart_puts("========================================\n");
-    uart_puts("          MyOS - ARM64 Edition         \n");
-    uart_puts("========================================\n");
-    uart_puts("\n");
+    static const char banner[] =
+        "\n"
+        "========================================\n"
+        "          MyOS - ARM64 Edition         \n"
+        "========================================\n"
+        "\n";
+    uart_write(banner, sizeof(banner) - 1);
 
     /*
-     * Step 2: Initialize memory allocator
+     * Find out how much RAM we have
+     * Read the device tree now, while it is still reachable with the
+     * MMU off; afterwards only mapped memory is.
+     */
+    uint64_t ram_base = DEFAULT_RAM_BASE;
+    uint64_t ram_size = DEFAULT_RAM_SIZE;
+    int have_dtb = fdt_get_memory(dtb, &ram_base, &ram_size) == 0;
+
+    /*
+     * Step 2: Enable the MMU and caches
+     * Measure memcpy before and after so the difference is visible
+     */
+    uint64_t uncached_kbs = memcpy_throughput();
+    uart_puts("[INIT] Enabling MMU and caches...\n");
+    mmu_init();
+    mmu_map_range(ram_base, ram_size, MMU_NORMAL);
+    uint64_t cached_kbs = memcpy_throughput();
+
+    uart_puts("[INIT] memcpy throughput: ");
+    uart_put_dec(uncached_kbs);
+    uart_puts(" KB/s (MMU off) -> ");
+    uart_put_dec(cached_kbs);
+    uart_puts(" KB/s (MMU on)\n");
+
+    /*
+     * Step 3: Initialize page and memory allocators
+     * The device tree blob stays reserved so nobody overwrites it
      */
     uart_puts("[INIT] Initializing memory allocator...\n");
+    if (!have_dtb) {
+        uart_puts("[INIT] No device tree found, assuming 128MB of RAM\n");
+    }
+    page_alloc_init(ram_base, ram_size,
+                    have_dtb ? (uint64_t)dtb : 0, have_dtb ? fdt_size(dtb) : 0);
     memory_init();
 
+    uart_puts("[INIT] RAM: ");
+    uart_put_dec(ram_size / (1024 * 1024));
+    uart_puts("MB at ");
+    uart_put_hex(ram_base);
+    uart_puts(", ");
+    uart_put_dec(page_free_count() * PAGE_SIZE / 1024);
+    uart_puts("KB free for allocation\n");
+
     /*
-     * Step 3: Initialize file system
+     * Step 4: Start the scheduler
+     * This flow of control becomes the main thread, which runs the
+     * shell; other threads start running once interrupts are on or
+     * this one waits
+     */
+    uart_puts("[INIT] Starting the scheduler...\n");
+    sched_init();
+
+    /*
+     * Step 5: Initialize file system
      */
     uart_puts("[INIT] Initializing file system...\n");
     fs_init();
 
     /*
-     * Step 4: Create some sample files for demonstration
+     * Step 6: Set up interrupts
+     * From here on the UART is interrupt driven and waiting for input
+     * sleeps instead of spinning
      */
-    uart_puts("[INIT] Creating sample files...\n");
-    uart_puts("[DEBUG] About to create files...\n");
+    uart_puts("[INIT] Enabling interrupts...\n");
+    irq_init();
+    if (gic_init() == 0 && uart_irq_init() == 0) {
+        timer_start_tick();
+        irq_enable();
+    } else {
+        uart_puts("[INIT] No GICv2 found, UART stays polled\n");
+    }
 
-    int result1 = fs_write_file("welcome.txt", "Welcome to MyOS! This is a sample file.");
-    uart_puts("[DEBUG] welcome.txt result: ");
-    uart_putc(result1 == 0 ? 'O' : 'F');
-    uart_putc('K');
-    uart_putc('\n');
+    /*
+     * Step 7: Attach the disk, if QEMU was given one (see run.sh), and
+     * load the file system from it
+     * After interrupts, so requests can complete by interrupt
+     */
+    if (virtio_blk_init() == 0 && bcache_init() == 0) {
+        uart_puts("[INIT] Disk: ");
+        uart_put_dec(virtio_blk_capacity() * VIRTIO_BLK_SECTOR_SIZE / (1024 * 1024));
+        uart_puts("MB (virtio-blk)\n");
 
-    int result2 = fs_write_file("readme.txt", "MyOS is an educational operating system written in ARM64 assembly and C.");
-    uart_puts("[DEBUG] readme.txt result: ");
-    uart_putc(result2 == 0 ? 'O' : 'F');
-    uart_putc('K');
-    uart_putc('\n');
+        int mounted = fslog_mount(timer_ticks());
+        if (mounted == 0) {
+            fslog_stats_t stats;
+            fslog_get_stats(&stats);
+            uart_puts("[INIT] File system loaded from disk (");
+            uart_put_dec(stats.replayed);
+            uart_puts(" records, ");
+            uart_put_dec(stats.replayed_tail);
+            uart_puts(" after the checkpoint)\n");
+        } else if (mounted == 1) {
+            uart_puts("[INIT] Disk formatted\n");
+        } else {
+            uart_puts("[INIT] Disk too small for a file system, files stay in memory\n");
+        }
+    } else {
+        uart_puts("[INIT] No disk attached\n");
+    }
 
-    int result3 = fs_write_file("about.txt", "Built for learning OS development concepts.");
-    uart_puts("[DEBUG] about.txt result: ");
-    uart_putc(result3 == 0 ? 'O' : 'F');
-    uart_putc('K');
+    /*
+     * Step 8: Bring up the secondary CPU cores
+     */
+    uart_puts("[INIT] Starting secondary cores...\n");
+    int cpus = smp_init();
+    uart_puts("[INIT] CPUs online: ");
+    uart_put_dec((uint64_t)cpus);
     uart_putc('\n');
 
-    uart_puts("[DEBUG] All files created.\n");
+    /*
+     * Step 9: Create some sample files for demonstration, unless the
+     * disk already brought files
+     */
+    if (fs_get_file_count() == 0) {
+        uart_puts("[INIT] Creating sample files...\n");
+
+        int failed = 0;
+        failed |= fs_write_file("welcome.txt", "Welcome to MyOS! This is a sample file.");
+        failed |= fs_write_file("readme.txt", "MyOS is an educational operating system written in ARM64 assembly and C.");
+        failed |= fs_write_file("about.txt", "Built for learning OS development concepts.");
+
+        if (failed) {
+            uart_puts("[INIT] Failed to create some sample files\n");
+        }
+        if (fslog_pending()) {
+            fslog_commit();
+        }
+    }
 
     /*
-     * Step 5: Print system information
+     * Step 10: Print system information
      */
     uart_puts("\n");
     uart_puts("[INFO] System ready!\n");
@@ -83,7 +226,7 @@ void kernel_main(void) {
     uart_puts("[INFO] Type 'ls' to see sample files.\n");
 
     /*
-     * Step 6: Start the interactive shell
+     * Step 11: Start the interactive shell
      * This function never returns
      */
     shell_run();
@@ -1,14 +1,37 @@
 /*
  * Memory Allocator Implementation
  *
- * This is a simple "bump allocator" - it just increments a pointer
- * for each allocation. It doesn't support freeing individual blocks.
+ * The heap is managed in two layers on top of the page allocator:
  *
- * For an educational OS, this is sufficient. A real OS would use
- * a more sophisticated allocator like a free-list or slab allocator.
+ * 1. A free-list allocator for large blocks. Every block starts with a
+ *    16-byte header holding its own size and the size of the block
+ *    before it, so free() can merge a block with both neighbours
+ *    ("coalescing") in O(1). Free blocks sit on a doubly linked list.
+ *    It starts with the .heap section from linker.ld and grows by
+ *    taking chunks from the page allocator; a chunk that becomes
+ *    completely free is given back.
+ *
+ * 2. Slab allocators for small objects (16 bytes to 2KB, in powers of
+ *    two). A slab is one 4KB page from the page allocator, cut into
+ *    equal-size objects. Free objects form a linked list inside the
+ *    page, so malloc and free are a pointer pop and push. The slab's
+ *    bookkeeping lives in the page's page_t, so free() finds it from
+ *    the address.
+ *
+ * Both layers are shared by all cores and protected by heap_lock. In
+ * front of the slabs, each core keeps a "magazine" per size class: a
+ * small stack of free objects only that core touches. malloc and free
+ * of small objects normally just pop or push the local magazine, with
+ * no lock and no atomic instruction. Only when a magazine runs empty
+ * (refill) or full (drain) do we move half a magazine's worth of
+ * objects to or from the slabs under heap_lock.
  */
 
 #include "memory.h"
+#include "page_alloc.h"
+#include "sched.h"
+#include "smp.h"
+#include "spinlock.h"
 #include "string.h"
 
 /*
@@ -18,72 +41,581 @@ extern char __heap_start;
 extern char __heap_end;
 
 /*
- * Current position in the heap
+ * Large block allocator constants
  */
-static char *heap_current = NULL;
-static size_t total_allocated = 0;
+#define ALIGNMENT         16
+#define BLOCK_HEADER_SIZE 16
+#define MIN_BLOCK_SIZE    32     // Header + room for the free-list links
+#define BLOCK_INUSE       1UL    // Low bit of block_t.size
 
 /*
- * Initialize the memory allocator
+ * Number of slab size classes: 16, 32, 64, ... 2048 bytes
  */
-void memory_init(void) {
-    heap_current = &__heap_start;
-    total_allocated = 0;
+#define NUM_SIZE_CLASSES  8
+#define MIN_SLAB_OBJECT   16
+
+/*
+ * Objects each per-CPU magazine can hold
+ */
+#define MAGAZINE_SIZE     32
+
+/*
+ * Smallest chunk the large allocator takes from the page allocator
+ * (2^4 pages = 64KB)
+ */
+#define HEAP_GROW_ORDER   4
+
+/*
+ * Large block header
+ * next_free/prev_free overlap the payload and are only valid while
+ * the block is on the free list.
+ */
+typedef struct block {
+    size_t prev_size;           // Size of the previous block (0 if first)
+    size_t size;                // Size including header; bit 0 = in use
+    struct block *next_free;
+    struct block *prev_free;
+} block_t;
+
+/*
+ * A slab is described by its page's page_t:
+ *   next/prev   - partial slab list links
+ *   private     - singly linked list of free objects
+ *   slab_class  - size class index
+ *   in_use      - objects handed out
+ *   capacity    - objects per page
+ */
+typedef page_t slab_t;
+
+/*
+ * Per-CPU magazine: a stack of free objects of one size class
+ */
+typedef struct {
+    uint32_t count;
+    void *objects[MAGAZINE_SIZE];
+} magazine_t;
+
+/*
+ * Per-CPU allocator state
+ * Only the owning core reads or writes its entry (statistics are read
+ * racily by memory_get_stats). The live counters can go negative on
+ * one core when memory is freed on a different core than allocated it.
+ */
+typedef struct {
+    magazine_t magazines[NUM_SIZE_CLASSES];
+    int64_t live_bytes;
+    int64_t live_allocations;
+} __attribute__((aligned(64))) cpu_cache_t;
+
+static cpu_cache_t cpu_caches[MAX_CPUS];
+
+/*
+ * Protects everything below (the shared pool)
+ */
+static spinlock_t heap_lock = SPINLOCK_INIT;
+
+/*
+ * Large block free list
+ */
+static block_t *free_list = NULL;
+
+/*
+ * Slab state
+ */
+static slab_t *partial_slabs[NUM_SIZE_CLASSES];
+
+/*
+ * Statistics
+ */
+static size_t free_bytes = 0;
+static size_t slab_bytes = 0;
+static size_t heap_bytes = 0;
+
+/*
+ * Block helpers
+ */
+static inline size_t block_size(block_t *b) {
+    return b->size & ~BLOCK_INUSE;
+}
+
+static inline block_t *next_block(block_t *b) {
+    return (block_t *)((char *)b + block_size(b));
+}
+
+static inline void *block_payload(block_t *b) {
+    return (char *)b + BLOCK_HEADER_SIZE;
+}
+
+static inline block_t *payload_block(void *ptr) {
+    return (block_t *)((char *)ptr - BLOCK_HEADER_SIZE);
 }
 
 /*
- * malloc - Allocate memory
- *
- * This is a bump allocator: we just move the heap pointer forward.
- * We don't support freeing individual allocations.
+ * Set a block's size and keep the next block's prev_size in sync
  */
-void *malloc(size_t size) {
-    if (size == 0) {
-        return NULL;
+static void set_block_size(block_t *b, size_t size, size_t flags) {
+    b->size = size | flags;
+    next_block(b)->prev_size = size;
+}
+
+/*
+ * Free list operations
+ */
+static void free_list_insert(block_t *b) {
+    b->prev_free = NULL;
+    b->next_free = free_list;
+    if (free_list != NULL) {
+        free_list->prev_free = b;
+    }
+    free_list = b;
+    free_bytes += block_size(b);
+}
+
+static void free_list_remove(block_t *b) {
+    if (b->prev_free != NULL) {
+        b->prev_free->next_free = b->next_free;
+    } else {
+        free_list = b->next_free;
+    }
+    if (b->next_free != NULL) {
+        b->next_free->prev_free = b->prev_free;
+    }
+    free_bytes -= block_size(b);
+}
+
+/*
+ * Split a block so it is exactly size bytes, returning the rest to the
+ * free list (only if the rest is big enough to be a block of its own)
+ */
+static void split_block(block_t *b, size_t size) {
+    size_t total = block_size(b);
+
+    if (total - size < MIN_BLOCK_SIZE) {
+        return;
+    }
+
+    block_t *rest = (block_t *)((char *)b + size);
+    b->size = size | (b->size & BLOCK_INUSE);
+    rest->prev_size = size;
+    set_block_size(rest, total - size, 0);
+    free_list_insert(rest);
+}
+
+/*
+ * Add a region of memory to the large block allocator
+ * The region ends with a zero-size in-use sentinel block so
+ * coalescing never runs past the end.
+ */
+static void heap_add_region(char *start, size_t len) {
+    char *aligned = (char *)(((uintptr_t)start + ALIGNMENT - 1) & ~(uintptr_t)(ALIGNMENT - 1));
+    len = (len - (size_t)(aligned - start)) & ~(size_t)(ALIGNMENT - 1);
+
+    if (len < MIN_BLOCK_SIZE + BLOCK_HEADER_SIZE) {
+        return;
+    }
+
+    block_t *b = (block_t *)aligned;
+    block_t *sentinel = (block_t *)(aligned + len - BLOCK_HEADER_SIZE);
+
+    b->prev_size = 0;
+    sentinel->size = BLOCK_INUSE;
+    set_block_size(b, len - BLOCK_HEADER_SIZE, 0);
+    free_list_insert(b);
+}
+
+/*
+ * Allocate a large block with at least size payload bytes (first fit)
+ */
+static block_t *large_alloc(size_t size) {
+    size_t need = ((size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1)) + BLOCK_HEADER_SIZE;
+    if (need < MIN_BLOCK_SIZE) {
+        need = MIN_BLOCK_SIZE;
+    }
+
+    for (block_t *b = free_list; b != NULL; b = b->next_free) {
+        if (block_size(b) >= need) {
+            free_list_remove(b);
+            b->size |= BLOCK_INUSE;
+            split_block(b, need);
+            return b;
+        }
+    }
+
+    return NULL;  // Out of memory
+}
+
+/*
+ * Grow the large allocator with a chunk from the page allocator big
+ * enough for a block of size payload bytes
+ * Returns 0 on success, -1 if out of memory
+ */
+static int heap_grow(size_t size) {
+    size_t need = size + MIN_BLOCK_SIZE + 2 * BLOCK_HEADER_SIZE;
+    int order = page_order_for(need);
+
+    if (order < HEAP_GROW_ORDER) {
+        order = HEAP_GROW_ORDER;
+    }
+
+    void *chunk = page_alloc(order);
+    if (chunk == NULL) {
+        return -1;
+    }
+
+    heap_bytes += (size_t)PAGE_SIZE << order;
+    heap_add_region(chunk, (size_t)PAGE_SIZE << order);
+    return 0;
+}
+
+/*
+ * Free a large block, merging it with free neighbours
+ */
+static void large_free(block_t *b) {
+    if (!(b->size & BLOCK_INUSE)) {
+        return;  // Double free - ignore
+    }
+
+    set_block_size(b, block_size(b), 0);
+
+    block_t *next = next_block(b);
+    if (!(next->size & BLOCK_INUSE)) {
+        free_list_remove(next);
+        set_block_size(b, block_size(b) + block_size(next), 0);
+    }
+
+    if (b->prev_size != 0) {
+        block_t *prev = (block_t *)((char *)b - b->prev_size);
+        if (!(prev->size & BLOCK_INUSE)) {
+            free_list_remove(prev);
+            set_block_size(prev, block_size(prev) + block_size(b), 0);
+            b = prev;
+        }
     }
 
     /*
-     * Align to 16 bytes for ARM64
-     * ARM64 requires 16-byte alignment for certain operations
+     * A chunk from the page allocator that is now one free block
+     * (first block, followed by the sentinel) goes back to it
      */
-    size = (size + 15) & ~15;
+    if (b->prev_size == 0 && next_block(b)->size == BLOCK_INUSE && page_of(b) != NULL) {
+        heap_bytes -= block_size(b) + BLOCK_HEADER_SIZE;
+        page_free(b);
+        return;
+    }
+
+    free_list_insert(b);
+}
+
+/*
+ * Map a small size to its size class
+ * Class n holds objects of 16 << n bytes
+ */
+static inline int size_class_of(size_t size) {
+    if (size <= MIN_SLAB_OBJECT) {
+        return 0;
+    }
+    return (int)(64 - __builtin_clzl(size - 1)) - 4;
+}
+
+static inline size_t class_size(int size_class) {
+    return (size_t)MIN_SLAB_OBJECT << size_class;
+}
+
+/*
+ * Find the slab bookkeeping for an address, or NULL if not a slab page
+ */
+static inline slab_t *slab_of(void *ptr) {
+    page_t *page = page_of(ptr);
+
+    if (page == NULL || !(page->flags & PAGE_SLAB)) {
+        return NULL;
+    }
+    return page;
+}
+
+/*
+ * Partial slab list operations
+ */
+static void slab_list_push(int size_class, slab_t *s) {
+    s->prev = NULL;
+    s->next = partial_slabs[size_class];
+    if (s->next != NULL) {
+        s->next->prev = s;
+    }
+    partial_slabs[size_class] = s;
+}
+
+static void slab_list_remove(int size_class, slab_t *s) {
+    if (s->prev != NULL) {
+        s->prev->next = s->next;
+    } else {
+        partial_slabs[size_class] = s->next;
+    }
+    if (s->next != NULL) {
+        s->next->prev = s->prev;
+    }
+    s->next = s->prev = NULL;
+}
+
+/*
+ * Create a new slab for a size class
+ */
+static slab_t *slab_create(int size_class) {
+    char *page = page_alloc(0);
+    if (page == NULL) {
+        return NULL;
+    }
+
+    slab_t *s = page_of(page);
+    size_t obj_size = class_size(size_class);
+
+    s->flags |= PAGE_SLAB;
+    s->slab_class = (uint16_t)size_class;
+    s->in_use = 0;
+    s->capacity = (uint16_t)(SLAB_PAGE_SIZE / obj_size);
 
     /*
-     * Check if we have enough space
+     * Thread the free list through the objects, lowest address first
      */
-    if (heap_current + size > &__heap_end) {
+    s->private = NULL;
+    for (int i = s->capacity - 1; i >= 0; i--) {
+        void **obj = (void **)(page + (size_t)i * obj_size);
+        *obj = s->private;
+        s->private = obj;
+    }
+
+    slab_list_push(size_class, s);
+    slab_bytes += SLAB_PAGE_SIZE;
+    return s;
+}
+
+/*
+ * Allocate an object from a size class
+ */
+static void *slab_alloc(int size_class) {
+    slab_t *s = partial_slabs[size_class];
+
+    if (s == NULL) {
+        s = slab_create(size_class);
+        if (s == NULL) {
+            return NULL;
+        }
+    }
+
+    void **obj = s->private;
+    s->private = *obj;
+    s->in_use++;
+
+    if (s->in_use == s->capacity) {
+        slab_list_remove(size_class, s);  // Full
+    }
+
+    return obj;
+}
+
+/*
+ * Return an object to its slab
+ * An empty slab goes back to the free-list allocator, unless it is
+ * the only partial slab left for its class.
+ */
+static void slab_free(slab_t *s, void *ptr) {
+    int size_class = s->slab_class;
+
+    *(void **)ptr = s->private;
+    s->private = ptr;
+
+    if (s->in_use == s->capacity) {
+        slab_list_push(size_class, s);  // Was full, now partial
+    }
+    s->in_use--;
+
+    if (s->in_use == 0 && (partial_slabs[size_class] != s || s->next != NULL)) {
+        slab_list_remove(size_class, s);
+        s->flags &= ~PAGE_SLAB;
+        page_free(page_address(s));
+        slab_bytes -= SLAB_PAGE_SIZE;
+    }
+}
+
+/*
+ * Refill an empty magazine with half a magazine of objects
+ */
+static void magazine_refill(magazine_t *mag, int size_class) {
+    spin_lock(&heap_lock);
+
+    while (mag->count < MAGAZINE_SIZE / 2) {
+        void *obj = slab_alloc(size_class);
+        if (obj == NULL) {
+            break;
+        }
+        mag->objects[mag->count++] = obj;
+    }
+
+    spin_unlock(&heap_lock);
+}
+
+/*
+ * Return half of a full magazine to the slabs
+ */
+static void magazine_drain(magazine_t *mag) {
+    spin_lock(&heap_lock);
+
+    while (mag->count > MAGAZINE_SIZE / 2) {
+        void *obj = mag->objects[--mag->count];
+        slab_free(slab_of(obj), obj);
+    }
+
+    spin_unlock(&heap_lock);
+}
+
+/*
+ * Initialize the memory allocator
+ * The page allocator must already be initialized
+ */
+void memory_init(void) {
+    free_list = NULL;
+    free_bytes = 0;
+    slab_bytes = 0;
+
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        partial_slabs[i] = NULL;
+    }
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        memset(&cpu_caches[cpu], 0, sizeof(cpu_cache_t));
+    }
+
+    heap_bytes = (size_t)(&__heap_end - &__heap_start);
+    heap_add_region(&__heap_start, heap_bytes);
+}
+
+/*
+ * Allocate from this core's cache or the heap
+ * The caller keeps the thread on this core (see malloc).
+ */
+static void *cpu_malloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    cpu_cache_t *cache = &cpu_caches[smp_cpu_id()];
+
+    if (size <= SLAB_MAX_SIZE) {
+        int size_class = size_class_of(size);
+        magazine_t *mag = &cache->magazines[size_class];
+
+        if (mag->count == 0) {
+            magazine_refill(mag, size_class);
+        }
+
+        if (mag->count > 0) {
+            cache->live_bytes += class_size(size_class);
+            cache->live_allocations++;
+            return mag->objects[--mag->count];
+        }
+        // No pages for a new slab: fall back to the free list
+    }
+
+    spin_lock(&heap_lock);
+
+    block_t *b = large_alloc(size);
+    if (b == NULL && heap_grow(size) == 0) {
+        b = large_alloc(size);
+    }
+
+    spin_unlock(&heap_lock);
+
+    if (b == NULL) {
         return NULL;  // Out of memory
     }
 
+    cache->live_bytes += block_size(b) - BLOCK_HEADER_SIZE;
+    cache->live_allocations++;
+    return block_payload(b);
+}
+
+/*
+ * Free to this core's cache or the heap
+ * The caller keeps the thread on this core (see free).
+ */
+static void cpu_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    cpu_cache_t *cache = &cpu_caches[smp_cpu_id()];
+
     /*
-     * Allocate the memory
+     * A live object's slab page can't be released under us, so
+     * reading its bookkeeping without the lock is safe
      */
-    void *ptr = heap_current;
-    heap_current += size;
-    total_allocated += size;
+    slab_t *s = slab_of(ptr);
+    if (s != NULL) {
+        int size_class = s->slab_class;
+        magazine_t *mag = &cache->magazines[size_class];
+
+        if (mag->count == MAGAZINE_SIZE) {
+            magazine_drain(mag);
+        }
+
+        mag->objects[mag->count++] = ptr;
+        cache->live_bytes -= class_size(size_class);
+        cache->live_allocations--;
+        return;
+    }
+
+    block_t *b = payload_block(ptr);
+    size_t size = 0;
+
+    spin_lock(&heap_lock);
+    if (b->size & BLOCK_INUSE) {
+        size = block_size(b) - BLOCK_HEADER_SIZE;
+        large_free(b);
+    }
+    spin_unlock(&heap_lock);
 
+    if (size != 0) {
+        cache->live_bytes -= size;
+        cache->live_allocations--;
+    }
+}
+
+/*
+ * malloc - Allocate memory
+ *
+ * Small sizes come from this core's magazine (refilled from the
+ * slabs), larger ones from the free list. All returned pointers are
+ * 16-byte aligned (ARM64 requirement for some operations).
+ * Preemption is off meanwhile: a thread moved to another core halfway
+ * through would be using a magazine that belongs to someone else.
+ */
+void *malloc(size_t size) {
+    preempt_disable();
+    void *ptr = cpu_malloc(size);
+    preempt_enable();
     return ptr;
 }
 
 /*
  * free - Free memory
  *
- * Our simple bump allocator doesn't support freeing.
- * In a real OS, this would return memory to a free list.
- * We keep the function for API compatibility.
+ * The address tells us whether this was a slab object (its page is
+ * marked PAGE_SLAB) or a large block (it has a header just before it).
+ * Slab objects go onto this core's magazine.
  */
 void free(void *ptr) {
-    /*
-     * Do nothing in bump allocator
-     * This is a limitation of our simple design
-     */
-    (void)ptr;  // Suppress unused parameter warning
+    preempt_disable();
+    cpu_free(ptr);
+    preempt_enable();
 }
 
 /*
  * calloc - Allocate and zero memory
  */
 void *calloc(size_t num, size_t size) {
+    if (size != 0 && num > (size_t)-1 / size) {
+        return NULL;  // Overflow
+    }
+
     size_t total = num * size;
     void *ptr = malloc(total);
 
@@ -98,5 +630,51 @@ void *calloc(size_t num, size_t size) {
  * Get total allocated memory
  */
 size_t get_allocated_memory(void) {
-    return total_allocated;
+    int64_t live = 0;
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        live += cpu_caches[cpu].live_bytes;
+    }
+
+    return (size_t)live;
+}
+
+/*
+ * Get detailed allocator statistics
+ */
+void memory_get_stats(memory_stats_t *stats) {
+    int64_t live_allocations = 0;
+    size_t cached = 0;
+    size_t largest = 0;
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        live_allocations += cpu_caches[cpu].live_allocations;
+        for (int c = 0; c < NUM_SIZE_CLASSES; c++) {
+            cached += cpu_caches[cpu].magazines[c].count * class_size(c);
+        }
+    }
+
+    spin_lock(&heap_lock);
+
+    for (block_t *b = free_list; b != NULL; b = b->next_free) {
+        if (block_size(b) > largest) {
+            largest = block_size(b);
+        }
+    }
+
+    stats->live_bytes = get_allocated_memory();
+    stats->live_allocations = (size_t)live_allocations;
+    stats->cached_bytes = cached;
+    stats->slab_bytes = slab_bytes;
+    stats->heap_bytes = heap_bytes;
+    stats->free_bytes = free_bytes;
+    stats->largest_free = largest;
+
+    spin_unlock(&heap_lock);
+
+    /*
+     * External fragmentation: how much of the free memory is unusable
+     * for one big allocation
+     */
+    stats->fragmentation = free_bytes ? (int)(100 - largest * 100 / free_bytes) : 0;
 }
@@ -1,8 +1,11 @@
 /*
  * Memory Allocator Header
  *
- * Simple memory allocator for our OS.
- * For educational purposes, we implement a basic bump allocator.
+ * Kernel heap allocator for our OS.
+ * Small allocations (up to 2KB) come from size-class slabs, larger
+ * ones from a coalescing free list. Both support free(), and both get
+ * their memory from the page allocator (page_alloc.h). Each CPU core
+ * caches free small objects so it rarely has to take the heap lock.
  */
 
 #ifndef MEMORY_H
@@ -10,22 +13,46 @@
 
 #include <stddef.h>
 
+/*
+ * Slab page size; small objects are carved out of pages this big
+ * (one page from the page allocator)
+ */
+#define SLAB_PAGE_SIZE 4096
+
+/*
+ * Largest allocation served from a slab (larger ones use the free list)
+ */
+#define SLAB_MAX_SIZE 2048
+
+/*
+ * Allocator statistics
+ */
+typedef struct {
+    size_t live_bytes;          // Bytes handed out and not yet freed
+    size_t live_allocations;    // Number of allocations not yet freed
+    size_t cached_bytes;        // Free objects held in per-CPU magazines
+    size_t slab_bytes;          // Bytes held by slab pages
+    size_t heap_bytes;          // Bytes held by the large block allocator
+    size_t free_bytes;          // Bytes on the free list
+    size_t largest_free;        // Largest free block
+    int fragmentation;          // External fragmentation, percent (0-100)
+} memory_stats_t;
+
 /*
  * Initialize the memory allocator
- * Must be called before malloc/free
+ * Must be called after page_alloc_init and before malloc/free
  */
 void memory_init(void);
 
 /*
  * Allocate size bytes of memory
- * Returns pointer to allocated memory, or NULL if failed
+ * Returns pointer to allocated memory (16-byte aligned), or NULL if failed
  */
 void *malloc(size_t size);
 
 /*
  * Free previously allocated memory
- * Note: Our simple allocator doesn't actually free memory,
- * but we keep the interface for future improvements
+ * Passing NULL does nothing
  */
 void free(void *ptr);
 
@@ -35,8 +62,13 @@ void free(void *ptr);
 void *calloc(size_t num, size_t size);
 
 /*
- * Get the total amount of allocated memory
+ * Get the total amount of allocated memory (live bytes)
  */
 size_t get_allocated_memory(void);
 
+/*
+ * Get detailed allocator statistics, including fragmentation
+ */
+void memory_get_stats(memory_stats_t *stats);
+
 #endif // MEMORY_H
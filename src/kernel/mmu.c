@@ -0,0 +1,238 @@
+/*
+ * Memory Management Unit (MMU) Implementation
+ *
+ * We use the 4KB translation granule with a 39-bit (512GB) virtual
+ * address space, so translation starts at level 1:
+ *
+ *   Level 1 table: 512 entries, each covering 1GB
+ *   Level 2 table: 512 entries, each covering 2MB
+ *
+ * Every mapping is an identity mapping made of 1GB or 2MB blocks, so
+ * we never need level 3 tables. The page tables live in .bss.
+ */
+
+#include "mmu.h"
+
+/*
+ * Block sizes at each level
+ */
+#define BLOCK_1G (1UL << 30)
+#define BLOCK_2M (1UL << 21)
+
+/*
+ * Number of level 2 tables available (each maps 1GB in 2MB blocks)
+ */
+#define MMU_L2_TABLES 8
+
+/*
+ * Descriptor bits
+ */
+#define DESC_VALID      (1UL << 0)
+#define DESC_TABLE      (1UL << 1)    // Table (not block) at levels 1-2
+#define DESC_ATTR(idx)  ((uint64_t)(idx) << 2)
+#define DESC_SH_INNER   (3UL << 8)    // Inner shareable
+#define DESC_AF         (1UL << 10)   // Access flag (must be set)
+#define DESC_PXN        (1UL << 53)   // Privileged execute never
+#define DESC_UXN        (1UL << 54)   // Unprivileged execute never
+#define DESC_ADDR_MASK  0x0000FFFFFFFFF000UL
+
+/*
+ * MAIR_EL1: memory attributes for each MMU_* index
+ *   0: Device-nGnRE (0x04)
+ *   1: Normal, inner/outer write-back read/write-allocate (0xFF)
+ */
+#define MAIR_VALUE ((0x04UL << (8 * MMU_DEVICE)) | (0xFFUL << (8 * MMU_NORMAL)))
+
+/*
+ * TCR_EL1 fields
+ */
+#define TCR_T0SZ        (64 - 39)     // 39-bit virtual addresses
+#define TCR_IRGN0_WBWA  (1UL << 8)    // Table walks: inner write-back
+#define TCR_ORGN0_WBWA  (1UL << 10)   // Table walks: outer write-back
+#define TCR_SH0_INNER   (3UL << 12)   // Table walks: inner shareable
+#define TCR_TG0_4K      (0UL << 14)   // 4KB granule
+#define TCR_EPD1        (1UL << 23)   // No TTBR1 (upper half) walks
+#define TCR_IPS_SHIFT   32
+
+/*
+ * SCTLR_EL1 bits
+ */
+#define SCTLR_M  (1UL << 0)    // MMU enable
+#define SCTLR_A  (1UL << 1)    // Alignment check
+#define SCTLR_C  (1UL << 2)    // Data cache enable
+#define SCTLR_I  (1UL << 12)   // Instruction cache enable
+
+/*
+ * Kernel image boundaries from linker.ld
+ */
+extern char __kernel_start;
+extern char __heap_end;
+
+/*
+ * Turns on the MMU using the given register values (in boot.S)
+ */
+extern void mmu_enable(const mmu_regs_t *regs);
+
+/*
+ * Page tables
+ */
+static uint64_t l1_table[512] __attribute__((aligned(4096)));
+static uint64_t l2_tables[MMU_L2_TABLES][512] __attribute__((aligned(4096)));
+static int l2_tables_used = 0;
+
+/*
+ * Register values for mmu_enable
+ * Written by the boot core before its MMU is on, so the values are in
+ * RAM (not just in its cache) when secondary cores read them with
+ * their MMU still off.
+ */
+mmu_regs_t mmu_boot_regs;
+
+/*
+ * Build a block descriptor for a memory type
+ */
+static uint64_t block_desc(uint64_t addr, int type) {
+    uint64_t desc = (addr & DESC_ADDR_MASK) | DESC_VALID | DESC_AF | DESC_ATTR(type);
+
+    if (type == MMU_NORMAL) {
+        desc |= DESC_SH_INNER;
+    } else {
+        desc |= DESC_PXN | DESC_UXN;  // Never execute from MMIO
+    }
+
+    return desc;
+}
+
+/*
+ * Get the level 2 table under a level 1 entry, creating it if needed
+ * Returns NULL if the entry is already a 1GB block or we're out of tables
+ */
+static uint64_t *get_l2_table(int l1_index) {
+    uint64_t entry = l1_table[l1_index];
+
+    if (entry & DESC_VALID) {
+        if (entry & DESC_TABLE) {
+            return (uint64_t *)(entry & DESC_ADDR_MASK);
+        }
+        return NULL;  // 1GB block
+    }
+
+    if (l2_tables_used >= MMU_L2_TABLES) {
+        return NULL;
+    }
+
+    uint64_t *table = l2_tables[l2_tables_used++];
+
+    /*
+     * The table must be visible to the table walker before the
+     * level 1 entry that points to it
+     */
+    __asm__ volatile("dsb ishst" ::: "memory");
+    l1_table[l1_index] = ((uint64_t)table & DESC_ADDR_MASK) | DESC_VALID | DESC_TABLE;
+
+    return table;
+}
+
+/*
+ * Identity-map a physical range
+ */
+int mmu_map_range(uint64_t base, uint64_t size, int type) {
+    uint64_t addr = base & ~(BLOCK_2M - 1);
+    uint64_t end = (base + size + BLOCK_2M - 1) & ~(BLOCK_2M - 1);
+
+    while (addr < end) {
+        int l1_index = (int)(addr >> 30);
+        if (l1_index >= 512) {
+            return -1;  // Outside the 39-bit address space
+        }
+
+        /*
+         * Use a whole 1GB block when the range covers it
+         */
+        if ((addr & (BLOCK_1G - 1)) == 0 && end - addr >= BLOCK_1G &&
+            !(l1_table[l1_index] & DESC_VALID)) {
+            l1_table[l1_index] = block_desc(addr, type);
+            addr += BLOCK_1G;
+            continue;
+        }
+
+        /*
+         * Already covered by a 1GB block: skip to the next gigabyte
+         */
+        if ((l1_table[l1_index] & (DESC_VALID | DESC_TABLE)) == DESC_VALID) {
+            addr = (addr + BLOCK_1G) & ~(BLOCK_1G - 1);
+            continue;
+        }
+
+        uint64_t *l2 = get_l2_table(l1_index);
+        if (l2 == NULL) {
+            return -1;  // Out of page tables
+        }
+
+        l2[(addr >> 21) & 511] = block_desc(addr, type);
+        addr += BLOCK_2M;
+    }
+
+    /*
+     * If the MMU is already running, make the new entries visible
+     * We only ever add mappings, so no break-before-make is needed
+     */
+    if (mmu_enabled()) {
+        __asm__ volatile("dsb ishst\n\t"
+                         "tlbi vmalle1is\n\t"
+                         "dsb ish\n\t"
+                         "isb" ::: "memory");
+    }
+
+    return 0;
+}
+
+/*
+ * Build the kernel page table and enable the MMU
+ */
+void mmu_init(void) {
+    uint64_t mmfr0, sctlr;
+
+    /*
+     * MMIO registers: device memory
+     * Kernel image (.text, .rodata, .data, .bss, .stack, .heap): normal memory
+     */
+    mmu_map_range(MMU_PERIPH_BASE, MMU_PERIPH_SIZE, MMU_DEVICE);
+    mmu_map_range((uint64_t)&__kernel_start,
+                  (uint64_t)(&__heap_end - &__kernel_start), MMU_NORMAL);
+
+    /*
+     * Physical address size comes from the CPU's PARange field
+     */
+    __asm__ volatile("mrs %0, id_aa64mmfr0_el1" : "=r"(mmfr0));
+    uint64_t ips = mmfr0 & 0xF;
+    if (ips > 5) {
+        ips = 5;  // 48 bits is the most the 4KB granule supports here
+    }
+
+    __asm__ volatile("mrs %0, sctlr_el1" : "=r"(sctlr));
+
+    mmu_boot_regs.mair = MAIR_VALUE;
+    mmu_boot_regs.tcr = TCR_T0SZ | TCR_IRGN0_WBWA | TCR_ORGN0_WBWA |
+                        TCR_SH0_INNER | TCR_TG0_4K | TCR_EPD1 |
+                        (ips << TCR_IPS_SHIFT);
+    mmu_boot_regs.ttbr0 = (uint64_t)l1_table;
+    mmu_boot_regs.sctlr = (sctlr | SCTLR_M | SCTLR_C | SCTLR_I) & ~SCTLR_A;
+
+    /*
+     * Make sure the page tables have reached memory before the walker
+     * starts reading them
+     */
+    __asm__ volatile("dsb sy" ::: "memory");
+
+    mmu_enable(&mmu_boot_regs);
+}
+
+/*
+ * Check whether the MMU is on
+ */
+int mmu_enabled(void) {
+    uint64_t sctlr;
+    __asm__ volatile("mrs %0, sctlr_el1" : "=r"(sctlr));
+    return (sctlr & SCTLR_M) != 0;
+}
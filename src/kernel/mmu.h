@@ -0,0 +1,62 @@
+/*
+ * Memory Management Unit (MMU) Header
+ *
+ * Sets up an identity-mapped page table (virtual address == physical
+ * address) so we can turn on the MMU and, with it, the data and
+ * instruction caches. Without the MMU every access to RAM is treated
+ * as uncached device memory, which is very slow.
+ */
+
+#ifndef MMU_H
+#define MMU_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Memory types for mmu_map_range
+ * These are indexes into the MAIR_EL1 register
+ */
+#define MMU_DEVICE  0   // Device-nGnRE: MMIO registers, never cached
+#define MMU_NORMAL  1   // Normal memory, write-back cacheable
+
+/*
+ * Start and size of the peripheral window on QEMU's virt machine
+ * Covers the GIC (0x08000000), PL011 UART (0x09000000) and
+ * virtio-mmio devices (0x0a000000)
+ */
+#define MMU_PERIPH_BASE 0x08000000UL
+#define MMU_PERIPH_SIZE 0x08000000UL
+
+/*
+ * System register values used to switch the MMU on
+ * Shared with boot.S so secondary cores can enable the MMU before
+ * touching memory. Field order matters: boot.S reads it with ldp.
+ */
+typedef struct {
+    uint64_t mair;
+    uint64_t tcr;
+    uint64_t ttbr0;
+    uint64_t sctlr;
+} mmu_regs_t;
+
+/*
+ * Build the kernel page table and enable the MMU and caches
+ * Maps the kernel image (.text through .heap) as normal memory and the
+ * peripheral window as device memory
+ */
+void mmu_init(void);
+
+/*
+ * Identity-map a physical range with the given memory type
+ * Addresses are rounded out to 2MB. May be called before or after
+ * mmu_init. Returns 0 on success, -1 if out of page tables.
+ */
+int mmu_map_range(uint64_t base, uint64_t size, int type);
+
+/*
+ * Check whether the MMU is enabled on the calling core
+ */
+int mmu_enabled(void);
+
+#endif // MMU_H
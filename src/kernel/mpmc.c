@@ -0,0 +1,84 @@
+/*
+ * Lock-Free Ring Implementation
+ *
+ * The algorithm is Dmitry Vyukov's bounded MPMC queue. A slot's
+ * sequence goes pos (free for the producer at pos), pos + 1 (holds the
+ * item for the consumer at pos), pos + size (free for the producer one
+ * lap later), and so on. Comparing it with the position we hope to
+ * claim tells us whether the slot is ours, still in use by the last lap
+ * (ring full / empty), or already taken by another core (look again).
+ */
+
+#include "mpmc.h"
+
+int mpmc_init(mpmc_ring_t *ring, mpmc_slot_t *slots, size_t count) {
+    if (count < 2 || (count & (count - 1)) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        slots[i].seq = i;
+        slots[i].item = NULL;
+    }
+    ring->slots = slots;
+    ring->mask = count - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return 0;
+}
+
+int mpmc_push(mpmc_ring_t *ring, void *item) {
+    uint64_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+    while (1) {
+        mpmc_slot_t *slot = &ring->slots[pos & ring->mask];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - pos);
+
+        if (diff == 0) {
+            // Free for us: claim the position (on failure pos is reloaded)
+            if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->item = item;
+                __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;  // Still holds an item from the last lap: full
+        } else {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);  // Someone beat us
+        }
+    }
+}
+
+int mpmc_pop(mpmc_ring_t *ring, void **item) {
+    uint64_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    while (1) {
+        mpmc_slot_t *slot = &ring->slots[pos & ring->mask];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - (pos + 1));
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *item = slot->item;
+                // Free it for the producer one lap on
+                __atomic_store_n(&slot->seq, pos + ring->mask + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;  // Not filled yet: empty
+        } else {
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+size_t mpmc_count(mpmc_ring_t *ring) {
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+    return head > tail ? (size_t)(head - tail) : 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Lock-Free Ring Header
+ *
+ * A bounded queue of pointers that any number of cores can push to and
+ * pop from at once (multi-producer, multi-consumer) without a lock.
+ *
+ * Every slot carries a sequence number that says whose turn it is: a
+ * producer at position pos may fill the slot once its sequence is pos,
+ * and a consumer may empty it once it is pos + 1. Producers and
+ * consumers each claim a position with one compare-and-swap on their
+ * own counter (head or tail, on separate cache lines), then publish the
+ * slot with a release store of its sequence. A core that is stopped
+ * halfway only holds up the slot it claimed.
+ *
+ * The caller provides the slot array; its size must be a power of two.
+ */
+
+#ifndef MPMC_H
+#define MPMC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * One slot
+ */
+typedef struct {
+    volatile uint64_t seq;      // Position it is ready for (see above)
+    void *item;
+} mpmc_slot_t;
+
+/*
+ * Ring type
+ */
+typedef struct {
+    mpmc_slot_t *slots;
+    uint64_t mask;              // Number of slots - 1
+    volatile uint64_t head __attribute__((aligned(64)));  // Next position to push
+    volatile uint64_t tail __attribute__((aligned(64)));  // Next position to pop
+} __attribute__((aligned(64))) mpmc_ring_t;
+
+/*
+ * Set up a ring over count slots (a power of two, at least 2)
+ * Returns 0 on success, -1 if count isn't usable
+ */
+int mpmc_init(mpmc_ring_t *ring, mpmc_slot_t *slots, size_t count);
+
+/*
+ * Add an item
+ * Returns 0 on success, -1 if the ring is full
+ */
+int mpmc_push(mpmc_ring_t *ring, void *item);
+
+/*
+ * Take the oldest item
+ * Returns 0 and sets *item on success, -1 if the ring is empty
+ */
+int mpmc_pop(mpmc_ring_t *ring, void **item);
+
+/*
+ * Number of items in the ring (a snapshot, for statistics)
+ */
+size_t mpmc_count(mpmc_ring_t *ring);
+
+#endif // MPMC_H
@@ -0,0 +1,261 @@
+/*
+ * Physical Page Allocator Implementation (Buddy System)
+ *
+ * Free blocks of 2^order pages are kept on one list per order. A block
+ * of order N at page frame number (PFN) p has its buddy at p ^ (1 << N):
+ * the other half of the order N+1 block they were split from.
+ *
+ *   page_alloc(order): take a block from the smallest non-empty list
+ *                      of at least that order, splitting it in half
+ *                      until it is the right size
+ *   page_free(addr):   while the buddy is free and the same order,
+ *                      merge with it and move up one order
+ *
+ * The page_t array describing every page is stored in the first pages
+ * of the managed region itself.
+ */
+
+#include "page_alloc.h"
+#include "spinlock.h"
+#include "string.h"
+
+/*
+ * End of the kernel image, from linker.ld
+ */
+extern char __heap_end;
+
+/*
+ * Managed page range [first_pfn, end_pfn)
+ */
+static page_t *page_array = NULL;
+static uint64_t first_pfn = 0;
+static uint64_t end_pfn = 0;
+
+/*
+ * One free list per order, protected by page_lock
+ */
+static page_t *free_lists[PAGE_MAX_ORDER + 1];
+static spinlock_t page_lock = SPINLOCK_INIT;
+
+/*
+ * Statistics
+ */
+static size_t total_pages = 0;
+static size_t free_pages = 0;
+
+static inline page_t *pfn_to_page(uint64_t pfn) {
+    return &page_array[pfn - first_pfn];
+}
+
+static inline uint64_t page_to_pfn(const page_t *page) {
+    return first_pfn + (uint64_t)(page - page_array);
+}
+
+/*
+ * Free list operations
+ */
+static void free_list_push(int order, page_t *page) {
+    page->prev = NULL;
+    page->next = free_lists[order];
+    if (page->next != NULL) {
+        page->next->prev = page;
+    }
+    free_lists[order] = page;
+}
+
+static void free_list_remove(int order, page_t *page) {
+    if (page->prev != NULL) {
+        page->prev->next = page->next;
+    } else {
+        free_lists[order] = page->next;
+    }
+    if (page->next != NULL) {
+        page->next->prev = page->prev;
+    }
+}
+
+/*
+ * Put a block back on the free lists, merging with free buddies
+ */
+static void free_block(uint64_t pfn, int order) {
+    pfn_to_page(pfn)->flags = 0;
+
+    while (order < PAGE_MAX_ORDER) {
+        uint64_t buddy_pfn = pfn ^ (1UL << order);
+
+        if (buddy_pfn < first_pfn || buddy_pfn + (1UL << order) > end_pfn) {
+            break;  // Buddy is outside managed memory
+        }
+
+        page_t *buddy = pfn_to_page(buddy_pfn);
+        if (!(buddy->flags & PAGE_FREE) || buddy->order != order) {
+            break;  // Buddy is (at least partly) in use
+        }
+
+        free_list_remove(order, buddy);
+        buddy->flags = 0;
+        pfn &= ~(1UL << order);  // Merged block starts at the lower half
+        order++;
+    }
+
+    page_t *head = pfn_to_page(pfn);
+    head->flags = PAGE_FREE;
+    head->order = (uint8_t)order;
+    free_list_push(order, head);
+}
+
+/*
+ * Initialize the page allocator
+ */
+void page_alloc_init(uint64_t ram_base, uint64_t ram_size,
+                     uint64_t reserved, uint64_t reserved_size) {
+    uint64_t start = ((uint64_t)&__heap_end + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = (ram_base + ram_size) & ~(uint64_t)(PAGE_SIZE - 1);
+
+    for (int i = 0; i <= PAGE_MAX_ORDER; i++) {
+        free_lists[i] = NULL;
+    }
+    total_pages = 0;
+    free_pages = 0;
+
+    if (start < ram_base || start >= end) {
+        return;  // No RAM after the kernel image
+    }
+
+    /*
+     * The page_t array goes at the start of the region and describes
+     * every page in it, including its own pages (which stay allocated)
+     */
+    uint64_t npages = (end - start) / PAGE_SIZE;
+    uint64_t meta_bytes = (npages * sizeof(page_t) + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+
+    page_array = (page_t *)start;
+    first_pfn = start >> PAGE_SHIFT;
+    end_pfn = end >> PAGE_SHIFT;
+
+    memset(page_array, 0, meta_bytes);
+    for (uint64_t pfn = first_pfn; pfn < end_pfn; pfn++) {
+        pfn_to_page(pfn)->flags = PAGE_ALLOCATED;
+    }
+
+    /*
+     * Free every usable page one by one; the buddy merging in
+     * free_block builds the large blocks for us
+     */
+    uint64_t reserved_end = reserved + reserved_size;
+    for (uint64_t pfn = (start + meta_bytes) >> PAGE_SHIFT; pfn < end_pfn; pfn++) {
+        uint64_t addr = pfn << PAGE_SHIFT;
+        if (reserved_size != 0 && addr + PAGE_SIZE > reserved && addr < reserved_end) {
+            continue;
+        }
+        free_block(pfn, 0);
+        total_pages++;
+        free_pages++;
+    }
+}
+
+/*
+ * Allocate 2^order contiguous pages
+ */
+void *page_alloc(int order) {
+    if (order < 0 || order > PAGE_MAX_ORDER) {
+        return NULL;
+    }
+
+    spin_lock(&page_lock);
+
+    for (int o = order; o <= PAGE_MAX_ORDER; o++) {
+        page_t *page = free_lists[o];
+        if (page == NULL) {
+            continue;
+        }
+
+        free_list_remove(o, page);
+
+        /*
+         * Split off upper halves until the block is the right size
+         */
+        while (o > order) {
+            o--;
+            page_t *buddy = page + (1UL << o);
+            buddy->flags = PAGE_FREE;
+            buddy->order = (uint8_t)o;
+            free_list_push(o, buddy);
+        }
+
+        page->flags = PAGE_ALLOCATED;
+        page->order = (uint8_t)order;
+        free_pages -= 1UL << order;
+
+        spin_unlock(&page_lock);
+        return page_address(page);
+    }
+
+    spin_unlock(&page_lock);
+    return NULL;  // Out of memory
+}
+
+/*
+ * Free a block of pages
+ */
+void page_free(void *addr) {
+    page_t *page = page_of(addr);
+
+    if (page == NULL || ((uint64_t)addr & (PAGE_SIZE - 1)) != 0) {
+        return;  // Not a page we manage
+    }
+
+    spin_lock(&page_lock);
+
+    if (!(page->flags & PAGE_ALLOCATED)) {
+        spin_unlock(&page_lock);
+        return;  // Not an allocated block
+    }
+
+    int order = page->order;
+    free_pages += 1UL << order;
+    free_block(page_to_pfn(page), order);
+
+    spin_unlock(&page_lock);
+}
+
+/*
+ * Get bookkeeping for an address
+ */
+page_t *page_of(const void *addr) {
+    uint64_t pfn = (uint64_t)addr >> PAGE_SHIFT;
+
+    if (page_array == NULL || pfn < first_pfn || pfn >= end_pfn) {
+        return NULL;
+    }
+    return pfn_to_page(pfn);
+}
+
+/*
+ * Get a page's address
+ */
+void *page_address(const page_t *page) {
+    return (void *)(page_to_pfn(page) << PAGE_SHIFT);
+}
+
+/*
+ * Smallest order that holds size bytes
+ */
+int page_order_for(size_t size) {
+    int order = 0;
+    while (((size_t)PAGE_SIZE << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+/*
+ * Statistics
+ */
+size_t page_total_count(void) {
+    return total_pages;
+}
+
+size_t page_free_count(void) {
+    return free_pages;
+}
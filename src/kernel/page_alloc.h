@@ -0,0 +1,95 @@
+/*
+ * Physical Page Allocator Header
+ *
+ * Manages all RAM after the kernel image (everything past __heap_end)
+ * in 4KB pages using a buddy system: free memory is kept in blocks of
+ * 2^order pages, big blocks are split in half to serve small requests,
+ * and freed blocks are merged back with their "buddy" half.
+ */
+
+#ifndef PAGE_ALLOC_H
+#define PAGE_ALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Page size (4KB, matches the MMU granule)
+ */
+#define PAGE_SIZE  4096
+#define PAGE_SHIFT 12
+
+/*
+ * Largest block is 2^PAGE_MAX_ORDER pages (4MB)
+ */
+#define PAGE_MAX_ORDER 10
+
+/*
+ * Page flags
+ */
+#define PAGE_FREE      (1 << 0)   // Head of a free block
+#define PAGE_ALLOCATED (1 << 1)   // Head of an allocated block
+#define PAGE_SLAB      (1 << 2)   // Used as a slab by memory.c
+
+/*
+ * Per-page bookkeeping
+ *
+ * One of these exists for every managed page. Only the first page
+ * ("head") of a block carries meaningful order and flags. While a page
+ * is allocated, its owner may use next/prev, private and the slab
+ * fields for its own purposes.
+ */
+typedef struct page {
+    struct page *next;          // Free list / owner list links
+    struct page *prev;
+    void *private;              // Owner data (slab: free object list)
+    uint8_t order;              // Block size is 2^order pages
+    uint8_t flags;              // PAGE_* flags
+    uint16_t slab_class;        // Slab size class (memory.c)
+    uint16_t in_use;            // Slab objects handed out (memory.c),
+                                // or holders of a file block (memfs.c)
+    uint16_t capacity;          // Slab objects per page (memory.c)
+} page_t;
+
+/*
+ * Initialize the page allocator for RAM [ram_base, ram_base + ram_size)
+ * Pages before __heap_end and the range [reserved, reserved + reserved_size)
+ * (e.g. the device tree blob) are never handed out.
+ */
+void page_alloc_init(uint64_t ram_base, uint64_t ram_size,
+                     uint64_t reserved, uint64_t reserved_size);
+
+/*
+ * Allocate 2^order physically contiguous pages
+ * Returns the address of the first page, or NULL if none available
+ */
+void *page_alloc(int order);
+
+/*
+ * Free a block returned by page_alloc
+ */
+void page_free(void *addr);
+
+/*
+ * Get the bookkeeping for the page containing addr
+ * Returns NULL if the address is not managed by the page allocator
+ */
+page_t *page_of(const void *addr);
+
+/*
+ * Get the address of the page described by a page_t
+ */
+void *page_address(const page_t *page);
+
+/*
+ * Smallest order whose block holds at least size bytes
+ */
+int page_order_for(size_t size);
+
+/*
+ * Statistics (in pages)
+ */
+size_t page_total_count(void);
+size_t page_free_count(void);
+
+#endif // PAGE_ALLOC_H
@@ -0,0 +1,574 @@
+/*
+ * Kernel Thread Scheduler Implementation
+ *
+ * Every core has a runqueue_t: a FIFO of ready threads behind a
+ * spinlock (other cores take from it when they steal), the thread it
+ * is running, its idle thread, and a list of its sleeping threads.
+ * Run queue locks are only taken with interrupts masked, since the
+ * tick interrupt uses them too.
+ *
+ * schedule() switches from the current thread to the next. The current
+ * thread's state says what becomes of it, but that only happens after
+ * context_switch has saved its registers (finish_switch, run by the
+ * thread switched to): until then another core that found it in a run
+ * queue would start it on a stack that is still in use.
+ *
+ * The idle thread is never in a run queue; it runs when the queue is
+ * empty, and whenever the core has smp work items, which run on it.
+ */
+
+#include "sched.h"
+#include "gic.h"
+#include "irq.h"
+#include "memory.h"
+#include "page_alloc.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "string.h"
+#include "timer.h"
+
+#define TRACE_MODULE SMP
+#include "trace.h"
+
+/*
+ * switch.S hard-codes where the stack pointer is saved
+ */
+_Static_assert(offsetof(thread_t, sp) == THREAD_SP, "thread_t sp offset");
+
+typedef struct {
+    spinlock_t lock;               // Protects the queue
+    thread_t *head;                // Ready threads, oldest first
+    thread_t *tail;
+    volatile int count;
+    volatile int stealable;        // ... of which not pinned
+    thread_t *current;             // The rest belongs to the owner core
+    thread_t *idle;
+    thread_t *prev;                // Switched away from, for finish_switch
+    thread_t *sleepers;
+    uint64_t slice_start;          // Counter value the current slice began
+    int need_resched;
+    uint64_t switches;
+    uint64_t preemptions;
+    uint64_t steals;
+} __attribute__((aligned(64))) runqueue_t;
+
+static runqueue_t rqs[MAX_CPUS];
+
+/*
+ * Boot flows: main on core 0, idle on the others
+ */
+static thread_t boot_threads[MAX_CPUS];
+
+/*
+ * Every thread, for sched_threads
+ */
+static thread_t *all_threads;
+static spinlock_t all_lock = SPINLOCK_INIT;
+
+static int next_id = 1;
+static uint64_t slice_ticks;
+
+/*
+ * In switch.S
+ */
+void context_switch(thread_t *prev, thread_t *next);
+extern char thread_start[];
+
+static void set_current(thread_t *t) {
+    __asm__ volatile("msr tpidr_el1, %0" :: "r"(t) : "memory");
+}
+
+/*
+ * Run queue operations (caller holds the queue's lock)
+ */
+static void rq_push(runqueue_t *q, thread_t *t) {
+    t->next = NULL;
+    if (q->tail != NULL) {
+        q->tail->next = t;
+    } else {
+        q->head = t;
+    }
+    q->tail = t;
+    q->count++;
+    if (t->pinned == THREAD_ANY_CPU) {
+        q->stealable++;
+    }
+}
+
+/*
+ * Take the first thread that may run on any core (steal), or just the
+ * first
+ */
+static thread_t *rq_take(runqueue_t *q, int steal) {
+    thread_t *prev = NULL;
+
+    for (thread_t *t = q->head; t != NULL; prev = t, t = t->next) {
+        if (steal && t->pinned != THREAD_ANY_CPU) {
+            continue;
+        }
+
+        if (prev != NULL) {
+            prev->next = t->next;
+        } else {
+            q->head = t->next;
+        }
+        if (q->tail == t) {
+            q->tail = prev;
+        }
+        q->count--;
+        if (t->pinned == THREAD_ANY_CPU) {
+            q->stealable--;
+        }
+        return t;
+    }
+    return NULL;
+}
+
+static void enqueue(int cpu, thread_t *t) {
+    runqueue_t *q = &rqs[cpu];
+
+    t->state = THREAD_READY;
+    spin_lock(&q->lock);
+    rq_push(q, t);
+    spin_unlock(&q->lock);
+}
+
+/*
+ * Take a ready thread from the core with the most of them
+ */
+static thread_t *steal(int cpu) {
+    int victim = -1;
+    int most = 0;
+
+    for (int i = 0; i < MAX_CPUS; i++) {
+        int n = __atomic_load_n(&rqs[i].stealable, __ATOMIC_RELAXED);
+        if (i != cpu && n > most) {
+            most = n;
+            victim = i;
+        }
+    }
+    if (victim < 0) {
+        return NULL;
+    }
+
+    runqueue_t *q = &rqs[victim];
+    spin_lock(&q->lock);
+    thread_t *t = rq_take(q, 1);
+    spin_unlock(&q->lock);
+
+    if (t != NULL) {
+        t->migrations++;
+        rqs[cpu].steals++;
+        TRACE(DEBUG, "steal", (uint64_t)t->id, (uint64_t)victim);
+    }
+    return t;
+}
+
+/*
+ * Wake a core sleeping in its idle loop
+ */
+static void wake_cpu(int cpu) {
+    if (gic_ready()) {
+        gic_send_sgi(cpu, IRQ_SGI_WAKEUP);
+    } else {
+        __asm__ volatile("dsb ishst\n\tsev" ::: "memory");
+    }
+}
+
+/*
+ * Wake an idle core (other than the caller) so it comes to steal
+ */
+static void kick_idle_core(void) {
+    int self = smp_cpu_id();
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        runqueue_t *q = &rqs[cpu];
+        if (cpu != self && smp_cpu_online(cpu) && q->idle != NULL &&
+            __atomic_load_n(&q->current, __ATOMIC_RELAXED) == q->idle) {
+            wake_cpu(cpu);
+            return;
+        }
+    }
+}
+
+/*
+ * Move sleepers whose time has come to the run queue
+ */
+static void wake_sleepers(runqueue_t *q, int cpu, uint64_t now) {
+    thread_t **link = &q->sleepers;
+
+    while (*link != NULL) {
+        thread_t *t = *link;
+        if (now < t->wake_at) {
+            link = &t->next;
+            continue;
+        }
+        *link = t->next;
+        enqueue(cpu, t);
+    }
+}
+
+static void free_thread(thread_t *t) {
+    spin_lock(&all_lock);
+    for (thread_t **link = &all_threads; *link != NULL; link = &(*link)->all_next) {
+        if (*link == t) {
+            *link = t->all_next;
+            break;
+        }
+    }
+    spin_unlock(&all_lock);
+
+    page_free(t->stack);
+    free(t);
+}
+
+/*
+ * Put the thread we just switched away from where its state says
+ * Runs in the thread switched to, right after context_switch.
+ */
+static void finish_switch(void) {
+    int cpu = smp_cpu_id();
+    runqueue_t *q = &rqs[cpu];
+    thread_t *prev = q->prev;
+
+    q->prev = NULL;
+    if (prev == NULL || prev == q->idle) {
+        return;
+    }
+
+    switch (prev->state) {
+    case THREAD_READY:
+        enqueue(cpu, prev);
+        break;
+    case THREAD_SLEEPING:
+        prev->next = q->sleepers;
+        q->sleepers = prev;
+        break;
+    case THREAD_DEAD:
+        free_thread(prev);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Switch to the next thread (interrupts masked)
+ * The caller sets the current thread's state first. Only a thread that
+ * stays ready waits for a thread of its own core: one that stops
+ * running lets the core steal.
+ * Returns 1 after another thread ran (and this one was picked again),
+ * 0 if this one just carries on
+ */
+static int schedule(void) {
+    int cpu = smp_cpu_id();
+    runqueue_t *q = &rqs[cpu];
+    thread_t *prev = q->current;
+    uint64_t now = timer_ticks();
+    thread_t *next = NULL;
+
+    wake_sleepers(q, cpu, now);
+
+    if (prev != q->idle && smp_work_pending(cpu)) {
+        next = q->idle;  // Work items run on the idle thread
+    } else {
+        spin_lock(&q->lock);
+        next = rq_take(q, 0);
+        spin_unlock(&q->lock);
+
+        if (next == NULL && (prev == q->idle || prev->state != THREAD_READY)) {
+            next = steal(cpu);
+        }
+    }
+
+    if (next == NULL) {
+        if (prev == q->idle || prev->state == THREAD_READY) {
+            prev->state = THREAD_RUNNING;
+            return 0;  // Nothing else to run
+        }
+        next = q->idle;
+    }
+
+    prev->run_ticks += now - prev->switched_in;
+    next->switched_in = now;
+    next->state = THREAD_RUNNING;
+    next->cpu = cpu;
+    next->switches++;
+    q->switches++;
+    q->slice_start = now;
+    q->prev = prev;
+    __atomic_store_n(&q->current, next, __ATOMIC_RELAXED);
+
+    TRACE(DEBUG, "switch", (uint64_t)prev->id, (uint64_t)next->id);
+    context_switch(prev, next);
+
+    // Back in prev, maybe on another core
+    finish_switch();
+    return 1;
+}
+
+/*
+ * C entry of a new thread (from thread_start in switch.S)
+ */
+void thread_entry(thread_fn fn, void *arg) {
+    finish_switch();
+    irq_enable();
+
+    fn(arg);
+    thread_exit();
+}
+
+/*
+ * Allocate a thread with a stack set up for context_switch to start it
+ * at thread_start
+ */
+static thread_t *new_thread(const char *name, thread_fn fn, void *arg, int pinned) {
+    thread_t *t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->stack = page_alloc(THREAD_STACK_ORDER);
+    if (t->stack == NULL) {
+        free(t);
+        return NULL;
+    }
+
+    uint64_t *context = (uint64_t *)((char *)t->stack + THREAD_STACK_SIZE - THREAD_CONTEXT_SIZE);
+    memset(context, 0, THREAD_CONTEXT_SIZE);
+    context[0] = (uint64_t)fn;             // x19
+    context[1] = (uint64_t)arg;            // x20
+    context[11] = (uint64_t)thread_start;  // x30: where context_switch returns
+
+    t->sp = (uint64_t)context;
+    t->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    t->pinned = pinned;
+    strncpy(t->name, name, THREAD_NAME_LEN - 1);
+
+    spin_lock(&all_lock);
+    t->all_next = all_threads;
+    all_threads = t;
+    spin_unlock(&all_lock);
+    return t;
+}
+
+/*
+ * Set up a boot flow's thread_t and make it current
+ */
+static void init_boot_thread(int cpu, const char *name) {
+    thread_t *t = &boot_threads[cpu];
+
+    t->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    t->state = THREAD_RUNNING;
+    t->cpu = cpu;
+    t->pinned = cpu;
+    t->switched_in = timer_ticks();
+    strncpy(t->name, name, THREAD_NAME_LEN - 1);
+
+    spin_lock(&all_lock);
+    t->all_next = all_threads;
+    all_threads = t;
+    spin_unlock(&all_lock);
+
+    rqs[cpu].current = t;
+    rqs[cpu].slice_start = t->switched_in;
+    set_current(t);
+}
+
+static void idle_thread(void *arg) {
+    (void)arg;
+    smp_idle();
+}
+
+void sched_init(void) {
+    slice_ticks = timer_freq() * SCHED_SLICE_MS / 1000;
+
+    init_boot_thread(0, "main");
+    rqs[0].idle = new_thread("idle0", idle_thread, NULL, 0);
+    if (rqs[0].idle != NULL) {
+        rqs[0].idle->state = THREAD_READY;
+        rqs[0].idle->cpu = 0;
+    }
+}
+
+void sched_init_cpu(int cpu) {
+    char name[THREAD_NAME_LEN] = "idle";
+
+    name[4] = (char)('0' + cpu);
+    init_boot_thread(cpu, name);
+    rqs[cpu].idle = &boot_threads[cpu];
+}
+
+int thread_create(const char *name, thread_fn fn, void *arg, int cpu) {
+    if (fn == NULL || (cpu != THREAD_ANY_CPU && !smp_cpu_online(cpu))) {
+        return -1;
+    }
+
+    thread_t *t = new_thread(name, fn, arg, cpu);
+    if (t == NULL) {
+        return -1;
+    }
+
+    int target = (cpu != THREAD_ANY_CPU) ? cpu : smp_cpu_id();
+    t->cpu = target;
+
+    uint64_t flags = irq_save();
+    enqueue(target, t);
+    irq_restore(flags);
+
+    TRACE(INFO, "thread create", (uint64_t)t->id, (uint64_t)target);
+    if (target != smp_cpu_id()) {
+        wake_cpu(target);
+    } else if (cpu == THREAD_ANY_CPU) {
+        kick_idle_core();
+    }
+    return t->id;
+}
+
+void thread_yield(void) {
+    thread_t *t = thread_current();
+
+    if (t == NULL || t->preempt_count > 0) {
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    t->state = THREAD_READY;
+    schedule();
+    irq_restore(flags);
+}
+
+void thread_sleep_ms(uint64_t ms) {
+    thread_t *t = thread_current();
+    uint64_t ticks = ms * timer_freq() / 1000;
+
+    if (t == NULL || t->preempt_count > 0 || t == rqs[t->cpu].idle) {
+        timer_delay_us(ms * 1000);
+        return;
+    }
+
+    /*
+     * Without the tick nothing would wake a sleeper: stay ready and
+     * let the others run until the time is up
+     */
+    if (!gic_ready()) {
+        uint64_t end = timer_ticks() + ticks;
+        while (timer_ticks() < end) {
+            thread_yield();
+        }
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    t->wake_at = timer_ticks() + ticks;
+    t->state = THREAD_SLEEPING;
+    schedule();
+    irq_restore(flags);
+}
+
+void thread_exit(void) {
+    thread_t *t = thread_current();
+
+    irq_disable();
+    TRACE(INFO, "thread exit", (uint64_t)t->id, t->run_ticks);
+    if (t->stack != NULL) {
+        t->state = THREAD_DEAD;
+        schedule();
+    }
+
+    // Boot flows have nowhere to go back to
+    while (1) {
+        irq_enable();
+        thread_sleep_ms(1000);
+    }
+}
+
+int sched_threads(thread_t *out, int max) {
+    int n = 0;
+    uint64_t flags = irq_save();
+
+    spin_lock(&all_lock);
+    for (thread_t *t = all_threads; t != NULL && n < max; t = t->all_next) {
+        out[n++] = *t;
+    }
+    spin_unlock(&all_lock);
+
+    irq_restore(flags);
+    return n;
+}
+
+void sched_get_stats(int cpu, sched_stats_t *stats) {
+    stats->switches = rqs[cpu].switches;
+    stats->preemptions = rqs[cpu].preemptions;
+    stats->steals = rqs[cpu].steals;
+    stats->ready = rqs[cpu].count;
+}
+
+void sched_tick(void) {
+    int cpu = smp_cpu_id();
+    runqueue_t *q = &rqs[cpu];
+    uint64_t now = timer_ticks();
+
+    if (q->current == NULL) {
+        return;  // Before sched_init
+    }
+
+    wake_sleepers(q, cpu, now);
+    if (q->count > 0 && (q->current == q->idle || now - q->slice_start >= slice_ticks)) {
+        q->need_resched = 1;
+    }
+}
+
+void sched_preempt(void) {
+    int cpu = smp_cpu_id();
+    runqueue_t *q = &rqs[cpu];
+    thread_t *t = q->current;
+
+    if (t == NULL) {
+        return;
+    }
+    if (!q->need_resched && (t == q->idle || !smp_work_pending(cpu))) {
+        return;
+    }
+    if (t->preempt_count > 0) {
+        return;  // Try again at the next interrupt
+    }
+
+    q->need_resched = 0;
+    t->state = THREAD_READY;
+    if (schedule()) {
+        rqs[smp_cpu_id()].preemptions++;
+    }
+}
+
+int sched_switch_idle(void) {
+    thread_t *t = thread_current();
+
+    if (t == NULL || t->preempt_count > 0) {
+        return 0;
+    }
+    t->state = THREAD_READY;
+    return schedule();
+}
+
+/*
+ * Mutex
+ * Waiters yield, then sleep a tick at a time if nothing else wants the
+ * core.
+ */
+int mutex_trylock(mutex_t *m) {
+    return __atomic_exchange_n(&m->locked, 1, __ATOMIC_ACQUIRE) == 0;
+}
+
+void mutex_lock(mutex_t *m) {
+    while (!mutex_trylock(m)) {
+        thread_yield();
+        if (mutex_trylock(m)) {
+            return;
+        }
+        thread_sleep_ms(1);
+    }
+}
+
+void mutex_unlock(mutex_t *m) {
+    __atomic_store_n(&m->locked, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,230 @@
+/*
+ * Kernel Thread Scheduler Header
+ *
+ * Kernel threads, each with its own stack, running on every core and
+ * switched preemptively:
+ *
+ * - Each core has a queue of ready threads, served round robin. A
+ *   thread runs until it yields, sleeps or exits, or until it has run
+ *   for SCHED_SLICE_MS and another thread is waiting, when the timer
+ *   interrupt switches to the next one
+ * - A core with nothing to run steals the oldest ready thread from the
+ *   core with the most waiting; creating a thread wakes an idle core so
+ *   it can do that straight away
+ * - The flow of control that enters kernel_main becomes the "main"
+ *   thread (the shell), pinned to core 0. The flow that starts each
+ *   secondary core becomes that core's idle thread, which runs smp work
+ *   items and otherwise sleeps; core 0 gets an idle thread of its own
+ * - Waiting in cpu_idle (for the UART, the disk...) first lets any
+ *   other ready thread on the core run
+ *
+ * Without a GIC there is no timer tick: threads only switch when they
+ * yield, sleep or wait.
+ *
+ * This header is also included from switch.S, so everything that is
+ * not a plain #define must stay inside the __ASSEMBLER__ guard.
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+/*
+ * Offset of thread_t.sp, and the registers context_switch saves on the
+ * stack: x19-x30 and d8-d15
+ */
+#define THREAD_SP           0
+#define THREAD_CONTEXT_SIZE 160
+
+/*
+ * Thread stacks: 16KB (page_alloc order 2), like the boot stacks
+ */
+#define THREAD_STACK_ORDER 2
+#define THREAD_STACK_SIZE  (4096 << THREAD_STACK_ORDER)
+
+/*
+ * Time a thread may run while others wait
+ */
+#define SCHED_SLICE_MS 20
+
+#define THREAD_NAME_LEN 16
+
+/*
+ * thread_create cpu argument: run on any core
+ */
+#define THREAD_ANY_CPU (-1)
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Thread states
+ */
+enum {
+    THREAD_READY,                  // In a run queue
+    THREAD_RUNNING,
+    THREAD_SLEEPING,               // On its core's sleep list
+    THREAD_DEAD                    // Freed once switched away from
+};
+
+typedef void (*thread_fn)(void *arg);
+
+/*
+ * A kernel thread
+ * Threads are only ever in one place at a time: running on one core,
+ * in one run queue or on one sleep list.
+ */
+typedef struct thread {
+    uint64_t sp;                   // Saved stack pointer (THREAD_SP)
+    struct thread *next;           // Run queue or sleep list
+    struct thread *all_next;       // List of every thread
+    int id;
+    int state;
+    int cpu;                       // Core it is running on, or ran on last
+    int pinned;                    // Core it must run on, or THREAD_ANY_CPU
+    int preempt_count;             // preempt_disable nesting
+    char name[THREAD_NAME_LEN];
+    void *stack;                   // NULL for the boot stacks in linker.ld
+    uint64_t wake_at;              // Counter value to wake at, while sleeping
+    uint64_t switched_in;          // Counter value it last started running at
+    uint64_t run_ticks;            // Counter ticks spent running
+    uint64_t switches;             // Times switched to
+    uint64_t migrations;           // Times stolen by another core
+    void *local;                   // Owned by the code the thread runs;
+                                   // the scheduler never touches it
+} thread_t;
+
+/*
+ * Per-core scheduler statistics
+ */
+typedef struct {
+    uint64_t switches;             // Context switches
+    uint64_t preemptions;          // ... forced by an interrupt
+    uint64_t steals;               // Threads taken from other cores
+    int ready;                     // Threads waiting in the run queue now
+} sched_stats_t;
+
+/*
+ * A lock that may be held for a long time (across disk I/O, say):
+ * waiting threads let others run instead of spinning
+ */
+typedef struct {
+    volatile uint32_t locked;
+} mutex_t;
+
+#define MUTEX_INIT { 0 }
+
+/*
+ * Get the calling thread (NULL before sched_init)
+ * Kept in TPIDR_EL1, which context_switch sets; the host build supplies
+ * its own (see tests/host.c).
+ */
+#ifdef HOST_BUILD
+thread_t *thread_current(void);
+#else
+static inline thread_t *thread_current(void) {
+    uint64_t t;
+    __asm__ volatile("mrs %0, tpidr_el1" : "=r"(t));
+    return (thread_t *)t;
+}
+#endif
+
+/*
+ * Keep the calling thread on its core until preempt_enable: for code
+ * that uses per-CPU data with interrupts unmasked. Nests.
+ * A switch that comes due meanwhile waits for the next interrupt.
+ */
+static inline void preempt_disable(void) {
+    thread_t *t = thread_current();
+
+    if (t != NULL) {
+        t->preempt_count++;
+    }
+    __asm__ volatile("" ::: "memory");
+}
+
+static inline void preempt_enable(void) {
+    thread_t *t = thread_current();
+
+    __asm__ volatile("" ::: "memory");
+    if (t != NULL) {
+        t->preempt_count--;
+    }
+}
+
+/*
+ * Turn the calling flow into the main thread on core 0 and create core
+ * 0's idle thread (after the page allocator and malloc are up)
+ */
+void sched_init(void);
+
+/*
+ * Turn a secondary core's boot flow into its idle thread
+ */
+void sched_init_cpu(int cpu);
+
+/*
+ * Start a thread running fn(arg); returning from fn ends the thread
+ * cpu pins it to one core, or is THREAD_ANY_CPU.
+ * Returns the thread ID, or -1 if out of memory or the core is offline
+ */
+int thread_create(const char *name, thread_fn fn, void *arg, int cpu);
+
+/*
+ * Let other ready threads on this core run first
+ */
+void thread_yield(void);
+
+/*
+ * Sleep for at least ms milliseconds (rounded up to timer ticks)
+ * Without a GIC, yields until the time is up instead.
+ */
+void thread_sleep_ms(uint64_t ms);
+
+/*
+ * End the calling thread
+ */
+void thread_exit(void) __attribute__((noreturn));
+
+/*
+ * Copy up to max threads into out, for listing
+ * Returns the number copied
+ */
+int sched_threads(thread_t *out, int max);
+
+/*
+ * Get a core's scheduler statistics
+ */
+void sched_get_stats(int cpu, sched_stats_t *stats);
+
+/*
+ * Timer tick on the calling core (interrupts masked): wake sleepers,
+ * note when the running thread's slice is up
+ */
+void sched_tick(void);
+
+/*
+ * Switch threads if a tick asked for it (end of irq_handle, interrupts
+ * masked); returns once this thread is picked again
+ */
+void sched_preempt(void);
+
+/*
+ * Run another ready thread, if the core has one (cpu_idle, interrupts
+ * masked)
+ * Returns 1 if another thread ran (the caller should check again
+ * whatever it is waiting for), 0 if there was nothing to run
+ */
+int sched_switch_idle(void);
+
+/*
+ * Mutex
+ */
+int mutex_trylock(mutex_t *m);
+void mutex_lock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+
+#endif // __ASSEMBLER__
+
+#endif // SCHED_H
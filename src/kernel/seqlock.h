@@ -0,0 +1,83 @@
+/*
+ * Sequence Lock Header
+ *
+ * For data that is read far more often than it is written, and is small
+ * enough to copy. Writers take a spinlock and bump a sequence count
+ * before and after changing the data, so it is odd while a change is
+ * under way. Readers take no lock and write nothing shared: they note
+ * the count, copy the data, and try again if the count was odd or has
+ * moved since. Readers never hold up writers or each other.
+ *
+ *     uint32_t seq;
+ *     do {
+ *         seq = seq_read_begin(&lock);
+ *         copy = shared;
+ *     } while (seq_read_retry(&lock, seq));
+ *
+ * A reader may see a half-changed copy before it retries, so it must
+ * not follow pointers out of it until seq_read_retry says the copy is
+ * good.
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdint.h>
+#include "spinlock.h"
+
+/*
+ * Sequence lock type
+ */
+typedef struct {
+    volatile uint32_t seq;      // Odd while a writer is changing the data
+    spinlock_t lock;            // Serializes writers
+} seqlock_t;
+
+/*
+ * Static initializer
+ */
+#define SEQLOCK_INIT { 0, SPINLOCK_INIT }
+
+/*
+ * Start a read: wait out any writer and return the count to check
+ * against
+ */
+static inline uint32_t seq_read_begin(seqlock_t *s) {
+    uint32_t seq;
+
+    while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1) {
+        // A writer is busy
+    }
+    return seq;
+}
+
+/*
+ * Finish a read
+ * Returns 1 if a writer got in since seq_read_begin (read again), 0 if
+ * what was read is consistent. The fence keeps the data loads before
+ * the second load of the count.
+ */
+static inline int seq_read_retry(seqlock_t *s, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/*
+ * Start a change: lock out other writers, and make readers retry
+ * The fence keeps the data stores after the count becomes odd.
+ */
+static inline void seq_write_lock(seqlock_t *s) {
+    spin_lock(&s->lock);
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+ * Finish a change
+ */
+static inline void seq_write_unlock(seqlock_t *s) {
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+    spin_unlock(&s->lock);
+}
+
+#endif // SEQLOCK_H
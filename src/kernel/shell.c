@@ -8,13 +8,45 @@
 #include "shell.h"
 #include "uart.h"
 #include "string.h"
+#include "smp.h"
+#include "memory.h"
+#include "page_alloc.h"
+#include "trace.h"
+#include "irq.h"
+#include "timer.h"
+#include "bench.h"
+#include "bcache.h"
+#include "virtio_blk.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "mpmc.h"
 #include "../filesystem/memfs.h"
+#include "../filesystem/fslog.h"
 
 /*
  * Command buffer
  */
 static char command_buffer[MAX_COMMAND_LEN];
 
+/*
+ * Held while a command changes memfs or uses the disk, which only one
+ * thread may do at a time (the shell, background jobs and the log
+ * flusher). Commands that only read files, like ls and pwd, don't take
+ * it: memfs readers run alongside a change (see memfs.h). cat holds it
+ * just to open and close its view.
+ */
+static mutex_t files_lock = MUTEX_INIT;
+
+/*
+ * Shell state kept per thread, in thread_t.local: one for the shell's
+ * own thread and one in each bg job
+ */
+typedef struct {
+    int source_depth;           // Scripts running (see cmd_source)
+} shell_thread_t;
+
+static shell_thread_t shell_main_thread;
+
 /*
  * Parse command into arguments
  * Returns number of arguments
@@ -60,24 +92,136 @@ static int parse_command(char *cmd, char **argv) {
     return argc;
 }
 
+/*
+ * Command table
+ *
+ * The SHELL_COMMAND entries from every file, between these two symbols
+ * (see linker.ld). shell_run indexes them before the first command:
+ *
+ * - commands lists them sorted by name, for help
+ * - command_slots is a perfect hash table: a seed is picked so that
+ *   every name hashes to a slot of its own, and finding a command is
+ *   then one hash and one string compare however many there are
+ */
+#define SHELL_MAX_COMMANDS 64
+#define SHELL_HASH_SLOTS   256   // Power of two; four times the commands
+                                 // makes a free seed quick to find
+
+extern const shell_command_t __shell_commands_start[];
+extern const shell_command_t __shell_commands_end[];
+
+static const shell_command_t *commands[SHELL_MAX_COMMANDS];
+static int command_count;
+static const shell_command_t *command_slots[SHELL_HASH_SLOTS];
+static uint32_t command_seed;
+
+/*
+ * Hash a command name with a seed (FNV-1a with the seed mixed into the
+ * offset basis)
+ */
+static uint32_t command_hash(const char *name, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ (seed * 0x9E3779B1u);
+
+    while (*name != '\0') {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Try a seed: put every command in its slot
+ * Returns 0 if no two names shared a slot, -1 if they did
+ */
+static int command_try_seed(uint32_t seed) {
+    memset(command_slots, 0, sizeof(command_slots));
+
+    for (int i = 0; i < command_count; i++) {
+        uint32_t slot = command_hash(commands[i]->name, seed) & (SHELL_HASH_SLOTS - 1);
+        if (command_slots[slot] != NULL) {
+            return -1;
+        }
+        command_slots[slot] = commands[i];
+    }
+    return 0;
+}
+
+/*
+ * Build the sorted list and the hash table from the linker's table
+ * A command registered twice, or past SHELL_MAX_COMMANDS, is left out
+ * with a warning.
+ */
+static void command_table_init(void) {
+    command_count = 0;
+
+    for (const shell_command_t *c = __shell_commands_start; c < __shell_commands_end; c++) {
+        int pos = 0;
+        while (pos < command_count && strcmp(commands[pos]->name, c->name) < 0) {
+            pos++;
+        }
+        if ((pos < command_count && strcmp(commands[pos]->name, c->name) == 0) ||
+            command_count == SHELL_MAX_COMMANDS) {
+            uart_puts("Warning: Command '");
+            uart_puts(c->name);
+            uart_puts("' not registered.\n");
+            continue;
+        }
+
+        // Insertion sort: shift the later names up one
+        for (int i = command_count; i > pos; i--) {
+            commands[i] = commands[i - 1];
+        }
+        commands[pos] = c;
+        command_count++;
+    }
+
+    command_seed = 0;
+    while (command_try_seed(command_seed) != 0) {
+        command_seed++;
+    }
+}
+
+/*
+ * Find a command by name
+ * Returns its entry, or NULL if there's no such command
+ */
+static const shell_command_t *find_command(const char *name) {
+    const shell_command_t *c =
+        command_slots[command_hash(name, command_seed) & (SHELL_HASH_SLOTS - 1)];
+
+    return (c != NULL && strcmp(c->name, name) == 0) ? c : NULL;
+}
+
 /*
  * Command: help
- * Display available commands
+ * List every registered command, with its arguments
  */
 static void cmd_help(int argc, char **argv) {
     (void)argc;
     (void)argv;
 
     uart_puts("\nAvailable commands:\n");
-    uart_puts("  help              - Show this help message\n");
-    uart_puts("  clear             - Clear the screen\n");
-    uart_puts("  echo <text>       - Print text to console\n");
-    uart_puts("  ls                - List all files\n");
-    uart_puts("  cat <filename>    - Display file contents\n");
-    uart_puts("  edit <file> <txt> - Create/edit a file\n");
-    uart_puts("  rm <filename>     - Delete a file\n");
+    for (int i = 0; i < command_count; i++) {
+        const shell_command_t *c = commands[i];
+        size_t len = strlen(c->name);
+
+        uart_puts("  ");
+        uart_puts(c->name);
+        if (c->args[0] != '\0') {
+            uart_putc(' ');
+            uart_puts(c->args);
+            len += 1 + strlen(c->args);
+        }
+        do {
+            uart_putc(' ');     // Line the descriptions up
+        } while (++len < 18);
+        uart_puts("- ");
+        uart_puts(c->help);
+        uart_putc('\n');
+    }
     uart_puts("\n");
 }
+SHELL_COMMAND(help, cmd_help, "", "Show this help message", 0);
 
 /*
  * Command: clear
@@ -92,6 +236,7 @@ static void cmd_clear(int argc, char **argv) {
      */
     uart_puts("\033[2J\033[H");
 }
+SHELL_COMMAND(clear, cmd_clear, "", "Clear the screen", 0);
 
 /*
  * Command: echo
@@ -106,63 +251,155 @@ static void cmd_echo(int argc, char **argv) {
     }
     uart_putc('\n');
 }
+SHELL_COMMAND(echo, cmd_echo, "<text>", "Print text to console", 0);
+
+/*
+ * Entries listed so far by ls
+ */
+static int ls_count;
 
 /*
  * Callback for listing files
  */
-static void list_file_callback(const char *name, size_t size) {
-    uart_puts("  ");
-    uart_puts(name);
-    uart_puts(" (");
+static void list_file_callback(const char *name, size_t size, int is_dir) {
+    if (ls_count++ == 0) {
+        uart_puts("Files:\n");
+    }
+
+    /*
+     * Build the whole line, then write it in one go
+     */
+    char line[MAX_FILENAME_LEN + 48];
+    size_t pos = 0;
+    size_t name_len = strlen(name);
+
+    line[pos++] = ' ';
+    line[pos++] = ' ';
+    memcpy(&line[pos], name, name_len);
+    pos += name_len;
+
+    if (is_dir) {
+        line[pos++] = '/';
+        line[pos++] = '\n';
+        uart_write(line, pos);
+        return;
+    }
+
+    line[pos++] = ' ';
+    line[pos++] = '(';
 
-    // Convert size to string and print
-    char size_str[32];
-    int pos = 0;
+    // Convert size to string (reverse order)
+    char digits[24];
+    int count = 0;
     size_t temp = size;
 
-    if (temp == 0) {
-        size_str[pos++] = '0';
-    } else {
-        // Convert number to string (reverse order)
-        int start = pos;
-        while (temp > 0) {
-            size_str[pos++] = '0' + (temp % 10);
-            temp /= 10;
-        }
-        // Reverse the digits
-        for (int i = start, j = pos - 1; i < j; i++, j--) {
-            char c = size_str[i];
-            size_str[i] = size_str[j];
-            size_str[j] = c;
-        }
+    do {
+        digits[count++] = '0' + (temp % 10);
+        temp /= 10;
+    } while (temp > 0);
+    while (count > 0) {
+        line[pos++] = digits[--count];
     }
 
-    size_str[pos] = '\0';
-    uart_puts(size_str);
-    uart_puts(" bytes)\n");
+    memcpy(&line[pos], " bytes)\n", 8);
+    pos += 8;
+
+    uart_write(line, pos);
 }
 
 /*
  * Command: ls
- * List all files
+ * List the files and directories in the current directory
  */
 static void cmd_ls(int argc, char **argv) {
     (void)argc;
     (void)argv;
 
-    int count = fs_get_file_count();
+    ls_count = 0;
+    fs_list_files(list_file_callback);
 
-    if (count == 0) {
+    if (ls_count == 0) {
         uart_puts("No files.\n");
-    } else {
-        uart_puts("Files:\n");
-        fs_list_files(list_file_callback);
     }
 }
+SHELL_COMMAND(ls, cmd_ls, "", "List the current directory", 0);
+
+/*
+ * Command: mkdir
+ * Create a directory
+ */
+static void cmd_mkdir(int argc, char **argv) {
+    if (argc < 2) {
+        uart_puts("Usage: mkdir <directory>\n");
+        return;
+    }
+
+    if (fs_mkdir(argv[1]) != 0) {
+        uart_puts("Error: Could not create directory '");
+        uart_puts(argv[1]);
+        uart_puts("'.\n");
+    }
+}
+SHELL_COMMAND(mkdir, cmd_mkdir, "<dir>", "Create a directory", SHELL_CMD_FILES);
+
+/*
+ * Command: rmdir
+ * Delete an empty directory
+ */
+static void cmd_rmdir(int argc, char **argv) {
+    if (argc < 2) {
+        uart_puts("Usage: rmdir <directory>\n");
+        return;
+    }
+
+    if (fs_rmdir(argv[1]) != 0) {
+        uart_puts("Error: '");
+        uart_puts(argv[1]);
+        uart_puts("' is not an empty directory.\n");
+    }
+}
+SHELL_COMMAND(rmdir, cmd_rmdir, "<dir>", "Delete an empty directory", SHELL_CMD_FILES);
+
+/*
+ * Command: cd
+ * Change the current directory (to the root with no argument)
+ */
+static void cmd_cd(int argc, char **argv) {
+    const char *path = (argc < 2) ? "/" : argv[1];
+
+    if (fs_chdir(path) != 0) {
+        uart_puts("Error: No such directory '");
+        uart_puts(path);
+        uart_puts("'.\n");
+    }
+}
+SHELL_COMMAND(cd, cmd_cd, "[dir]", "Change directory (root if none)", SHELL_CMD_FILES);
+
+/*
+ * Command: pwd
+ * Print the current directory
+ */
+static void cmd_pwd(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    char path[FS_PATH_MAX];
+
+    if (fs_getcwd(path, sizeof(path)) != 0) {
+        uart_puts("Error: Path too long.\n");
+        return;
+    }
+    uart_puts(path);
+    uart_putc('\n');
+}
+SHELL_COMMAND(pwd, cmd_pwd, "", "Show the current directory", 0);
 
 /*
  * Command: cat
  * Display file contents
+ * files_lock is only held to open and close the view, where block
+ * reference counts change; the file is sent from the view without it,
+ * so edits and log commits go ahead while a large file prints.
  */
 static void cmd_cat(int argc, char **argv) {
     if (argc < 2) {
@@ -170,18 +407,36 @@ static void cmd_cat(int argc, char **argv) {
         return;
     }
 
-    const char *content = fs_read_file(argv[1]);
-
-    if (content == NULL) {
+    fs_view_t view;
+    mutex_lock(&files_lock);
+    int opened = fs_view_open(argv[1], &view);
+    mutex_unlock(&files_lock);
+    if (opened != 0) {
         uart_puts("Error: File '");
         uart_puts(argv[1]);
         uart_puts("' not found.\n");
         return;
     }
 
-    uart_puts(content);
+    /*
+     * Send the file's blocks straight to the UART, with no copy
+     */
+    const char *data;
+    size_t offset = 0;
+    size_t n;
+
+    while ((n = fs_view_chunk(&view, offset, &data)) > 0) {
+        uart_write(data, n);
+        offset += n;
+    }
+
+    mutex_lock(&files_lock);
+    fs_view_close(&view);
+    mutex_unlock(&files_lock);
+
     uart_putc('\n');
 }
+SHELL_COMMAND(cat, cmd_cat, "<filename>", "Display file contents", 0);
 
 /*
  * Command: edit
@@ -218,6 +473,41 @@ static void cmd_edit(int argc, char **argv) {
         uart_puts("Error: Could not save file.\n");
     }
 }
+SHELL_COMMAND(edit, cmd_edit, "<file> <txt>", "Create/edit a file", SHELL_CMD_FILES);
+
+/*
+ * Command: append
+ * Add a line to the end of a file, creating it if needed
+ */
+static void cmd_append(int argc, char **argv) {
+    if (argc < 3) {
+        uart_puts("Usage: append <filename> <content>\n");
+        return;
+    }
+
+    char line[MAX_COMMAND_LEN + 1];
+    line[0] = '\0';
+
+    for (int i = 2; i < argc; i++) {
+        strcat(line, argv[i]);
+        if (i < argc - 1) {
+            strcat(line, " ");
+        }
+    }
+    strcat(line, "\n");
+
+    /*
+     * Only the new bytes are written, however long the file already is
+     */
+    int fd = fs_open(argv[1], FS_O_CREATE);
+    if (fd < 0 || fs_append(fd, line, strlen(line)) < 0) {
+        uart_puts("Error: Could not append to file.\n");
+    }
+    if (fd >= 0) {
+        fs_close(fd);
+    }
+}
+SHELL_COMMAND(append, cmd_append, "<f> <txt>", "Add a line to the end of a file", SHELL_CMD_FILES);
 
 /*
  * Command: rm
@@ -239,53 +529,1528 @@ static void cmd_rm(int argc, char **argv) {
         uart_puts("' not found.\n");
     }
 }
+SHELL_COMMAND(rm, cmd_rm, "<filename>", "Delete a file", SHELL_CMD_FILES);
 
 /*
- * Execute a command
+ * Work item for cpus: record which core ran it
  */
-static void execute_command(char *cmd) {
-    char *argv[MAX_ARGS];
-    int argc = parse_command(cmd, argv);
+static volatile int cpu_checkin[MAX_CPUS];
 
-    if (argc == 0) {
-        return;  // Empty command
+static void cpu_checkin_work(void *arg) {
+    (void)arg;
+    cpu_checkin[smp_cpu_id()] = 1;
+}
+
+/*
+ * Idle time and timer count at the previous `cpus`, for utilization
+ */
+static uint64_t cpus_last_idle[MAX_CPUS];
+static uint64_t cpus_last_time;
+
+/*
+ * Command: cpus
+ * Dispatch a work item to every online core and report which ran it,
+ * and how busy each core was since the last `cpus`
+ */
+static void cmd_cpus(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    uint64_t now = timer_ticks();
+    uint64_t elapsed = (now > cpus_last_time) ? now - cpus_last_time : 1;
+    cpus_last_time = now;
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        cpu_checkin[cpu] = 0;
     }
 
-    /*
-     * Dispatch to appropriate command handler
-     */
-    if (strcmp(argv[0], "help") == 0) {
-        cmd_help(argc, argv);
-    } else if (strcmp(argv[0], "clear") == 0) {
-        cmd_clear(argc, argv);
-    } else if (strcmp(argv[0], "echo") == 0) {
-        cmd_echo(argc, argv);
-    } else if (strcmp(argv[0], "ls") == 0) {
-        cmd_ls(argc, argv);
-    } else if (strcmp(argv[0], "cat") == 0) {
-        cmd_cat(argc, argv);
-    } else if (strcmp(argv[0], "edit") == 0) {
-        cmd_edit(argc, argv);
-    } else if (strcmp(argv[0], "rm") == 0) {
-        cmd_rm(argc, argv);
-    } else {
-        uart_puts("Unknown command: ");
-        uart_puts(argv[0]);
-        uart_puts("\nType 'help' for available commands.\n");
+    smp_call_all(cpu_checkin_work, NULL);
+
+    uart_puts("CPUs online: ");
+    uart_put_dec((uint64_t)smp_num_cpus());
+    uart_putc('\n');
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!smp_cpu_online(cpu)) {
+            continue;
+        }
+        uart_puts("  CPU ");
+        uart_put_dec((uint64_t)cpu);
+        uart_puts(cpu_checkin[cpu] ? ": ran work item" : ": no response");
+        uart_puts(" (");
+        uart_put_dec(smp_cpu_data(cpu)->work_done);
+        uart_puts(" items total), ");
+
+        uint64_t idle = smp_cpu_data(cpu)->idle_ticks;
+        uint64_t idle_delta = idle - cpus_last_idle[cpu];
+        cpus_last_idle[cpu] = idle;
+        if (idle_delta > elapsed) {
+            idle_delta = elapsed;
+        }
+        uart_put_dec(100 - idle_delta * 100 / elapsed);
+        uart_puts("% busy, ");
+        uart_put_dec(irq_count(cpu));
+        uart_puts(" interrupts\n");
     }
 }
+SHELL_COMMAND(cpus, cmd_cpus, "", "Run a work item on every CPU core", 0);
 
 /*
- * Main shell loop
+ * Command: mem
+ * Show allocator statistics
  */
-void shell_run(void) {
-    uart_puts("\n");
-    uart_puts("========================================\n");
-    uart_puts("       Welcome to MyOS Shell!          \n");
-    uart_puts("========================================\n");
-    uart_puts("\n");
-    uart_puts("Type 'help' for available commands.\n");
-    uart_puts("\n");
+static void cmd_mem(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    memory_stats_t stats;
+    memory_get_stats(&stats);
+
+    uart_puts("Heap usage:\n");
+    uart_puts("  Live:          ");
+    uart_put_dec(stats.live_bytes);
+    uart_puts(" bytes in ");
+    uart_put_dec(stats.live_allocations);
+    uart_puts(" allocations\n");
+    uart_puts("  CPU caches:    ");
+    uart_put_dec(stats.cached_bytes);
+    uart_puts(" bytes\n");
+    uart_puts("  Slab pages:    ");
+    uart_put_dec(stats.slab_bytes);
+    uart_puts(" bytes\n");
+    uart_puts("  Large heap:    ");
+    uart_put_dec(stats.heap_bytes);
+    uart_puts(" bytes\n");
+    uart_puts("  Free:          ");
+    uart_put_dec(stats.free_bytes);
+    uart_puts(" bytes (largest block ");
+    uart_put_dec(stats.largest_free);
+    uart_puts(")\n");
+    uart_puts("  Fragmentation: ");
+    uart_put_dec((uint64_t)stats.fragmentation);
+    uart_puts("%\n");
+    uart_puts("  RAM pages:     ");
+    uart_put_dec(page_free_count());
+    uart_puts(" free of ");
+    uart_put_dec(page_total_count());
+    uart_puts(" (4KB each)\n");
+}
+SHELL_COMMAND(mem, cmd_mem, "", "Show heap usage and fragmentation", 0);
+
+/*
+ * Parse a decimal number, returning fallback if str isn't one
+ */
+uint64_t shell_parse_number(const char *str, uint64_t fallback) {
+    uint64_t value = 0;
+
+    if (str == NULL || *str == '\0') {
+        return fallback;
+    }
+    while (*str >= '0' && *str <= '9') {
+        value = value * 10 + (uint64_t)(*str - '0');
+        str++;
+    }
+    return (*str == '\0') ? value : fallback;
+}
+
+/*
+ * memstress state shared by all participating cores
+ */
+#define MEMSTRESS_BATCH 16
+
+static volatile int memstress_go;
+static int memstress_iterations;
+static uint64_t memstress_ticks[MAX_CPUS];
+
+/*
+ * memstress worker: allocate a batch of mixed small sizes, free it,
+ * repeat. Waits for memstress_go so all cores start together.
+ */
+static void memstress_work(void *arg) {
+    void *ptrs[MEMSTRESS_BATCH];
+    (void)arg;
+
+    while (!__atomic_load_n(&memstress_go, __ATOMIC_ACQUIRE)) {
+        // Wait for the start signal
+    }
+
+    uint64_t start = timer_ticks();
+
+    for (int i = 0; i < memstress_iterations; i++) {
+        for (int j = 0; j < MEMSTRESS_BATCH; j++) {
+            ptrs[j] = malloc(16 + (size_t)((i + j) * 40) % 1024);
+        }
+        for (int j = 0; j < MEMSTRESS_BATCH; j++) {
+            free(ptrs[j]);
+        }
+    }
+
+    memstress_ticks[smp_cpu_id()] = timer_ticks() - start;
+}
+
+/*
+ * Run memstress on ncpus cores (the caller plus ncpus - 1 others)
+ * Returns total operations per second
+ */
+static uint64_t memstress_run(int ncpus) {
+    int self = smp_cpu_id();
+    int used[MAX_CPUS];
+    int count = 0;
+
+    memstress_go = 0;
+    for (int cpu = 0; cpu < MAX_CPUS && count < ncpus - 1; cpu++) {
+        if (cpu != self && smp_cpu_online(cpu) &&
+            smp_call_on_cpu(cpu, memstress_work, NULL) == 0) {
+            used[count++] = cpu;
+        }
+    }
+
+    __atomic_store_n(&memstress_go, 1, __ATOMIC_RELEASE);
+    memstress_work(NULL);
+
+    uint64_t slowest = memstress_ticks[self];
+    for (int i = 0; i < count; i++) {
+        smp_wait_cpu(used[i]);
+        if (memstress_ticks[used[i]] > slowest) {
+            slowest = memstress_ticks[used[i]];
+        }
+    }
+
+    if (slowest == 0) {
+        slowest = 1;
+    }
+
+    uint64_t ops = (uint64_t)(count + 1) * (uint64_t)memstress_iterations * MEMSTRESS_BATCH * 2;
+    return ops * timer_freq() / slowest;
+}
+
+/*
+ * Command: memstress
+ * Measure malloc/free throughput with 1, 2, 4, ... cores
+ */
+static void cmd_memstress(int argc, char **argv) {
+    memstress_iterations = (int)shell_parse_number(argc > 1 ? argv[1] : NULL, 10000);
+    int online = smp_num_cpus();
+
+    uart_puts("malloc/free throughput (");
+    uart_put_dec((uint64_t)memstress_iterations * MEMSTRESS_BATCH);
+    uart_puts(" pairs per core):\n");
+
+    int ncpus = 1;
+    while (1) {
+        uint64_t ops = memstress_run(ncpus);
+
+        uart_puts("  ");
+        uart_put_dec((uint64_t)ncpus);
+        uart_puts(" core(s): ");
+        uart_put_dec(ops);
+        uart_puts(" ops/sec (");
+        uart_put_dec(ops / (uint64_t)ncpus);
+        uart_puts(" per core)\n");
+
+        if (ncpus == online) {
+            break;
+        }
+        ncpus = (ncpus * 2 < online) ? ncpus * 2 : online;
+    }
+}
+SHELL_COMMAND(memstress, cmd_memstress, "[iters]", "Multi-core malloc/free benchmark", 0);
+
+/*
+ * lockstress state shared by all participating cores
+ */
+#define LOCKSTRESS_RING_SLOTS 64
+
+enum { LOCKSTRESS_LOCK, LOCKSTRESS_RING };
+
+static volatile int lockstress_go;
+static int lockstress_iterations;
+static uint64_t lockstress_ticks[MAX_CPUS];
+static spinlock_t lockstress_lock = SPINLOCK_INIT;
+static uint64_t lockstress_counter;
+static mpmc_slot_t lockstress_slots[LOCKSTRESS_RING_SLOTS];
+static mpmc_ring_t lockstress_ring;
+static uint64_t lockstress_pushed;
+static uint64_t lockstress_popped;
+
+/*
+ * lockstress worker: either take the shared lock to bump a counter, or
+ * push a number into the shared ring and pop one back (not necessarily
+ * the same one), adding up what went in and what came out
+ */
+static void lockstress_work(void *arg) {
+    int phase = *(const int *)arg;
+    uint64_t pushed = 0;
+    uint64_t popped = 0;
+
+    while (!__atomic_load_n(&lockstress_go, __ATOMIC_ACQUIRE)) {
+        // Wait for the start signal
+    }
+
+    uint64_t start = timer_ticks();
+
+    for (int i = 0; i < lockstress_iterations; i++) {
+        if (phase == LOCKSTRESS_LOCK) {
+            spin_lock(&lockstress_lock);
+            lockstress_counter++;
+            spin_unlock(&lockstress_lock);
+            continue;
+        }
+
+        uintptr_t value = ((uintptr_t)smp_cpu_id() << 32) | (uintptr_t)(i + 1);
+        void *item;
+        while (mpmc_push(&lockstress_ring, (void *)value) != 0) {
+            // Full (every other core got in first); they will pop
+        }
+        pushed += value;
+        while (mpmc_pop(&lockstress_ring, &item) != 0) {
+            // Someone took ours; more are on the way
+        }
+        popped += (uintptr_t)item;
+    }
+
+    lockstress_ticks[smp_cpu_id()] = timer_ticks() - start;
+    __atomic_fetch_add(&lockstress_pushed, pushed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lockstress_popped, popped, __ATOMIC_RELAXED);
+}
+
+/*
+ * Run one lockstress phase on ncpus cores, as memstress_run does
+ * Returns total operations per second, or 0 if the totals don't add up
+ */
+static uint64_t lockstress_run(int ncpus, int phase) {
+    int self = smp_cpu_id();
+    int used[MAX_CPUS];
+    int count = 0;
+
+    lockstress_go = 0;
+    lockstress_counter = 0;
+    lockstress_pushed = 0;
+    lockstress_popped = 0;
+    mpmc_init(&lockstress_ring, lockstress_slots, LOCKSTRESS_RING_SLOTS);
+
+    for (int cpu = 0; cpu < MAX_CPUS && count < ncpus - 1; cpu++) {
+        if (cpu != self && smp_cpu_online(cpu) &&
+            smp_call_on_cpu(cpu, lockstress_work, &phase) == 0) {
+            used[count++] = cpu;
+        }
+    }
+
+    __atomic_store_n(&lockstress_go, 1, __ATOMIC_RELEASE);
+    lockstress_work(&phase);
+
+    uint64_t slowest = lockstress_ticks[self];
+    for (int i = 0; i < count; i++) {
+        smp_wait_cpu(used[i]);
+        if (lockstress_ticks[used[i]] > slowest) {
+            slowest = lockstress_ticks[used[i]];
+        }
+    }
+
+    uint64_t ops = (uint64_t)(count + 1) * (uint64_t)lockstress_iterations;
+    if (phase == LOCKSTRESS_LOCK ? lockstress_counter != ops
+                                 : lockstress_pushed != lockstress_popped ||
+                                   mpmc_count(&lockstress_ring) != 0) {
+        return 0;
+    }
+
+    if (slowest == 0) {
+        slowest = 1;
+    }
+    return ops * timer_freq() / slowest;
+}
+
+/*
+ * Command: lockstress
+ * Check the ticket lock and the lock-free ring on 1, 2, 4, ... cores,
+ * and measure their throughput as contention grows
+ */
+static void cmd_lockstress(int argc, char **argv) {
+    lockstress_iterations = (int)shell_parse_number(argc > 1 ? argv[1] : NULL, 100000);
+    int online = smp_num_cpus();
+
+    uart_puts("Lock and ring throughput (");
+    uart_put_dec((uint64_t)lockstress_iterations);
+    uart_puts(" operations per core):\n");
+
+    int ncpus = 1;
+    while (1) {
+        uint64_t lock_ops = lockstress_run(ncpus, LOCKSTRESS_LOCK);
+        uint64_t ring_ops = lockstress_run(ncpus, LOCKSTRESS_RING);
+
+        uart_puts("  ");
+        uart_put_dec((uint64_t)ncpus);
+        uart_puts(" core(s): ");
+        if (lock_ops == 0 || ring_ops == 0) {
+            uart_puts(lock_ops == 0 ? "FAILED: lost lock updates\n"
+                                    : "FAILED: ring items lost or duplicated\n");
+            return;
+        }
+        uart_puts("lock ");
+        uart_put_dec(lock_ops);
+        uart_puts(" ops/sec, ring ");
+        uart_put_dec(ring_ops);
+        uart_puts(" push+pop/sec\n");
+
+        if (ncpus == online) {
+            break;
+        }
+        ncpus = (ncpus * 2 < online) ? ncpus * 2 : online;
+    }
+}
+SHELL_COMMAND(lockstress, cmd_lockstress, "[iters]", "Multi-core lock and ring stress test", 0);
+
+/*
+ * fsscale state shared by all participating cores
+ */
+#define FSSCALE_FILES       8
+#define FSSCALE_FILE_SIZE   256
+#define FSSCALE_WRITE_EVERY 100   // The caller's core writes once per this many
+
+static volatile int fsscale_go;
+static int fsscale_iterations;
+static uint64_t fsscale_ticks[MAX_CPUS];
+static char fsscale_names[FSSCALE_FILES][16];
+
+static void fsscale_count(const char *name, size_t size, int is_dir) {
+    (void)name;
+    (void)size;
+    (void)is_dir;
+}
+
+/*
+ * fsscale worker: a mix of file reads, lookups and listings. The core
+ * that started the run (which holds files_lock, so may change files)
+ * also rewrites a file now and then.
+ */
+static void fsscale_work(void *arg) {
+    int writer = *(const int *)arg == smp_cpu_id();
+    char buf[FSSCALE_FILE_SIZE + 1];
+
+    while (!__atomic_load_n(&fsscale_go, __ATOMIC_ACQUIRE)) {
+        // Wait for the start signal
+    }
+
+    uint64_t start = timer_ticks();
+
+    for (int i = 0; i < fsscale_iterations; i++) {
+        const char *name = fsscale_names[(i + smp_cpu_id()) % FSSCALE_FILES];
+
+        if (writer && i % FSSCALE_WRITE_EVERY == 0) {
+            memset(buf, 'a' + i % 26, FSSCALE_FILE_SIZE);
+            buf[FSSCALE_FILE_SIZE] = '\0';
+            fs_write_file(name, buf);
+        } else if (i % 8 < 5) {
+            fs_read_at(name, 0, buf, FSSCALE_FILE_SIZE);
+        } else if (i % 8 < 7) {
+            fs_file_exists(name);
+        } else {
+            fs_list_files(fsscale_count);
+        }
+    }
+
+    fsscale_ticks[smp_cpu_id()] = timer_ticks() - start;
+}
+
+/*
+ * Run fsscale on ncpus cores, as memstress_run does
+ * Returns total operations per second
+ */
+static uint64_t fsscale_run(int ncpus) {
+    int self = smp_cpu_id();
+    int used[MAX_CPUS];
+    int count = 0;
+
+    fsscale_go = 0;
+    for (int cpu = 0; cpu < MAX_CPUS && count < ncpus - 1; cpu++) {
+        if (cpu != self && smp_cpu_online(cpu) &&
+            smp_call_on_cpu(cpu, fsscale_work, &self) == 0) {
+            used[count++] = cpu;
+        }
+    }
+
+    __atomic_store_n(&fsscale_go, 1, __ATOMIC_RELEASE);
+    fsscale_work(&self);
+
+    uint64_t slowest = fsscale_ticks[self];
+    for (int i = 0; i < count; i++) {
+        smp_wait_cpu(used[i]);
+        if (fsscale_ticks[used[i]] > slowest) {
+            slowest = fsscale_ticks[used[i]];
+        }
+    }
+
+    if (slowest == 0) {
+        slowest = 1;
+    }
+
+    uint64_t ops = (uint64_t)(count + 1) * (uint64_t)fsscale_iterations;
+    return ops * timer_freq() / slowest;
+}
+
+/*
+ * Command: fsscale
+ * Measure read-mostly file system throughput with 1, 2, 4, ... cores:
+ * readers don't lock, so it should grow with the number of cores
+ */
+static void cmd_fsscale(int argc, char **argv) {
+    char content[FSSCALE_FILE_SIZE + 1];
+    int created = 0;
+
+    fsscale_iterations = (int)shell_parse_number(argc > 1 ? argv[1] : NULL, 100000);
+
+    memset(content, 'x', FSSCALE_FILE_SIZE);
+    content[FSSCALE_FILE_SIZE] = '\0';
+    if (bench_scratch_enter() != 0) {
+        uart_puts("Error: File system full\n");
+        return;
+    }
+    while (created < FSSCALE_FILES) {
+        bench_file_name(fsscale_names[created], created);
+        if (fs_write_file(fsscale_names[created], content) != 0) {
+            break;
+        }
+        created++;
+    }
+    if (created < FSSCALE_FILES) {
+        uart_puts("Error: File system full\n");
+        for (int i = 0; i < created; i++) {
+            fs_delete_file(fsscale_names[i]);
+        }
+        bench_scratch_leave();
+        return;
+    }
+
+    uart_puts("Read-mostly throughput (");
+    uart_put_dec((uint64_t)fsscale_iterations);
+    uart_puts(" operations per core, 1 in ");
+    uart_put_dec(FSSCALE_WRITE_EVERY);
+    uart_puts(" a write on one core):\n");
+
+    int online = smp_num_cpus();
+    int ncpus = 1;
+    while (1) {
+        uint64_t ops = fsscale_run(ncpus);
+
+        uart_puts("  ");
+        uart_put_dec((uint64_t)ncpus);
+        uart_puts(" core(s): ");
+        uart_put_dec(ops);
+        uart_puts(" ops/sec (");
+        uart_put_dec(ops / (uint64_t)ncpus);
+        uart_puts(" per core)\n");
+
+        if (ncpus == online) {
+            break;
+        }
+        ncpus = (ncpus * 2 < online) ? ncpus * 2 : online;
+    }
+
+    for (int i = 0; i < FSSCALE_FILES; i++) {
+        fs_delete_file(fsscale_names[i]);
+    }
+    bench_scratch_leave();
+}
+SHELL_COMMAND(fsscale, cmd_fsscale, "[iters]",
+              "Multi-core read-mostly file system benchmark", SHELL_CMD_FILES);
+
+/*
+ * strbench buffers and sizes
+ */
+#define STRBENCH_MAX_SIZE (64 * 1024)
+#define STRBENCH_BYTES    (4 * 1024 * 1024)   // Bytes processed per measurement
+
+static const size_t strbench_sizes[] = {
+    16, 64, 256, 1024, 4096, 16384, 65536
+};
+
+enum { BENCH_MEMCPY, BENCH_MEMSET, BENCH_MEMCMP, BENCH_STRLEN };
+
+static const char *const strbench_names[] = {
+    "memcpy", "memset", "memcmp", "strlen"
+};
+
+/*
+ * Sink for results so the compiler can't drop the calls
+ */
+static volatile uint64_t strbench_sink;
+
+/*
+ * Run one function over size-byte buffers until STRBENCH_BYTES have been
+ * processed. Returns elapsed cycles.
+ */
+static uint64_t strbench_run(int fn, int scalar, char *dst, char *src, size_t size) {
+    uint64_t reps = STRBENCH_BYTES / size;
+    uint64_t sink = 0;
+
+    uint64_t start = timer_cycles();
+    for (uint64_t i = 0; i < reps; i++) {
+        switch (fn) {
+        case BENCH_MEMCPY:
+            scalar ? memcpy_scalar(dst, src, size) : memcpy(dst, src, size);
+            break;
+        case BENCH_MEMSET:
+            scalar ? memset_scalar(dst, (int)i, size) : memset(dst, (int)i, size);
+            break;
+        case BENCH_MEMCMP:
+            sink += (uint64_t)(scalar ? memcmp_scalar(dst, src, size) : memcmp(dst, src, size));
+            break;
+        case BENCH_STRLEN:
+            sink += scalar ? strlen_scalar(src) : strlen(src);
+            break;
+        }
+    }
+    uint64_t elapsed = timer_cycles() - start;
+
+    strbench_sink = sink;
+    return elapsed ? elapsed : 1;
+}
+
+/*
+ * Print bytes per cycle with two decimals
+ */
+static void print_rate(uint64_t bytes, uint64_t cycles) {
+    uint64_t hundredths = bytes * 100 / cycles;
+
+    uart_put_dec(hundredths / 100);
+    uart_putc('.');
+    uart_putc((char)('0' + (hundredths / 10) % 10));
+    uart_putc((char)('0' + hundredths % 10));
+}
+
+/*
+ * Check the optimized functions against the scalar references for every
+ * source/destination alignment and lengths around the 16/64-byte steps
+ * Returns the number of mismatches
+ */
+static int strbench_check(char *a, char *b, char *c) {
+    int errors = 0;
+
+    for (size_t off = 0; off < 16; off++) {
+        for (size_t len = 0; len < 300; len++) {
+            for (size_t i = 0; i < 512; i++) {
+                a[i] = (char)(i * 7 + off + 1);
+                b[i] = 0;
+                c[i] = 0;
+            }
+
+            memcpy(b + off, a + (15 - off), len);
+            memcpy_scalar(c + off, a + (15 - off), len);
+            errors += memcmp_scalar(b, c, 512) != 0;
+
+            memset(b + off, (int)len, len);
+            memset_scalar(c + off, (int)len, len);
+            errors += memcmp_scalar(b, c, 512) != 0;
+
+            if (len > 0) {
+                c[off + len - 1] ^= 0x40;
+            }
+            int r1 = memcmp(b + off, c + off, len);
+            int r2 = memcmp_scalar(b + off, c + off, len);
+            errors += (r1 < 0) != (r2 < 0) || (r1 > 0) != (r2 > 0);
+
+            a[off + len] = '\0';
+            errors += strlen(a + off) != strlen_scalar(a + off);
+        }
+    }
+
+    return errors;
+}
+
+/*
+ * Command: strbench
+ * Check and benchmark the string functions against the scalar versions
+ */
+static void cmd_strbench(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    char *src = malloc(STRBENCH_MAX_SIZE + 1);
+    char *dst = malloc(STRBENCH_MAX_SIZE + 1);
+    char *ref = malloc(STRBENCH_MAX_SIZE + 1);
+
+    if (src == NULL || dst == NULL || ref == NULL) {
+        uart_puts("Error: Out of memory\n");
+        free(src);
+        free(dst);
+        free(ref);
+        return;
+    }
+
+    int errors = strbench_check(src, dst, ref);
+    uart_puts("Self-check: ");
+    if (errors == 0) {
+        uart_puts("OK\n");
+    } else {
+        uart_put_dec((uint64_t)errors);
+        uart_puts(" mismatches\n");
+    }
+
+    uart_puts(timer_has_cycles() ? "Bytes per cycle (optimized / scalar):\n"
+                            : "Bytes per timer tick (optimized / scalar, no PMU):\n");
+
+    for (int fn = BENCH_MEMCPY; fn <= BENCH_STRLEN; fn++) {
+        uart_puts("  ");
+        uart_puts(strbench_names[fn]);
+        uart_puts(":\n");
+
+        for (size_t i = 0; i < sizeof(strbench_sizes) / sizeof(strbench_sizes[0]); i++) {
+            size_t size = strbench_sizes[i];
+
+            /*
+             * memcmp compares equal buffers (the worst case), strlen
+             * measures a string of exactly size bytes
+             */
+            memset(src, 'x', size);
+            memset(dst, 'x', size);
+            src[size] = '\0';
+
+            uint64_t bytes = (STRBENCH_BYTES / size) * size;
+            uint64_t fast = strbench_run(fn, 0, dst, src, size);
+            uint64_t slow = strbench_run(fn, 1, dst, src, size);
+
+            uart_puts("    ");
+            if (size >= 1024) {
+                uart_put_dec(size / 1024);
+                uart_puts("KB");
+            } else {
+                uart_put_dec(size);
+                uart_puts("B");
+            }
+            uart_puts(": ");
+            print_rate(bytes, fast);
+            uart_puts(" / ");
+            print_rate(bytes, slow);
+            uart_putc('\n');
+        }
+    }
+
+    free(src);
+    free(dst);
+    free(ref);
+}
+SHELL_COMMAND(strbench, cmd_strbench, "", "Benchmark memcpy/memset/memcmp/strlen", 0);
+
+/*
+ * Time lookups of names[0..count-1] in turn
+ * Returns nanoseconds per lookup
+ */
+static uint64_t fsbench_lookups(char names[][16], int count, uint64_t lookups) {
+    int found = 0;
+
+    uint64_t start = timer_ticks();
+    for (uint64_t i = 0; i < lookups; i++) {
+        found += fs_file_exists(names[i % (uint64_t)count]);
+    }
+    uint64_t ticks = timer_ticks() - start;
+
+    (void)found;
+    return ticks * 1000000000UL / timer_freq() / lookups;
+}
+
+/*
+ * Command: fsbench
+ * Measure hit and miss lookup latency as the number of files grows
+ */
+static void cmd_fsbench(int argc, char **argv) {
+    static char hit_names[MAX_FILES][16];
+    static char miss_names[MAX_FILES][16];
+    uint64_t lookups = shell_parse_number(argc > 1 ? argv[1] : NULL, 100000);
+    int created = 0;
+
+    if (lookups == 0) {
+        lookups = 1;
+    }
+
+    for (int i = 0; i < MAX_FILES; i++) {
+        bench_file_name(hit_names[i], i);
+        bench_file_name(miss_names[i], MAX_FILES + i);
+    }
+
+    if (bench_scratch_enter() != 0) {
+        uart_puts("Error: File system full\n");
+        return;
+    }
+
+    uart_puts("Lookup latency (");
+    uart_put_dec(lookups);
+    uart_puts(" lookups each):\n");
+
+    int target = 1;
+    while (1) {
+        /*
+         * Grow the file system to target bench files
+         */
+        while (created < target) {
+            if (fs_write_file(hit_names[created], "x") != 0) {
+                break;
+            }
+            created++;
+        }
+        if (created == 0) {
+            uart_puts("Error: File system full\n");
+            break;
+        }
+
+        uint64_t hit_ns = fsbench_lookups(hit_names, created, lookups);
+        uint64_t miss_ns = fsbench_lookups(miss_names, created, lookups);
+
+        uart_puts("  ");
+        uart_put_dec((uint64_t)fs_get_file_count());
+        uart_puts(" files: hit ");
+        uart_put_dec(hit_ns);
+        uart_puts(" ns, miss ");
+        uart_put_dec(miss_ns);
+        uart_puts(" ns\n");
+
+        if (created < target || target == MAX_FILES) {
+            break;
+        }
+        target = (target * 2 < MAX_FILES) ? target * 2 : MAX_FILES;
+    }
+
+    for (int i = 0; i < created; i++) {
+        fs_delete_file(hit_names[i]);
+    }
+    bench_scratch_leave();
+}
+SHELL_COMMAND(fsbench, cmd_fsbench, "[lookups]", "Measure file lookup latency", SHELL_CMD_FILES);
+
+/*
+ * uartbench results for one output method
+ */
+typedef struct {
+    uint64_t ticks;            // Until the last byte left the FIFO
+    uint64_t writer_ticks;     // Until the writer returned
+    uint64_t idle_ticks;       // Time the core spent asleep
+    uart_stats_t stats;        // Bytes and MMIO accesses
+} uartbench_result_t;
+
+static const char uartbench_line[] =
+    "uartbench: the quick brown fox jumps over the lazy dog 0123456\n";
+
+/*
+ * Write lines copies of uartbench_line, a character at a time with
+ * uart_putc or a line at a time with uart_write
+ */
+static void uartbench_run(uint64_t lines, int bulk, uartbench_result_t *r) {
+    const size_t len = sizeof(uartbench_line) - 1;
+    percpu_t *self = this_cpu();
+    uart_stats_t before;
+
+    uart_flush();
+    uart_get_stats(&before);
+    uint64_t idle_before = self->idle_ticks;
+    uint64_t start = timer_ticks();
+
+    for (uint64_t i = 0; i < lines; i++) {
+        if (bulk) {
+            uart_write(uartbench_line, len);
+        } else {
+            for (size_t j = 0; j < len; j++) {
+                uart_putc(uartbench_line[j]);
+            }
+        }
+    }
+    r->writer_ticks = timer_ticks() - start;
+
+    uart_flush();
+    r->ticks = timer_ticks() - start;
+    r->idle_ticks = self->idle_ticks - idle_before;
+
+    uart_get_stats(&r->stats);
+    r->stats.bytes -= before.bytes;
+    r->stats.mmio_accesses -= before.mmio_accesses;
+}
+
+static void uartbench_report(const char *label, const uartbench_result_t *r) {
+    uint64_t freq = timer_freq();
+    uint64_t ticks = r->ticks ? r->ticks : 1;
+    uint64_t bytes = r->stats.bytes ? r->stats.bytes : 1;
+    uint64_t idle = (r->idle_ticks < ticks) ? r->idle_ticks : ticks;
+    uint64_t mmio_x100 = r->stats.mmio_accesses * 100 / bytes;
+
+    uart_puts(label);
+    uart_put_dec(r->stats.bytes * freq / ticks);
+    uart_puts(" chars/s, ");
+    uart_put_dec(mmio_x100 / 100);
+    uart_putc('.');
+    uart_putc((char)('0' + (mmio_x100 / 10) % 10));
+    uart_putc((char)('0' + mmio_x100 % 10));
+    uart_puts(" MMIO/byte, writer ");
+    uart_put_dec(r->writer_ticks * 1000 / freq);
+    uart_puts(" ms, CPU busy ");
+    uart_put_dec(100 - idle * 100 / ticks);
+    uart_puts("%\n");
+}
+
+/*
+ * Command: uartbench
+ * Write a block of text with uart_putc, then with uart_write, and
+ * compare throughput, MMIO accesses per byte and CPU busy time
+ */
+static void cmd_uartbench(int argc, char **argv) {
+    uint64_t kb = shell_parse_number(argc > 1 ? argv[1] : NULL, 16);
+    uint64_t lines = kb * 1024 / (sizeof(uartbench_line) - 1);
+    uartbench_result_t per_char, bulk;
+
+    uartbench_run(lines, 0, &per_char);
+    uartbench_run(lines, 1, &bulk);
+
+    uart_puts("\nSent ");
+    uart_put_dec(bulk.stats.bytes);
+    uart_puts(" bytes each way:\n");
+    uartbench_report("  uart_putc:  ", &per_char);
+    uartbench_report("  uart_write: ", &bulk);
+}
+SHELL_COMMAND(uartbench, cmd_uartbench, "[kb]", "Measure bulk console output", 0);
+
+static void run_command(int argc, char **argv);
+
+/*
+ * Print a duration in microseconds as milliseconds with 3 decimals
+ */
+static void print_ms(uint64_t us) {
+    uart_put_dec(us / 1000);
+    uart_putc('.');
+    uart_putc((char)('0' + (us / 100) % 10));
+    uart_putc((char)('0' + (us / 10) % 10));
+    uart_putc((char)('0' + us % 10));
+    uart_puts(" ms");
+}
+
+/*
+ * Command: time
+ * Run a command and report how long it took, including sending its
+ * output
+ */
+static void cmd_time(int argc, char **argv) {
+    if (argc < 2) {
+        uart_puts("Usage: time <command> [args...]\n");
+        return;
+    }
+
+    uart_flush();
+    uint64_t start_cycles = timer_cycles();
+    uint64_t start = timer_ticks();
+
+    run_command(argc - 1, argv + 1);
+    uart_flush();
+
+    uint64_t ticks = timer_ticks() - start;
+    uint64_t cycles = timer_cycles() - start_cycles;
+
+    uart_puts("\nreal ");
+    print_ms(timer_ticks_to_us(ticks));
+    uart_puts(" (");
+    uart_put_dec(ticks);
+    uart_puts(" timer ticks");
+    if (timer_has_cycles()) {
+        uart_puts(", ");
+        uart_put_dec(cycles);
+        uart_puts(" cycles");
+    }
+    uart_puts(")\n");
+}
+SHELL_COMMAND(time, cmd_time, "<command>", "Run a command and show how long it took", 0);
+
+/*
+ * Command: uptime
+ * Show time since boot and the number of timer ticks
+ */
+static void cmd_uptime(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    uint64_t us = timer_now_us();
+
+    uart_puts("Up ");
+    uart_put_dec(us / 1000000);
+    uart_puts(".");
+    uart_putc((char)('0' + (us / 100000) % 10));
+    uart_putc((char)('0' + (us / 10000) % 10));
+    uart_puts(" s, ");
+    uart_put_dec(timer_jiffies());
+    uart_puts(" ticks at ");
+    uart_put_dec(TIMER_HZ);
+    uart_puts(" Hz (counter ");
+    uart_put_dec(timer_freq());
+    uart_puts(" Hz)\n");
+}
+SHELL_COMMAND(uptime, cmd_uptime, "", "Show time since boot", 0);
+
+/*
+ * Bytes of a block disk read shows
+ */
+#define DISK_SHOW_BYTES 64
+
+static void disk_info(void) {
+    bcache_stats_t stats;
+    bcache_get_stats(&stats);
+
+    uart_puts("Disk: ");
+    uart_put_dec(bcache_blocks());
+    uart_puts(" blocks of ");
+    uart_put_dec(BCACHE_BLOCK_SIZE);
+    uart_puts(" bytes\n");
+    uart_puts("  Cache:      ");
+    uart_put_dec(BCACHE_BUFFERS);
+    uart_puts(" buffers, ");
+    uart_put_dec((uint64_t)stats.dirty);
+    uart_puts(" dirty\n");
+    uart_puts("  Hits:       ");
+    uart_put_dec(stats.hits);
+    uart_puts(", misses ");
+    uart_put_dec(stats.misses);
+    uart_puts("\n");
+    uart_puts("  Read-ahead: ");
+    uart_put_dec(stats.readaheads);
+    uart_puts(" blocks, ");
+    uart_put_dec(stats.readahead_hits);
+    uart_puts(" used\n");
+    uart_puts("  Written:    ");
+    uart_put_dec(stats.writebacks);
+    uart_puts(" blocks\n");
+
+    fslog_stats_t log;
+    fslog_get_stats(&log);
+    if (!fslog_active() && !log.failed) {
+        uart_puts("  No file system log\n");
+        return;
+    }
+
+    if (log.failed) {
+        uart_puts("  Log failed: file changes are no longer saved to the disk\n");
+    }
+    uart_puts("  Log:        ");
+    uart_put_dec(log.live_bytes / 1024);
+    uart_puts(" of ");
+    uart_put_dec(log.log_blocks * BCACHE_BLOCK_SIZE / 1024);
+    uart_puts(" KB in use, ");
+    uart_put_dec(log.pending_bytes);
+    uart_puts(" bytes not committed\n");
+    uart_puts("  Records:    ");
+    uart_put_dec(log.records);
+    uart_puts(" logged, ");
+    uart_put_dec(log.commits);
+    uart_puts(" commits, ");
+    uart_put_dec(log.checkpoints);
+    uart_puts(" checkpoints\n");
+    uart_puts("  Mount:      ");
+    uart_put_dec(log.replayed);
+    uart_puts(" records replayed, ");
+    uart_put_dec(log.replayed_tail);
+    uart_puts(" after the checkpoint\n");
+}
+
+/*
+ * Show the start of a block as text, with dots for anything that isn't
+ * printable
+ */
+static void disk_show(uint64_t block) {
+    char data[DISK_SHOW_BYTES];
+
+    if (bcache_read(block, 0, data, sizeof(data)) != 0) {
+        uart_puts("Error: Could not read block.\n");
+        return;
+    }
+    for (size_t i = 0; i < sizeof(data); i++) {
+        uart_putc(data[i] >= ' ' && data[i] <= '~' ? data[i] : '.');
+    }
+    uart_putc('\n');
+}
+
+/*
+ * Command: disk
+ * Show the disk and cache statistics, read or write the start of a
+ * block through the cache, or write every dirty block back
+ */
+static void cmd_disk(int argc, char **argv) {
+    if (!virtio_blk_ready()) {
+        uart_puts("No disk attached (see 'make disk').\n");
+        return;
+    }
+
+    if (argc < 2) {
+        disk_info();
+    } else if (strcmp(argv[1], "read") == 0 && argc == 3) {
+        disk_show(shell_parse_number(argv[2], UINT64_MAX));
+    } else if (strcmp(argv[1], "write") == 0 && argc >= 4 && fslog_mounted()) {
+        // Every block is the log's headers or log space: writing one
+        // would lose the file system at the next boot
+        uart_puts("Error: The disk holds the file system; 'disk write' is off.\n");
+    } else if (strcmp(argv[1], "write") == 0 && argc >= 4) {
+        char line[MAX_COMMAND_LEN + 1];
+        line[0] = '\0';
+
+        for (int i = 3; i < argc; i++) {
+            strcat(line, argv[i]);
+            if (i < argc - 1) {
+                strcat(line, " ");
+            }
+        }
+        if (bcache_write(shell_parse_number(argv[2], UINT64_MAX), 0, line, strlen(line) + 1) != 0) {
+            uart_puts("Error: Could not write block.\n");
+        }
+    } else if (strcmp(argv[1], "sync") == 0) {
+        if (bcache_sync() != 0) {
+            uart_puts("Error: Some blocks could not be written.\n");
+        }
+    } else {
+        uart_puts("Usage: disk [read <block> | write <block> <text> | sync]\n");
+    }
+}
+SHELL_COMMAND(disk, cmd_disk, "[cmd]", "Disk info, read/write a block, sync", SHELL_CMD_FILES);
+
+/*
+ * Command: sync
+ * Commit file changes to the disk without waiting for the shell to go
+ * idle
+ */
+static void cmd_sync(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    fslog_stats_t log;
+    fslog_get_stats(&log);
+    if (log.failed) {
+        uart_puts("Error: The file system log failed; file changes are no longer\n"
+                  "saved to the disk (see 'disk').\n");
+    } else if (fslog_active()) {
+        if (fslog_commit() != 0) {
+            uart_puts("Error: Could not write the file system log.\n");
+        }
+    } else if (virtio_blk_ready()) {
+        if (bcache_sync() != 0) {
+            uart_puts("Error: Some blocks could not be written.\n");
+        }
+    } else {
+        uart_puts("No disk attached; files are only in memory.\n");
+    }
+}
+SHELL_COMMAND(sync, cmd_sync, "", "Write file changes to the disk now", SHELL_CMD_FILES);
+
+/*
+ * Command: poweroff
+ * Shut down the machine (QEMU exits)
+ */
+static void cmd_poweroff(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    if (fslog_pending() && fslog_commit() != 0) {
+        uart_puts("Warning: File changes could not be written to the disk.\n");
+    }
+    uart_puts("Powering off...\n");
+    uart_flush();
+    smp_system_off();
+    uart_puts("Power off failed\n");
+}
+SHELL_COMMAND(poweroff, cmd_poweroff, "", "Shut down the machine", SHELL_CMD_FILES);
+
+/*
+ * Threads ps can list
+ */
+#define PS_MAX_THREADS 32
+
+static const char *const thread_state_names[] = {
+    "ready", "running", "sleeping", "dead"
+};
+
+/*
+ * Command: ps
+ * List threads, then each core's scheduler statistics
+ */
+static void cmd_ps(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    static thread_t threads[PS_MAX_THREADS];
+
+    int count = sched_threads(threads, PS_MAX_THREADS);
+
+    uart_puts("Threads: ");
+    uart_put_dec((uint64_t)count);
+    uart_putc('\n');
+
+    for (int i = 0; i < count; i++) {
+        thread_t *t = &threads[i];
+
+        uart_puts("  ");
+        uart_put_dec((uint64_t)t->id);
+        uart_puts(" ");
+        uart_puts(t->name);
+        uart_puts(": ");
+        uart_puts(thread_state_names[t->state]);
+        uart_puts(" on CPU ");
+        uart_put_dec((uint64_t)t->cpu);
+        if (t->pinned != THREAD_ANY_CPU) {
+            uart_puts(" (pinned)");
+        }
+        uart_puts(", ");
+        uart_put_dec(timer_ticks_to_us(t->run_ticks) / 1000);
+        uart_puts(" ms run, ");
+        uart_put_dec(t->switches);
+        uart_puts(" switches, ");
+        uart_put_dec(t->migrations);
+        uart_puts(" moves\n");
+    }
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!smp_cpu_online(cpu)) {
+            continue;
+        }
+        sched_stats_t stats;
+        sched_get_stats(cpu, &stats);
+
+        uart_puts("  CPU ");
+        uart_put_dec((uint64_t)cpu);
+        uart_puts(": ");
+        uart_put_dec(stats.switches);
+        uart_puts(" switches, ");
+        uart_put_dec(stats.preemptions);
+        uart_puts(" preempted, ");
+        uart_put_dec(stats.steals);
+        uart_puts(" stolen, ");
+        uart_put_dec((uint64_t)stats.ready);
+        uart_puts(" ready\n");
+    }
+}
+SHELL_COMMAND(ps, cmd_ps, "", "List threads and scheduler statistics", 0);
+
+/*
+ * spin threads: burn the CPU for arg milliseconds
+ */
+static void spin_thread(void *arg) {
+    uint64_t end = timer_now_us() + (uint64_t)(uintptr_t)arg * 1000;
+
+    while (timer_now_us() < end) {
+        // Spin; the timer tick shares the core with other threads
+    }
+
+    thread_t *self = thread_current();
+    uart_puts("[spin ");
+    uart_put_dec((uint64_t)self->id);
+    uart_puts("] done on CPU ");
+    uart_put_dec((uint64_t)smp_cpu_id());
+    uart_puts(", moved ");
+    uart_put_dec(self->migrations);
+    uart_puts(" times\n");
+}
+
+/*
+ * Command: spin
+ * Start n CPU-bound threads (default: two per core) on this core; idle
+ * cores steal them, and `ps` shows them being shared out
+ */
+static void cmd_spin(int argc, char **argv) {
+    uint64_t n = shell_parse_number(argc > 1 ? argv[1] : NULL, 2 * (uint64_t)smp_num_cpus());
+    uint64_t ms = shell_parse_number(argc > 2 ? argv[2] : NULL, 3000);
+
+    for (uint64_t i = 0; i < n; i++) {
+        if (thread_create("spin", spin_thread, (void *)(uintptr_t)ms, THREAD_ANY_CPU) < 0) {
+            uart_puts("Error: Could not create a thread.\n");
+            return;
+        }
+    }
+    uart_puts("Started ");
+    uart_put_dec(n);
+    uart_puts(" threads for ");
+    uart_put_dec(ms);
+    uart_puts(" ms each\n");
+}
+SHELL_COMMAND(spin, cmd_spin, "[n] [ms]", "Start CPU-bound threads to watch scheduling", 0);
+
+/*
+ * Background job: a copy of its command line
+ */
+typedef struct {
+    int id;
+    char line[MAX_COMMAND_LEN];
+    shell_thread_t state;
+} bg_job_t;
+
+static void bg_thread(void *arg) {
+    bg_job_t *job = arg;
+    char *argv[MAX_ARGS];
+    int argc = parse_command(job->line, argv);
+
+    thread_current()->local = &job->state;
+
+    run_command(argc, argv);
+
+    uart_puts("[bg ");
+    uart_put_dec((uint64_t)thread_current()->id);
+    uart_puts("] done\n");
+    thread_current()->local = NULL;
+    free(job);
+}
+
+/*
+ * Core for a background job: the secondary core with the fewest ready
+ * threads, so the job doesn't compete with the shell on core 0
+ */
+static int bg_pick_cpu(void) {
+    int best = THREAD_ANY_CPU;
+    int best_ready = 0;
+
+    for (int cpu = 1; cpu < MAX_CPUS; cpu++) {
+        if (!smp_cpu_online(cpu)) {
+            continue;
+        }
+        sched_stats_t stats;
+        sched_get_stats(cpu, &stats);
+        if (best == THREAD_ANY_CPU || stats.ready < best_ready) {
+            best = cpu;
+            best_ready = stats.ready;
+        }
+    }
+    return best;
+}
+
+/*
+ * Command: bg
+ * Run a command in its own thread and return to the prompt
+ * The job stays on one core, since commands like memstress and
+ * uartbench measure the core they run on.
+ */
+static void cmd_bg(int argc, char **argv) {
+    if (argc < 2) {
+        uart_puts("Usage: bg <command> [args...]\n");
+        return;
+    }
+
+    bg_job_t *job = calloc(1, sizeof(*job));
+    if (job == NULL) {
+        uart_puts("Error: Out of memory.\n");
+        return;
+    }
+
+    /*
+     * Join the arguments again; the thread parses its own copy
+     */
+    job->line[0] = '\0';
+    for (int i = 1; i < argc; i++) {
+        if (i > 1) {
+            strcat(job->line, " ");
+        }
+        strcat(job->line, argv[i]);
+    }
+
+    int id = thread_create("bg", bg_thread, job, bg_pick_cpu());
+    if (id < 0) {
+        uart_puts("Error: Could not create a thread.\n");
+        free(job);
+        return;
+    }
+    uart_puts("[bg ");
+    uart_put_dec((uint64_t)id);
+    uart_puts("] started\n");
+}
+SHELL_COMMAND(bg, cmd_bg, "<command>", "Run a command in a background thread", 0);
+
+/*
+ * Run a parsed command, holding files_lock if it needs it
+ */
+static void run_command(int argc, char **argv) {
+    const shell_command_t *c = find_command(argv[0]);
+
+    if (c == NULL) {
+        uart_puts("Unknown command: ");
+        uart_puts(argv[0]);
+        uart_puts("\nType 'help' for available commands.\n");
+        return;
+    }
+
+    if (c->flags & SHELL_CMD_FILES) {
+        mutex_lock(&files_lock);
+    }
+    c->fn(argc, argv);
+    if (c->flags & SHELL_CMD_FILES) {
+        mutex_unlock(&files_lock);
+    }
+}
+
+/*
+ * Execute a command
+ */
+static void execute_command(char *cmd) {
+    char *argv[MAX_ARGS];
+    int argc = parse_command(cmd, argv);
+
+    if (argc == 0) {
+        return;  // Empty command
+    }
+
+    run_command(argc, argv);
+}
+
+/*
+ * Scripts may source other scripts, but not forever: a thread can be
+ * this many source commands deep (see shell_thread_t)
+ */
+#define SOURCE_MAX_DEPTH 8
+
+/*
+ * Run one line of a script
+ * len may be up to MAX_COMMAND_LEN; longer lines come with too_long set.
+ */
+static void source_line(const char *name, int line_no, char *line, size_t len,
+                        int too_long, int quiet) {
+    if (!too_long && len > 0 && line[len - 1] == '\r') {
+        len--;      // Written on a system with CRLF line endings
+    }
+
+    if (too_long || len >= MAX_COMMAND_LEN) {
+        uart_puts("Error: ");
+        uart_puts(name);
+        uart_puts(" line ");
+        uart_put_dec((uint64_t)line_no);
+        uart_puts(" is too long, skipped.\n");
+        return;
+    }
+    if (len == 0 || line[0] == '#') {
+        return;
+    }
+    line[len] = '\0';
+
+    if (!quiet) {
+        uart_puts("myos> ");
+        uart_puts(line);
+        uart_putc('\n');
+    }
+    execute_command(line);
+}
+
+/*
+ * Command: source
+ * Run the commands in a file, one per line, as if they were typed
+ * Blank lines and lines starting with '#' are skipped. With -q the
+ * prompt and the command lines aren't echoed, so only what the commands
+ * themselves print goes to the UART.
+ *
+ * The script is read through a view opened once at the start, so it
+ * runs as it was then even if it cds elsewhere or changes or deletes
+ * its own file. The view is walked a block at a time (so any size
+ * works), with a line that spans two blocks carried over in line.
+ *
+ * Each line goes through run_command, which takes files_lock for the
+ * commands that need it. source only holds it to open and close the
+ * view, since the script's commands would otherwise wait for it forever.
+ */
+static void cmd_source(int argc, char **argv) {
+    int quiet = (argc == 3 && strcmp(argv[1], "-q") == 0);
+
+    if (argc != 2 && !quiet) {
+        uart_puts("Usage: source [-q] <filename>\n");
+        return;
+    }
+    const char *name = argv[argc - 1];
+
+    shell_thread_t *self = thread_current()->local;
+    if (self->source_depth == SOURCE_MAX_DEPTH) {
+        uart_puts("Error: Scripts nested too deeply.\n");
+        return;
+    }
+
+    fs_view_t view;
+    mutex_lock(&files_lock);
+    int opened = fs_view_open(name, &view);
+    mutex_unlock(&files_lock);
+    if (opened != 0) {
+        uart_puts("Error: File '");
+        uart_puts(name);
+        uart_puts(fs_file_exists(name) ? "' could not be opened.\n" : "' not found.\n");
+        return;
+    }
+    self->source_depth++;
+
+    char line[MAX_COMMAND_LEN + 1];
+    size_t len = 0;
+    int too_long = 0;
+    int line_no = 0;
+    size_t offset = 0;
+    const char *chunk;
+    size_t n;
+
+    while ((n = fs_view_chunk(&view, offset, &chunk)) > 0) {
+        offset += n;
+
+        for (size_t i = 0; i < n; i++) {
+            if (chunk[i] == '\n') {
+                source_line(name, ++line_no, line, len, too_long, quiet);
+                len = 0;
+                too_long = 0;
+            } else if (len < MAX_COMMAND_LEN) {
+                line[len++] = chunk[i];
+            } else {
+                too_long = 1;
+            }
+        }
+    }
+    if (len > 0 || too_long) {
+        source_line(name, ++line_no, line, len, too_long, quiet);   // No final newline
+    }
+
+    self->source_depth--;
+    mutex_lock(&files_lock);
+    fs_view_close(&view);
+    mutex_unlock(&files_lock);
+}
+SHELL_COMMAND(source, cmd_source, "[-q] <f>", "Run the commands in a file", 0);
+
+/*
+ * Log flusher thread: commit file changes once nothing has been logged
+ * for FSLOG_COMMIT_MS
+ * Commands that change several files in a row (or a user typing a few
+ * in quick succession) then share one disk write. The commit also
+ * writes a checkpoint when one is due, which compacts the log.
+ *
+ * Once the log has failed (a disk error, or the log is full) nothing
+ * more can be committed, so the thread says so once and exits.
+ */
+static void fsflush_thread(void *arg) {
+    (void)arg;
+    uint64_t last_records = 0;
+
+    while (1) {
+        thread_sleep_ms(FSLOG_COMMIT_MS);
+
+        mutex_lock(&files_lock);
+        fslog_stats_t stats;
+        fslog_get_stats(&stats);
+        if (!stats.failed && fslog_pending() && stats.records == last_records) {
+            fslog_commit();
+            fslog_get_stats(&stats);
+        }
+        last_records = stats.records;
+        mutex_unlock(&files_lock);
+
+        if (stats.failed) {
+            uart_puts("\nError: The file system log failed; file changes are no longer\n"
+                      "saved to the disk (see 'disk').\n");
+            return;
+        }
+    }
+}
+
+/*
+ * Main shell loop
+ */
+void shell_run(void) {
+    command_table_init();
+    thread_current()->local = &shell_main_thread;
+
+    uart_puts("\n");
+    uart_puts("========================================\n");
+    uart_puts("       Welcome to MyOS Shell!          \n");
+    uart_puts("========================================\n");
+    uart_puts("\n");
+    uart_puts("Type 'help' for available commands.\n");
+    uart_puts("\n");
+
+    if (fslog_active() && thread_create("fsflush", fsflush_thread, NULL, THREAD_ANY_CPU) < 0) {
+        uart_puts("Warning: No log flusher; use 'sync' to save files.\n");
+    }
 
     /*
      * Main command loop
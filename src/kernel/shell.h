@@ -2,11 +2,23 @@
  * Command Shell Header
  *
  * Interactive command-line interface for the OS
+ *
+ * Commands are registered where they are defined, with SHELL_COMMAND,
+ * in any source file:
+ *
+ *     static void cmd_uptime(int argc, char **argv) { ... }
+ *     SHELL_COMMAND(uptime, cmd_uptime, "", "Show time since boot", 0);
+ *
+ * Each registration is a shell_command_t placed in the .shell_commands
+ * section; the linker gathers them into one table (see linker.ld),
+ * which the shell indexes by name when it starts and lists for help.
  */
 
 #ifndef SHELL_H
 #define SHELL_H
 
+#include <stdint.h>
+
 /*
  * Maximum command line length
  */
@@ -17,6 +29,39 @@
  */
 #define MAX_ARGS 16
 
+/*
+ * Command flags
+ */
+#define SHELL_CMD_FILES 0x1   // Changes memfs or uses the disk: run holding
+                              // the shell's file lock
+
+/*
+ * A registered command
+ */
+typedef struct {
+    const char *name;
+    const char *args;              // Arguments, for help ("" if none)
+    const char *help;              // One-line description
+    void (*fn)(int argc, char **argv);
+    uint32_t flags;                // SHELL_CMD_*
+} shell_command_t;
+
+/*
+ * Register fn as the command name (an identifier, which becomes the
+ * command's name)
+ */
+#define SHELL_COMMAND(name, fn, args, help, flags)                          \
+    static const shell_command_t shell_command_##name                       \
+        __attribute__((used, section(".shell_commands"), aligned(8))) = {  \
+            #name, args, help, fn, flags                                    \
+        }
+
+/*
+ * Parse a decimal number argument, returning fallback if str is NULL
+ * or isn't one
+ */
+uint64_t shell_parse_number(const char *str, uint64_t fallback);
+
 /*
  * Initialize and start the shell
  * This function does not return
@@ -0,0 +1,345 @@
+/*
+ * Symmetric Multi-Processing (SMP) Implementation
+ *
+ * The boot core asks the firmware to start every other core through
+ * PSCI CPU_ON. QEMU's virt machine implements PSCI itself and expects
+ * the call through the HVC instruction. Each secondary core starts at
+ * secondary_entry in boot.S, which sets up its stack and calls
+ * secondary_main() below.
+ *
+ * Once online, a secondary core becomes an idle thread for the
+ * scheduler (see sched.h): it runs threads when there are any, and
+ * otherwise sleeps in WFI until another core puts a work item into its
+ * queue and sends it a wakeup SGI (software generated interrupt), runs
+ * it, and goes back to sleep. Without a GIC it falls back to WFE and
+ * events.
+ */
+
+#include "smp.h"
+#include "gic.h"
+#include "irq.h"
+#include "sched.h"
+#include "timer.h"
+#include "uart.h"
+
+/*
+ * PSCI function IDs (SMC64 calling convention)
+ */
+#define PSCI_CPU_ON     0xC4000003
+#define PSCI_SYSTEM_OFF 0x84000008
+
+/*
+ * PSCI return codes we care about
+ */
+#define PSCI_SUCCESS        0
+#define PSCI_ALREADY_ON    -4
+
+/*
+ * How long to wait for a secondary core to report in
+ */
+#define CPU_ON_TIMEOUT 10000000
+
+/*
+ * Entry point for secondary cores (in boot.S)
+ */
+extern char secondary_entry[];
+
+/*
+ * Per-CPU data for every possible core
+ */
+static percpu_t cpu_data[MAX_CPUS];
+
+/*
+ * Number of cores online
+ */
+static volatile int cpus_online = 1;
+
+/*
+ * Send an event to wake up cores sleeping in WFE
+ */
+static inline void send_event(void) {
+    __asm__ volatile("dsb ishst\n\tsev" ::: "memory");
+}
+
+/*
+ * Sleep until an event arrives
+ */
+static inline void wait_event(void) {
+    __asm__ volatile("wfe" ::: "memory");
+}
+
+/*
+ * Sleep until an interrupt arrives, unless another thread can run
+ */
+void cpu_idle(void) {
+    if (sched_switch_idle()) {
+        return;
+    }
+
+    uint64_t start = timer_ticks();
+    __asm__ volatile("dsb sy\n\twfi" ::: "memory");
+    cpu_data[smp_cpu_id()].idle_ticks += timer_ticks() - start;
+}
+
+/*
+ * The wakeup SGI only needs to end WFI; there is nothing to do
+ */
+static void wakeup_handler(void *arg) {
+    (void)arg;
+}
+
+/*
+ * Make a PSCI call through the hypervisor call instruction
+ */
+static int64_t psci_call(uint64_t fn, uint64_t arg0, uint64_t arg1, uint64_t arg2) {
+    register uint64_t x0 __asm__("x0") = fn;
+    register uint64_t x1 __asm__("x1") = arg0;
+    register uint64_t x2 __asm__("x2") = arg1;
+    register uint64_t x3 __asm__("x3") = arg2;
+
+    __asm__ volatile("hvc #0"
+                     : "+r"(x0), "+r"(x1), "+r"(x2), "+r"(x3)
+                     :
+                     : "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11",
+                       "x12", "x13", "x14", "x15", "x16", "x17", "memory");
+
+    return (int64_t)x0;
+}
+
+/*
+ * Run every work item queued to this core
+ */
+static void run_pending_work(percpu_t *c) {
+    uint32_t head = c->work_head;
+
+    while (head != __atomic_load_n(&c->work_tail, __ATOMIC_ACQUIRE)) {
+        smp_work_t *item = &c->work[head % SMP_WORK_QUEUE_LEN];
+        item->fn(item->arg);
+
+        head++;
+        c->work_done++;
+        __atomic_store_n(&c->work_head, head, __ATOMIC_RELEASE);
+        send_event();  // Wake anyone waiting in smp_wait_cpu()
+    }
+}
+
+/*
+ * Check whether a core has work items waiting
+ */
+int smp_work_pending(int cpu) {
+    percpu_t *c = &cpu_data[cpu];
+    return c->work_head != __atomic_load_n(&c->work_tail, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Idle loop: run work items, then any ready threads, then sleep
+ * With a GIC, check the queue with interrupts masked and sleep in
+ * WFI: a wakeup SGI sent after the check is left pending, which ends
+ * WFI, and is taken once interrupts are unmasked. Without one, WFE
+ * works the same way with the event register.
+ */
+void smp_idle(void) {
+    while (1) {
+        percpu_t *c = this_cpu();
+
+        preempt_disable();  // Work items finish on the core they started on
+        run_pending_work(c);
+        preempt_enable();
+
+        irq_disable();
+        if (!smp_work_pending(c->cpu_id)) {
+            if (gic_ready()) {
+                cpu_idle();
+            } else if (!sched_switch_idle()) {
+                wait_event();
+            }
+        }
+        irq_enable();
+    }
+}
+
+/*
+ * secondary_main - C entry point for secondary cores
+ *
+ * Called from boot.S with the core index. Never returns.
+ */
+void secondary_main(int cpu) {
+    percpu_t *c = &cpu_data[cpu];
+
+    c->cpu_id = cpu;
+    irq_init();
+    if (gic_ready()) {
+        gic_cpu_init();
+        timer_start_tick();
+    }
+    sched_init_cpu(cpu);
+
+    __atomic_store_n(&c->online, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&cpus_online, 1, __ATOMIC_RELAXED);
+    send_event();
+
+    smp_idle();
+}
+
+/*
+ * Bring up the secondary cores
+ */
+int smp_init(void) {
+    cpu_data[0].cpu_id = 0;
+    cpu_data[0].online = 1;
+
+    if (gic_ready()) {
+        irq_register(IRQ_SGI_WAKEUP, wakeup_handler, NULL);
+    }
+
+    for (int cpu = 1; cpu < MAX_CPUS; cpu++) {
+        int64_t ret = psci_call(PSCI_CPU_ON, (uint64_t)cpu,
+                                (uint64_t)secondary_entry, (uint64_t)cpu);
+
+        if (ret != PSCI_SUCCESS) {
+            /*
+             * INVALID_PARAMETERS means the core doesn't exist, which is
+             * how we discover the core count. ALREADY_ON means a loader
+             * started it at _start and it parked itself; leave it.
+             */
+            if (ret == PSCI_ALREADY_ON) {
+                continue;
+            }
+            break;
+        }
+
+        /*
+         * Wait for the core to report in
+         */
+        for (int i = 0; i < CPU_ON_TIMEOUT; i++) {
+            if (__atomic_load_n(&cpu_data[cpu].online, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+        }
+
+        if (!cpu_data[cpu].online) {
+            uart_puts("[SMP] Core did not come online: ");
+            uart_put_dec((uint64_t)cpu);
+            uart_putc('\n');
+        }
+    }
+
+    return cpus_online;
+}
+
+/*
+ * Power off the machine
+ */
+void smp_system_off(void) {
+    psci_call(PSCI_SYSTEM_OFF, 0, 0, 0);
+}
+
+/*
+ * Get per-CPU data
+ */
+percpu_t *smp_cpu_data(int cpu) {
+    return &cpu_data[cpu];
+}
+
+percpu_t *this_cpu(void) {
+    return &cpu_data[smp_cpu_id()];
+}
+
+/*
+ * Get number of online cores
+ */
+int smp_num_cpus(void) {
+    return cpus_online;
+}
+
+/*
+ * Check whether a core is online
+ */
+int smp_cpu_online(int cpu) {
+    if (cpu < 0 || cpu >= MAX_CPUS) {
+        return 0;
+    }
+    return __atomic_load_n(&cpu_data[cpu].online, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Queue a work item on a core
+ */
+int smp_call_on_cpu(int cpu, smp_work_fn fn, void *arg) {
+    if (!smp_cpu_online(cpu) || fn == NULL) {
+        return -1;
+    }
+
+    percpu_t *c = &cpu_data[cpu];
+
+    /*
+     * Running work on ourselves: just call it
+     */
+    if (cpu == smp_cpu_id()) {
+        fn(arg);
+        c->work_done++;
+        return 0;
+    }
+
+    spin_lock(&c->work_lock);
+
+    uint32_t tail = c->work_tail;
+    if (tail - __atomic_load_n(&c->work_head, __ATOMIC_ACQUIRE) >= SMP_WORK_QUEUE_LEN) {
+        spin_unlock(&c->work_lock);
+        return -1;  // Queue full
+    }
+
+    c->work[tail % SMP_WORK_QUEUE_LEN].fn = fn;
+    c->work[tail % SMP_WORK_QUEUE_LEN].arg = arg;
+    __atomic_store_n(&c->work_tail, tail + 1, __ATOMIC_RELEASE);
+
+    spin_unlock(&c->work_lock);
+    send_event();
+    if (gic_ready()) {
+        gic_send_sgi(cpu, IRQ_SGI_WAKEUP);
+    }
+
+    return 0;
+}
+
+/*
+ * Wait for a core to drain its work queue
+ */
+void smp_wait_cpu(int cpu) {
+    if (!smp_cpu_online(cpu) || cpu == smp_cpu_id()) {
+        return;
+    }
+
+    percpu_t *c = &cpu_data[cpu];
+    while (__atomic_load_n(&c->work_head, __ATOMIC_ACQUIRE) !=
+           __atomic_load_n(&c->work_tail, __ATOMIC_ACQUIRE)) {
+        wait_event();
+    }
+}
+
+/*
+ * Run a function on every online core and wait for all of them
+ */
+void smp_call_all(smp_work_fn fn, void *arg) {
+    int self = smp_cpu_id();
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpu != self && smp_cpu_online(cpu)) {
+            /*
+             * Retry while the target's queue is full
+             */
+            while (smp_call_on_cpu(cpu, fn, arg) != 0) {
+                wait_event();
+            }
+        }
+    }
+
+    fn(arg);
+    this_cpu()->work_done++;
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpu != self) {
+            smp_wait_cpu(cpu);
+        }
+    }
+}
@@ -0,0 +1,149 @@
+/*
+ * Symmetric Multi-Processing (SMP) Header
+ *
+ * On QEMU's virt machine every core except core 0 starts powered off.
+ * We wake them up through PSCI (Power State Coordination Interface),
+ * give each one its own stack and per-CPU data, and let the rest of the
+ * kernel hand them work items.
+ *
+ * This header is also included from boot.S, so everything that is not
+ * a plain #define must stay inside the __ASSEMBLER__ guard.
+ */
+
+#ifndef SMP_H
+#define SMP_H
+
+/*
+ * Maximum number of CPU cores we support
+ * The stack area in linker.ld is sized for this many cores
+ */
+#define MAX_CPUS 8
+
+/*
+ * Size of each core's stack (16KB, must match linker.ld)
+ */
+#define CPU_STACK_SIZE 0x4000
+
+/*
+ * Number of pending work items each core can queue
+ */
+#define SMP_WORK_QUEUE_LEN 16
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "spinlock.h"
+
+/*
+ * Work item function type
+ */
+typedef void (*smp_work_fn)(void *arg);
+
+/*
+ * A single queued work item
+ */
+typedef struct {
+    smp_work_fn fn;                // Function to run
+    void *arg;                     // Argument passed to fn
+} smp_work_t;
+
+/*
+ * Per-CPU data
+ *
+ * One of these exists for every possible core. Each core only writes
+ * its own entry (except for the work queue, which other cores append to
+ * under work_lock). Aligned to a cache line so cores don't share lines.
+ */
+typedef struct {
+    int cpu_id;                    // Index of this core (0 = boot core)
+    volatile int online;           // 1 once the core has entered C code
+    spinlock_t work_lock;          // Protects work_tail for producers
+    volatile uint32_t work_head;   // Next item to run (owner only)
+    volatile uint32_t work_tail;   // Next free slot (producers)
+    smp_work_t work[SMP_WORK_QUEUE_LEN];
+    uint64_t work_done;            // Number of work items completed
+    uint64_t idle_ticks;           // Timer ticks spent asleep in cpu_idle
+} __attribute__((aligned(64))) percpu_t;
+
+/*
+ * Bring up the secondary cores
+ * Returns the number of cores online (including the boot core)
+ */
+int smp_init(void);
+
+/*
+ * Get the index of the calling core
+ * (the host test build supplies its own, see tests/host.c)
+ */
+#ifdef HOST_BUILD
+int smp_cpu_id(void);
+#else
+static inline int smp_cpu_id(void) {
+    uint64_t mpidr;
+    __asm__ volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+    return (int)(mpidr & 0xFF);
+}
+#endif
+
+/*
+ * Get the per-CPU data of a given core, or of the calling core
+ */
+percpu_t *smp_cpu_data(int cpu);
+percpu_t *this_cpu(void);
+
+/*
+ * Get the number of cores currently online
+ */
+int smp_num_cpus(void);
+
+/*
+ * Check whether a core is online
+ */
+int smp_cpu_online(int cpu);
+
+/*
+ * Queue a work item to run on the given core
+ * Returns 0 on success, -1 if the core is offline or its queue is full
+ */
+int smp_call_on_cpu(int cpu, smp_work_fn fn, void *arg);
+
+/*
+ * Wait until a core has finished all work queued to it so far
+ */
+void smp_wait_cpu(int cpu);
+
+/*
+ * Run fn(arg) on every online core (including the caller)
+ * and wait for all of them to finish
+ */
+void smp_call_all(smp_work_fn fn, void *arg);
+
+/*
+ * Sleep in WFI until an interrupt arrives, counting the time as idle
+ * Call with interrupts masked, after checking there is nothing to do:
+ * an interrupt that arrives in between still wakes the core.
+ * If another thread is ready to run on this core, runs that instead
+ * and returns once this one is picked again (perhaps on another core).
+ */
+void cpu_idle(void);
+
+/*
+ * Check whether a core has work items waiting to run
+ */
+int smp_work_pending(int cpu);
+
+/*
+ * Run work items and sleep, forever (the body of every idle thread)
+ */
+void smp_idle(void) __attribute__((noreturn));
+
+/*
+ * Power off the machine through PSCI SYSTEM_OFF
+ * Only returns if the firmware refused
+ */
+void smp_system_off(void);
+
+#endif // __ASSEMBLER__
+
+#endif // SMP_H
@@ -0,0 +1,129 @@
+/*
+ * Spinlock Header
+ *
+ * A ticket lock for data shared between CPU cores. Each core that wants
+ * the lock takes the next ticket and waits until the owner field shows
+ * its number, so cores get the lock in the order they asked for it
+ * instead of whoever wins the race to the cache line. Only use it
+ * around short critical sections.
+ *
+ * On the kernel build the ticket is taken with a load-exclusive /
+ * store-exclusive pair (LDAXR/STXR), or with one LDADDA when built with
+ * LSE atomics (make LSE=1, see BUILD.md). Waiters sleep in WFE: their
+ * load-exclusive of the owner field arms the core's exclusive monitor,
+ * and the unlocking store to that field wakes them. The host build
+ * uses the compiler's atomics.
+ *
+ * The holder can't be switched out until it unlocks (see
+ * preempt_disable), so a thread never spins on a lock whose holder is
+ * waiting for the same core.
+ */
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include "sched.h"
+
+/*
+ * Spinlock type
+ * Both halves share one 32-bit word, so taking a ticket can read the
+ * owner in the same atomic operation.
+ */
+typedef struct {
+    volatile uint16_t owner;    // Ticket being served
+    volatile uint16_t next;     // Next ticket to hand out
+} __attribute__((aligned(4))) spinlock_t;
+
+/*
+ * Static initializer for an unlocked spinlock
+ */
+#define SPINLOCK_INIT { 0, 0 }
+
+#ifndef HOST_BUILD
+
+/*
+ * Take a ticket: add 1 to next and return the whole word as it was
+ */
+static inline uint32_t spin_take_ticket(spinlock_t *lock) {
+    uint32_t old;
+
+#ifdef __ARM_FEATURE_ATOMICS
+    __asm__ volatile("ldadda %w1, %w0, [%2]"
+                     : "=&r"(old)
+                     : "r"(1U << 16), "r"(lock)
+                     : "memory");
+#else
+    uint32_t new, fail;
+    __asm__ volatile("1: ldaxr %w0, [%3]\n\t"
+                     "add %w1, %w0, %w4\n\t"
+                     "stxr %w2, %w1, [%3]\n\t"
+                     "cbnz %w2, 1b"
+                     : "=&r"(old), "=&r"(new), "=&r"(fail)
+                     : "r"(lock), "r"(1U << 16)
+                     : "memory");
+#endif
+    return old;
+}
+
+/*
+ * Wait until the owner field reaches ticket
+ * SEVL makes the first WFE fall through; after that each WFE waits
+ * until the store that clears our exclusive monitor (an unlock) or
+ * another event.
+ */
+static inline void spin_wait_ticket(spinlock_t *lock, uint16_t ticket) {
+    uint32_t owner;
+
+    __asm__ volatile("sevl\n"
+                     "1: wfe\n\t"
+                     "ldaxrh %w0, [%1]\n\t"
+                     "eor %w0, %w0, %w2\n\t"
+                     "cbnz %w0, 1b"
+                     : "=&r"(owner)
+                     : "r"(&lock->owner), "r"((uint32_t)ticket)
+                     : "memory");
+}
+
+#else
+
+/*
+ * Host build: the tests' threads may outnumber the host's CPUs, so a
+ * waiter gives its CPU to the holder
+ */
+static inline uint32_t spin_take_ticket(spinlock_t *lock) {
+    uint16_t next = __atomic_fetch_add(&lock->next, 1, __ATOMIC_ACQUIRE);
+    return ((uint32_t)next << 16) | __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE);
+}
+
+static inline void spin_wait_ticket(spinlock_t *lock, uint16_t ticket) {
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        sched_yield();
+    }
+}
+
+#endif // HOST_BUILD
+
+/*
+ * Acquire the lock
+ */
+static inline void spin_lock(spinlock_t *lock) {
+    preempt_disable();
+
+    uint32_t old = spin_take_ticket(lock);
+    uint16_t ticket = (uint16_t)(old >> 16);
+    if ((uint16_t)old != ticket) {
+        spin_wait_ticket(lock, ticket);
+    }
+}
+
+/*
+ * Release the lock: serve the next ticket
+ * Only the holder writes owner, so a plain read is enough.
+ */
+static inline void spin_unlock(spinlock_t *lock) {
+    __atomic_store_n(&lock->owner, (uint16_t)(lock->owner + 1), __ATOMIC_RELEASE);
+    preempt_enable();
+}
+
+#endif // SPINLOCK_H
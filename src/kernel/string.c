@@ -3,19 +3,141 @@
  *
  * Basic implementations of standard C string functions.
  * We need these because we don't have access to libc.
+ *
+ * memcpy, memset, memcmp and strlen are on the hot path of every file
+ * write and zeroed allocation, so they work 16 bytes at a time: NEON
+ * registers on ARM64, a pair of 64-bit words elsewhere. Each has a
+ * prologue that handles bytes up to an alignment boundary and an
+ * epilogue for the leftover tail. The byte-at-a-time *_scalar versions
+ * at the end are kept as a reference for tests and benchmarks.
+ *
+ * With the MMU off all memory is device memory, where unaligned loads
+ * fault. Before mmu_init, only use memcpy/memcmp on 16-byte aligned
+ * buffers. strlen and memset only ever do aligned wide accesses.
  */
 
 #include "string.h"
 
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * strlen's aligned 16-byte loads can read past the terminator (never
+ * into the next page, so they can't fault). The host build runs under
+ * AddressSanitizer, which would report them. vec_load is always inlined
+ * so it picks up strlen's exemption.
+ */
+#ifdef HOST_BUILD
+#define OVERREAD __attribute__((no_sanitize_address))
+#else
+#define OVERREAD
+#endif
+#define VEC_INLINE __attribute__((always_inline))
+
+/*
+ * 16-byte vector helpers
+ */
+#ifdef __ARM_NEON
+
+typedef uint8x16_t vec16_t;
+
+static inline VEC_INLINE vec16_t vec_load(const void *p) {
+    return vld1q_u8((const uint8_t *)p);
+}
+
+static inline void vec_store(void *p, vec16_t v) {
+    vst1q_u8((uint8_t *)p, v);
+}
+
+static inline vec16_t vec_splat(unsigned char c) {
+    return vdupq_n_u8(c);
+}
+
+static inline int vec_has_zero(vec16_t v) {
+    return vmaxvq_u8(vceqzq_u8(v)) != 0;
+}
+
+static inline int vec_equal(vec16_t a, vec16_t b) {
+    return vminvq_u8(vceqq_u8(a, b)) == 0xFF;
+}
+
+static inline int vec_any_equal(vec16_t a, vec16_t b) {
+    return vmaxvq_u8(vceqq_u8(a, b)) != 0;
+}
+
+#else
+
+/*
+ * Unaligned 64-bit word that may alias anything
+ */
+typedef uint64_t __attribute__((may_alias, aligned(1))) word_t;
+
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+} vec16_t;
+
+static inline VEC_INLINE vec16_t vec_load(const void *p) {
+    vec16_t v = { ((const word_t *)p)[0], ((const word_t *)p)[1] };
+    return v;
+}
+
+static inline void vec_store(void *p, vec16_t v) {
+    ((word_t *)p)[0] = v.lo;
+    ((word_t *)p)[1] = v.hi;
+}
+
+static inline vec16_t vec_splat(unsigned char c) {
+    uint64_t w = 0x0101010101010101ULL * c;
+    vec16_t v = { w, w };
+    return v;
+}
+
+static inline int word_has_zero(uint64_t w) {
+    return ((w - 0x0101010101010101ULL) & ~w & 0x8080808080808080ULL) != 0;
+}
+
+static inline int vec_has_zero(vec16_t v) {
+    return word_has_zero(v.lo) || word_has_zero(v.hi);
+}
+
+static inline int vec_equal(vec16_t a, vec16_t b) {
+    return a.lo == b.lo && a.hi == b.hi;
+}
+
+static inline int vec_any_equal(vec16_t a, vec16_t b) {
+    return word_has_zero(a.lo ^ b.lo) || word_has_zero(a.hi ^ b.hi);
+}
+
+#endif // __ARM_NEON
+
 /*
  * strlen - Calculate the length of a string
+ *
+ * After a byte-wise prologue up to a 16-byte boundary, we test 16
+ * aligned bytes at a time for a zero. An aligned 16-byte load never
+ * crosses a page boundary, so reading past the terminator is safe.
  */
-size_t strlen(const char *str) {
-    size_t len = 0;
-    while (str[len] != '\0') {
-        len++;
+OVERREAD size_t strlen(const char *str) {
+    const char *p = str;
+
+    while ((uintptr_t)p & 15) {
+        if (*p == '\0') {
+            return (size_t)(p - str);
+        }
+        p++;
     }
-    return len;
+
+    while (!vec_has_zero(vec_load(p))) {
+        p += 16;
+    }
+
+    while (*p != '\0') {
+        p++;
+    }
+
+    return (size_t)(p - str);
 }
 
 /*
@@ -47,13 +169,10 @@ int strncmp(const char *s1, const char *s2, size_t n) {
 
 /*
  * strcpy - Copy string src to dst
+ * Uses the wide strlen and memcpy rather than a byte loop
  */
 char *strcpy(char *dst, const char *src) {
-    char *original_dst = dst;
-    while ((*dst++ = *src++) != '\0') {
-        // Copy until null terminator
-    }
-    return original_dst;
+    return memcpy(dst, src, strlen(src) + 1);
 }
 
 /*
@@ -109,19 +228,89 @@ char *strchr(const char *str, int c) {
  */
 void *memset(void *ptr, int value, size_t num) {
     unsigned char *p = (unsigned char *)ptr;
+    unsigned char c = (unsigned char)value;
+
+    if (num >= 16) {
+        vec16_t v = vec_splat(c);
+
+        /*
+         * Prologue: bytes up to a 16-byte boundary
+         */
+        while ((uintptr_t)p & 15) {
+            *p++ = c;
+            num--;
+        }
+
+        while (num >= 64) {
+            vec_store(p, v);
+            vec_store(p + 16, v);
+            vec_store(p + 32, v);
+            vec_store(p + 48, v);
+            p += 64;
+            num -= 64;
+        }
+
+        while (num >= 16) {
+            vec_store(p, v);
+            p += 16;
+            num -= 16;
+        }
+    }
+
+    /*
+     * Epilogue: remaining bytes
+     */
     while (num--) {
-        *p++ = (unsigned char)value;
+        *p++ = c;
     }
+
     return ptr;
 }
 
 /*
  * memcpy - Copy memory from src to dst
+ *
+ * The destination is aligned first; the source may stay unaligned,
+ * which ARM64 handles at full speed for normal memory.
  */
 void *memcpy(void *dst, const void *src, size_t n) {
     unsigned char *d = (unsigned char *)dst;
     const unsigned char *s = (const unsigned char *)src;
 
+    if (n >= 16) {
+        /*
+         * Prologue: bytes up to a 16-byte destination boundary
+         */
+        while ((uintptr_t)d & 15) {
+            *d++ = *s++;
+            n--;
+        }
+
+        while (n >= 64) {
+            vec16_t a = vec_load(s);
+            vec16_t b = vec_load(s + 16);
+            vec16_t c = vec_load(s + 32);
+            vec16_t e = vec_load(s + 48);
+            vec_store(d, a);
+            vec_store(d + 16, b);
+            vec_store(d + 32, c);
+            vec_store(d + 48, e);
+            d += 64;
+            s += 64;
+            n -= 64;
+        }
+
+        while (n >= 16) {
+            vec_store(d, vec_load(s));
+            d += 16;
+            s += 16;
+            n -= 16;
+        }
+    }
+
+    /*
+     * Epilogue: remaining bytes
+     */
     while (n--) {
         *d++ = *s++;
     }
@@ -131,11 +320,95 @@ void *memcpy(void *dst, const void *src, size_t n) {
 
 /*
  * memcmp - Compare memory regions
+ *
+ * Skips over equal 16-byte chunks, then finds the first differing
+ * byte within the chunk that didn't match.
  */
 int memcmp(const void *s1, const void *s2, size_t n) {
     const unsigned char *p1 = (const unsigned char *)s1;
     const unsigned char *p2 = (const unsigned char *)s2;
 
+    while (n >= 16 && vec_equal(vec_load(p1), vec_load(p2))) {
+        p1 += 16;
+        p2 += 16;
+        n -= 16;
+    }
+
+    while (n--) {
+        if (*p1 != *p2) {
+            return *p1 - *p2;
+        }
+        p1++;
+        p2++;
+    }
+
+    return 0;
+}
+
+/*
+ * memchr - Find the first occurrence of a byte
+ *
+ * Skips 16-byte chunks that don't contain it, then scans bytewise.
+ */
+void *memchr(const void *ptr, int value, size_t n) {
+    const unsigned char *p = (const unsigned char *)ptr;
+    unsigned char c = (unsigned char)value;
+    vec16_t v = vec_splat(c);
+
+    while (n >= 16 && !vec_any_equal(vec_load(p), v)) {
+        p += 16;
+        n -= 16;
+    }
+
+    while (n--) {
+        if (*p == c) {
+            return (void *)p;
+        }
+        p++;
+    }
+
+    return NULL;
+}
+
+/*
+ * Scalar reference versions
+ *
+ * These are the original byte-at-a-time loops. The optimize attribute
+ * stops GCC from vectorizing them, so they stay a fair baseline.
+ */
+#define SCALAR __attribute__((optimize("no-tree-vectorize")))
+
+SCALAR size_t strlen_scalar(const char *str) {
+    size_t len = 0;
+    while (str[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+SCALAR void *memset_scalar(void *ptr, int value, size_t num) {
+    unsigned char *p = (unsigned char *)ptr;
+    while (num--) {
+        *p++ = (unsigned char)value;
+    }
+    return ptr;
+}
+
+SCALAR void *memcpy_scalar(void *dst, const void *src, size_t n) {
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+
+    while (n--) {
+        *d++ = *s++;
+    }
+
+    return dst;
+}
+
+SCALAR int memcmp_scalar(const void *s1, const void *s2, size_t n) {
+    const unsigned char *p1 = (const unsigned char *)s1;
+    const unsigned char *p2 = (const unsigned char *)s2;
+
     while (n--) {
         if (*p1 != *p2) {
             return *p1 - *p2;
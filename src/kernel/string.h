@@ -63,4 +63,19 @@ void *memcpy(void *dst, const void *src, size_t n);
  */
 int memcmp(const void *s1, const void *s2, size_t n);
 
+/*
+ * Find the first byte equal to value in the first n bytes of ptr
+ * Returns a pointer to it, or NULL if there is none
+ */
+void *memchr(const void *ptr, int value, size_t n);
+
+/*
+ * Byte-at-a-time reference versions of the functions above
+ * Used to check and benchmark the optimized implementations
+ */
+size_t strlen_scalar(const char *str);
+void *memset_scalar(void *ptr, int value, size_t num);
+void *memcpy_scalar(void *dst, const void *src, size_t n);
+int memcmp_scalar(const void *s1, const void *s2, size_t n);
+
 #endif // STRING_H
@@ -0,0 +1,157 @@
+/*
+ * Timer Implementation
+ */
+
+#include "timer.h"
+#include "gic.h"
+#include "irq.h"
+#include "sched.h"
+#include "smp.h"
+
+static uint64_t counter_freq = 0;
+
+/*
+ * Counter ticks between tick interrupts, and each core's next deadline
+ */
+static uint64_t tick_interval = 0;
+static uint64_t next_deadline[MAX_CPUS];
+static volatile uint64_t jiffies = 0;
+
+static int pmu_available = 0;
+
+/*
+ * Enable the PMU cycle counter if the CPU has one
+ * (ID_AA64DFR0_EL1.PMUVer is non-zero and not IMPLEMENTATION DEFINED)
+ */
+static void cycles_init(void) {
+    uint64_t dfr0;
+    __asm__ volatile("mrs %0, id_aa64dfr0_el1" : "=r"(dfr0));
+
+    uint64_t pmuver = (dfr0 >> 8) & 0xF;
+    pmu_available = (pmuver != 0 && pmuver != 0xF);
+    if (!pmu_available) {
+        return;
+    }
+
+    uint64_t pmcr;
+    __asm__ volatile("mrs %0, pmcr_el0" : "=r"(pmcr));
+    pmcr |= (1UL << 0) | (1UL << 6);  // E: enable, LC: 64-bit cycle counter
+    __asm__ volatile("msr pmcr_el0, %0" :: "r"(pmcr));
+    __asm__ volatile("msr pmcntenset_el0, %0" :: "r"(1UL << 31));
+    __asm__ volatile("isb");
+}
+
+/*
+ * Initialize the timer
+ */
+void timer_init(void) {
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(counter_freq));
+    if (counter_freq == 0) {
+        counter_freq = 62500000;  // QEMU's default, in case firmware didn't set it
+    }
+
+    cycles_init();
+}
+
+/*
+ * Tick interrupt: program the next deadline and count the tick
+ * Deadlines advance by a fixed interval, so late interrupts don't make
+ * the tick drift. Jiffies count core 0's ticks only.
+ */
+static void timer_tick_handler(void *arg) {
+    (void)arg;
+    int cpu = smp_cpu_id();
+
+    next_deadline[cpu] += tick_interval;
+    __asm__ volatile("msr cntv_cval_el0, %0\n\tisb" :: "r"(next_deadline[cpu]));
+    if (cpu == 0) {
+        jiffies++;
+    }
+
+    sched_tick();
+}
+
+/*
+ * Start the periodic tick
+ * Core 0 registers the handler; the interrupt is private to each core,
+ * so the others only enable it in their GIC CPU interface.
+ */
+int timer_start_tick(void) {
+    if (!gic_ready()) {
+        return -1;
+    }
+
+    int cpu = smp_cpu_id();
+    if (cpu == 0) {
+        tick_interval = counter_freq / TIMER_HZ;
+    }
+    next_deadline[cpu] = timer_ticks() + tick_interval;
+
+    __asm__ volatile("msr cntv_cval_el0, %0" :: "r"(next_deadline[cpu]));
+    __asm__ volatile("msr cntv_ctl_el0, %0\n\tisb" :: "r"(1UL));  // Enable, unmasked
+
+    if (cpu != 0) {
+        gic_enable_irq(TIMER_IRQ);
+        return 0;
+    }
+    return irq_register(TIMER_IRQ, timer_tick_handler, NULL);
+}
+
+uint64_t timer_freq(void) {
+    return counter_freq;
+}
+
+/*
+ * Conversions
+ * Split into whole seconds and the remainder so the multiplication
+ * can't overflow
+ */
+uint64_t timer_ticks_to_ns(uint64_t ticks) {
+    return ticks / counter_freq * 1000000000UL +
+           (ticks % counter_freq) * 1000000000UL / counter_freq;
+}
+
+uint64_t timer_ticks_to_us(uint64_t ticks) {
+    return ticks / counter_freq * 1000000UL +
+           (ticks % counter_freq) * 1000000UL / counter_freq;
+}
+
+uint64_t timer_now_ns(void) {
+    return timer_ticks_to_ns(timer_ticks());
+}
+
+uint64_t timer_now_us(void) {
+    return timer_ticks_to_us(timer_ticks());
+}
+
+uint64_t timer_jiffies(void) {
+    return jiffies;
+}
+
+/*
+ * Busy-wait
+ */
+void timer_delay_us(uint64_t us) {
+    uint64_t end = timer_ticks() + us * counter_freq / 1000000UL;
+
+    while (timer_ticks() < end) {
+        // Spin
+    }
+}
+
+/*
+ * Cycle counter
+ */
+int timer_has_cycles(void) {
+    return pmu_available;
+}
+
+uint64_t timer_cycles(void) {
+    uint64_t value;
+
+    if (!pmu_available) {
+        return timer_ticks();
+    }
+    __asm__ volatile("isb\n\tmrs %0, pmccntr_el0" : "=r"(value) :: "memory");
+    return value;
+}
@@ -0,0 +1,88 @@
+/*
+ * Timer Header
+ *
+ * Time keeping based on the ARM generic timer. Every core has a 64-bit
+ * counter (CNTVCT_EL0) that counts up at a fixed frequency (CNTFRQ_EL0,
+ * 62.5MHz on QEMU's virt machine) from boot, and the same value on
+ * every core, so it makes a cheap monotonic clock.
+ *
+ * On top of that:
+ *   - a periodic tick interrupt (TIMER_HZ per second) on every core
+ *     from its virtual timer, which drives the scheduler; the boot
+ *     core's ticks are counted in timer_jiffies()
+ *   - CPU cycle counts from the PMU cycle counter, where there is one
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+/*
+ * Tick interrupts per second
+ */
+#define TIMER_HZ 100
+
+/*
+ * Virtual timer interrupt (a PPI, private to each core)
+ */
+#define TIMER_IRQ 27
+
+/*
+ * Read the counter frequency and start the cycle counter
+ * Safe to call before interrupts are set up
+ */
+void timer_init(void);
+
+/*
+ * Start the periodic tick on the calling core (core 0 first)
+ * Needs the GIC; returns 0 on success, -1 otherwise
+ */
+int timer_start_tick(void);
+
+/*
+ * Raw counter value (ticks since boot)
+ * The ISB keeps the read from being done early, out of program order.
+ */
+static inline uint64_t timer_ticks(void) {
+    uint64_t value;
+    __asm__ volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(value) :: "memory");
+    return value;
+}
+
+/*
+ * Counter frequency in Hz
+ */
+uint64_t timer_freq(void);
+
+/*
+ * Convert counter ticks to nanoseconds / microseconds
+ */
+uint64_t timer_ticks_to_ns(uint64_t ticks);
+uint64_t timer_ticks_to_us(uint64_t ticks);
+
+/*
+ * Time since boot
+ */
+uint64_t timer_now_ns(void);
+uint64_t timer_now_us(void);
+
+/*
+ * Number of tick interrupts since timer_start_tick
+ */
+uint64_t timer_jiffies(void);
+
+/*
+ * Busy-wait for a number of microseconds
+ */
+void timer_delay_us(uint64_t us);
+
+/*
+ * CPU cycle counter
+ * timer_cycles returns PMU cycles if timer_has_cycles(), otherwise
+ * counter ticks (much coarser than cycles)
+ */
+int timer_has_cycles(void);
+uint64_t timer_cycles(void);
+
+#endif // TIMER_H
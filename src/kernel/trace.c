@@ -0,0 +1,157 @@
+/*
+ * Trace Implementation
+ *
+ * All cores share one ring buffer. A writer claims a slot by atomically
+ * incrementing trace_head, fills it in, and finally publishes it by
+ * storing its sequence number. The dump skips any slot whose sequence
+ * number doesn't match, which happens when a writer is still filling it
+ * or has already wrapped around and overwritten it.
+ */
+
+#include "trace.h"
+#include "shell.h"
+#include "smp.h"
+#include "string.h"
+#include "timer.h"
+#include "uart.h"
+
+static trace_entry_t trace_ring[TRACE_RING_SIZE];
+
+/*
+ * Total number of events recorded (including overwritten ones)
+ */
+static volatile uint64_t trace_head = 0;
+
+/*
+ * Events before this sequence number were discarded by trace_clear
+ */
+static volatile uint64_t trace_start = 0;
+
+static const char *const trace_module_names[TRACE_MOD_COUNT] = {
+    "kernel", "mem", "smp", "fs", "blk"
+};
+
+static const int trace_module_levels[TRACE_MOD_COUNT] = {
+    TRACE_KERNEL, TRACE_MEM, TRACE_SMP, TRACE_FS, TRACE_BLK
+};
+
+static const char *const trace_level_names[] = {
+    "none", "error", "info", "debug"
+};
+
+/*
+ * Record an event
+ */
+void trace_record(int module, int level, const char *event,
+                  uint64_t arg0, uint64_t arg1) {
+    uint64_t seq = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    trace_entry_t *e = &trace_ring[seq & (TRACE_RING_SIZE - 1)];
+
+    /*
+     * Invalidate the slot while we fill it in
+     */
+    __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    e->timestamp = timer_ticks();
+    e->event = event;
+    e->arg0 = arg0;
+    e->arg1 = arg1;
+    e->cpu = (uint16_t)smp_cpu_id();
+    e->module = (uint8_t)module;
+    e->level = (uint8_t)level;
+
+    __atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Print the buffered events
+ */
+void trace_dump(size_t max_entries) {
+    uint64_t head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+    uint64_t first = __atomic_load_n(&trace_start, __ATOMIC_RELAXED);
+
+    if (head - first > TRACE_RING_SIZE) {
+        first = head - TRACE_RING_SIZE;  // Older events were overwritten
+    }
+    if (max_entries != 0 && head - first > max_entries) {
+        first = head - max_entries;
+    }
+
+    for (uint64_t seq = first; seq < head; seq++) {
+        trace_entry_t e = trace_ring[seq & (TRACE_RING_SIZE - 1)];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (e.seq != seq + 1 ||
+            __atomic_load_n(&trace_ring[seq & (TRACE_RING_SIZE - 1)].seq,
+                            __ATOMIC_RELAXED) != seq + 1) {
+            continue;  // Being written or already overwritten
+        }
+
+        uint64_t usec = timer_ticks_to_us(e.timestamp);
+
+        uart_puts("[");
+        uart_put_dec(usec);
+        uart_puts("us cpu");
+        uart_put_dec(e.cpu);
+        uart_puts("] ");
+        uart_puts(e.module < TRACE_MOD_COUNT ? trace_module_names[e.module] : "?");
+        uart_puts(".");
+        uart_puts(e.level <= TRACE_LEVEL_DEBUG ? trace_level_names[e.level] : "?");
+        uart_puts(" ");
+        uart_puts(e.event);
+        uart_puts(" ");
+        uart_put_hex(e.arg0);
+        uart_puts(" ");
+        uart_put_hex(e.arg1);
+        uart_putc('\n');
+    }
+}
+
+/*
+ * Discard all buffered events
+ */
+void trace_clear(void) {
+    __atomic_store_n(&trace_start, __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELAXED);
+}
+
+/*
+ * Module information
+ */
+int trace_module_level(int module) {
+    if (module < 0 || module >= TRACE_MOD_COUNT) {
+        return TRACE_LEVEL_NONE;
+    }
+    return trace_module_levels[module];
+}
+
+const char *trace_module_name(int module) {
+    if (module < 0 || module >= TRACE_MOD_COUNT) {
+        return "?";
+    }
+    return trace_module_names[module];
+}
+
+/*
+ * Command: trace
+ * Dump the trace ring buffer, or clear it
+ */
+static void cmd_trace(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "clear") == 0) {
+        trace_clear();
+        return;
+    }
+
+    uart_puts("Trace levels:");
+    for (int m = 0; m < TRACE_MOD_COUNT; m++) {
+        uart_puts(" ");
+        uart_puts(trace_module_name(m));
+        uart_puts("=");
+        uart_put_dec((uint64_t)trace_module_level(m));
+    }
+    uart_puts("\n");
+
+    trace_dump((size_t)shell_parse_number(argc > 1 ? argv[1] : NULL, 0));
+}
+SHELL_COMMAND(trace, cmd_trace, "[n|clear]", "Show recent trace events", 0);
@@ -0,0 +1,131 @@
+/*
+ * Trace Header
+ *
+ * Lightweight event tracing. Each trace point records a small binary
+ * entry (timestamp, CPU, event name and two numbers) into a ring buffer
+ * in memory; nothing is printed until someone asks for a dump with the
+ * `trace` shell command. This keeps tracing cheap enough to leave in hot
+ * paths, unlike printing to the UART at 115200 baud.
+ *
+ * Trace points are filtered at compile time. Each module has its own
+ * level, set from the Makefile (e.g. make TRACE_FS=3), and a source file
+ * picks its module by defining TRACE_MODULE before including this file:
+ *
+ *   #define TRACE_MODULE FS
+ *   #include "trace.h"
+ *
+ *   TRACE(DEBUG, "write", len, 0);
+ *
+ * A trace point above its module's level is a constant-false if, so it
+ * compiles to nothing, including its arguments.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Trace levels
+ */
+#define TRACE_LEVEL_NONE  0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_INFO  2
+#define TRACE_LEVEL_DEBUG 3
+
+/*
+ * Modules
+ * To add one, give it a TRACE_MOD_<MOD> number here (and bump
+ * TRACE_MOD_COUNT), add an #ifndef TRACE_<MOD> default below, add its
+ * name to trace_module_names in trace.c, and in the Makefile add a
+ * TRACE_<MOD> ?= 0 line and -DTRACE_<MOD>=$(TRACE_<MOD>) to the CFLAGS
+ * line after them
+ */
+#define TRACE_MOD_KERNEL 0
+#define TRACE_MOD_MEM    1
+#define TRACE_MOD_SMP    2
+#define TRACE_MOD_FS     3
+#define TRACE_MOD_BLK    4
+#define TRACE_MOD_COUNT  5
+
+/*
+ * Per-module compile-time levels (the Makefile passes -DTRACE_FS=N etc.)
+ */
+#ifndef TRACE_KERNEL
+#define TRACE_KERNEL TRACE_LEVEL_NONE
+#endif
+#ifndef TRACE_MEM
+#define TRACE_MEM TRACE_LEVEL_NONE
+#endif
+#ifndef TRACE_SMP
+#define TRACE_SMP TRACE_LEVEL_NONE
+#endif
+#ifndef TRACE_FS
+#define TRACE_FS TRACE_LEVEL_NONE
+#endif
+#ifndef TRACE_BLK
+#define TRACE_BLK TRACE_LEVEL_NONE
+#endif
+
+/*
+ * Number of entries in the ring buffer (power of two)
+ * Once full, new entries overwrite the oldest
+ */
+#define TRACE_RING_SIZE 1024
+
+/*
+ * One recorded event
+ */
+typedef struct {
+    uint64_t seq;                  // Sequence number + 1 (0 = never written)
+    uint64_t timestamp;            // Generic timer count
+    const char *event;             // Event name (string literal)
+    uint64_t arg0;                 // Event-specific values
+    uint64_t arg1;
+    uint16_t cpu;                  // Core that recorded it
+    uint8_t module;                // TRACE_MOD_*
+    uint8_t level;                 // TRACE_LEVEL_*
+} trace_entry_t;
+
+/*
+ * Record an event (use the TRACE macro instead of calling this)
+ */
+void trace_record(int module, int level, const char *event,
+                  uint64_t arg0, uint64_t arg1);
+
+/*
+ * Print the buffered events, oldest first, to the UART
+ * Prints at most max_entries of the newest events (0 = all)
+ */
+void trace_dump(size_t max_entries);
+
+/*
+ * Discard all buffered events
+ */
+void trace_clear(void);
+
+/*
+ * Get the compile-time trace level of each module
+ */
+int trace_module_level(int module);
+const char *trace_module_name(int module);
+
+/*
+ * Trace macro
+ */
+#define TRACE_CAT_(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT_(a, b)
+
+#ifdef TRACE_MODULE
+#define TRACE(level, event, arg0, arg1)                                        \
+    do {                                                                       \
+        if (TRACE_LEVEL_##level <= TRACE_CAT(TRACE_, TRACE_MODULE)) {          \
+            trace_record(TRACE_CAT(TRACE_MOD_, TRACE_MODULE),                  \
+                         TRACE_LEVEL_##level, (event),                         \
+                         (uint64_t)(arg0), (uint64_t)(arg1));                  \
+        }                                                                      \
+    } while (0)
+#endif
+
+#endif // TRACE_H
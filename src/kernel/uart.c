@@ -3,9 +3,31 @@
  *
  * This driver communicates with the PL011 UART hardware in QEMU.
  * The UART is memory-mapped at address 0x09000000.
+ *
+ * Until uart_irq_init() runs, every byte is written and read by polling
+ * the flag register. After that the driver is interrupt driven:
+ *
+ *   Output: uart_putc appends to the TX ring and returns. Bytes move
+ *           from the ring into the 16-byte hardware FIFO right away if
+ *           there is room, and the TX interrupt refills the FIFO as it
+ *           drains.
+ *   Input:  the RX interrupt moves received bytes into the RX ring;
+ *           uart_getc sleeps in WFI until one arrives.
+ *
+ * Each ring has one producer and one consumer, which only ever write
+ * their own index, so the two sides never need to lock each other out.
+ * Writers on different cores still take tx_lock between themselves, and
+ * whoever moves bytes into the FIFO (the TX interrupt or a writer) holds
+ * tx_fifo_lock with interrupts masked.
  */
 
 #include "uart.h"
+#include "gic.h"
+#include "irq.h"
+#include "sched.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "string.h"
 
 /*
  * UART base address for QEMU's virt machine
@@ -23,12 +45,62 @@
 #define UART_FBRD   (*(volatile uint32_t*)(UART_BASE + 0x28))  // Fractional Baud Rate
 #define UART_LCRH   (*(volatile uint32_t*)(UART_BASE + 0x2C))  // Line Control
 #define UART_CR     (*(volatile uint32_t*)(UART_BASE + 0x30))  // Control Register
+#define UART_IFLS   (*(volatile uint32_t*)(UART_BASE + 0x34))  // FIFO Level Select
+#define UART_IMSC   (*(volatile uint32_t*)(UART_BASE + 0x38))  // Interrupt Mask
+#define UART_MIS    (*(volatile uint32_t*)(UART_BASE + 0x40))  // Masked Interrupt Status
+#define UART_ICR    (*(volatile uint32_t*)(UART_BASE + 0x44))  // Interrupt Clear
 
 /*
  * UART Flag Register bits
  */
 #define UART_FR_TXFF (1 << 5)  // Transmit FIFO Full
 #define UART_FR_RXFE (1 << 4)  // Receive FIFO Empty
+#define UART_FR_BUSY (1 << 3)  // Still transmitting
+#define UART_FR_TXFE (1 << 7)  // Transmit FIFO Empty
+
+/*
+ * Depth of the PL011 transmit FIFO
+ */
+#define UART_FIFO_DEPTH 16
+
+/*
+ * UART interrupt bits (IMSC, MIS and ICR)
+ */
+#define UART_INT_RX (1 << 4)   // RX FIFO reached its trigger level
+#define UART_INT_TX (1 << 5)   // TX FIFO drained to its trigger level
+#define UART_INT_RT (1 << 6)   // RX timeout: data waiting below the level
+
+/*
+ * PL011 interrupt on QEMU's virt machine (SPI 1)
+ */
+#define UART_IRQ (GIC_SPI_BASE + 1)
+
+/*
+ * Ring buffer sizes (powers of two)
+ * The TX ring holds a whole 4KB file, so `cat` never has to wait
+ */
+#define UART_TX_RING_SIZE 8192
+#define UART_RX_RING_SIZE 256
+
+/*
+ * Ring buffers
+ * head is only written by the producer, tail only by the consumer
+ */
+static char tx_ring[UART_TX_RING_SIZE];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+
+static char rx_ring[UART_RX_RING_SIZE];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+
+static spinlock_t tx_lock = SPINLOCK_INIT;       // Serializes writers
+static spinlock_t tx_fifo_lock = SPINLOCK_INIT;  // Serializes FIFO fills
+
+/*
+ * 1 once output and input go through the rings
+ */
+static volatile int uart_irq_mode = 0;
 
 /*
  * Initialize the UART
@@ -65,33 +137,295 @@ void uart_init(void) {
 }
 
 /*
- * Write a single character to UART
- *
- * We wait until the transmit FIFO is not full, then write the character
+ * Transmit-side MMIO accesses and bytes sent, for uart_get_stats
+ * Updated without locking, so only approximate with several writers
  */
-void uart_putc(char c) {
+static uint64_t tx_mmio_count = 0;
+static uint64_t tx_byte_count = 0;
+
+static inline uint32_t tx_read_flags(void) {
+    tx_mmio_count++;
+    return UART_FR;
+}
+
+static inline void tx_write_data(char c) {
+    tx_mmio_count++;
+    tx_byte_count++;
+    UART_DR = (uint32_t)(uint8_t)c;
+}
+
+/*
+ * How many bytes can be written to the TX FIFO right now
+ * An empty FIFO takes a whole burst without checking FR again
+ */
+static inline uint32_t tx_fifo_room(void) {
+    uint32_t flags = tx_read_flags();
+
+    if (flags & UART_FR_TXFE) {
+        return UART_FIFO_DEPTH;
+    }
+    return (flags & UART_FR_TXFF) ? 0 : 1;
+}
+
+/*
+ * Write bytes straight to the hardware, as they are
+ */
+static void uart_write_raw(const char *buf, size_t len) {
+    while (len > 0) {
+        uint32_t room = tx_fifo_room();
+
+        while (room > 0 && len > 0) {
+            tx_write_data(*buf++);
+            room--;
+            len--;
+        }
+    }
+}
+
+/*
+ * Write bytes straight to the hardware, turning each '\n' into "\r\n"
+ * (terminals expect CR LF). Used before interrupts are set up.
+ */
+static void uart_write_polled(const char *buf, size_t len) {
+    int pending_cr = 0;
+
+    while (len > 0 || pending_cr) {
+        uint32_t room = tx_fifo_room();
+
+        while (room > 0 && (len > 0 || pending_cr)) {
+            if (pending_cr) {
+                tx_write_data('\r');
+                pending_cr = 0;
+            } else {
+                char c = *buf++;
+                len--;
+                tx_write_data(c);
+                pending_cr = (c == '\n');
+            }
+            room--;
+        }
+    }
+}
+
+/*
+ * Move bytes from the TX ring into the hardware FIFO until one of them
+ * is full/empty. Caller holds tx_fifo_lock with interrupts masked.
+ */
+static void tx_fill_fifo(void) {
+    uint32_t tail = tx_tail;
+    uint32_t head = __atomic_load_n(&tx_head, __ATOMIC_ACQUIRE);
+
+    while (tail != head) {
+        uint32_t room = tx_fifo_room();
+        if (room == 0) {
+            break;
+        }
+
+        while (room > 0 && tail != head) {
+            tx_write_data(tx_ring[tail % UART_TX_RING_SIZE]);
+            tail++;
+            room--;
+        }
+    }
+
+    __atomic_store_n(&tx_tail, tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Start transmitting whatever is in the TX ring
+ */
+static void tx_kick(void) {
+    uint64_t flags = irq_save();
+    spin_lock(&tx_fifo_lock);
+    tx_fill_fifo();
+    spin_unlock(&tx_fifo_lock);
+    irq_restore(flags);
+}
+
+/*
+ * Copy len bytes into the TX ring at head (caller holds tx_lock)
+ * Returns the new head. If the ring fills up, publish what we have and
+ * feed the FIFO ourselves until there is room.
+ */
+static uint32_t tx_copy(uint32_t head, const char *src, size_t len) {
+    while (len > 0) {
+        uint32_t space = UART_TX_RING_SIZE - (head - __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE));
+        if (space == 0) {
+            __atomic_store_n(&tx_head, head, __ATOMIC_RELEASE);
+            tx_kick();
+            continue;
+        }
+
+        /*
+         * Copy up to the free space or the end of the ring, whichever
+         * comes first
+         */
+        uint32_t offset = head % UART_TX_RING_SIZE;
+        size_t chunk = len;
+        if (chunk > space) {
+            chunk = space;
+        }
+        if (chunk > UART_TX_RING_SIZE - offset) {
+            chunk = UART_TX_RING_SIZE - offset;
+        }
+
+        memcpy(&tx_ring[offset], src, chunk);
+        head += (uint32_t)chunk;
+        src += chunk;
+        len -= chunk;
+    }
+    return head;
+}
+
+/*
+ * Write a buffer to the UART
+ */
+void uart_write(const char *buf, size_t len) {
+    if (!uart_irq_mode) {
+        uart_write_polled(buf, len);
+        return;
+    }
+
+    spin_lock(&tx_lock);
+
     /*
-     * Wait until TX FIFO is not full
-     * UART_FR_TXFF = 1 when FIFO is full
+     * Copy each run of text up to and including a newline in one go,
+     * then add the '\r'
      */
-    while (UART_FR & UART_FR_TXFF) {
-        // Busy wait
+    uint32_t head = tx_head;
+    while (len > 0) {
+        const char *nl = memchr(buf, '\n', len);
+        size_t run = (nl != NULL) ? (size_t)(nl - buf) + 1 : len;
+
+        head = tx_copy(head, buf, run);
+        if (nl != NULL) {
+            head = tx_copy(head, "\r", 1);
+        }
+        buf += run;
+        len -= run;
+    }
+    __atomic_store_n(&tx_head, head, __ATOMIC_RELEASE);
+
+    spin_unlock(&tx_lock);
+
+    tx_kick();
+}
+
+/*
+ * Write a single character to UART
+ */
+void uart_putc(char c) {
+    uart_write(&c, 1);
+}
+
+/*
+ * Get transmit statistics
+ */
+void uart_get_stats(uart_stats_t *stats) {
+    stats->bytes = tx_byte_count;
+    stats->mmio_accesses = tx_mmio_count;
+}
+
+/*
+ * UART interrupt handler
+ */
+static void uart_irq_handler(void *arg) {
+    (void)arg;
+    uint32_t status = UART_MIS;
+
+    if (status & (UART_INT_RX | UART_INT_RT)) {
+        uint32_t head = rx_head;
+
+        while (!(UART_FR & UART_FR_RXFE)) {
+            char c = (char)(UART_DR & 0xFF);
+
+            /*
+             * Drop input if nobody is reading it
+             */
+            if (head - __atomic_load_n(&rx_tail, __ATOMIC_ACQUIRE) < UART_RX_RING_SIZE) {
+                rx_ring[head % UART_RX_RING_SIZE] = c;
+                head++;
+            }
+        }
+
+        __atomic_store_n(&rx_head, head, __ATOMIC_RELEASE);
+        UART_ICR = UART_INT_RX | UART_INT_RT;
+    }
+
+    if (status & UART_INT_TX) {
+        UART_ICR = UART_INT_TX;
+        spin_lock(&tx_fifo_lock);
+        tx_fill_fifo();
+        spin_unlock(&tx_fifo_lock);
+    }
+}
+
+/*
+ * Switch to interrupt-driven operation
+ */
+int uart_irq_init(void) {
+    if (!gic_ready()) {
+        return -1;
     }
 
     /*
-     * Write the character to the data register
+     * Interrupt when the TX FIFO drains to 1/8 full and when the RX
+     * FIFO fills to 1/8 (or data has waited for a while)
      */
-    UART_DR = (uint32_t)c;
+    UART_IFLS = 0;
+    UART_ICR = 0x7FF;
+    UART_IMSC = UART_INT_RX | UART_INT_RT | UART_INT_TX;
+
+    if (irq_register(UART_IRQ, uart_irq_handler, NULL) != 0) {
+        UART_IMSC = 0;
+        return -1;
+    }
+
+    uart_irq_mode = 1;
+    return 0;
+}
+
+/*
+ * Go back to polled output
+ */
+void uart_panic_mode(void) {
+    uart_irq_mode = 0;
+    UART_IMSC = 0;
 
     /*
-     * Handle newline: also send carriage return for proper formatting
-     * This makes output look correct in terminal emulators
+     * Print what was still queued so the message appears in order
+     * (the lock holder may have crashed, so don't take tx_fifo_lock)
      */
-    if (c == '\n') {
-        while (UART_FR & UART_FR_TXFF) {
-            // Busy wait
+    uint32_t head = tx_head;
+    for (uint32_t tail = tx_tail; tail != head; tail++) {
+        uart_write_raw(&tx_ring[tail % UART_TX_RING_SIZE], 1);
+    }
+    tx_tail = head;
+}
+
+/*
+ * Wait until all queued output has been sent
+ */
+void uart_flush(void) {
+    while (uart_irq_mode &&
+           __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE) != __atomic_load_n(&tx_head, __ATOMIC_ACQUIRE)) {
+        /*
+         * The TX interrupt (routed to core 0) refills the FIFO; other
+         * cores can't sleep until it does, so they just feed it
+         */
+        if (smp_cpu_id() == 0) {
+            uint64_t flags = irq_save();
+            if (tx_tail != tx_head) {
+                cpu_idle();
+            }
+            irq_restore(flags);
+        } else {
+            tx_kick();
         }
-        UART_DR = '\r';
+    }
+
+    while (UART_FR & UART_FR_BUSY) {
+        // Last bytes leaving the FIFO
     }
 }
 
@@ -99,23 +433,77 @@ void uart_putc(char c) {
  * Write a null-terminated string to UART
  */
 void uart_puts(const char *str) {
-    while (*str) {
-        uart_putc(*str++);
+    uart_write(str, strlen(str));
+}
+
+/*
+ * Write an unsigned number in decimal
+ */
+void uart_put_dec(uint64_t value) {
+    char digits[20];
+    int pos = 0;
+
+    do {
+        digits[pos++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    while (pos > 0) {
+        uart_putc(digits[--pos]);
+    }
+}
+
+/*
+ * Write an unsigned number in hexadecimal
+ */
+void uart_put_hex(uint64_t value) {
+    uart_puts("0x");
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        int nibble = (value >> shift) & 0xF;
+        uart_putc(nibble < 10 ? '0' + nibble : 'a' + nibble - 10);
     }
 }
 
 /*
  * Read a single character from UART
  *
- * This blocks until a character is available
+ * This blocks until a character is available. In interrupt mode the
+ * caller sleeps in WFI meanwhile, which only works on core 0 (where the
+ * UART interrupt goes) with interrupts unmasked.
  */
 char uart_getc(void) {
+    if (uart_irq_mode) {
+        uint32_t tail = rx_tail;
+
+        while (__atomic_load_n(&rx_head, __ATOMIC_ACQUIRE) == tail) {
+            if (smp_cpu_id() != 0) {
+                thread_yield();
+                continue;
+            }
+
+            /*
+             * Check again with interrupts masked: if a byte arrives
+             * after the check, its interrupt stays pending and wakes
+             * us from WFI, and is taken once we unmask
+             */
+            uint64_t flags = irq_save();
+            if (__atomic_load_n(&rx_head, __ATOMIC_ACQUIRE) == tail) {
+                cpu_idle();
+            }
+            irq_restore(flags);
+        }
+
+        char c = rx_ring[tail % UART_RX_RING_SIZE];
+        __atomic_store_n(&rx_tail, tail + 1, __ATOMIC_RELEASE);
+        return c;
+    }
+
     /*
-     * Wait until RX FIFO is not empty
+     * Wait until RX FIFO is not empty, letting other threads run
      * UART_FR_RXFE = 1 when FIFO is empty
      */
     while (UART_FR & UART_FR_RXFE) {
-        // Busy wait
+        thread_yield();
     }
 
     /*
@@ -129,6 +517,10 @@ char uart_getc(void) {
  * Check if a character is available to read
  */
 int uart_can_read(void) {
+    if (uart_irq_mode) {
+        return __atomic_load_n(&rx_head, __ATOMIC_ACQUIRE) != rx_tail;
+    }
+
     /*
      * Return 1 if FIFO is NOT empty (data available)
      * Return 0 if FIFO is empty
@@ -11,6 +11,15 @@
 #define UART_H
 
 #include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Transmit statistics (see uart_get_stats)
+ */
+typedef struct {
+    uint64_t bytes;            // Bytes written to the data register
+    uint64_t mmio_accesses;    // Data and flag register accesses for them
+} uart_stats_t;
 
 /*
  * Initialize the UART hardware
@@ -18,19 +27,62 @@
  */
 void uart_init(void);
 
+/*
+ * Switch the UART to interrupt-driven input and output
+ * Needs the GIC (gic_init) and exception vectors (irq_init)
+ * Returns 0 on success, -1 if interrupts aren't available (the UART
+ * then keeps polling)
+ */
+int uart_irq_init(void);
+
+/*
+ * Go back to polled output, printing anything still queued
+ * Used when the kernel crashes and interrupts can't be trusted
+ */
+void uart_panic_mode(void);
+
+/*
+ * Wait until all queued output has been transmitted
+ */
+void uart_flush(void);
+
 /*
  * Write a single character to the UART
+ * Queues it and returns once interrupts are set up (uart_irq_init)
  */
 void uart_putc(char c);
 
+/*
+ * Write len bytes to the UART
+ * Newlines are sent as CR LF. Much cheaper per byte than uart_putc:
+ * the bytes are queued in one go and the FIFO is filled in bursts.
+ */
+void uart_write(const char *buf, size_t len);
+
 /*
  * Write a null-terminated string to the UART
  */
 void uart_puts(const char *str);
 
+/*
+ * Write an unsigned number in decimal
+ */
+void uart_put_dec(uint64_t value);
+
+/*
+ * Write an unsigned number in hexadecimal (with 0x prefix)
+ */
+void uart_put_hex(uint64_t value);
+
+/*
+ * Get transmit statistics since boot
+ */
+void uart_get_stats(uart_stats_t *stats);
+
 /*
  * Read a single character from the UART
- * Blocks until a character is available
+ * Blocks until a character is available (sleeping in WFI on core 0
+ * once interrupts are set up)
  */
 char uart_getc(void);
 
@@ -0,0 +1,444 @@
+/*
+ * Virtio Block Device Driver
+ *
+ * Talks to a virtio-blk disk through QEMU's virtio-mmio transport. Both
+ * the legacy (version 1, QEMU's default) and the current (version 2)
+ * register layouts are handled; they differ only in how the queue's
+ * memory is handed to the device.
+ *
+ * The virtqueue is three rings in ordinary memory shared with the
+ * device:
+ *
+ *   Descriptor table - buffers (address, length, flags), chained with
+ *                      "next" into one request
+ *   Available ring   - heads of the chains we've handed to the device
+ *   Used ring        - heads of the chains it has finished, with status
+ *
+ * Every request is a chain of three descriptors: a header saying read or
+ * write and which sector, the data buffer, and one status byte the
+ * device fills in. Request slot i always uses descriptors 3i to 3i + 2,
+ * so the chains never need to be allocated; a bitmap tracks which slots
+ * are busy.
+ *
+ * Completions are collected from the used ring by whoever gets there
+ * first: the interrupt handler, or a waiter polling (which also covers
+ * running without interrupts, and waiters on other cores, since device
+ * interrupts only go to core 0). Both hold queue_lock with interrupts
+ * masked.
+ */
+
+#include "virtio_blk.h"
+#include "gic.h"
+#include "irq.h"
+#include "page_alloc.h"
+#include "sched.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "string.h"
+
+#define TRACE_MODULE BLK
+#include "trace.h"
+
+/*
+ * virtio-mmio windows on QEMU's virt machine, and their interrupts
+ * (window n raises SPI 16 + n)
+ */
+#define VIRTIO_MMIO_BASE   0x0a000000UL
+#define VIRTIO_MMIO_STRIDE 0x200
+#define VIRTIO_MMIO_COUNT  32
+#define VIRTIO_MMIO_IRQ    (GIC_SPI_BASE + 16)
+
+/*
+ * Register offsets
+ */
+#define VIRTIO_MAGIC            0x000   // "virt"
+#define VIRTIO_VERSION          0x004   // 1 = legacy, 2 = current
+#define VIRTIO_DEVICE_ID        0x008   // 2 = block device, 0 = empty slot
+#define VIRTIO_DEVICE_FEATURES  0x010
+#define VIRTIO_DEVICE_FEAT_SEL  0x014
+#define VIRTIO_DRIVER_FEATURES  0x020
+#define VIRTIO_DRIVER_FEAT_SEL  0x024
+#define VIRTIO_GUEST_PAGE_SIZE  0x028   // Legacy only
+#define VIRTIO_QUEUE_SEL        0x030
+#define VIRTIO_QUEUE_NUM_MAX    0x034
+#define VIRTIO_QUEUE_NUM        0x038
+#define VIRTIO_QUEUE_ALIGN      0x03c   // Legacy only
+#define VIRTIO_QUEUE_PFN        0x040   // Legacy only
+#define VIRTIO_QUEUE_READY      0x044
+#define VIRTIO_QUEUE_NOTIFY     0x050
+#define VIRTIO_INT_STATUS       0x060
+#define VIRTIO_INT_ACK          0x064
+#define VIRTIO_STATUS           0x070
+#define VIRTIO_QUEUE_DESC_LO    0x080
+#define VIRTIO_QUEUE_DESC_HI    0x084
+#define VIRTIO_QUEUE_AVAIL_LO   0x090
+#define VIRTIO_QUEUE_AVAIL_HI   0x094
+#define VIRTIO_QUEUE_USED_LO    0x0a0
+#define VIRTIO_QUEUE_USED_HI    0x0a4
+#define VIRTIO_CONFIG           0x100   // Block: capacity (u64, sectors)
+
+#define VIRTIO_MAGIC_VALUE 0x74726976
+#define VIRTIO_ID_BLOCK    2
+
+/*
+ * Device status bits
+ */
+#define VIRTIO_STATUS_ACK         1
+#define VIRTIO_STATUS_DRIVER      2
+#define VIRTIO_STATUS_DRIVER_OK   4
+#define VIRTIO_STATUS_FEATURES_OK 8
+
+/*
+ * VIRTIO_F_VERSION_1 (feature bit 32): required by version 2 devices
+ */
+#define VIRTIO_F_VERSION_1_HI (1u << 0)
+
+/*
+ * Descriptor flags
+ */
+#define VIRTQ_DESC_F_NEXT  1   // Chain continues in next
+#define VIRTQ_DESC_F_WRITE 2   // Device writes this buffer
+
+/*
+ * Block request types and status values
+ */
+#define VIRTIO_BLK_T_IN   0   // Read
+#define VIRTIO_BLK_T_OUT  1   // Write
+#define VIRTIO_BLK_S_OK   0
+
+/*
+ * Virtqueue layout (legacy layout: the used ring starts on the next
+ * page, which version 2 devices are happy with too)
+ */
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} virtq_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[VIRTIO_BLK_QUEUE_SIZE];
+} virtq_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} virtq_used_elem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    virtq_used_elem_t ring[VIRTIO_BLK_QUEUE_SIZE];
+} virtq_used_t;
+
+_Static_assert(sizeof(virtq_desc_t) * VIRTIO_BLK_QUEUE_SIZE + sizeof(virtq_avail_t) <= PAGE_SIZE,
+               "descriptors and available ring must fit in the first page");
+
+/*
+ * Request header, read by the device
+ */
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} virtio_blk_req_t;
+
+/*
+ * Per-slot request state
+ */
+typedef struct {
+    virtio_blk_req_t header;
+    volatile uint8_t status;       // Written by the device
+    volatile uint8_t done;         // Set when it shows up in the used ring
+} blk_slot_t;
+
+static volatile uint8_t *regs = NULL;
+static virtq_desc_t *desc;
+static virtq_avail_t *avail;
+static virtq_used_t *used;
+static uint16_t used_seen;         // Used ring entries collected so far
+
+static blk_slot_t slots[VIRTIO_BLK_MAX_INFLIGHT];
+static uint32_t slots_busy;        // Bit per slot
+static uint64_t capacity;
+static spinlock_t queue_lock = SPINLOCK_INIT;
+
+_Static_assert(VIRTIO_BLK_MAX_INFLIGHT <= 32, "slot bitmap is 32 bits");
+
+static inline uint32_t reg_read(uint32_t offset) {
+    return *(volatile uint32_t *)(regs + offset);
+}
+
+static inline void reg_write(uint32_t offset, uint32_t value) {
+    *(volatile uint32_t *)(regs + offset) = value;
+}
+
+/*
+ * Order our ring updates against the device's view of memory
+ */
+static inline void dma_barrier(void) {
+    __asm__ volatile("dmb sy" ::: "memory");
+}
+
+/*
+ * Collect finished requests from the used ring
+ * Caller holds queue_lock with interrupts masked.
+ */
+static void collect_used(void) {
+    dma_barrier();
+    uint16_t idx = __atomic_load_n(&used->idx, __ATOMIC_ACQUIRE);
+
+    while (used_seen != idx) {
+        uint32_t head = used->ring[used_seen % VIRTIO_BLK_QUEUE_SIZE].id;
+        slots[head / 3].done = 1;
+        TRACE(DEBUG, "complete", head / 3, slots[head / 3].status);
+        used_seen++;
+    }
+}
+
+static void virtio_blk_irq(void *arg) {
+    (void)arg;
+
+    spin_lock(&queue_lock);
+    reg_write(VIRTIO_INT_ACK, reg_read(VIRTIO_INT_STATUS));
+    collect_used();
+    spin_unlock(&queue_lock);
+}
+
+/*
+ * Set up queue 0
+ * Returns 0 on success, -1 if the device's queue is too small or we
+ * are out of memory
+ */
+static int setup_queue(uint32_t version) {
+    reg_write(VIRTIO_QUEUE_SEL, 0);
+    if (reg_read(VIRTIO_QUEUE_NUM_MAX) < VIRTIO_BLK_QUEUE_SIZE) {
+        return -1;
+    }
+
+    char *mem = page_alloc(1);   // Two pages: rings, then used ring
+    if (mem == NULL) {
+        return -1;
+    }
+    memset(mem, 0, 2 * PAGE_SIZE);
+    desc = (virtq_desc_t *)mem;
+    avail = (virtq_avail_t *)(mem + VIRTIO_BLK_QUEUE_SIZE * sizeof(virtq_desc_t));
+    used = (virtq_used_t *)(mem + PAGE_SIZE);
+    used_seen = 0;
+
+    reg_write(VIRTIO_QUEUE_NUM, VIRTIO_BLK_QUEUE_SIZE);
+
+    if (version == 1) {
+        reg_write(VIRTIO_GUEST_PAGE_SIZE, PAGE_SIZE);
+        reg_write(VIRTIO_QUEUE_ALIGN, PAGE_SIZE);
+        reg_write(VIRTIO_QUEUE_PFN, (uint32_t)((uint64_t)mem >> PAGE_SHIFT));
+    } else {
+        reg_write(VIRTIO_QUEUE_DESC_LO, (uint32_t)(uint64_t)desc);
+        reg_write(VIRTIO_QUEUE_DESC_HI, (uint32_t)((uint64_t)desc >> 32));
+        reg_write(VIRTIO_QUEUE_AVAIL_LO, (uint32_t)(uint64_t)avail);
+        reg_write(VIRTIO_QUEUE_AVAIL_HI, (uint32_t)((uint64_t)avail >> 32));
+        reg_write(VIRTIO_QUEUE_USED_LO, (uint32_t)(uint64_t)used);
+        reg_write(VIRTIO_QUEUE_USED_HI, (uint32_t)((uint64_t)used >> 32));
+        reg_write(VIRTIO_QUEUE_READY, 1);
+    }
+
+    /*
+     * Chain each slot's three descriptors once; only addresses, lengths
+     * and the data direction change per request
+     */
+    for (int i = 0; i < VIRTIO_BLK_MAX_INFLIGHT; i++) {
+        virtq_desc_t *d = &desc[i * 3];
+        d[0].addr = (uint64_t)&slots[i].header;
+        d[0].len = sizeof(virtio_blk_req_t);
+        d[0].flags = VIRTQ_DESC_F_NEXT;
+        d[0].next = (uint16_t)(i * 3 + 1);
+        d[1].next = (uint16_t)(i * 3 + 2);
+        d[2].addr = (uint64_t)&slots[i].status;
+        d[2].len = 1;
+        d[2].flags = VIRTQ_DESC_F_WRITE;
+    }
+    return 0;
+}
+
+/*
+ * Initialize one virtio-mmio window holding a block device
+ */
+static int init_device(uint32_t version) {
+    reg_write(VIRTIO_STATUS, 0);   // Reset
+    reg_write(VIRTIO_STATUS, VIRTIO_STATUS_ACK);
+    reg_write(VIRTIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    /*
+     * We need no optional features; version 2 devices insist we accept
+     * VIRTIO_F_VERSION_1
+     */
+    reg_write(VIRTIO_DRIVER_FEAT_SEL, 0);
+    reg_write(VIRTIO_DRIVER_FEATURES, 0);
+    if (version == 2) {
+        reg_write(VIRTIO_DRIVER_FEAT_SEL, 1);
+        reg_write(VIRTIO_DRIVER_FEATURES, VIRTIO_F_VERSION_1_HI);
+        reg_write(VIRTIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER |
+                                 VIRTIO_STATUS_FEATURES_OK);
+        if (!(reg_read(VIRTIO_STATUS) & VIRTIO_STATUS_FEATURES_OK)) {
+            return -1;
+        }
+    }
+
+    if (setup_queue(version) != 0) {
+        return -1;
+    }
+
+    capacity = *(volatile uint64_t *)(regs + VIRTIO_CONFIG);
+    reg_write(VIRTIO_STATUS, reg_read(VIRTIO_STATUS) | VIRTIO_STATUS_DRIVER_OK);
+    return 0;
+}
+
+int virtio_blk_init(void) {
+    for (int i = 0; i < VIRTIO_MMIO_COUNT; i++) {
+        volatile uint8_t *base = (volatile uint8_t *)(VIRTIO_MMIO_BASE + i * VIRTIO_MMIO_STRIDE);
+        uint32_t magic = *(volatile uint32_t *)(base + VIRTIO_MAGIC);
+        uint32_t version = *(volatile uint32_t *)(base + VIRTIO_VERSION);
+        uint32_t id = *(volatile uint32_t *)(base + VIRTIO_DEVICE_ID);
+
+        if (magic != VIRTIO_MAGIC_VALUE || id != VIRTIO_ID_BLOCK ||
+            (version != 1 && version != 2)) {
+            continue;
+        }
+
+        regs = base;
+        if (init_device(version) != 0) {
+            TRACE(ERROR, "init failed", i, version);
+            regs = NULL;
+            return -1;
+        }
+
+        /*
+         * Without a GIC every wait just polls the used ring
+         */
+        if (gic_ready()) {
+            irq_register(VIRTIO_MMIO_IRQ + i, virtio_blk_irq, NULL);
+        }
+        TRACE(INFO, "disk", i, capacity);
+        return 0;
+    }
+    return -1;
+}
+
+int virtio_blk_ready(void) {
+    return regs != NULL;
+}
+
+uint64_t virtio_blk_capacity(void) {
+    return capacity;
+}
+
+int virtio_blk_submit(uint64_t sector, void *buf, uint32_t count, int write) {
+    if (regs == NULL || count == 0 || sector >= capacity || count > capacity - sector) {
+        return -1;
+    }
+
+    uint64_t flags = irq_save();
+    spin_lock(&queue_lock);
+
+    uint32_t free_slots = ~slots_busy & ((1u << VIRTIO_BLK_MAX_INFLIGHT) - 1);
+    if (free_slots == 0) {
+        spin_unlock(&queue_lock);
+        irq_restore(flags);
+        return -1;
+    }
+    int id = __builtin_ctz(free_slots);
+    slots_busy |= 1u << id;
+
+    blk_slot_t *s = &slots[id];
+    s->header.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    s->header.reserved = 0;
+    s->header.sector = sector;
+    s->status = 0xFF;
+    s->done = 0;
+
+    virtq_desc_t *data = &desc[id * 3 + 1];
+    data->addr = (uint64_t)buf;
+    data->len = count * VIRTIO_BLK_SECTOR_SIZE;
+    data->flags = VIRTQ_DESC_F_NEXT | (write ? 0 : VIRTQ_DESC_F_WRITE);
+
+    /*
+     * Publish the chain, then the new index, then tell the device
+     */
+    avail->ring[avail->idx % VIRTIO_BLK_QUEUE_SIZE] = (uint16_t)(id * 3);
+    dma_barrier();
+    avail->idx++;
+    dma_barrier();
+    reg_write(VIRTIO_QUEUE_NOTIFY, 0);
+    TRACE(DEBUG, write ? "write" : "read", sector, count);
+
+    spin_unlock(&queue_lock);
+    irq_restore(flags);
+    return id;
+}
+
+int virtio_blk_done(int id) {
+    uint64_t flags = irq_save();
+    spin_lock(&queue_lock);
+    collect_used();
+    int done = slots[id].done;
+    spin_unlock(&queue_lock);
+    irq_restore(flags);
+    return done;
+}
+
+int virtio_blk_wait(int id) {
+    while (!virtio_blk_done(id)) {
+        /*
+         * Sleep until the completion interrupt on core 0 (checking again
+         * with interrupts masked, as uart_getc does); other cores, and
+         * core 0 without interrupts, poll and let other threads run
+         */
+        if (gic_ready() && smp_cpu_id() == 0) {
+            uint64_t flags = irq_save();
+            if (!slots[id].done) {
+                cpu_idle();
+            }
+            irq_restore(flags);
+        } else {
+            thread_yield();
+        }
+    }
+
+    uint64_t flags = irq_save();
+    spin_lock(&queue_lock);
+    int ok = slots[id].status == VIRTIO_BLK_S_OK;
+    slots_busy &= ~(1u << id);
+    spin_unlock(&queue_lock);
+    irq_restore(flags);
+
+    if (!ok) {
+        TRACE(ERROR, "request failed", slots[id].header.sector, slots[id].status);
+    }
+    return ok ? 0 : -1;
+}
+
+int virtio_blk_read(uint64_t sector, void *buf, uint32_t count) {
+    int id;
+
+    while ((id = virtio_blk_submit(sector, buf, count, 0)) < 0) {
+        if (regs == NULL || count == 0 || sector >= capacity || count > capacity - sector) {
+            return -1;
+        }
+        // All slots busy with someone else's requests - try again
+    }
+    return virtio_blk_wait(id);
+}
+
+int virtio_blk_write(uint64_t sector, const void *buf, uint32_t count) {
+    int id;
+
+    while ((id = virtio_blk_submit(sector, (void *)buf, count, 1)) < 0) {
+        if (regs == NULL || count == 0 || sector >= capacity || count > capacity - sector) {
+            return -1;
+        }
+    }
+    return virtio_blk_wait(id);
+}
@@ -0,0 +1,80 @@
+/*
+ * Virtio Block Device Driver Header
+ *
+ * Drives a virtio-blk disk on QEMU's virt machine, which exposes virtio
+ * devices through 32 "virtio-mmio" register windows starting at
+ * 0x0a000000. A disk appears in one of them when QEMU is started with
+ *
+ *   -drive file=disk.img,if=none,format=raw,id=hd0
+ *   -device virtio-blk-device,drive=hd0
+ *
+ * (run.sh does this when disk.img exists).
+ *
+ * Requests go through a single virtqueue. Several can be in flight at
+ * once: virtio_blk_submit queues one and returns straight away, and
+ * virtio_blk_wait collects it. virtio_blk_read and virtio_blk_write are
+ * the one-at-a-time versions.
+ */
+
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Disk sector size (the unit of sector numbers and capacity)
+ */
+#define VIRTIO_BLK_SECTOR_SIZE 512
+
+/*
+ * Descriptors in the virtqueue; each request uses three (header, data,
+ * status), so this many / 3 requests can be in flight
+ */
+#define VIRTIO_BLK_QUEUE_SIZE 32
+#define VIRTIO_BLK_MAX_INFLIGHT (VIRTIO_BLK_QUEUE_SIZE / 3)
+
+/*
+ * Find and initialize the disk
+ * Returns 0 on success, -1 if there is no virtio-blk device
+ */
+int virtio_blk_init(void);
+
+/*
+ * Check whether virtio_blk_init found a disk
+ */
+int virtio_blk_ready(void);
+
+/*
+ * Disk size in sectors
+ */
+uint64_t virtio_blk_capacity(void);
+
+/*
+ * Queue a read (write = 0) or write (write = 1) of count sectors
+ * starting at sector, to or from buf
+ * buf must stay valid until the request is collected.
+ * Returns a request ID for virtio_blk_wait, or -1 if the request is
+ * out of range or all VIRTIO_BLK_MAX_INFLIGHT slots are busy
+ */
+int virtio_blk_submit(uint64_t sector, void *buf, uint32_t count, int write);
+
+/*
+ * Check whether a submitted request has finished, without waiting
+ */
+int virtio_blk_done(int id);
+
+/*
+ * Wait for a submitted request to finish and free its slot
+ * Returns 0 on success, -1 if the device reported an error
+ */
+int virtio_blk_wait(int id);
+
+/*
+ * Read or write count sectors and wait for the result
+ * Returns 0 on success, -1 on error
+ */
+int virtio_blk_read(uint64_t sector, void *buf, uint32_t count);
+int virtio_blk_write(uint64_t sector, const void *buf, uint32_t count);
+
+#endif // VIRTIO_BLK_H
@@ -0,0 +1,349 @@
+/*
+ * File System Fuzz Harness
+ *
+ * Turns the fuzzer's input into a sequence of memfs operations and
+ * checks every result against a simple model of what the file system
+ * should contain. Each input starts from a freshly reset kernel heap and
+ * file system.
+ *
+ * Input format, 4 bytes per operation until the input runs out:
+ *
+ *   byte 0: operation (low 3 bits, see below); the other bits add to
+ *           the offset
+ *   byte 1: file name (one of FUZZ_NAMES; more than MAX_FILES, so the
+ *           file system fills up)
+ *   byte 2: offset / 253 (offsets reach FUZZ_SPACE, 16 blocks); also
+ *           picks the view slot for OP_VIEW
+ *   byte 3: length / 37, also used as the data written
+ *
+ * Built with -fsanitize=fuzzer this is a libFuzzer target. Built with
+ * -DFUZZ_STANDALONE it instead runs each file named on the command line
+ * (or stdin), for AFL and for replaying crashes.
+ */
+
+#include "memfs.h"
+#include "memory.h"
+#include "page_alloc.h"
+#include "string.h"
+
+#define FUZZ_NAMES (MAX_FILES + 8)
+#define FUZZ_SPACE (16 * FS_BLOCK_SIZE)
+#define FUZZ_VIEWS 4
+
+enum {
+    OP_WRITE_FILE,
+    OP_WRITE_AT,
+    OP_TRUNCATE,
+    OP_READ_AT,
+    OP_DELETE,
+    OP_EXISTS,
+    OP_APPEND,
+    OP_VIEW,
+    OP_COUNT
+};
+
+/*
+ * Model: which names exist and what they hold (zero past the end)
+ */
+static struct {
+    int exists;
+    size_t size;
+    uint8_t data[FUZZ_SPACE];
+} model[FUZZ_NAMES];
+
+static int model_count;
+
+/*
+ * Open views and what their file held when they were opened
+ */
+static struct {
+    int open;
+    fs_view_t view;
+    size_t size;
+    uint8_t data[FUZZ_SPACE];
+} views[FUZZ_VIEWS];
+
+static uint8_t buf[FUZZ_SPACE + 1];
+
+static void fuzz_check(int ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "fuzz_memfs: %s\n", what);
+        abort();
+    }
+}
+
+static void fuzz_name(char *name, int n) {
+    strcpy(name, "fuzz.");
+    name[5] = (char)('0' + n / 10);
+    name[6] = (char)('0' + n % 10);
+    name[7] = '\0';
+}
+
+/*
+ * A write to a missing file creates it if there is a free slot
+ */
+static int model_can_create(int n) {
+    return model[n].exists || model_count < MAX_FILES;
+}
+
+static void model_create(int n) {
+    if (!model[n].exists) {
+        model[n].exists = 1;
+        model[n].size = 0;
+        model_count++;
+    }
+}
+
+static void model_set_size(int n, size_t size) {
+    if (size < model[n].size) {
+        memset(model[n].data + size, 0, model[n].size - size);
+    }
+    model[n].size = size;
+}
+
+static void fuzz_write_file(const char *name, int n, size_t len, uint8_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(seed + i) | 1;   // No NULs inside the string
+    }
+    buf[len] = '\0';
+
+    int ret = fs_write_file(name, (const char *)buf);
+    fuzz_check((ret == 0) == model_can_create(n), "write_file result");
+    if (ret == 0) {
+        model_create(n);
+        memcpy(model[n].data, buf, len);
+        model_set_size(n, len);
+    }
+}
+
+static void fuzz_write_at(const char *name, int n, size_t offset, size_t len, uint8_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(seed * 7 + i);
+    }
+
+    int ret = fs_write_at(name, offset, buf, len);
+    fuzz_check((ret == 0) == model_can_create(n), "write_at result");
+    if (ret == 0) {
+        model_create(n);
+        memcpy(model[n].data + offset, buf, len);
+        if (len > 0 && offset + len > model[n].size) {
+            model[n].size = offset + len;
+        }
+    }
+}
+
+static void fuzz_truncate(const char *name, int n, size_t size) {
+    int ret = fs_truncate(name, size);
+    fuzz_check((ret == 0) == model[n].exists, "truncate result");
+    if (ret == 0) {
+        model_set_size(n, size);
+    }
+}
+
+static void fuzz_read_at(const char *name, int n, size_t offset, size_t len) {
+    long ret = fs_read_at(name, offset, buf, len);
+
+    if (!model[n].exists) {
+        fuzz_check(ret == -1, "read of missing file");
+        return;
+    }
+
+    size_t expect = offset < model[n].size ? model[n].size - offset : 0;
+    if (expect > len) {
+        expect = len;
+    }
+    fuzz_check(ret == (long)expect, "read length");
+    fuzz_check(memcmp(buf, model[n].data + offset, expect) == 0, "read content");
+    fuzz_check(fs_file_size(name) == (long)model[n].size, "file size");
+}
+
+/*
+ * Append through a handle, then check the handle dies with the file
+ */
+static void fuzz_append(const char *name, int n, size_t len, uint8_t seed) {
+    int fd = fs_open(name, FS_O_CREATE);
+    fuzz_check((fd >= 0) == model_can_create(n), "open result");
+    if (fd < 0) {
+        return;
+    }
+    model_create(n);
+
+    if (len > FUZZ_SPACE - model[n].size) {
+        len = FUZZ_SPACE - model[n].size;
+    }
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(seed * 13 + i);
+    }
+    fuzz_check(fs_append(fd, buf, len) == (long)len, "append result");
+    memcpy(model[n].data + model[n].size, buf, len);
+    model[n].size += len;
+    fuzz_check(fs_fsize(fd) == (long)model[n].size, "handle size");
+
+    if (seed & 1) {
+        fuzz_check(fs_delete_file(name) == 0, "delete while open");
+        model_set_size(n, 0);
+        model[n].exists = 0;
+        model_count--;
+        fuzz_check(fs_pread(fd, buf, 1, 0) == -1, "stale handle read");
+    }
+    fuzz_check(fs_close(fd) == 0, "close");
+}
+
+static void fuzz_delete(const char *name, int n) {
+    int ret = fs_delete_file(name);
+    fuzz_check((ret == 0) == model[n].exists, "delete result");
+    if (ret == 0) {
+        model_set_size(n, 0);
+        model[n].exists = 0;
+        model_count--;
+    }
+}
+
+/*
+ * Check an open view still matches its snapshot, and close it
+ */
+static void fuzz_view_close(int v) {
+    const char *data;
+    size_t offset = 0;
+    size_t n;
+
+    while ((n = fs_view_chunk(&views[v].view, offset, &data)) > 0) {
+        fuzz_check(memcmp(data, views[v].data + offset, n) == 0, "view content");
+        offset += n;
+    }
+    fuzz_check(offset == views[v].size, "view size");
+
+    fs_view_close(&views[v].view);
+    views[v].open = 0;
+}
+
+/*
+ * Open a view of a file in a free view slot, or check and close the
+ * one already there
+ */
+static void fuzz_view(const char *name, int n, int v) {
+    if (views[v].open) {
+        fuzz_view_close(v);
+        return;
+    }
+
+    int ret = fs_view_open(name, &views[v].view);
+    fuzz_check((ret == 0) == model[n].exists, "view_open result");
+    if (ret == 0) {
+        views[v].open = 1;
+        views[v].size = model[n].size;
+        memcpy(views[v].data, model[n].data, model[n].size);
+    }
+}
+
+/*
+ * Pages held by the heap and slabs; with no files, every other page
+ * should be free
+ */
+static size_t heap_pages(void) {
+    memory_stats_t stats;
+    memory_get_stats(&stats);
+    return (stats.slab_bytes + stats.heap_bytes - HOST_HEAP_SIZE) / PAGE_SIZE;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    char name[8];
+
+    host_reset();
+    memset(model, 0, sizeof(model));
+    model_count = 0;
+    size_t pages_free = page_free_count() + heap_pages();
+
+    while (size >= 4) {
+        int n = data[1] % FUZZ_NAMES;
+        size_t offset = (size_t)data[2] * 253 + (data[0] >> 3);
+        size_t len = (size_t)data[3] * 37;
+        if (len > FUZZ_SPACE - offset) {
+            len = FUZZ_SPACE - offset;
+        }
+        fuzz_name(name, n);
+
+        switch ((data[0] & 7) % OP_COUNT) {
+        case OP_WRITE_FILE:
+            fuzz_write_file(name, n, len, data[3]);
+            break;
+        case OP_WRITE_AT:
+            fuzz_write_at(name, n, offset, len, data[3]);
+            break;
+        case OP_TRUNCATE:
+            fuzz_truncate(name, n, offset);
+            break;
+        case OP_READ_AT:
+            fuzz_read_at(name, n, offset, len);
+            break;
+        case OP_DELETE:
+            fuzz_delete(name, n);
+            break;
+        case OP_APPEND:
+            fuzz_append(name, n, len, data[3]);
+            break;
+        case OP_VIEW:
+            fuzz_view(name, n, data[2] % FUZZ_VIEWS);
+            break;
+        default:
+            fuzz_check(fs_file_exists(name) == model[n].exists, "exists");
+            break;
+        }
+
+        fuzz_check(fs_get_file_count() == model_count, "file count");
+        data += 4;
+        size -= 4;
+    }
+
+    /*
+     * Closing every view and deleting everything must give back every
+     * byte and every page
+     */
+    for (int v = 0; v < FUZZ_VIEWS; v++) {
+        if (views[v].open) {
+            fuzz_view_close(v);
+        }
+    }
+    for (int i = 0; i < FUZZ_NAMES; i++) {
+        if (model[i].exists) {
+            fuzz_name(name, i);
+            fuzz_delete(name, i);
+        }
+    }
+    fuzz_check(fs_get_file_count() == 0, "file count after cleanup");
+    fuzz_check(get_allocated_memory() == 0, "memory leaked");
+    fuzz_check(page_free_count() + heap_pages() == pages_free, "pages leaked");
+
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+
+static uint8_t input[1 << 20];
+
+static void run_file(FILE *f) {
+    size_t size = fread(input, 1, sizeof(input), f);
+    LLVMFuzzerTestOneInput(input, size);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        run_file(stdin);
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (f == NULL) {
+            fprintf(stderr, "fuzz_memfs: cannot open %s\n", argv[i]);
+            return 1;
+        }
+        run_file(f);
+        fclose(f);
+    }
+    return 0;
+}
+
+#endif
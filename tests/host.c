@@ -0,0 +1,183 @@
+/*
+ * Host Build Shim Implementation
+ *
+ * Stands in for the hardware and the linker script: a static array
+ * plays the part of RAM, another the disk, and each thread plays a
+ * core (the main thread is core 0).
+ */
+
+#include "memory.h"
+#include "page_alloc.h"
+#include "sched.h"
+#include "smp.h"
+#include "string.h"
+#include "trace.h"
+#include "memfs.h"
+#include "fslog.h"
+#include "virtio_blk.h"
+
+/*
+ * Fake RAM: the static heap followed by the pages
+ */
+char host_ram[HOST_HEAP_SIZE + HOST_PAGES_SIZE] __attribute__((aligned(4096)));
+
+/*
+ * The linker script symbols memory.c and page_alloc.c use, placed at
+ * the start and end of the static heap part of host_ram
+ */
+#define HOST_STR_(x) #x
+#define HOST_STR(x) HOST_STR_(x)
+#define HOST_SYM(name) HOST_STR(__USER_LABEL_PREFIX__) #name
+
+__asm__(".globl " HOST_SYM(__heap_start) "\n"
+        ".globl " HOST_SYM(__heap_end) "\n"
+        ".set " HOST_SYM(__heap_start) ", " HOST_SYM(host_ram) "\n"
+        ".set " HOST_SYM(__heap_end) ", " HOST_SYM(host_ram) " + " HOST_STR(HOST_HEAP_SIZE) "\n");
+
+/*
+ * Each thread gets the next core number the first time it asks
+ */
+static int host_next_cpu;
+static __thread int host_cpu = -1;
+
+int smp_cpu_id(void) {
+    if (host_cpu < 0) {
+        host_cpu = __atomic_fetch_add(&host_next_cpu, 1, __ATOMIC_RELAXED) % MAX_CPUS;
+    }
+    return host_cpu;
+}
+
+/*
+ * No threads: preempt_disable and spin_lock do nothing
+ */
+thread_t *thread_current(void) {
+    return NULL;
+}
+
+/*
+ * Trace points compile to nothing at the default levels; if a test is
+ * built with e.g. -DTRACE_FS=3 they just do nothing
+ */
+void trace_record(int module, int level, const char *event,
+                  uint64_t arg0, uint64_t arg1) {
+    (void)module;
+    (void)level;
+    (void)event;
+    (void)arg0;
+    (void)arg1;
+}
+
+/*
+ * Fake disk: requests wait in slots until collected, like the
+ * virtqueue's
+ */
+char host_disk[HOST_DISK_SIZE];
+int host_disk_reads;
+int host_disk_writes;
+int host_disk_max_inflight;
+
+static struct {
+    int busy;
+    int done;
+    uint64_t sector;
+    void *buf;
+    uint32_t count;
+    int write;
+} host_requests[VIRTIO_BLK_MAX_INFLIGHT];
+
+int virtio_blk_init(void) {
+    return 0;
+}
+
+int virtio_blk_ready(void) {
+    return 1;
+}
+
+uint64_t virtio_blk_capacity(void) {
+    return HOST_DISK_SIZE / VIRTIO_BLK_SECTOR_SIZE;
+}
+
+int virtio_blk_submit(uint64_t sector, void *buf, uint32_t count, int write) {
+    uint64_t capacity = virtio_blk_capacity();
+
+    if (count == 0 || sector >= capacity || count > capacity - sector) {
+        return -1;
+    }
+
+    int id = -1;
+    int inflight = 1;
+    for (int i = 0; i < VIRTIO_BLK_MAX_INFLIGHT; i++) {
+        if (host_requests[i].busy) {
+            inflight++;
+        } else if (id < 0) {
+            id = i;
+        }
+    }
+    if (id < 0) {
+        return -1;
+    }
+
+    host_requests[id].busy = 1;
+    host_requests[id].done = 0;
+    host_requests[id].sector = sector;
+    host_requests[id].buf = buf;
+    host_requests[id].count = count;
+    host_requests[id].write = write;
+    if (write) {
+        host_disk_writes++;
+    } else {
+        host_disk_reads++;
+    }
+    if (inflight > host_disk_max_inflight) {
+        host_disk_max_inflight = inflight;
+    }
+    return id;
+}
+
+int virtio_blk_done(int id) {
+    if (!host_requests[id].done) {
+        char *disk = host_disk + host_requests[id].sector * VIRTIO_BLK_SECTOR_SIZE;
+        size_t len = host_requests[id].count * VIRTIO_BLK_SECTOR_SIZE;
+
+        if (host_requests[id].write) {
+            memcpy(disk, host_requests[id].buf, len);
+        } else {
+            memcpy(host_requests[id].buf, disk, len);
+        }
+        host_requests[id].done = 1;
+    }
+    return 1;
+}
+
+int virtio_blk_wait(int id) {
+    virtio_blk_done(id);
+    host_requests[id].busy = 0;
+    return 0;
+}
+
+int virtio_blk_read(uint64_t sector, void *buf, uint32_t count) {
+    int id = virtio_blk_submit(sector, buf, count, 0);
+    return id < 0 ? -1 : virtio_blk_wait(id);
+}
+
+int virtio_blk_write(uint64_t sector, const void *buf, uint32_t count) {
+    int id = virtio_blk_submit(sector, (void *)buf, count, 1);
+    return id < 0 ? -1 : virtio_blk_wait(id);
+}
+
+void host_reboot(void) {
+    fslog_unmount();
+    page_alloc_init((uint64_t)(uintptr_t)host_ram, sizeof(host_ram), 0, 0);
+    memory_init();
+    fs_init();
+
+    memset(host_requests, 0, sizeof(host_requests));
+    host_disk_reads = 0;
+    host_disk_writes = 0;
+    host_disk_max_inflight = 0;
+}
+
+void host_reset(void) {
+    host_reboot();
+    memset(host_disk, 0, sizeof(host_disk));
+}
@@ -0,0 +1,82 @@
+/*
+ * Host Build Shim
+ *
+ * Lets the kernel's memfs, allocator and string code compile and run as
+ * a normal program on the development machine, for unit tests and
+ * fuzzing. The Makefile force-includes this header (-include) into every
+ * host build source, kernel and test alike.
+ *
+ * The kernel defines its own malloc, memcpy, strlen and so on, which
+ * would collide with the C library's. Everything below renames the
+ * kernel's versions to k_* after the system headers are in, so the
+ * kernel code calls its own copies while the C library (and the
+ * sanitizers) keep theirs.
+ *
+ * Kernel headers are found with -iquote, so "string.h" is the kernel's
+ * and <string.h> is the system's.
+ */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Kernel C library names
+ */
+#define malloc  k_malloc
+#define free    k_free
+#define calloc  k_calloc
+
+#define strlen  k_strlen
+#define strcmp  k_strcmp
+#define strncmp k_strncmp
+#define strcpy  k_strcpy
+#define strncpy k_strncpy
+#define strcat  k_strcat
+#define strchr  k_strchr
+#define memset  k_memset
+#define memcpy  k_memcpy
+#define memcmp  k_memcmp
+#define memchr  k_memchr
+
+/*
+ * Size of the fake RAM the kernel allocators manage: the static heap
+ * (__heap_start to __heap_end in linker.ld) and the pages after it
+ */
+#define HOST_HEAP_SIZE  (1024 * 1024)
+#define HOST_PAGES_SIZE (64 * 1024 * 1024)
+
+/*
+ * Size of the fake disk behind the virtio_blk_* functions
+ */
+#define HOST_DISK_SIZE (8 * 1024 * 1024)
+
+/*
+ * The fake disk and what has been asked of it: requests are counted
+ * when submitted, and their data only moves when they are collected
+ * (virtio_blk_done or virtio_blk_wait), as with a real device
+ */
+extern char host_disk[HOST_DISK_SIZE];
+extern int host_disk_reads;
+extern int host_disk_writes;
+extern int host_disk_max_inflight;
+
+/*
+ * Reset the page allocator, heap and file system to their boot state,
+ * and zero the disk
+ */
+void host_reset(void);
+
+/*
+ * Reset everything but the disk, as if the machine had lost power:
+ * anything not written to the disk is gone
+ */
+void host_reboot(void);
+
+#endif // HOST_H
@@ -0,0 +1,35 @@
+/*
+ * Unit Test Helpers
+ *
+ * Each test_*.c file has one entry point that runs its checks; the
+ * runner in test_main.c resets the kernel state before each one.
+ * CHECK records a failure and carries on, so one run shows every
+ * broken check.
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+/*
+ * Record a failed check
+ */
+void test_fail(const char *file, int line, const char *expr);
+
+#define CHECK(cond)                                  \
+    do {                                             \
+        if (!(cond)) {                               \
+            test_fail(__FILE__, __LINE__, #cond);    \
+        }                                            \
+    } while (0)
+
+/*
+ * Test groups
+ */
+void test_string(void);
+void test_memory(void);
+void test_memfs(void);
+void test_bcache(void);
+void test_fslog(void);
+void test_sync(void);
+
+#endif // TEST_H
@@ -0,0 +1,176 @@
+/*
+ * Block Buffer Cache Tests
+ *
+ * Run against the fake disk in host.c, which only moves a request's
+ * data when the request is collected, so a buffer used before its read
+ * finished would show up as wrong data.
+ */
+
+#include "bcache.h"
+#include "string.h"
+#include "test.h"
+#include "virtio_blk.h"
+
+static char block[BCACHE_BLOCK_SIZE];
+
+static void fill_disk_block(uint64_t n) {
+    memset(host_disk + n * BCACHE_BLOCK_SIZE, (int)(n & 0xFF), BCACHE_BLOCK_SIZE);
+}
+
+static int disk_block_is(uint64_t n, int value) {
+    const unsigned char *p = (const unsigned char *)host_disk + n * BCACHE_BLOCK_SIZE;
+
+    for (size_t i = 0; i < BCACHE_BLOCK_SIZE; i++) {
+        if (p[i] != (unsigned char)value) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void test_hits(void) {
+    bcache_stats_t stats;
+
+    fill_disk_block(3);
+    CHECK(bcache_read(3, 0, block, BCACHE_BLOCK_SIZE) == 0);
+    CHECK(block[0] == 3 && block[BCACHE_BLOCK_SIZE - 1] == 3);
+    CHECK(bcache_read(3, 100, block, 1) == 0);
+    CHECK(block[0] == 3);
+
+    bcache_get_stats(&stats);
+    CHECK(stats.misses == 1 && stats.hits == 1);
+    CHECK(host_disk_reads == 1);
+
+    bcache_buf_t *a = bcache_get(3);
+    bcache_buf_t *b = bcache_get(3);
+    CHECK(a != NULL && a == b);
+    bcache_put(a);
+    bcache_put(b);
+
+    CHECK(bcache_get(bcache_blocks()) == NULL);
+    CHECK(bcache_read(3, BCACHE_BLOCK_SIZE - 1, block, 2) == -1);
+}
+
+static void test_write_back(void) {
+    bcache_stats_t stats;
+
+    memset(block, 0x5A, sizeof(block));
+    CHECK(bcache_write(7, 0, block, BCACHE_BLOCK_SIZE) == 0);
+    CHECK(host_disk_reads == 0);   // Whole-block write skips the read
+    CHECK(bcache_write(8, 10, "hello", 5) == 0);
+    CHECK(host_disk_reads == 1);
+    CHECK(host_disk_writes == 0);
+    CHECK(disk_block_is(7, 0));
+
+    bcache_get_stats(&stats);
+    CHECK(stats.dirty == 2);
+
+    CHECK(bcache_sync() == 0);
+    CHECK(host_disk_writes == 2);
+    CHECK(disk_block_is(7, 0x5A));
+    CHECK(memcmp(host_disk + 8 * BCACHE_BLOCK_SIZE + 10, "hello", 5) == 0);
+
+    bcache_get_stats(&stats);
+    CHECK(stats.dirty == 0 && stats.writebacks == 2);
+    CHECK(bcache_sync() == 0);
+    CHECK(host_disk_writes == 2);
+}
+
+static void test_eviction(void) {
+    int count = BCACHE_BUFFERS * 2;
+
+    /*
+     * Dirtying more blocks than there are buffers writes the oldest
+     * back as their buffers are reused
+     */
+    for (int i = 0; i < count; i++) {
+        memset(block, i + 1, sizeof(block));
+        CHECK(bcache_write((uint64_t)i, 0, block, BCACHE_BLOCK_SIZE) == 0);
+    }
+    CHECK(disk_block_is(0, 1));
+    CHECK(host_disk_writes == count - BCACHE_BUFFERS);
+
+    for (int i = 0; i < count; i++) {
+        CHECK(bcache_read((uint64_t)i, 0, block, BCACHE_BLOCK_SIZE) == 0);
+        CHECK(block[0] == (char)(i + 1) && block[BCACHE_BLOCK_SIZE - 1] == (char)(i + 1));
+    }
+
+    CHECK(bcache_sync() == 0);
+    for (int i = 0; i < count; i++) {
+        CHECK(disk_block_is((uint64_t)i, i + 1));
+    }
+
+    /*
+     * Held buffers are never reused
+     */
+    bcache_buf_t *held[BCACHE_BUFFERS];
+    for (int i = 0; i < BCACHE_BUFFERS; i++) {
+        held[i] = bcache_get((uint64_t)i);
+        CHECK(held[i] != NULL);
+    }
+    CHECK(bcache_get(BCACHE_BUFFERS) == NULL);
+    for (int i = 0; i < BCACHE_BUFFERS; i++) {
+        CHECK(held[i]->block == (uint64_t)i && held[i]->data[0] == (char)(i + 1));
+        bcache_put(held[i]);
+    }
+    CHECK(bcache_get(BCACHE_BUFFERS) != NULL);
+}
+
+static void test_read_ahead(void) {
+    bcache_stats_t stats;
+    int count = 32;
+
+    for (int i = 0; i < count; i++) {
+        fill_disk_block((uint64_t)(100 + i));
+    }
+
+    /*
+     * A sequential scan only waits on the first two blocks; the rest
+     * were read ahead and are correct by the time they're used
+     */
+    for (int i = 0; i < count; i++) {
+        CHECK(bcache_read((uint64_t)(100 + i), 0, block, BCACHE_BLOCK_SIZE) == 0);
+        CHECK(block[0] == (char)(100 + i) && block[BCACHE_BLOCK_SIZE - 1] == (char)(100 + i));
+    }
+
+    bcache_get_stats(&stats);
+    CHECK(stats.misses == 2);
+    CHECK(stats.readaheads >= (uint64_t)count - 2);
+    CHECK(stats.readahead_hits == (uint64_t)count - 2);
+    CHECK(host_disk_max_inflight > 1);
+}
+
+static void test_batched_sync(void) {
+    int count = 3 * VIRTIO_BLK_MAX_INFLIGHT;
+
+    for (int i = 0; i < count; i++) {
+        CHECK(bcache_write((uint64_t)(100 + i * 2), 0, "x", 1) == 0);
+    }
+    host_disk_max_inflight = 0;
+    CHECK(bcache_sync() == 0);
+    CHECK(host_disk_max_inflight == VIRTIO_BLK_MAX_INFLIGHT);
+    for (int i = 0; i < count; i++) {
+        CHECK(host_disk[(100 + i * 2) * BCACHE_BLOCK_SIZE] == 'x');
+    }
+}
+
+/*
+ * Each test starts from a zeroed disk and an empty cache, since they
+ * count disk requests
+ */
+static void (*const tests[])(void) = {
+    test_hits,
+    test_write_back,
+    test_eviction,
+    test_read_ahead,
+    test_batched_sync,
+};
+
+void test_bcache(void) {
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        host_reset();
+        CHECK(bcache_init() == 0);
+        CHECK(bcache_blocks() == HOST_DISK_SIZE / BCACHE_BLOCK_SIZE);
+        tests[i]();
+    }
+}
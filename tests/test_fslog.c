@@ -0,0 +1,302 @@
+/*
+ * File System Log Tests
+ *
+ * Each test formats the fake disk, changes memfs, then "reboots" with
+ * host_reboot (memory and memfs wiped, disk kept) and mounts again to
+ * see what survived.
+ */
+
+#include "bcache.h"
+#include "fslog.h"
+#include "memfs.h"
+#include "page_alloc.h"
+#include "string.h"
+#include "test.h"
+
+#define LOG_START 2   // First log block, after the two headers
+
+static char buf[64 * 1024];
+
+/*
+ * Lose power and boot again
+ * Returns fslog_mount's result
+ */
+static int reboot(uint64_t seed) {
+    host_reboot();
+    if (bcache_init() != 0) {
+        return -1;
+    }
+    return fslog_mount(seed);
+}
+
+static const char *read_str(const char *name) {
+    long n = fs_read_at(name, 0, buf, sizeof(buf) - 1);
+
+    if (n < 0) {
+        return NULL;
+    }
+    buf[n] = '\0';
+    return buf;
+}
+
+/*
+ * Position of the log head (the format's checkpoint starts at 0, and
+ * the tests that use this never write another)
+ */
+static uint64_t log_head(void) {
+    fslog_stats_t stats;
+
+    fslog_get_stats(&stats);
+    return stats.live_bytes;
+}
+
+static void test_remount(void) {
+    fslog_stats_t stats;
+
+    CHECK(fs_mkdir("/docs") == 0);
+    CHECK(fs_write_file("/docs/a.txt", "hello") == 0);
+    CHECK(fs_write_at("/sparse", 100000, "end", 3) == 0);
+    CHECK(fs_write_file("/gone", "x") == 0);
+    CHECK(fs_delete_file("/gone") == 0);
+    CHECK(fs_mkdir("/empty") == 0);
+    CHECK(fs_rmdir("/empty") == 0);
+    CHECK(fs_write_file("/short", "0123456789") == 0);
+    CHECK(fs_truncate("/short", 4) == 0);
+    CHECK(fslog_pending());
+    CHECK(fslog_commit() == 0);
+    CHECK(!fslog_pending());
+
+    CHECK(reboot(2) == 0);
+    CHECK(strcmp(read_str("/docs/a.txt"), "hello") == 0);
+    CHECK(fs_file_size("/sparse") == 100003);
+    CHECK(fs_read_at("/sparse", 99999, buf, 4) == 4 && memcmp(buf, "\0end", 4) == 0);
+    CHECK(fs_read_at("/sparse", 0, buf, 1) == 1 && buf[0] == 0);
+    CHECK(!fs_file_exists("/gone"));
+    CHECK(!fs_file_exists("/empty"));
+    CHECK(strcmp(read_str("/short"), "0123") == 0);
+    CHECK(fs_get_file_count() == 4);
+
+    fslog_get_stats(&stats);
+    CHECK(stats.replayed > 0 && stats.replayed == stats.replayed_tail + 2);
+    CHECK(stats.failed == 0);
+
+    /*
+     * Mounting again after changes on top of a replayed log
+     */
+    CHECK(fs_write_file("/docs/b.txt", "second boot") == 0);
+    CHECK(fslog_commit() == 0);
+    CHECK(reboot(3) == 0);
+    CHECK(strcmp(read_str("/docs/a.txt"), "hello") == 0);
+    CHECK(strcmp(read_str("/docs/b.txt"), "second boot") == 0);
+}
+
+static void test_uncommitted_lost(void) {
+    CHECK(fs_write_file("/kept", "kept") == 0);
+    CHECK(fslog_commit() == 0);
+    CHECK(fs_write_file("/lost", "lost") == 0);
+    CHECK(fs_write_file("/kept", "changed") == 0);
+
+    CHECK(reboot(2) == 0);
+    CHECK(strcmp(read_str("/kept"), "kept") == 0);
+    CHECK(!fs_file_exists("/lost"));
+
+    /*
+     * A new record after the mount can't be confused with the lost ones
+     */
+    CHECK(fs_write_file("/after", "after") == 0);
+    CHECK(fslog_commit() == 0);
+    CHECK(reboot(3) == 0);
+    CHECK(strcmp(read_str("/kept"), "kept") == 0);
+    CHECK(strcmp(read_str("/after"), "after") == 0);
+    CHECK(!fs_file_exists("/lost"));
+}
+
+static void test_paused(void) {
+    CHECK(fs_write_file("/kept", "kept") == 0);
+    CHECK(fslog_commit() == 0);
+
+    fslog_pause();
+    CHECK(!fslog_active());
+    CHECK(fs_mkdir("/scratch") == 0);
+    CHECK(fs_write_file("/scratch/x", "scratch") == 0);
+    CHECK(fs_delete_file("/scratch/x") == 0);
+    CHECK(fs_rmdir("/scratch") == 0);
+    CHECK(!fslog_pending());
+    fslog_resume();
+
+    CHECK(fslog_active());
+    CHECK(fs_write_file("/after", "after") == 0);
+    CHECK(fslog_commit() == 0);
+    CHECK(reboot(2) == 0);
+    CHECK(strcmp(read_str("/kept"), "kept") == 0);
+    CHECK(strcmp(read_str("/after"), "after") == 0);
+    CHECK(fs_get_file_count() == 2);
+}
+
+/*
+ * A rewrite that runs out of memory leaves the old file, in memory and
+ * on the disk
+ */
+static void test_write_out_of_memory(void) {
+    CHECK(fs_write_file("/kept", "kept") == 0);
+    CHECK(fslog_commit() == 0);
+
+    while (page_alloc(0) != NULL) {
+        // Use up every page, so no write can get a block
+    }
+    CHECK(fs_write_file("/kept", "replaced") == -1);
+    CHECK(fs_write_file("/new", "new") == -1);
+    CHECK(strcmp(read_str("/kept"), "kept") == 0);
+    CHECK(!fs_file_exists("/new"));
+    CHECK(fslog_commit() == 0);
+
+    CHECK(reboot(2) == 0);
+    CHECK(strcmp(read_str("/kept"), "kept") == 0);
+    CHECK(!fs_file_exists("/new"));
+}
+
+static void test_group_commit(void) {
+    fslog_stats_t stats;
+    int writes = host_disk_writes;
+    uint64_t start = log_head();
+
+    /*
+     * Small changes wait in memory, then go out as one run of blocks
+     */
+    for (int i = 0; i < 50; i++) {
+        CHECK(fs_write_at("/log", (size_t)i * 16, "sixteen bytes..", 16) == 0);
+    }
+    CHECK(host_disk_writes == writes);
+    fslog_get_stats(&stats);
+    CHECK(stats.pending_bytes > 0 && stats.records >= 50);
+
+    CHECK(fslog_commit() == 0);
+    fslog_get_stats(&stats);
+    CHECK(stats.pending_bytes == 0);
+    CHECK(host_disk_writes - writes == (int)((log_head() - start) / BCACHE_BLOCK_SIZE));
+    CHECK(log_head() - start <= 2 * BCACHE_BLOCK_SIZE);
+
+    /*
+     * Once a batch is big enough, it goes out without waiting
+     */
+    writes = host_disk_writes;
+    memset(buf, 'b', sizeof(buf));
+    CHECK(fs_write_at("/big", 0, buf, FSLOG_BATCH_BYTES) == 0);
+    CHECK(host_disk_writes > writes);
+    CHECK(fslog_commit() == 0);
+
+    CHECK(reboot(2) == 0);
+    CHECK(fs_file_size("/log") == 50 * 16);
+    CHECK(fs_file_size("/big") == FSLOG_BATCH_BYTES);
+    CHECK(fs_read_at("/big", FSLOG_BATCH_BYTES - 1, buf, 1) == 1 && buf[0] == 'b');
+}
+
+static void test_torn_tail(void) {
+    CHECK(fs_write_file("/first", "first") == 0);
+    CHECK(fslog_commit() == 0);
+
+    uint64_t pos = log_head();
+    CHECK(fs_write_file("/second", "second") == 0);
+    CHECK(fs_write_file("/third", "third") == 0);
+    CHECK(fslog_commit() == 0);
+
+    // One corrupted byte in the second commit's first record
+    host_disk[(LOG_START + pos / BCACHE_BLOCK_SIZE) * BCACHE_BLOCK_SIZE + 20] ^= 0x40;
+
+    CHECK(reboot(2) == 0);
+    CHECK(strcmp(read_str("/first"), "first") == 0);
+    CHECK(!fs_file_exists("/second"));
+    CHECK(!fs_file_exists("/third"));
+}
+
+static void test_header_fallback(void) {
+    CHECK(fs_write_file("/a", "one") == 0);
+    CHECK(fslog_checkpoint() == 0);  // Header generation 2, in block 0
+    CHECK(fs_write_file("/b", "two") == 0);
+    CHECK(fs_write_file("/a", "three") == 0);
+    CHECK(fslog_commit() == 0);
+
+    /*
+     * With the newest header gone, mount replays from the format's
+     * checkpoint, through the newer one, to the same state
+     */
+    host_disk[8] ^= 0x01;
+    CHECK(reboot(2) == 0);
+    CHECK(strcmp(read_str("/a"), "three") == 0);
+    CHECK(strcmp(read_str("/b"), "two") == 0);
+    CHECK(fs_get_file_count() == 2);
+
+    // With no valid header at all, the disk is formatted again
+    host_disk[BCACHE_BLOCK_SIZE + 8] ^= 0x01;
+    CHECK(reboot(3) == 1);
+    CHECK(fs_get_file_count() == 0);
+}
+
+static void test_checkpoints(void) {
+    fslog_stats_t stats;
+    uint64_t region = HOST_DISK_SIZE - LOG_START * BCACHE_BLOCK_SIZE;
+    int rounds = (int)(3 * region / (16 * 1024)) + 1;
+
+    /*
+     * Rewriting the same files goes around the log three times; the
+     * checkpoints keep mount from replaying all of it
+     */
+    CHECK(fs_mkdir("/dir") == 0);
+    CHECK(fs_write_file("/dir/fixed", "fixed") == 0);
+    for (int i = 0; i < rounds; i++) {
+        memset(buf, 'a' + i % 26, 16 * 1024);
+        CHECK(fs_write_at("/dir/rewritten", 0, buf, 16 * 1024) == 0);
+        CHECK(fslog_commit() == 0);
+    }
+    fslog_get_stats(&stats);
+    CHECK(stats.checkpoints >= 3 * region / (2 * FSLOG_CHECKPOINT_BYTES));
+    CHECK(stats.live_bytes < region);
+    CHECK(stats.failed == 0);
+
+    CHECK(reboot(2) == 0);
+    fslog_get_stats(&stats);
+    CHECK(stats.replayed < 2 * FSLOG_CHECKPOINT_BYTES / (16 * 1024));
+    CHECK(strcmp(read_str("/dir/fixed"), "fixed") == 0);
+    CHECK(fs_file_size("/dir/rewritten") == 16 * 1024);
+    CHECK(fs_read_at("/dir/rewritten", 16 * 1024 - 1, buf, 1) == 1);
+    CHECK(buf[0] == 'a' + (rounds - 1) % 26);
+
+    /*
+     * Without commits, a filling log checkpoints on its own
+     */
+    for (int i = 0; i < rounds; i++) {
+        memset(buf, 'A' + i % 26, 16 * 1024);
+        CHECK(fs_write_at("/dir/rewritten", 0, buf, 16 * 1024) == 0);
+    }
+    CHECK(fslog_commit() == 0);
+    fslog_get_stats(&stats);
+    CHECK(stats.failed == 0);
+
+    CHECK(reboot(3) == 0);
+    CHECK(fs_read_at("/dir/rewritten", 0, buf, 1) == 1 && buf[0] == 'A' + (rounds - 1) % 26);
+    CHECK(strcmp(read_str("/dir/fixed"), "fixed") == 0);
+}
+
+/*
+ * Each test starts from a freshly formatted disk
+ */
+static void (*const tests[])(void) = {
+    test_remount,
+    test_uncommitted_lost,
+    test_paused,
+    test_write_out_of_memory,
+    test_group_commit,
+    test_torn_tail,
+    test_header_fallback,
+    test_checkpoints,
+};
+
+void test_fslog(void) {
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        host_reset();
+        CHECK(bcache_init() == 0);
+        CHECK(fslog_mount(1) == 1);
+        tests[i]();
+    }
+    fslog_unmount();
+}
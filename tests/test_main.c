@@ -0,0 +1,49 @@
+/*
+ * Unit Test Runner
+ *
+ * Usage: unit_tests [group]
+ */
+
+#include "string.h"
+#include "test.h"
+
+static int failures = 0;
+
+void test_fail(const char *file, int line, const char *expr) {
+    printf("%s:%d: check failed: %s\n", file, line, expr);
+    failures++;
+}
+
+static const struct {
+    const char *name;
+    void (*run)(void);
+} groups[] = {
+    { "string", test_string },
+    { "memory", test_memory },
+    { "memfs",  test_memfs },
+    { "bcache", test_bcache },
+    { "fslog",  test_fslog },
+    { "sync",   test_sync },
+};
+
+int main(int argc, char **argv) {
+    int ran = 0;
+
+    for (size_t i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+        if (argc > 1 && strcmp(argv[1], groups[i].name) != 0) {
+            continue;
+        }
+
+        int before = failures;
+        host_reset();
+        groups[i].run();
+        printf("%-8s %s\n", groups[i].name, failures == before ? "ok" : "FAILED");
+        ran++;
+    }
+
+    if (ran == 0) {
+        printf("No test group named '%s'\n", argv[1]);
+        return 2;
+    }
+    return failures == 0 ? 0 : 1;
+}
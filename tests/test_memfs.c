@@ -0,0 +1,685 @@
+/*
+ * File System Tests
+ */
+
+#include <pthread.h>
+
+#include "memfs.h"
+#include "memory.h"
+#include "page_alloc.h"
+#include "string.h"
+#include "test.h"
+
+#define LARGE_SIZE (4 * 1024 * 1024)
+
+static int listed;
+static size_t listed_bytes;
+
+static int listed_dirs;
+
+static void count_file(const char *name, size_t size, int is_dir) {
+    (void)name;
+    listed++;
+    listed_bytes += size;
+    listed_dirs += is_dir;
+}
+
+/*
+ * Read a whole (small) file as a string, or NULL if it doesn't exist
+ */
+static const char *read_str(const char *name) {
+    static char buf[1024];
+    long n = fs_read_at(name, 0, buf, sizeof(buf) - 1);
+
+    if (n < 0) {
+        return NULL;
+    }
+    buf[n] = '\0';
+    return buf;
+}
+
+static uint8_t pattern(size_t offset) {
+    return (uint8_t)(offset * 31 + (offset >> 12));
+}
+
+static void make_name(char *buf, int n) {
+    strcpy(buf, "file.");
+    buf[5] = (char)('a' + n / 26);
+    buf[6] = (char)('a' + n % 26);
+    buf[7] = '\0';
+}
+
+static void test_read_write(void) {
+    CHECK(fs_get_file_count() == 0);
+    CHECK(read_str("missing") == NULL);
+    CHECK(fs_file_size("missing") == -1);
+    CHECK(!fs_file_exists("missing"));
+
+    CHECK(fs_write_file("a.txt", "hello") == 0);
+    CHECK(fs_file_exists("a.txt"));
+    CHECK(strcmp(read_str("a.txt"), "hello") == 0);
+    CHECK(fs_file_size("a.txt") == 5);
+    CHECK(fs_get_file_count() == 1);
+
+    /*
+     * Overwrite, with longer and shorter content
+     */
+    CHECK(fs_write_file("a.txt", "a much longer piece of content") == 0);
+    CHECK(strcmp(read_str("a.txt"), "a much longer piece of content") == 0);
+    CHECK(fs_write_file("a.txt", "x") == 0);
+    CHECK(strcmp(read_str("a.txt"), "x") == 0);
+    CHECK(fs_file_size("a.txt") == 1);
+    CHECK(fs_get_file_count() == 1);
+
+    /*
+     * Empty files exist but have no content
+     */
+    CHECK(fs_write_file("empty", "") == 0);
+    CHECK(fs_file_exists("empty"));
+    CHECK(fs_file_size("empty") == 0);
+    CHECK(strcmp(read_str("empty"), "") == 0);
+
+    CHECK(fs_delete_file("a.txt") == 0);
+    CHECK(fs_delete_file("a.txt") == -1);
+    CHECK(!fs_file_exists("a.txt"));
+    CHECK(fs_delete_file("empty") == 0);
+    CHECK(fs_get_file_count() == 0);
+    CHECK(get_allocated_memory() == 0);
+}
+
+static void test_limits(void) {
+    static char name[MAX_FILENAME_LEN + 1];
+    static char content[MAX_FILE_SIZE + 2];
+    char byte;
+
+    CHECK(fs_write_file(NULL, "x") == -1);
+    CHECK(fs_write_file("", "x") == -1);
+
+    memset(name, 'n', MAX_FILENAME_LEN);
+    name[MAX_FILENAME_LEN] = '\0';
+    CHECK(fs_write_file(name, "x") == -1);         // No room for the NUL
+    name[MAX_FILENAME_LEN - 1] = '\0';
+    CHECK(fs_write_file(name, "x") == 0);          // Longest allowed
+    CHECK(fs_delete_file(name) == 0);
+
+    memset(content, 'c', MAX_FILE_SIZE + 1);
+    content[MAX_FILE_SIZE + 1] = '\0';
+    CHECK(fs_write_file("big", content) == -1);
+    content[MAX_FILE_SIZE] = '\0';
+    CHECK(fs_write_file("big", content) == 0);     // Largest allowed
+    CHECK(fs_file_size("big") == MAX_FILE_SIZE);
+    CHECK(fs_read_at("big", MAX_FILE_SIZE - 1, &byte, 1) == 1 && byte == 'c');
+    CHECK(fs_read_at("big", MAX_FILE_SIZE, &byte, 1) == 0);
+    CHECK(fs_write_at("big", MAX_FILE_SIZE, "x", 1) == -1);
+    CHECK(fs_write_at("big", (size_t)-1, "x", 2) == -1);   // Offset overflow
+    CHECK(fs_truncate("big", MAX_FILE_SIZE + 1) == -1);
+    CHECK(fs_delete_file("big") == 0);
+}
+
+/*
+ * Large files: written in uneven chunks, read back across block
+ * boundaries, and all pages given back on delete
+ */
+static void test_large(void) {
+    static uint8_t buf[10000];
+    size_t offset = 0;
+
+    while (offset < LARGE_SIZE) {
+        size_t len = sizeof(buf) - (offset % 1000);
+        if (len > LARGE_SIZE - offset) {
+            len = LARGE_SIZE - offset;
+        }
+        for (size_t i = 0; i < len; i++) {
+            buf[i] = pattern(offset + i);
+        }
+        CHECK(fs_write_at("large", offset, buf, len) == 0);
+        offset += len;
+    }
+    CHECK(fs_file_size("large") == LARGE_SIZE);
+
+    for (offset = 0; offset < LARGE_SIZE; offset += 777 * 13) {
+        long n = fs_read_at("large", offset, buf, 777);
+        CHECK(n == (long)(LARGE_SIZE - offset < 777 ? LARGE_SIZE - offset : 777));
+        for (long i = 0; i < n; i++) {
+            if (buf[i] != pattern(offset + (size_t)i)) {
+                CHECK(buf[i] == pattern(offset + (size_t)i));
+                break;
+            }
+        }
+    }
+
+    /*
+     * Overwriting the middle leaves the neighbours alone
+     */
+    CHECK(fs_write_at("large", FS_BLOCK_SIZE * 10 - 2, "ABCD", 4) == 0);
+    CHECK(fs_read_at("large", FS_BLOCK_SIZE * 10 - 3, buf, 6) == 6);
+    CHECK(buf[0] == pattern(FS_BLOCK_SIZE * 10 - 3));
+    CHECK(memcmp(buf + 1, "ABCD", 4) == 0);
+    CHECK(buf[5] == pattern(FS_BLOCK_SIZE * 10 + 2));
+    CHECK(fs_file_size("large") == LARGE_SIZE);
+
+    /*
+     * Every data block goes back to the page allocator (the block map
+     * itself goes back to the heap, which may keep its pages)
+     */
+    size_t pages_before = page_free_count();
+    CHECK(fs_delete_file("large") == 0);
+    CHECK(page_free_count() >= pages_before + LARGE_SIZE / FS_BLOCK_SIZE);
+    CHECK(get_allocated_memory() == 0);
+}
+
+/*
+ * Holes and truncation
+ */
+static void test_sparse(void) {
+    uint8_t buf[64];
+    size_t pages_before = page_free_count();
+
+    /*
+     * Writing far past the end leaves a hole that reads as zeros and
+     * takes no pages
+     */
+    CHECK(fs_write_at("sparse", FS_BLOCK_SIZE * 100 + 10, "tail", 4) == 0);
+    CHECK(fs_file_size("sparse") == FS_BLOCK_SIZE * 100 + 14);
+    CHECK(page_free_count() == pages_before - 1);
+    CHECK(fs_read_at("sparse", FS_BLOCK_SIZE * 50, buf, sizeof(buf)) == (long)sizeof(buf));
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        CHECK(buf[i] == 0);
+    }
+    CHECK(fs_read_at("sparse", FS_BLOCK_SIZE * 100 + 8, buf, sizeof(buf)) == 6);
+    CHECK(buf[0] == 0 && buf[1] == 0 && memcmp(buf + 2, "tail", 4) == 0);
+
+    /*
+     * Shrinking frees blocks and zeros the cut-off bytes, so growing
+     * again reads zeros rather than the old content
+     */
+    CHECK(fs_write_at("sparse", 0, "0123456789", 10) == 0);
+    CHECK(fs_truncate("sparse", 4) == 0);
+    CHECK(page_free_count() == pages_before - 1);
+    CHECK(fs_truncate("sparse", 10) == 0);
+    CHECK(fs_read_at("sparse", 0, buf, sizeof(buf)) == 10);
+    CHECK(memcmp(buf, "0123\0\0\0\0\0\0", 10) == 0);
+
+    /*
+     * Rewriting with fs_write_file reuses and trims blocks
+     */
+    CHECK(fs_write_file("sparse", "short") == 0);
+    CHECK(fs_file_size("sparse") == 5);
+    CHECK(strcmp(read_str("sparse"), "short") == 0);
+
+    CHECK(fs_truncate("missing", 0) == -1);
+    CHECK(fs_delete_file("sparse") == 0);
+    CHECK(page_free_count() == pages_before);
+}
+
+/*
+ * Handles: binary data, appends, and handles to deleted files
+ */
+static void test_handles(void) {
+    static const char bin[] = { 'a', '\0', 'b', '\0', '\0', 'c' };
+    char buf[64];
+
+    CHECK(fs_open("log", 0) == -1);                // No FS_O_CREATE
+    int fd = fs_open("log", FS_O_CREATE);
+    CHECK(fd >= 0);
+    CHECK(fs_file_exists("log") && fs_fsize(fd) == 0);
+
+    /*
+     * NULs are data like any other byte
+     */
+    CHECK(fs_pwrite(fd, bin, sizeof(bin), 0) == (long)sizeof(bin));
+    CHECK(fs_fsize(fd) == (long)sizeof(bin));
+    CHECK(fs_pread(fd, buf, sizeof(buf), 0) == (long)sizeof(bin));
+    CHECK(memcmp(buf, bin, sizeof(bin)) == 0);
+    CHECK(fs_pread(fd, buf, sizeof(buf), 100) == 0);
+
+    CHECK(fs_append(fd, "xyz", 3) == 3);
+    CHECK(fs_append(fd, "", 0) == 0);
+    CHECK(fs_pread(fd, buf, sizeof(buf), 4) == 5);
+    CHECK(memcmp(buf, "\0cxyz", 5) == 0);
+
+    /*
+     * Appends across block boundaries
+     */
+    for (int i = 0; i < 3000; i++) {
+        CHECK(fs_append(fd, "0123456789", 10) == 10);
+    }
+    CHECK(fs_fsize(fd) == 9 + 30000);
+    CHECK(fs_pread(fd, buf, 10, 9 + 10 * 1234) == 10);
+    CHECK(memcmp(buf, "0123456789", 10) == 0);
+
+    /*
+     * A second handle sees the same file; FS_O_TRUNC empties it
+     */
+    int fd2 = fs_open("log", FS_O_TRUNC);
+    CHECK(fd2 >= 0 && fd2 != fd);
+    CHECK(fs_fsize(fd) == 0);
+    CHECK(fs_close(fd2) == 0);
+    CHECK(fs_close(fd2) == -1);
+    CHECK(fs_pread(fd2, buf, 1, 0) == -1);
+
+    /*
+     * Deleting the file invalidates the handle, even if the slot is
+     * reused by a new file
+     */
+    CHECK(fs_delete_file("log") == 0);
+    CHECK(fs_write_file("other", "data") == 0);
+    CHECK(fs_pread(fd, buf, sizeof(buf), 0) == -1);
+    CHECK(fs_append(fd, "x", 1) == -1);
+    CHECK(fs_fsize(fd) == -1);
+    CHECK(strcmp(read_str("other"), "data") == 0);
+    CHECK(fs_close(fd) == 0);
+
+    CHECK(fs_close(-1) == -1 && fs_close(FS_MAX_OPEN) == -1);
+    CHECK(fs_pread(FS_MAX_OPEN, buf, 1, 0) == -1);
+
+    /*
+     * Running out of handles
+     */
+    int fds[FS_MAX_OPEN];
+    for (int i = 0; i < FS_MAX_OPEN; i++) {
+        fds[i] = fs_open("other", 0);
+        CHECK(fds[i] >= 0);
+    }
+    CHECK(fs_open("other", 0) == -1);
+    for (int i = 0; i < FS_MAX_OPEN; i++) {
+        CHECK(fs_close(fds[i]) == 0);
+    }
+
+    CHECK(fs_delete_file("other") == 0);
+    CHECK(get_allocated_memory() == 0);
+}
+
+/*
+ * Read a whole view into buf
+ */
+static size_t view_copy(const fs_view_t *view, uint8_t *buf) {
+    const char *data;
+    size_t offset = 0;
+    size_t n;
+
+    while ((n = fs_view_chunk(view, offset, &data)) > 0) {
+        CHECK(n <= FS_BLOCK_SIZE);
+        memcpy(buf + offset, data, n);
+        offset += n;
+    }
+    return offset;
+}
+
+/*
+ * Views keep seeing the content they were opened on while the file is
+ * rewritten, truncated and deleted, and share blocks until then
+ */
+static void test_views(void) {
+    static uint8_t buf[3 * FS_BLOCK_SIZE];
+    fs_view_t view, empty;
+    const char *data;
+
+    CHECK(fs_view_open("missing", &view) == -1);
+    CHECK(fs_write_file("empty", "") == 0);
+    CHECK(fs_view_open("empty", &empty) == 0);
+    CHECK(fs_view_chunk(&empty, 0, &data) == 0);
+
+    /*
+     * Two blocks and a hole between them
+     */
+    for (size_t i = 0; i < FS_BLOCK_SIZE; i++) {
+        buf[i] = pattern(i);
+    }
+    CHECK(fs_write_at("v", 0, buf, FS_BLOCK_SIZE) == 0);
+    CHECK(fs_write_at("v", 2 * FS_BLOCK_SIZE, "end", 3) == 0);
+
+    size_t pages_before = page_free_count();
+    CHECK(fs_view_open("v", &view) == 0);
+    CHECK(page_free_count() == pages_before);   // Nothing copied
+
+    CHECK(fs_view_chunk(&view, 10, &data) == FS_BLOCK_SIZE - 10);
+    CHECK((uint8_t)data[0] == pattern(10));
+    CHECK(fs_view_chunk(&view, FS_BLOCK_SIZE + 5, &data) == FS_BLOCK_SIZE - 5);
+    CHECK(data[0] == 0);
+    CHECK(fs_view_chunk(&view, 2 * FS_BLOCK_SIZE + 1, &data) == 2);
+    CHECK(memcmp(data, "nd", 2) == 0);
+    CHECK(fs_view_chunk(&view, 2 * FS_BLOCK_SIZE + 3, &data) == 0);
+
+    /*
+     * Writing a pinned block copies it; the view is unchanged
+     */
+    CHECK(fs_write_at("v", 0, "XY", 2) == 0);
+    CHECK(page_free_count() == pages_before - 1);
+    CHECK(fs_write_at("v", 2, "Z", 1) == 0);        // Already private
+    CHECK(page_free_count() == pages_before - 1);
+    CHECK(strncmp(read_str("v"), "XYZ", 3) == 0);
+    CHECK(fs_view_chunk(&view, 0, &data) == FS_BLOCK_SIZE);
+    CHECK((uint8_t)data[0] == pattern(0) && (uint8_t)data[2] == pattern(2));
+
+    /*
+     * Truncating into a pinned block, rewriting and deleting
+     */
+    CHECK(fs_truncate("v", 2 * FS_BLOCK_SIZE + 1) == 0);
+    CHECK(fs_write_file("v", "short") == 0);
+    CHECK(fs_delete_file("v") == 0);
+    CHECK(view_copy(&view, buf) == 2 * FS_BLOCK_SIZE + 3);
+    CHECK(buf[1] == pattern(1) && buf[FS_BLOCK_SIZE - 1] == pattern(FS_BLOCK_SIZE - 1));
+    CHECK(buf[FS_BLOCK_SIZE] == 0 && memcmp(buf + 2 * FS_BLOCK_SIZE, "end", 3) == 0);
+
+    /*
+     * Closing the last holder gives the blocks back
+     */
+    fs_view_close(&view);
+    fs_view_close(&empty);
+    CHECK(fs_delete_file("empty") == 0);
+    CHECK(page_free_count() == pages_before + 2);
+    CHECK(get_allocated_memory() == 0);
+}
+
+static void test_full(void) {
+    char name[16];
+
+    for (int i = 0; i < MAX_FILES; i++) {
+        make_name(name, i);
+        CHECK(fs_write_file(name, name) == 0);
+    }
+    CHECK(fs_get_file_count() == MAX_FILES);
+    CHECK(fs_write_file("one.more", "x") == -1);
+
+    listed = 0;
+    listed_bytes = 0;
+    fs_list_files(count_file);
+    CHECK(listed == MAX_FILES);
+    CHECK(listed_bytes == (size_t)MAX_FILES * 7);
+
+    /*
+     * Existing files can still be rewritten when full
+     */
+    make_name(name, 3);
+    CHECK(fs_write_file(name, "rewritten") == 0);
+    CHECK(strcmp(read_str(name), "rewritten") == 0);
+
+    /*
+     * Free slots are reused, and every other file is still found
+     */
+    make_name(name, 7);
+    CHECK(fs_delete_file(name) == 0);
+    CHECK(fs_write_file("one.more", "x") == 0);
+    for (int i = 0; i < MAX_FILES; i++) {
+        make_name(name, i);
+        CHECK(fs_file_exists(name) == (i != 7));
+    }
+
+    for (int i = 0; i < MAX_FILES; i++) {
+        make_name(name, i);
+        fs_delete_file(name);
+    }
+    CHECK(fs_delete_file("one.more") == 0);
+    CHECK(fs_get_file_count() == 0);
+}
+
+/*
+ * Directories, paths and the current directory
+ */
+static void test_dirs(void) {
+    char cwd[256];
+
+    CHECK(fs_getcwd(cwd, sizeof(cwd)) == 0 && strcmp(cwd, "/") == 0);
+    CHECK(fs_mkdir("a") == 0);
+    CHECK(fs_mkdir("a") == -1);                    // Exists
+    CHECK(fs_mkdir("a/b") == 0);
+    CHECK(fs_mkdir("/a/b/c") == 0);
+    CHECK(fs_mkdir("x/y") == -1);                  // No parent
+    CHECK(fs_mkdir("/") == -1);
+
+    /*
+     * The same name in different directories is a different file
+     */
+    CHECK(fs_write_file("f", "root") == 0);
+    CHECK(fs_write_file("a/f", "in a") == 0);
+    CHECK(fs_write_file("/a/b/c/f", "in c") == 0);
+    CHECK(strcmp(read_str("/f"), "root") == 0);
+    CHECK(strcmp(read_str("a//f"), "in a") == 0);
+    CHECK(strcmp(read_str("a/b/./c/../c/f"), "in c") == 0);
+    CHECK(fs_get_file_count() == 6);
+
+    /*
+     * Files and directories don't stand in for each other
+     */
+    CHECK(fs_write_file("a", "x") == -1);
+    CHECK(fs_mkdir("f") == -1);
+    CHECK(read_str("a") == NULL);
+    CHECK(fs_write_file("f/g", "x") == -1);
+    CHECK(fs_chdir("f") == -1);
+    CHECK(fs_delete_file("a") == -1);
+    CHECK(fs_rmdir("f") == -1);
+
+    /*
+     * Relative paths follow the current directory
+     */
+    CHECK(fs_chdir("a/b") == 0);
+    CHECK(fs_getcwd(cwd, sizeof(cwd)) == 0 && strcmp(cwd, "/a/b") == 0);
+    CHECK(strcmp(read_str("c/f"), "in c") == 0);
+    CHECK(strcmp(read_str("../f"), "in a") == 0);
+    CHECK(strcmp(read_str("../../../f"), "root") == 0);   // Root is its own parent
+    CHECK(fs_getcwd(cwd, 4) == -1);                        // Too small
+    CHECK(fs_getcwd(cwd, 5) == 0 && strcmp(cwd, "/a/b") == 0);
+
+    listed = 0;
+    listed_bytes = 0;
+    listed_dirs = 0;
+    fs_list_files(count_file);
+    CHECK(listed == 1 && listed_dirs == 1);
+
+    CHECK(fs_chdir("..") == 0);
+    listed = 0;
+    listed_dirs = 0;
+    fs_list_files(count_file);
+    CHECK(listed == 2 && listed_dirs == 1 && listed_bytes == 4);
+
+    /*
+     * Only empty directories other than the current one can go
+     */
+    CHECK(fs_rmdir("/a") == -1);                   // Current directory
+    CHECK(fs_rmdir("b/c") == -1);                  // Not empty
+    CHECK(fs_delete_file("b/c/f") == 0);
+    CHECK(fs_chdir("b/c") == 0);
+    CHECK(fs_rmdir(".") == -1);
+    CHECK(fs_chdir("/") == 0);
+    CHECK(fs_rmdir("/a/b/c") == 0);
+    CHECK(fs_rmdir("a/b") == 0);
+    CHECK(fs_rmdir("a") == -1);
+    CHECK(fs_delete_file("a/f") == 0);
+    CHECK(fs_rmdir("a") == 0);
+    CHECK(fs_rmdir("/") == -1);
+    CHECK(fs_delete_file("f") == 0);
+    CHECK(fs_get_file_count() == 0);
+    CHECK(get_allocated_memory() == 0);
+}
+
+/*
+ * Readers on other threads while one thread keeps changing the files
+ * Every file holds one letter repeated, and each letter has its own
+ * length (growing the block map as it goes up), so a read that mixed
+ * two versions shows up as the wrong length or a stray letter.
+ */
+#define RACE_READERS 3
+#define RACE_CHANGES 20000
+#define RACE_MAX     (26 * 700 + 100)
+
+static const char *const race_names[] = { "r0", "r1", "r2", "r3" };
+static volatile int race_done;
+
+static size_t race_len(char c) {
+    return 100 + (size_t)(c - 'a') * 700;
+}
+
+static int race_listed_bad;
+
+static void race_list(const char *name, size_t size, int is_dir) {
+    (void)name;
+    if (!is_dir && size != 0 && (size < race_len('a') || size > race_len('z'))) {
+        __atomic_fetch_add(&race_listed_bad, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void *race_reader(void *arg) {
+    static __thread char buf[RACE_MAX];
+    int *bad = arg;
+
+    for (unsigned i = 0; !__atomic_load_n(&race_done, __ATOMIC_ACQUIRE); i++) {
+        const char *name = race_names[i % 4];
+        long n = fs_read_at(name, 0, buf, sizeof(buf));
+
+        if (n > 0) {
+            if ((size_t)n != race_len(buf[0])) {
+                (*bad)++;
+            }
+            for (long j = 1; j < n; j++) {
+                if (buf[j] != buf[0]) {
+                    (*bad)++;
+                    break;
+                }
+            }
+        }
+
+        long size = fs_file_size(name);
+        if (size > 0 && (size < (long)race_len('a') || size > (long)race_len('z'))) {
+            (*bad)++;
+        }
+        fs_file_exists(name);
+        if (i % 16 == 0) {
+            fs_list_files(race_list);
+        }
+    }
+    return NULL;
+}
+
+static void test_concurrent_reads(void) {
+    static char content[RACE_MAX + 1];
+    pthread_t threads[RACE_READERS];
+    int bad[RACE_READERS] = { 0 };
+    size_t pages_before = page_free_count();
+
+    race_done = 0;
+    race_listed_bad = 0;
+    for (int i = 0; i < RACE_READERS; i++) {
+        CHECK(pthread_create(&threads[i], NULL, race_reader, &bad[i]) == 0);
+    }
+
+    for (int i = 0; i < RACE_CHANGES; i++) {
+        const char *name = race_names[i % 4];
+        char c = (char)('a' + (i * 7) % 26);
+
+        if (i % 11 == 0) {
+            CHECK(fs_delete_file(name) == 0 || i < 4);
+        } else if (i % 13 == 0) {
+            CHECK(fs_mkdir("d") == 0);
+            CHECK(fs_rmdir("d") == 0);
+        } else {
+            memset(content, c, race_len(c));
+            content[race_len(c)] = '\0';
+            CHECK(fs_write_file(name, content) == 0);
+        }
+    }
+
+    __atomic_store_n(&race_done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < RACE_READERS; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK(bad[i] == 0);
+    }
+    CHECK(race_listed_bad == 0);
+
+    /*
+     * Once the readers are gone, everything retired is freed
+     */
+    for (int i = 0; i < 4; i++) {
+        fs_delete_file(race_names[i]);
+    }
+    CHECK(fs_get_file_count() == 0);
+    CHECK(page_free_count() == pages_before);
+    CHECK(get_allocated_memory() == 0);
+}
+
+/*
+ * Readers while one thread appends to, and truncates, a file that a
+ * view has pinned: the last block is copied and swapped in outside a
+ * change each time, and readers must only ever see pattern bytes
+ */
+#define PINNED_CHANGES 5000
+#define PINNED_APPEND  100
+#define PINNED_MAX     (8 * FS_BLOCK_SIZE)
+
+static void *pinned_reader(void *arg) {
+    static __thread uint8_t buf[PINNED_MAX];
+    int *bad = arg;
+
+    while (!__atomic_load_n(&race_done, __ATOMIC_ACQUIRE)) {
+        long n = fs_read_at("pinned", 0, buf, sizeof(buf));
+        for (long j = 0; j < n; j++) {
+            if (buf[j] != pattern((size_t)j)) {
+                (*bad)++;
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void test_pinned_appends(void) {
+    uint8_t chunk[PINNED_APPEND];
+    pthread_t threads[RACE_READERS];
+    int bad[RACE_READERS] = { 0 };
+    size_t pages_before = page_free_count();
+    size_t size = 0;
+
+    CHECK(fs_write_file("pinned", "") == 0);
+    race_done = 0;
+    for (int i = 0; i < RACE_READERS; i++) {
+        CHECK(pthread_create(&threads[i], NULL, pinned_reader, &bad[i]) == 0);
+    }
+
+    for (int i = 0; i < PINNED_CHANGES; i++) {
+        fs_view_t view;
+        CHECK(fs_view_open("pinned", &view) == 0);
+
+        if (size + PINNED_APPEND > PINNED_MAX) {
+            size = FS_BLOCK_SIZE + 7;           // Cut inside a pinned block
+            CHECK(fs_truncate("pinned", size) == 0);
+        } else {
+            for (size_t j = 0; j < PINNED_APPEND; j++) {
+                chunk[j] = pattern(size + j);
+            }
+            CHECK(fs_write_at("pinned", size, chunk, PINNED_APPEND) == 0);
+            size += PINNED_APPEND;
+        }
+        fs_view_close(&view);
+    }
+
+    __atomic_store_n(&race_done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < RACE_READERS; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK(bad[i] == 0);
+    }
+    CHECK(fs_file_size("pinned") == (long)size);
+
+    CHECK(fs_delete_file("pinned") == 0);
+    CHECK(page_free_count() == pages_before);
+    CHECK(get_allocated_memory() == 0);
+}
+
+static void test_hash(void) {
+    CHECK(fs_hash_name("") == 2166136261u);   // FNV-1a offset basis
+    CHECK(fs_hash_name("a") == 0xe40c292cu);
+    CHECK(fs_hash_name("abc") != fs_hash_name("acb"));
+}
+
+void test_memfs(void) {
+    test_read_write();
+    test_limits();
+    test_large();
+    test_sparse();
+    test_handles();
+    test_views();
+    test_full();
+    test_dirs();
+    test_concurrent_reads();
+    test_pinned_appends();
+    test_hash();
+}
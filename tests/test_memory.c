@@ -0,0 +1,130 @@
+/*
+ * Allocator Tests
+ */
+
+#include "memory.h"
+#include "page_alloc.h"
+#include "string.h"
+#include "test.h"
+
+#define STRESS_SLOTS 256
+#define STRESS_ROUNDS 20000
+
+/*
+ * Small deterministic PRNG (xorshift32)
+ */
+static uint32_t rng_state = 12345;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void test_basics(void) {
+    CHECK(malloc(0) == NULL);
+    free(NULL);
+
+    size_t sizes[] = { 1, 15, 16, 17, 100, SLAB_MAX_SIZE, SLAB_MAX_SIZE + 1,
+                       PAGE_SIZE, 64 * 1024, 2 * 1024 * 1024 };
+    void *ptrs[sizeof(sizes) / sizeof(sizes[0])];
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        ptrs[i] = malloc(sizes[i]);
+        CHECK(ptrs[i] != NULL);
+        CHECK(((uintptr_t)ptrs[i] & 15) == 0);
+        memset(ptrs[i], (int)i, sizes[i]);
+    }
+
+    /*
+     * Nothing overlapped: every block still holds its own fill
+     */
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        unsigned char *p = ptrs[i];
+        CHECK(p[0] == (unsigned char)i && p[sizes[i] - 1] == (unsigned char)i);
+    }
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        free(ptrs[i]);
+    }
+    CHECK(get_allocated_memory() == 0);
+}
+
+static void test_calloc(void) {
+    unsigned char *p = malloc(256);
+    memset(p, 0xFF, 256);
+    free(p);
+
+    p = calloc(16, 16);   // Likely reuses the block above
+    CHECK(p != NULL);
+    for (int i = 0; i < 256; i++) {
+        CHECK(p[i] == 0);
+    }
+    free(p);
+
+    CHECK(calloc((size_t)-1 / 2, 4) == NULL);   // Size overflows
+}
+
+static void test_reuse(void) {
+    void *a = malloc(64);
+    free(a);
+    void *b = malloc(64);
+    CHECK(a == b);   // Comes back out of this core's magazine
+    free(b);
+}
+
+/*
+ * Random malloc/free with every block filled with a pattern derived
+ * from its address, checked on free
+ */
+static void test_stress(void) {
+    static unsigned char *slots[STRESS_SLOTS];
+    static size_t sizes[STRESS_SLOTS];
+    size_t free_before = page_free_count();
+
+    for (int round = 0; round < STRESS_ROUNDS; round++) {
+        int i = (int)(rng() % STRESS_SLOTS);
+
+        if (slots[i] != NULL) {
+            unsigned char fill = (unsigned char)(uintptr_t)slots[i];
+            for (size_t j = 0; j < sizes[i]; j++) {
+                if (slots[i][j] != fill) {
+                    CHECK(slots[i][j] == fill);
+                    break;
+                }
+            }
+            free(slots[i]);
+            slots[i] = NULL;
+            continue;
+        }
+
+        /*
+         * Mostly small sizes, some large ones
+         */
+        sizes[i] = (rng() % 8 == 0) ? 1 + rng() % 20000 : 1 + rng() % 512;
+        slots[i] = malloc(sizes[i]);
+        CHECK(slots[i] != NULL);
+        if (slots[i] != NULL) {
+            memset(slots[i], (int)(unsigned char)(uintptr_t)slots[i], sizes[i]);
+        }
+    }
+
+    for (int i = 0; i < STRESS_SLOTS; i++) {
+        free(slots[i]);
+        slots[i] = NULL;
+    }
+
+    memory_stats_t stats;
+    memory_get_stats(&stats);
+    CHECK(stats.live_bytes == 0);
+    CHECK(stats.live_allocations == 0);
+    CHECK(page_free_count() <= free_before);   // Slab pages may stay cached
+}
+
+void test_memory(void) {
+    test_basics();
+    test_calloc();
+    test_reuse();
+    test_stress();
+}
@@ -0,0 +1,158 @@
+/*
+ * String Function Tests
+ *
+ * The vectorized functions are checked against the *_scalar reference
+ * versions for every source/destination alignment and lengths around
+ * the 16 and 64 byte block sizes, with guard bytes around the output.
+ */
+
+#include "string.h"
+#include "test.h"
+
+#define BUF_SIZE   512
+#define MAX_LEN    200
+#define GUARD      0xA5
+
+static unsigned char src_buf[BUF_SIZE] __attribute__((aligned(16)));
+static unsigned char dst_buf[BUF_SIZE] __attribute__((aligned(16)));
+static unsigned char ref_buf[BUF_SIZE] __attribute__((aligned(16)));
+
+static void fill_pattern(unsigned char *buf, size_t len, unsigned seed) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (unsigned char)(seed + i * 7 + (i >> 3));
+    }
+}
+
+static void test_memcpy(void) {
+    fill_pattern(src_buf, BUF_SIZE, 1);
+
+    for (size_t s = 0; s < 16; s++) {
+        for (size_t d = 0; d < 16; d++) {
+            for (size_t len = 0; len <= MAX_LEN; len++) {
+                memset_scalar(dst_buf, GUARD, BUF_SIZE);
+                memset_scalar(ref_buf, GUARD, BUF_SIZE);
+
+                void *ret = memcpy(dst_buf + d, src_buf + s, len);
+                memcpy_scalar(ref_buf + d, src_buf + s, len);
+
+                CHECK(ret == dst_buf + d);
+                CHECK(memcmp_scalar(dst_buf, ref_buf, BUF_SIZE) == 0);
+            }
+        }
+    }
+}
+
+static void test_memset(void) {
+    for (size_t d = 0; d < 16; d++) {
+        for (size_t len = 0; len <= MAX_LEN; len++) {
+            memset_scalar(dst_buf, GUARD, BUF_SIZE);
+            memset_scalar(ref_buf, GUARD, BUF_SIZE);
+
+            void *ret = memset(dst_buf + d, 0x3C, len);
+            memset_scalar(ref_buf + d, 0x3C, len);
+
+            CHECK(ret == dst_buf + d);
+            CHECK(memcmp_scalar(dst_buf, ref_buf, BUF_SIZE) == 0);
+        }
+    }
+}
+
+static int sign(int x) {
+    return (x > 0) - (x < 0);
+}
+
+static void test_memcmp(void) {
+    fill_pattern(src_buf, BUF_SIZE, 3);
+
+    for (size_t off = 0; off < 16; off++) {
+        for (size_t len = 0; len <= 100; len++) {
+            memcpy_scalar(dst_buf + off, src_buf, len);
+            CHECK(memcmp(dst_buf + off, src_buf, len) == 0);
+
+            /*
+             * A difference at every position, in both directions
+             */
+            for (size_t pos = 0; pos < len; pos++) {
+                dst_buf[off + pos]++;
+                CHECK(sign(memcmp(dst_buf + off, src_buf, len)) ==
+                      sign(memcmp_scalar(dst_buf + off, src_buf, len)));
+                CHECK(memcmp(dst_buf + off, src_buf, len) > 0 ||
+                      src_buf[pos] == 0xFF);
+                dst_buf[off + pos] -= 2;
+                CHECK(sign(memcmp(dst_buf + off, src_buf, len)) ==
+                      sign(memcmp_scalar(dst_buf + off, src_buf, len)));
+                dst_buf[off + pos]++;
+            }
+        }
+    }
+}
+
+static void test_strlen(void) {
+    for (size_t off = 0; off < 16; off++) {
+        for (size_t len = 0; len <= MAX_LEN; len++) {
+            char *s = (char *)dst_buf + off;
+            memset_scalar(s, 'x', len);
+            s[len] = '\0';
+            s[len + 1] = 'y';   // Must not be counted
+
+            CHECK(strlen(s) == len);
+            CHECK(strlen_scalar(s) == len);
+        }
+    }
+}
+
+static void test_memchr(void) {
+    for (size_t off = 0; off < 16; off++) {
+        for (size_t len = 0; len <= 100; len++) {
+            unsigned char *p = dst_buf + off;
+            memset_scalar(p, 'a', len + 1);
+            p[len] = 'z';   // Just past the end: must not be found
+
+            CHECK(memchr(p, 'z', len) == NULL);
+            for (size_t pos = 0; pos < len; pos++) {
+                p[pos] = 'z';
+                CHECK(memchr(p, 'z', len) == p + pos);
+                p[pos] = 'a';
+            }
+        }
+    }
+}
+
+static void test_str_basics(void) {
+    char buf[32];
+
+    CHECK(strcmp("abc", "abc") == 0);
+    CHECK(strcmp("abc", "abd") < 0);
+    CHECK(strcmp("abd", "abc") > 0);
+    CHECK(strcmp("ab", "abc") < 0);
+    CHECK(strcmp("\xff", "a") > 0);   // Compares as unsigned char
+
+    CHECK(strncmp("abcdef", "abcxyz", 3) == 0);
+    CHECK(strncmp("abcdef", "abcxyz", 4) < 0);
+    CHECK(strncmp("a", "b", 0) == 0);
+
+    CHECK(strcpy(buf, "hello") == buf);
+    CHECK(strcmp(buf, "hello") == 0);
+
+    memset_scalar(buf, 'q', sizeof(buf));
+    strncpy(buf, "hi", 5);
+    CHECK(buf[0] == 'h' && buf[1] == 'i');
+    CHECK(buf[2] == '\0' && buf[3] == '\0' && buf[4] == '\0');
+    CHECK(buf[5] == 'q');   // Pads to n and no further
+
+    strcpy(buf, "foo");
+    CHECK(strcat(buf, "bar") == buf);
+    CHECK(strcmp(buf, "foobar") == 0);
+
+    CHECK(strchr(buf, 'b') == buf + 3);
+    CHECK(strchr(buf, 'z') == NULL);
+}
+
+void test_string(void) {
+    test_memcpy();
+    test_memset();
+    test_memcmp();
+    test_strlen();
+    test_memchr();
+    test_str_basics();
+}
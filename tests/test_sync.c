@@ -0,0 +1,216 @@
+/*
+ * Synchronization Primitive Tests
+ *
+ * The single-threaded checks pin down the semantics; the stress tests
+ * run the same code on several host threads at once, which on a
+ * multi-core machine really does race (the kernel's own stress test is
+ * the `lockstress` shell command).
+ */
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "mpmc.h"
+#include "seqlock.h"
+#include "spinlock.h"
+#include "test.h"
+
+#define STRESS_THREADS 4
+#define STRESS_ITERS   200000
+#define RING_SLOTS     64
+
+static void test_ticket_order(void) {
+    spinlock_t lock = SPINLOCK_INIT;
+
+    /*
+     * More than 65536 tickets, so the 16-bit counters wrap
+     */
+    for (int i = 0; i < 70000; i++) {
+        spin_lock(&lock);
+        CHECK(lock.next == (uint16_t)(lock.owner + 1));
+        spin_unlock(&lock);
+    }
+    CHECK(lock.owner == lock.next);
+    CHECK(lock.owner == (uint16_t)70000);
+}
+
+static void test_seqlock_retry(void) {
+    seqlock_t s = SEQLOCK_INIT;
+
+    uint32_t seq = seq_read_begin(&s);
+    CHECK(!seq_read_retry(&s, seq));
+
+    seq_write_lock(&s);
+    CHECK(s.seq & 1);
+    seq_write_unlock(&s);
+    CHECK(seq_read_retry(&s, seq));
+
+    seq = seq_read_begin(&s);
+    CHECK(seq == 2 && !seq_read_retry(&s, seq));
+}
+
+static void test_ring_basic(void) {
+    static mpmc_slot_t slots[8];
+    mpmc_ring_t ring;
+    void *item;
+
+    CHECK(mpmc_init(&ring, slots, 6) == -1);
+    CHECK(mpmc_init(&ring, slots, 1) == -1);
+    CHECK(mpmc_init(&ring, slots, 8) == 0);
+    CHECK(mpmc_pop(&ring, &item) == -1);
+
+    /*
+     * Several laps around the ring, filling it each time
+     */
+    for (uintptr_t lap = 0; lap < 5; lap++) {
+        for (uintptr_t i = 0; i < 8; i++) {
+            CHECK(mpmc_push(&ring, (void *)(lap * 8 + i + 1)) == 0);
+        }
+        CHECK(mpmc_push(&ring, (void *)1) == -1);
+        CHECK(mpmc_count(&ring) == 8);
+
+        for (uintptr_t i = 0; i < 8; i++) {
+            CHECK(mpmc_pop(&ring, &item) == 0 && item == (void *)(lap * 8 + i + 1));
+        }
+        CHECK(mpmc_pop(&ring, &item) == -1);
+        CHECK(mpmc_count(&ring) == 0);
+    }
+}
+
+/*
+ * Stress: every thread increments a counter under the lock
+ */
+static spinlock_t stress_lock = SPINLOCK_INIT;
+static uint64_t stress_counter;
+
+static void *lock_worker(void *arg) {
+    (void)arg;
+
+    for (int i = 0; i < STRESS_ITERS; i++) {
+        spin_lock(&stress_lock);
+        stress_counter++;
+        spin_unlock(&stress_lock);
+    }
+    return NULL;
+}
+
+/*
+ * Stress: a writer keeps a pair equal; readers must never see it
+ * otherwise
+ */
+static seqlock_t stress_seq = SEQLOCK_INIT;
+static volatile uint64_t pair_a, pair_b;
+static volatile int writer_done;
+
+static void *seq_writer(void *arg) {
+    (void)arg;
+
+    for (uint64_t i = 1; i <= STRESS_ITERS; i++) {
+        seq_write_lock(&stress_seq);
+        pair_a = i;
+        pair_b = i;
+        seq_write_unlock(&stress_seq);
+    }
+    __atomic_store_n(&writer_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *seq_reader(void *arg) {
+    uint64_t *torn = arg;
+
+    while (!__atomic_load_n(&writer_done, __ATOMIC_ACQUIRE)) {
+        uint32_t seq;
+        uint64_t a, b;
+        do {
+            seq = seq_read_begin(&stress_seq);
+            a = pair_a;
+            b = pair_b;
+        } while (seq_read_retry(&stress_seq, seq));
+
+        if (a != b) {
+            (*torn)++;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Stress: producers push distinct numbers, consumers pop until they
+ * have seen them all; each must come out exactly once
+ */
+static mpmc_slot_t stress_slots[RING_SLOTS];
+static mpmc_ring_t stress_ring;
+static uint8_t seen[STRESS_THREADS * STRESS_ITERS];
+static volatile uint64_t popped;
+
+static void *ring_producer(void *arg) {
+    uintptr_t base = (uintptr_t)arg * STRESS_ITERS;
+
+    for (uintptr_t i = 0; i < STRESS_ITERS; i++) {
+        while (mpmc_push(&stress_ring, (void *)(base + i + 1)) != 0) {
+            sched_yield();  // Full: let the consumers run
+        }
+    }
+    return NULL;
+}
+
+static void *ring_consumer(void *arg) {
+    (void)arg;
+    void *item;
+
+    while (__atomic_load_n(&popped, __ATOMIC_RELAXED) < STRESS_THREADS * STRESS_ITERS) {
+        if (mpmc_pop(&stress_ring, &item) == 0) {
+            __atomic_fetch_add(&seen[(uintptr_t)item - 1], 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&popped, 1, __ATOMIC_RELAXED);
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void test_stress(void) {
+    pthread_t threads[2 * STRESS_THREADS];
+    uint64_t torn[STRESS_THREADS] = { 0 };
+
+    for (int i = 0; i < STRESS_THREADS; i++) {
+        CHECK(pthread_create(&threads[i], NULL, lock_worker, NULL) == 0);
+    }
+    for (int i = 0; i < STRESS_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    CHECK(stress_counter == (uint64_t)STRESS_THREADS * STRESS_ITERS);
+    CHECK(stress_lock.owner == stress_lock.next);
+
+    CHECK(pthread_create(&threads[0], NULL, seq_writer, NULL) == 0);
+    for (int i = 1; i < STRESS_THREADS; i++) {
+        CHECK(pthread_create(&threads[i], NULL, seq_reader, &torn[i]) == 0);
+    }
+    for (int i = 0; i < STRESS_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK(torn[i] == 0);
+    }
+
+    CHECK(mpmc_init(&stress_ring, stress_slots, RING_SLOTS) == 0);
+    for (int i = 0; i < STRESS_THREADS; i++) {
+        CHECK(pthread_create(&threads[i], NULL, ring_producer, (void *)(uintptr_t)i) == 0);
+        CHECK(pthread_create(&threads[STRESS_THREADS + i], NULL, ring_consumer, NULL) == 0);
+    }
+    for (int i = 0; i < 2 * STRESS_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    int wrong = 0;
+    for (size_t i = 0; i < sizeof(seen); i++) {
+        wrong += (seen[i] != 1);
+    }
+    CHECK(wrong == 0);
+    CHECK(mpmc_count(&stress_ring) == 0);
+}
+
+void test_sync(void) {
+    test_ticket_order();
+    test_seqlock_retry();
+    test_ring_basic();
+    test_stress();
+}